@@ -0,0 +1,221 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <cstdlib>
+#include <cstring>
+
+// Popt
+#include <popt.h>
+
+// C++
+#include <iomanip>
+#include <iostream>
+
+// STL
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// e
+#include <e/guard.h>
+
+// HyperDex
+#include "benchrunner.h"
+
+static long repetitions = 5;
+static const char* filter = "";
+static const char* label = "";
+
+extern "C"
+{
+
+static struct poptOption popts[] = {
+    POPT_AUTOHELP
+    {"repetitions", 'r', POPT_ARG_LONG, &repetitions, 'r',
+        "the number of timed runs of each benchmark",
+        "number"},
+    {"filter", 'f', POPT_ARG_STRING, &filter, 'f',
+        "only run benchmarks whose name contains this string",
+        "string"},
+    {"label", 'l', POPT_ARG_STRING, &label, 'l',
+        "a label (e.g., a commit) to attach to every result",
+        "label"},
+    POPT_TABLEEND
+};
+
+} // extern "C"
+
+namespace
+{
+
+struct benchmark
+{
+    benchmark(const char* n, uint64_t i, bench::function f)
+        : name(n), iterations(i), func(f) {}
+    const char* name;
+    uint64_t iterations;
+    bench::function func;
+};
+
+// A function-local static so that registrations in other translation units
+// may run before anything in this one is initialized.
+std::vector<benchmark>&
+registry()
+{
+    static std::vector<benchmark> r;
+    return r;
+}
+
+std::string
+quote(const char* s)
+{
+    std::string q("\"");
+
+    for (; *s; ++s)
+    {
+        if (*s == '"' || *s == '\\')
+        {
+            q += '\\';
+        }
+
+        q += *s;
+    }
+
+    q += '"';
+    return q;
+}
+
+} // namespace
+
+bench :: state :: state(uint64_t iterations)
+    : m_iterations(iterations)
+    , m_started(0)
+    , m_elapsed(0)
+    , m_bytes(0)
+{
+}
+
+bench :: registration :: registration(const char* name,
+                                      uint64_t iterations,
+                                      function func)
+{
+    registry().push_back(benchmark(name, iterations, func));
+}
+
+static void
+run(const benchmark& b)
+{
+    std::vector<double> ns_per_op;
+    uint64_t bytes = 0;
+
+    // The first run is a warmup and is not reported.
+    for (long r = 0; r <= repetitions; ++r)
+    {
+        bench::state st(b.iterations);
+        st.resume();
+        b.func(st);
+        st.pause();
+        bytes = st.bytes();
+
+        if (r > 0)
+        {
+            ns_per_op.push_back(static_cast<double>(st.elapsed()) / b.iterations);
+        }
+    }
+
+    std::sort(ns_per_op.begin(), ns_per_op.end());
+    double median = ns_per_op[ns_per_op.size() / 2];
+    double ops_per_sec = median > 0 ? 1e9 / median : 0;
+    std::cout << std::fixed << std::setprecision(1)
+              << "{\"label\": " << quote(label)
+              << ", \"benchmark\": " << quote(b.name)
+              << ", \"iterations\": " << b.iterations
+              << ", \"repetitions\": " << repetitions
+              << ", \"ns_per_op\": {\"min\": " << ns_per_op.front()
+              << ", \"median\": " << median
+              << ", \"max\": " << ns_per_op.back() << "}"
+              << ", \"ops_per_sec\": " << ops_per_sec;
+
+    if (bytes > 0)
+    {
+        std::cout << ", \"bytes_per_sec\": " << ops_per_sec * bytes;
+    }
+
+    std::cout << "}" << std::endl;
+}
+
+int
+main(int argc, const char* argv[])
+{
+    poptContext poptcon;
+    poptcon = poptGetContext(NULL, argc, argv, popts, POPT_CONTEXT_POSIXMEHARDER);
+    e::guard g = e::makeguard(poptFreeContext, poptcon);
+    g.use_variable();
+    int rc;
+
+    while ((rc = poptGetNextOpt(poptcon)) != -1)
+    {
+        switch (rc)
+        {
+            case 'r':
+                if (repetitions <= 0)
+                {
+                    std::cerr << "repetitions must be > 0" << std::endl;
+                    return EXIT_FAILURE;
+                }
+
+                break;
+            case 'f':
+            case 'l':
+                break;
+            case POPT_ERROR_NOARG:
+            case POPT_ERROR_BADOPT:
+            case POPT_ERROR_BADNUMBER:
+            case POPT_ERROR_OVERFLOW:
+                std::cerr << poptStrerror(rc) << " " << poptBadOption(poptcon, 0) << std::endl;
+                return EXIT_FAILURE;
+            case POPT_ERROR_OPTSTOODEEP:
+            case POPT_ERROR_BADQUOTE:
+            case POPT_ERROR_ERRNO:
+            default:
+                std::cerr << "logic error in argument parsing" << std::endl;
+                return EXIT_FAILURE;
+        }
+    }
+
+    for (size_t i = 0; i < registry().size(); ++i)
+    {
+        if (strstr(registry()[i].name, filter))
+        {
+            run(registry()[i]);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
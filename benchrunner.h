@@ -0,0 +1,116 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef benchrunner_h_
+#define benchrunner_h_
+
+// C
+#include <stdint.h>
+
+// e
+#include <e/timer.h>
+
+// The benchmarks are registered much like Google Test's tests, and
+// benchrunner.cc supplies a main() that runs each of them a fixed number of
+// times and prints one JSON object per benchmark.  A benchmark runs for a fixed
+// number of iterations rather than for a fixed amount of time, and seeds its
+// inputs with constants, so that each run does the same work as every other.
+//
+// The body is timed as a whole.  Setup and teardown that should not count
+// against the benchmark go between st.pause() and st.resume().
+
+namespace bench
+{
+
+class state
+{
+    public:
+        state(uint64_t iterations);
+
+    public:
+        uint64_t iterations() const { return m_iterations; }
+        void pause() { m_elapsed += e::time() - m_started; }
+        void resume() { m_started = e::time(); }
+        // Bytes processed by each iteration, for reporting throughput.
+        void set_bytes(uint64_t bytes) { m_bytes = bytes; }
+
+    public:
+        uint64_t elapsed() const { return m_elapsed; }
+        uint64_t bytes() const { return m_bytes; }
+
+    private:
+        const uint64_t m_iterations;
+        uint64_t m_started;
+        uint64_t m_elapsed;
+        uint64_t m_bytes;
+};
+
+typedef void (*function)(state& st);
+
+class registration
+{
+    public:
+        registration(const char* name, uint64_t iterations, function func);
+};
+
+// Keep the compiler from discarding a result that is otherwise unused.
+template <typename T>
+inline void
+consume(const T& t)
+{
+    __asm__ __volatile__ ("" : : "r" (&t) : "memory");
+}
+
+// A small deterministic generator (xorshift64*) for benchmark inputs.
+class generator
+{
+    public:
+        generator(uint64_t seed) : m_x(seed ? seed : 1) {}
+
+    public:
+        uint64_t next()
+        {
+            m_x ^= m_x >> 12;
+            m_x ^= m_x << 25;
+            m_x ^= m_x >> 27;
+            return m_x * 2685821657736338717ULL;
+        }
+
+    private:
+        uint64_t m_x;
+};
+
+} // namespace bench
+
+#define BENCHMARK(GROUP, NAME, ITERATIONS) \
+    static void GROUP ## _ ## NAME ## _benchmark(bench::state& st); \
+    static bench::registration GROUP ## _ ## NAME ## _registration( \
+        #GROUP "." #NAME, ITERATIONS, GROUP ## _ ## NAME ## _benchmark); \
+    static void GROUP ## _ ## NAME ## _benchmark(bench::state& st)
+
+#endif // benchrunner_h_
@@ -0,0 +1,1420 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// This benchmark stands up a complete cluster on the loopback interface and
+// drives the YCSB core workloads against it.  A minimal coordinator runs inside
+// this process:  it waits for every daemon to announce itself, hands out one
+// fixed configuration for a single space, and otherwise ignores what the
+// daemons tell it.  The daemons are ordinary hyperdex-daemon processes, each
+// with a scratch data directory.
+//
+// Once the records are loaded, client threads issue operations on a Poisson
+// schedule at a fixed target rate, whether or not earlier operations have
+// completed.  Latency is measured from the time an operation was scheduled, so
+// a cluster that cannot keep up shows it as latency rather than as a lower
+// request rate.
+
+#define __STDC_LIMIT_MACROS
+
+// C
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+// POSIX
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Popt
+#include <popt.h>
+
+// C++
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+// STL
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <tr1/functional>
+#include <tr1/memory>
+#include <utility>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+#include <po6/threads/thread.h>
+
+// e
+#include <e/endian.h>
+#include <e/guard.h>
+#include <e/timer.h>
+
+// Google CityHash
+#include <city.h>
+
+// HyperClient
+#include <hyperclient.h>
+
+static long daemons = 3;
+static long daemon_threads = 4;
+static const char* daemon_binary = "hyperdex-daemon";
+static const char* data = "/tmp";
+static long prefix = 2;
+static long replicas = 2;
+static const char* workload = "a";
+static long records = 100000;
+static long fields = 1;
+static long value_size = 100;
+static long scan_length = 100;
+static double theta = 0.99;
+static long threads = 4;
+static long rate = 10000;
+static long duration = 30;
+static long outstanding = 256;
+static bool keep_data = false;
+static bool search_subspace = true;
+static const char* space = "ycsb";
+
+enum op_t
+{
+    OP_READ,
+    OP_UPDATE,
+    OP_INSERT,
+    OP_SCAN,
+    OP_RMW,
+    OP_COUNT
+};
+
+static const char* op_names[] = {"read", "update", "insert", "scan", "read-modify-write"};
+
+// The YCSB core workloads.  "latest" skews reads towards the most recent
+// inserts instead of towards a fixed set of popular records.
+struct mix
+{
+    char name;
+    double read;
+    double update;
+    double insert;
+    double scan;
+    double rmw;
+    bool latest;
+};
+
+static const mix mixes[] = {
+    {'a', 0.50, 0.50, 0.00, 0.00, 0.00, false},
+    {'b', 0.95, 0.05, 0.00, 0.00, 0.00, false},
+    {'c', 1.00, 0.00, 0.00, 0.00, 0.00, false},
+    {'d', 0.95, 0.00, 0.05, 0.00, 0.00, true},
+    {'e', 0.00, 0.00, 0.05, 0.95, 0.00, false},
+    {'f', 0.50, 0.00, 0.00, 0.00, 0.50, false}
+};
+
+extern "C"
+{
+
+static struct poptOption popts[] = {
+    POPT_AUTOHELP
+    {"daemons", 'n', POPT_ARG_LONG, &daemons, 'n',
+        "the number of daemons to start",
+        "number"},
+    {"daemon-threads", 'T', POPT_ARG_LONG, &daemon_threads, 'T',
+        "the number of network threads in each daemon",
+        "number"},
+    {"daemon-binary", 'b', POPT_ARG_STRING, &daemon_binary, 'b',
+        "the hyperdex-daemon program to run",
+        "path"},
+    {"data", 'D', POPT_ARG_STRING, &data, 'D',
+        "the directory in which to create the daemons' data directories",
+        "D"},
+    {"keep-data", 'K', POPT_ARG_NONE, NULL, 'K',
+        "do not remove the data directories and logs on exit",
+        NULL},
+    {"prefix", 'P', POPT_ARG_LONG, &prefix, 'P',
+        "each subspace is divided into 2^prefix regions",
+        "bits"},
+    {"replicas", 'R', POPT_ARG_LONG, &replicas, 'R',
+        "the number of replicas of each region",
+        "number"},
+    {"no-search-subspace", 'S', POPT_ARG_NONE, NULL, 'S',
+        "do not create a subspace for the attribute that scans search",
+        NULL},
+    {"workload", 'w', POPT_ARG_STRING, &workload, 'w',
+        "the YCSB core workload to run (a-f)",
+        "letter"},
+    {"records", 'r', POPT_ARG_LONG, &records, 'r',
+        "the number of records to load before the run",
+        "number"},
+    {"fields", 'F', POPT_ARG_LONG, &fields, 'F',
+        "the number of value attributes in each record",
+        "number"},
+    {"value-size", 'v', POPT_ARG_LONG, &value_size, 'v',
+        "the size of each value attribute",
+        "bytes"},
+    {"scan-length", 'l', POPT_ARG_LONG, &scan_length, 'l',
+        "the maximum number of records covered by one scan",
+        "number"},
+    {"zipf", 'z', POPT_ARG_DOUBLE, &theta, 'z',
+        "the skew of the key popularity (0 for uniform)",
+        "theta"},
+    {"threads", 't', POPT_ARG_LONG, &threads, 't',
+        "the number of client threads issuing operations",
+        "number"},
+    {"rate", 'o', POPT_ARG_LONG, &rate, 'o',
+        "the target number of operations per second, across all threads",
+        "ops/s"},
+    {"duration", 'd', POPT_ARG_LONG, &duration, 'd',
+        "the number of seconds to run for",
+        "seconds"},
+    {"outstanding", 'O', POPT_ARG_LONG, &outstanding, 'O',
+        "the most operations each thread may have in flight",
+        "number"},
+    POPT_TABLEEND
+};
+
+} // extern "C"
+
+// Draws ranks in [0, n) such that rank i is chosen with probability
+// proportional to 1 / (i + 1)^theta, following Gray et al., "Quickly Generating
+// Billion-Record Synthetic Databases".
+class zipfian
+{
+    public:
+        zipfian(uint64_t n, double theta);
+
+    public:
+        uint64_t next(double u) const;
+
+    private:
+        static double zeta(uint64_t n, double theta);
+
+    private:
+        uint64_t m_n;
+        double m_theta;
+        double m_alpha;
+        double m_zetan;
+        double m_eta;
+};
+
+zipfian :: zipfian(uint64_t n, double t)
+    : m_n(n)
+    , m_theta(t)
+    , m_alpha(1.0 / (1.0 - t))
+    , m_zetan(zeta(n, t))
+    , m_eta((1.0 - pow(2.0 / n, 1.0 - t)) / (1.0 - zeta(2, t) / m_zetan))
+{
+}
+
+uint64_t
+zipfian :: next(double u) const
+{
+    double uz = u * m_zetan;
+
+    if (uz < 1.0)
+    {
+        return 0;
+    }
+
+    if (uz < 1.0 + pow(0.5, m_theta))
+    {
+        return 1;
+    }
+
+    uint64_t rank = m_n * pow(m_eta * u - m_eta + 1.0, m_alpha);
+    return std::min(rank, m_n - 1);
+}
+
+double
+zipfian :: zeta(uint64_t n, double t)
+{
+    double sum = 0;
+
+    for (uint64_t i = 1; i <= n; ++i)
+    {
+        sum += 1.0 / pow(static_cast<double>(i), t);
+    }
+
+    return sum;
+}
+
+// The coordinator stand-in.  It speaks just enough of the coordinator's host
+// protocol to bring the daemons and clients up on one configuration.
+class standin
+{
+    public:
+        standin(size_t expected);
+        ~standin() throw ();
+
+    public:
+        // Bind to an ephemeral port on the loopback interface.
+        bool listen();
+        in_port_t port() const { return m_port; }
+        // Serve connections until "stop" is called.
+        void run();
+        void stop() { m_done = true; }
+        // True once every daemon has acknowledged the configuration.
+        bool ready();
+        uint64_t failures_reported();
+
+    private:
+        struct connection
+        {
+            connection() : buffer(), identified(false), instance(0) {}
+            std::string buffer;
+            bool identified;
+            uint64_t instance;
+        };
+
+    private:
+        void handle(int fd, connection* conn, const std::string& line);
+        void publish();
+        void send(int fd);
+
+    private:
+        const size_t m_expected;
+        int m_listen;
+        in_port_t m_port;
+        volatile bool m_done;
+        po6::threads::mutex m_lock;
+        std::map<int, connection> m_conns;
+        // Host lines, by instance id, as the configuration lists them.
+        std::map<uint64_t, std::string> m_hosts;
+        std::set<uint64_t> m_acked;
+        std::string m_config;
+        uint64_t m_failures;
+
+    private:
+        standin(const standin&);
+        standin& operator = (const standin&);
+};
+
+standin :: standin(size_t expected)
+    : m_expected(expected)
+    , m_listen(-1)
+    , m_port(0)
+    , m_done(false)
+    , m_lock()
+    , m_conns()
+    , m_hosts()
+    , m_acked()
+    , m_config()
+    , m_failures(0)
+{
+}
+
+standin :: ~standin() throw ()
+{
+    for (std::map<int, connection>::iterator c = m_conns.begin();
+            c != m_conns.end(); ++c)
+    {
+        close(c->first);
+    }
+
+    if (m_listen >= 0)
+    {
+        close(m_listen);
+    }
+}
+
+bool
+standin :: listen()
+{
+    m_listen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    if (m_listen < 0)
+    {
+        return false;
+    }
+
+    fcntl(m_listen, F_SETFD, FD_CLOEXEC);
+    sockaddr_in sa;
+    socklen_t salen = sizeof(sa);
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sa.sin_port = 0;
+
+    if (bind(m_listen, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)) < 0 ||
+        ::listen(m_listen, 64) < 0 ||
+        getsockname(m_listen, reinterpret_cast<sockaddr*>(&sa), &salen) < 0)
+    {
+        return false;
+    }
+
+    m_port = ntohs(sa.sin_port);
+    return true;
+}
+
+void
+standin :: run()
+{
+    while (!m_done)
+    {
+        std::vector<pollfd> pfds(1);
+        pfds[0].fd = m_listen;
+        pfds[0].events = POLLIN;
+        pfds[0].revents = 0;
+
+        for (std::map<int, connection>::iterator c = m_conns.begin();
+                c != m_conns.end(); ++c)
+        {
+            pollfd pfd;
+            pfd.fd = c->first;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            pfds.push_back(pfd);
+        }
+
+        if (poll(&pfds.front(), pfds.size(), 100) <= 0)
+        {
+            continue;
+        }
+
+        po6::threads::mutex::hold hold(&m_lock);
+
+        for (size_t i = 1; i < pfds.size(); ++i)
+        {
+            if (pfds[i].revents == 0)
+            {
+                continue;
+            }
+
+            int fd = pfds[i].fd;
+            connection& conn(m_conns[fd]);
+            char buf[4096];
+            ssize_t ret = read(fd, buf, sizeof(buf));
+
+            // A daemon that goes away is not replaced; it simply stops
+            // counting towards the cluster being ready.
+            if (ret <= 0)
+            {
+                m_acked.erase(conn.instance);
+                close(fd);
+                m_conns.erase(fd);
+                continue;
+            }
+
+            conn.buffer.append(buf, ret);
+            size_t eol;
+
+            while ((eol = conn.buffer.find('\n')) != std::string::npos)
+            {
+                std::string line(conn.buffer.substr(0, eol));
+                conn.buffer.erase(0, eol + 1);
+                handle(fd, &conn, line);
+            }
+        }
+
+        if (pfds[0].revents & POLLIN)
+        {
+            int fd = accept(m_listen, NULL, NULL);
+
+            if (fd >= 0)
+            {
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+                m_conns[fd] = connection();
+            }
+        }
+    }
+}
+
+bool
+standin :: ready()
+{
+    po6::threads::mutex::hold hold(&m_lock);
+    return !m_config.empty() && m_acked.size() == m_expected;
+}
+
+uint64_t
+standin :: failures_reported()
+{
+    po6::threads::mutex::hold hold(&m_lock);
+    return m_failures;
+}
+
+void
+standin :: handle(int fd, connection* conn, const std::string& line)
+{
+    std::istringstream istr(line);
+    std::string command;
+    istr >> command;
+
+    if (command == "instance")
+    {
+        std::string addr;
+        uint16_t inport;
+        uint16_t outport;
+
+        if (!(istr >> addr >> inport >> outport))
+        {
+            return;
+        }
+
+        // Every daemon is new to this coordinator, so every port starts in
+        // its first epoch.
+        conn->identified = true;
+        conn->instance = m_hosts.size() + 1;
+        std::ostringstream host;
+        host << "host " << conn->instance << " " << addr
+             << " " << inport << " 0 " << outport << " 0";
+        m_hosts[conn->instance] = host.str();
+
+        if (m_hosts.size() == m_expected)
+        {
+            publish();
+        }
+        else if (!m_config.empty())
+        {
+            send(fd);
+        }
+    }
+    else if (command == "client")
+    {
+        conn->identified = true;
+
+        if (!m_config.empty())
+        {
+            send(fd);
+        }
+    }
+    else if (command == "ACK")
+    {
+        if (conn->instance > 0)
+        {
+            m_acked.insert(conn->instance);
+        }
+    }
+    else if (command == "fail_host")
+    {
+        ++m_failures;
+    }
+}
+
+// Lay the space out the way "auto prefix replicas" would for every subspace,
+// placing replicas round-robin so that every daemon holds a similar share.
+void
+standin :: publish()
+{
+    std::vector<uint64_t> ids;
+    std::ostringstream config;
+
+    for (std::map<uint64_t, std::string>::iterator h = m_hosts.begin();
+            h != m_hosts.end(); ++h)
+    {
+        ids.push_back(h->first);
+        config << h->second << "\n";
+    }
+
+    config << "version 1\n";
+    config << "space " << space << " 1 k string";
+
+    for (long f = 0; f < fields; ++f)
+    {
+        config << " f" << f << " string";
+    }
+
+    config << " r int64\n";
+    size_t attrs = fields + 2;
+    size_t subspaces = search_subspace ? 2 : 1;
+    size_t next = 0;
+
+    for (size_t ss = 0; ss < subspaces; ++ss)
+    {
+        config << "subspace 1 " << ss;
+
+        for (size_t a = 0; a < attrs; ++a)
+        {
+            bool hashed = ss == 0 ? a == 0 : a == attrs - 1;
+            config << (hashed ? " true" : " false") << " true";
+        }
+
+        config << "\n";
+
+        for (uint64_t r = 0; r < (1ULL << prefix); ++r)
+        {
+            uint64_t mask = prefix == 0 ? 0 : r << (64 - prefix);
+            config << "region 1 " << ss << " " << prefix
+                   << " 0x" << std::hex << mask << std::dec;
+
+            for (long i = 0; i < replicas; ++i)
+            {
+                config << " " << ids[(next + i) % ids.size()];
+            }
+
+            config << "\n";
+            ++next;
+        }
+    }
+
+    m_config = config.str() + "end of line\n";
+
+    for (std::map<int, connection>::iterator c = m_conns.begin();
+            c != m_conns.end(); ++c)
+    {
+        if (c->second.identified)
+        {
+            send(c->first);
+        }
+    }
+}
+
+void
+standin :: send(int fd)
+{
+    const char* buf = m_config.data();
+    size_t rem = m_config.size();
+
+    while (rem > 0)
+    {
+        ssize_t ret = write(fd, buf, rem);
+
+        if (ret <= 0)
+        {
+            return;
+        }
+
+        buf += ret;
+        rem -= ret;
+    }
+}
+
+// One operation in flight.  The status and attributes live with the operation
+// because hyperclient fills them in when it completes.
+struct pending
+{
+    pending(op_t o, uint64_t s, uint64_t k)
+        : op(o), scheduled(s), key(k), written(false)
+        , status(HYPERCLIENT_ZERO), attrs(NULL), attrs_sz(0) {}
+    ~pending() throw ()
+    {
+        if (attrs)
+        {
+            hyperclient_destroy_attrs(attrs, attrs_sz);
+        }
+    }
+    op_t op;
+    uint64_t scheduled;
+    uint64_t key;
+    // Set once the read of a read-modify-write has been answered.
+    bool written;
+    hyperclient_returncode status;
+    hyperclient_attribute* attrs;
+    size_t attrs_sz;
+
+    private:
+        pending(const pending&);
+        pending& operator = (const pending&);
+};
+
+typedef std::map<int64_t, std::tr1::shared_ptr<pending> > pending_map_t;
+
+static in_port_t coord_port = 0;
+static const mix* chosen = NULL;
+static const zipfian* popularity = NULL;
+static std::vector<std::string> field_names;
+static std::string values;
+static uint64_t inserted = 0;
+static po6::threads::mutex results_lock;
+static std::vector<uint64_t> latencies[OP_COUNT];
+static std::map<hyperclient_returncode, uint64_t> failures;
+static uint64_t incomplete = 0;
+static uint64_t loaded = 0;
+static uint64_t load_failures = 0;
+
+static void
+sleep_until(uint64_t when);
+static int
+remove_entry(const char* path, const struct stat*, int, struct FTW*);
+static std::vector<pid_t>
+start_daemons(const std::string& base, in_port_t port);
+static void
+stop_daemons(const std::vector<pid_t>& pids);
+static void
+load_thread(long thread);
+static void
+run_thread(long thread);
+static void
+report(const char* name, std::vector<uint64_t>* lats);
+
+int
+main(int argc, const char* argv[])
+{
+    poptContext poptcon;
+    poptcon = poptGetContext(NULL, argc, argv, popts, POPT_CONTEXT_POSIXMEHARDER);
+    e::guard g = e::makeguard(poptFreeContext, poptcon);
+    g.use_variable();
+    int rc;
+
+    while ((rc = poptGetNextOpt(poptcon)) != -1)
+    {
+        switch (rc)
+        {
+            case 'n':
+            case 'T':
+            case 't':
+            case 'o':
+            case 'd':
+            case 'O':
+            case 'F':
+            case 'l':
+                if (daemons <= 0 || daemon_threads <= 0 || threads <= 0 ||
+                    rate <= 0 || duration <= 0 || outstanding <= 0 ||
+                    fields <= 0 || scan_length <= 0)
+                {
+                    std::cerr << "daemons, daemon-threads, threads, rate, duration, "
+                              << "outstanding, fields and scan-length must be > 0" << std::endl;
+                    return EXIT_FAILURE;
+                }
+
+                break;
+            case 'r':
+            case 'v':
+                if (records <= 1 || value_size < 0)
+                {
+                    std::cerr << "records must be > 1 and value-size must be >= 0" << std::endl;
+                    return EXIT_FAILURE;
+                }
+
+                break;
+            case 'P':
+                if (prefix < 0 || prefix > 16)
+                {
+                    std::cerr << "prefix must be in [0, 16]" << std::endl;
+                    return EXIT_FAILURE;
+                }
+
+                break;
+            case 'R':
+                if (replicas <= 0)
+                {
+                    std::cerr << "replicas must be > 0" << std::endl;
+                    return EXIT_FAILURE;
+                }
+
+                break;
+            case 'z':
+                if (theta < 0 || theta >= 1)
+                {
+                    std::cerr << "zipf must be in [0, 1)" << std::endl;
+                    return EXIT_FAILURE;
+                }
+
+                break;
+            case 'K':
+                keep_data = true;
+                break;
+            case 'S':
+                search_subspace = false;
+                break;
+            case 'w':
+            case 'b':
+            case 'D':
+                break;
+            case POPT_ERROR_NOARG:
+            case POPT_ERROR_BADOPT:
+            case POPT_ERROR_BADNUMBER:
+            case POPT_ERROR_OVERFLOW:
+                std::cerr << poptStrerror(rc) << " " << poptBadOption(poptcon, 0) << std::endl;
+                return EXIT_FAILURE;
+            case POPT_ERROR_OPTSTOODEEP:
+            case POPT_ERROR_BADQUOTE:
+            case POPT_ERROR_ERRNO:
+            default:
+                std::cerr << "logic error in argument parsing" << std::endl;
+                return EXIT_FAILURE;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(mixes) / sizeof(mix); ++i)
+    {
+        if (strlen(workload) == 1 && tolower(workload[0]) == mixes[i].name)
+        {
+            chosen = mixes + i;
+        }
+    }
+
+    if (!chosen)
+    {
+        std::cerr << "workload must be one of a, b, c, d, e or f" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (replicas > daemons)
+    {
+        std::cerr << "cannot place " << replicas << " replicas on "
+                  << daemons << " daemons" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::string base(std::string(data) + "/hyperdex-cluster-benchmark-XXXXXX");
+    std::vector<char> basebuf(base.begin(), base.end());
+    basebuf.push_back('\0');
+
+    if (!mkdtemp(&basebuf.front()))
+    {
+        std::cerr << "could not create a directory in " << data
+                  << ": " << strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    base = &basebuf.front();
+    standin coord(daemons);
+
+    if (!coord.listen())
+    {
+        std::cerr << "could not start the coordinator: " << strerror(errno) << std::endl;
+        rmdir(base.c_str());
+        return EXIT_FAILURE;
+    }
+
+    coord_port = coord.port();
+    po6::threads::thread coordinator(std::tr1::bind(&standin::run, &coord));
+    coordinator.start();
+    std::vector<pid_t> pids = start_daemons(base, coord.port());
+    uint64_t started = e::time();
+    rc = EXIT_SUCCESS;
+
+    while (pids.size() == static_cast<size_t>(daemons) && !coord.ready())
+    {
+        pid_t exited = waitpid(-1, NULL, WNOHANG);
+
+        if (exited > 0)
+        {
+            std::cerr << "a daemon exited during startup; see the logs in "
+                      << base << std::endl;
+            pids.erase(std::find(pids.begin(), pids.end(), exited));
+            keep_data = true;
+            rc = EXIT_FAILURE;
+        }
+        else if (e::time() - started > 30 * 1000000000ULL)
+        {
+            std::cerr << "the daemons did not come up within 30 seconds; see the logs in "
+                      << base << std::endl;
+            keep_data = true;
+            rc = EXIT_FAILURE;
+            break;
+        }
+
+        e::sleep_ns(0, 10000000);
+    }
+
+    if (pids.size() != static_cast<size_t>(daemons))
+    {
+        rc = EXIT_FAILURE;
+    }
+
+    if (rc == EXIT_SUCCESS)
+    {
+        std::cout << "# cluster: " << daemons << " daemons, 2^" << prefix
+                  << " regions per subspace, " << replicas << " replicas, "
+                  << (search_subspace ? 2 : 1) << " subspaces" << std::endl;
+        values.resize(value_size * 2 + 1);
+
+        for (size_t i = 0; i < values.size(); ++i)
+        {
+            values[i] = 'a' + i % 26;
+        }
+
+        for (long f = 0; f < fields; ++f)
+        {
+            std::ostringstream name;
+            name << "f" << f;
+            field_names.push_back(name.str());
+        }
+
+        zipfian z(records, theta);
+        popularity = &z;
+        inserted = records;
+        std::vector<std::tr1::shared_ptr<po6::threads::thread> > clients;
+        uint64_t load_start = e::time();
+
+        for (long i = 0; i < threads; ++i)
+        {
+            std::tr1::shared_ptr<po6::threads::thread> tptr(new po6::threads::thread(std::tr1::bind(load_thread, i)));
+            clients.push_back(tptr);
+            tptr->start();
+        }
+
+        for (size_t i = 0; i < clients.size(); ++i)
+        {
+            clients[i]->join();
+        }
+
+        double load_seconds = (e::time() - load_start) / 1e9;
+        std::cout << "# load: " << loaded << " records in " << std::fixed
+                  << std::setprecision(1) << load_seconds << "s ("
+                  << std::setprecision(0) << loaded / load_seconds << " ops/s, "
+                  << load_failures << " failed)" << std::endl;
+        clients.clear();
+
+        for (long i = 0; i < threads; ++i)
+        {
+            std::tr1::shared_ptr<po6::threads::thread> tptr(new po6::threads::thread(std::tr1::bind(run_thread, i)));
+            clients.push_back(tptr);
+            tptr->start();
+        }
+
+        for (size_t i = 0; i < clients.size(); ++i)
+        {
+            clients[i]->join();
+        }
+
+        std::vector<uint64_t> all;
+        uint64_t completed = 0;
+
+        for (size_t i = 0; i < OP_COUNT; ++i)
+        {
+            completed += latencies[i].size();
+        }
+
+        std::cout << "# run: workload " << chosen->name << ", target " << rate
+                  << " ops/s, achieved " << completed / duration << " ops/s over "
+                  << duration << "s" << std::endl;
+        std::cout << "# op ops p50_us p95_us p99_us p999_us max_us" << std::endl;
+
+        for (size_t i = 0; i < OP_COUNT; ++i)
+        {
+            if (!latencies[i].empty())
+            {
+                all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+                report(op_names[i], &latencies[i]);
+            }
+        }
+
+        report("all", &all);
+        typedef std::map<hyperclient_returncode, uint64_t>::iterator result_iter_t;
+
+        for (result_iter_t f = failures.begin(); f != failures.end(); ++f)
+        {
+            std::cout << "# failed " << f->first << " " << f->second << std::endl;
+        }
+
+        if (incomplete > 0)
+        {
+            std::cout << "# incomplete " << incomplete << std::endl;
+        }
+
+        if (coord.failures_reported() > 0)
+        {
+            std::cout << "# daemons reported " << coord.failures_reported()
+                      << " failures" << std::endl;
+        }
+    }
+
+    stop_daemons(pids);
+    coord.stop();
+    coordinator.join();
+
+    if (keep_data)
+    {
+        std::cerr << "data and logs kept in " << base << std::endl;
+    }
+    else
+    {
+        nftw(base.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    return rc;
+}
+
+static void
+sleep_until(uint64_t when)
+{
+    uint64_t now = e::time();
+
+    if (when > now)
+    {
+        e::sleep_ns((when - now) / 1000000000ULL, (when - now) % 1000000000ULL);
+    }
+}
+
+static int
+remove_entry(const char* path, const struct stat*, int, struct FTW*)
+{
+    return remove(path);
+}
+
+static std::vector<pid_t>
+start_daemons(const std::string& base, in_port_t port)
+{
+    std::vector<pid_t> pids;
+
+    for (long i = 0; i < daemons; ++i)
+    {
+        std::ostringstream dir;
+        dir << base << "/daemon" << i;
+        std::ostringstream log;
+        log << base << "/daemon" << i << ".log";
+        std::ostringstream portstr;
+        portstr << port;
+        std::ostringstream threadstr;
+        threadstr << daemon_threads;
+
+        if (mkdir(dir.str().c_str(), S_IRWXU) < 0)
+        {
+            std::cerr << "could not create " << dir.str() << ": " << strerror(errno) << std::endl;
+            break;
+        }
+
+        // Everything the child needs is prepared before the fork, because
+        // the coordinator thread may hold locks that the child would inherit.
+        std::vector<std::string> args;
+        args.push_back(daemon_binary);
+        args.push_back("--foreground");
+        args.push_back("--data=" + dir.str());
+        args.push_back("--host=127.0.0.1");
+        args.push_back("--port=" + portstr.str());
+        args.push_back("--threads=" + threadstr.str());
+        args.push_back("--bind-to=127.0.0.1");
+        std::vector<char*> argv;
+
+        for (size_t a = 0; a < args.size(); ++a)
+        {
+            argv.push_back(const_cast<char*>(args[a].c_str()));
+        }
+
+        argv.push_back(NULL);
+        std::string logpath(log.str());
+        pid_t pid = fork();
+
+        if (pid < 0)
+        {
+            std::cerr << "could not start a daemon: " << strerror(errno) << std::endl;
+            break;
+        }
+        else if (pid == 0)
+        {
+            int fd = open(logpath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+
+            if (fd >= 0)
+            {
+                dup2(fd, STDOUT_FILENO);
+                dup2(fd, STDERR_FILENO);
+            }
+
+            execvp(argv[0], &argv.front());
+            _exit(127);
+        }
+
+        pids.push_back(pid);
+    }
+
+    return pids;
+}
+
+static void
+stop_daemons(const std::vector<pid_t>& pids)
+{
+    for (size_t i = 0; i < pids.size(); ++i)
+    {
+        kill(pids[i], SIGTERM);
+    }
+
+    uint64_t deadline = e::time() + 10 * 1000000000ULL;
+
+    for (size_t i = 0; i < pids.size(); ++i)
+    {
+        while (waitpid(pids[i], NULL, WNOHANG) == 0)
+        {
+            if (e::time() > deadline)
+            {
+                kill(pids[i], SIGKILL);
+                waitpid(pids[i], NULL, 0);
+                break;
+            }
+
+            e::sleep_ns(0, 10000000);
+        }
+    }
+}
+
+static size_t
+format_key(uint64_t key, char* buf, size_t buf_sz)
+{
+    return snprintf(buf, buf_sz, "user%llu", static_cast<unsigned long long>(key));
+}
+
+// Popular keys are scattered across the key space, as YCSB does, so that they
+// do not all fall in the same stretch of any scan.
+static uint64_t
+choose_key(unsigned short* xsubi)
+{
+    uint64_t rank = popularity->next(erand48(xsubi));
+
+    if (chosen->latest)
+    {
+        uint64_t latest = inserted;
+        return rank < latest ? latest - 1 - rank : 0;
+    }
+
+    return CityHash64(reinterpret_cast<const char*>(&rank), sizeof(rank)) % records;
+}
+
+static std::tr1::shared_ptr<pending>
+choose_op(uint64_t scheduled, unsigned short* xsubi)
+{
+    double u = erand48(xsubi);
+    op_t op;
+
+    if ((u -= chosen->read) < 0)
+    {
+        op = OP_READ;
+    }
+    else if ((u -= chosen->update) < 0)
+    {
+        op = OP_UPDATE;
+    }
+    else if ((u -= chosen->insert) < 0)
+    {
+        op = OP_INSERT;
+    }
+    else if ((u -= chosen->scan) < 0)
+    {
+        op = OP_SCAN;
+    }
+    else
+    {
+        op = OP_RMW;
+    }
+
+    uint64_t key = op == OP_INSERT ? __sync_fetch_and_add(&inserted, 1)
+                                   : choose_key(xsubi);
+    return std::tr1::shared_ptr<pending>(new pending(op, scheduled, key));
+}
+
+// Write every attribute of the record, or just one of its fields.
+static int64_t
+put(hyperclient* cl, pending* p, bool whole, unsigned short* xsubi)
+{
+    char key[32];
+    size_t key_sz = format_key(p->key, key, sizeof(key));
+    uint8_t r[sizeof(uint64_t)];
+    e::pack64le(p->key, r);
+    std::vector<hyperclient_attribute> attrs;
+    long first = whole ? 0 : static_cast<long>(erand48(xsubi) * fields);
+    long last = whole ? fields : first + 1;
+
+    for (long f = first; f < last; ++f)
+    {
+        hyperclient_attribute attr;
+        attr.attr = field_names[f].c_str();
+        attr.value = values.data() + static_cast<size_t>(erand48(xsubi) * value_size);
+        attr.value_sz = value_size;
+        attr.datatype = HYPERDATATYPE_STRING;
+        attrs.push_back(attr);
+    }
+
+    if (whole)
+    {
+        hyperclient_attribute attr;
+        attr.attr = "r";
+        attr.value = reinterpret_cast<const char*>(r);
+        attr.value_sz = sizeof(r);
+        attr.datatype = HYPERDATATYPE_INT64;
+        attrs.push_back(attr);
+    }
+
+    return cl->put(space, key, key_sz, &attrs.front(), attrs.size(), &p->status);
+}
+
+static int64_t
+issue(hyperclient* cl, pending* p, unsigned short* xsubi)
+{
+    char key[32];
+    size_t key_sz = format_key(p->key, key, sizeof(key));
+    hyperclient_range_query rn;
+
+    switch (p->op)
+    {
+        case OP_READ:
+        case OP_RMW:
+            return cl->get(space, key, key_sz, &p->status, &p->attrs, &p->attrs_sz);
+        case OP_UPDATE:
+            return put(cl, p, false, xsubi);
+        case OP_INSERT:
+            return put(cl, p, true, xsubi);
+        case OP_SCAN:
+            rn.attr = "r";
+            rn.lower = p->key;
+            rn.upper = p->key + 1 + static_cast<uint64_t>(erand48(xsubi) * scan_length);
+            return cl->search(space, NULL, 0, &rn, 1, &p->status, &p->attrs, &p->attrs_sz);
+        case OP_COUNT:
+        default:
+            abort();
+    }
+}
+
+static void
+load_thread(long thread)
+{
+    unsigned short xsubi[3] = {static_cast<unsigned short>(thread), 0x5eed, 0x330e};
+    uint64_t key = records * thread / threads;
+    uint64_t last = records * (thread + 1) / threads;
+    uint64_t lloaded = 0;
+    uint64_t lfailed = 0;
+    hyperclient cl("127.0.0.1", coord_port);
+    pending_map_t ops;
+
+    while (key < last || !ops.empty())
+    {
+        while (key < last && ops.size() < static_cast<size_t>(outstanding))
+        {
+            std::tr1::shared_ptr<pending> p(new pending(OP_INSERT, 0, key));
+            int64_t id = put(&cl, p.get(), true, xsubi);
+
+            if (id < 0)
+            {
+                ++lfailed;
+            }
+            else
+            {
+                ops[id] = p;
+            }
+
+            ++key;
+        }
+
+        if (ops.empty())
+        {
+            continue;
+        }
+
+        hyperclient_returncode lstatus;
+        int64_t id = cl.loop(10000, &lstatus);
+
+        // Nothing more will come back for the operations in flight.
+        if (id < 0)
+        {
+            lfailed += ops.size();
+            ops.clear();
+            continue;
+        }
+
+        pending_map_t::iterator it = ops.find(id);
+
+        if (it != ops.end())
+        {
+            ++(it->second->status == HYPERCLIENT_SUCCESS ? lloaded : lfailed);
+            ops.erase(it);
+        }
+    }
+
+    po6::threads::mutex::hold hold(&results_lock);
+    loaded += lloaded;
+    load_failures += lfailed;
+}
+
+// Issue operations on a Poisson schedule of rate / threads operations per
+// second.  An operation that cannot be issued on time, because the thread has
+// too many in flight, is issued as soon as possible, but its latency still
+// counts from when it was due.
+static void
+run_thread(long thread)
+{
+    std::vector<uint64_t> llatencies[OP_COUNT];
+    std::map<hyperclient_returncode, uint64_t> lfailures;
+    uint64_t lincomplete = 0;
+    unsigned short xsubi[3] = {static_cast<unsigned short>(thread), 0xbe7c, 0x330e};
+    const double per_second = static_cast<double>(rate) / threads;
+    hyperclient cl("127.0.0.1", coord_port);
+    pending_map_t ops;
+    const uint64_t start = e::time();
+    const uint64_t end = start + duration * 1000000000ULL;
+    uint64_t next = start;
+
+    while (true)
+    {
+        uint64_t now = e::time();
+
+        while (next < end && next <= now && ops.size() < static_cast<size_t>(outstanding))
+        {
+            std::tr1::shared_ptr<pending> p(choose_op(next, xsubi));
+            int64_t id = issue(&cl, p.get(), xsubi);
+
+            if (id < 0)
+            {
+                ++lfailures[p->status];
+            }
+            else
+            {
+                ops[id] = p;
+            }
+
+            next += -log(1.0 - erand48(xsubi)) / per_second * 1e9;
+        }
+
+        if (next >= end && ops.empty())
+        {
+            break;
+        }
+
+        if (now > end + 10 * 1000000000ULL)
+        {
+            lincomplete += ops.size();
+            break;
+        }
+
+        if (ops.empty())
+        {
+            sleep_until(next);
+            continue;
+        }
+
+        int timeout = 100;
+
+        if (next < end && ops.size() < static_cast<size_t>(outstanding))
+        {
+            timeout = next > now ? (next - now) / 1000000 : 0;
+        }
+
+        hyperclient_returncode lstatus;
+        int64_t id = cl.loop(timeout, &lstatus);
+
+        if (id < 0)
+        {
+            if (lstatus == HYPERCLIENT_NONEPENDING)
+            {
+                lincomplete += ops.size();
+                ops.clear();
+            }
+            else if (lstatus != HYPERCLIENT_TIMEOUT)
+            {
+                ++lfailures[lstatus];
+            }
+
+            continue;
+        }
+
+        pending_map_t::iterator it = ops.find(id);
+
+        if (it == ops.end())
+        {
+            continue;
+        }
+
+        std::tr1::shared_ptr<pending> p(it->second);
+        ops.erase(it);
+
+        if (p->attrs)
+        {
+            hyperclient_destroy_attrs(p->attrs, p->attrs_sz);
+            p->attrs = NULL;
+            p->attrs_sz = 0;
+        }
+
+        // Each object found by a scan comes back separately, under the same
+        // id, before the scan is done.
+        if (p->op == OP_SCAN && p->status == HYPERCLIENT_SUCCESS)
+        {
+            ops[id] = p;
+            continue;
+        }
+
+        // The read half of a read-modify-write is done; the write still
+        // counts against the time the whole operation was due.
+        if (p->op == OP_RMW && !p->written &&
+            (p->status == HYPERCLIENT_SUCCESS || p->status == HYPERCLIENT_NOTFOUND))
+        {
+            p->written = true;
+            int64_t wid = put(&cl, p.get(), false, xsubi);
+
+            if (wid < 0)
+            {
+                ++lfailures[p->status];
+            }
+            else
+            {
+                ops[wid] = p;
+            }
+
+            continue;
+        }
+
+        if (p->status == HYPERCLIENT_SUCCESS ||
+            p->status == HYPERCLIENT_NOTFOUND ||
+            p->status == HYPERCLIENT_SEARCHDONE)
+        {
+            llatencies[p->op].push_back(e::time() - p->scheduled);
+        }
+        else
+        {
+            ++lfailures[p->status];
+        }
+    }
+
+    po6::threads::mutex::hold hold(&results_lock);
+    incomplete += lincomplete;
+
+    for (size_t i = 0; i < OP_COUNT; ++i)
+    {
+        latencies[i].insert(latencies[i].end(), llatencies[i].begin(), llatencies[i].end());
+    }
+
+    for (std::map<hyperclient_returncode, uint64_t>::iterator f = lfailures.begin();
+            f != lfailures.end(); ++f)
+    {
+        failures[f->first] += f->second;
+    }
+}
+
+static uint64_t
+percentile(const std::vector<uint64_t>& sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+
+    return sorted[static_cast<size_t>(p * (sorted.size() - 1))];
+}
+
+static void
+report(const char* name, std::vector<uint64_t>* lats)
+{
+    std::sort(lats->begin(), lats->end());
+    std::cout << name << " " << lats->size()
+              << " " << percentile(*lats, 0.5) / 1000
+              << " " << percentile(*lats, 0.95) / 1000
+              << " " << percentile(*lats, 0.99) / 1000
+              << " " << percentile(*lats, 0.999) / 1000
+              << " " << (lats->empty() ? 0 : lats->back() / 1000) << std::endl;
+}
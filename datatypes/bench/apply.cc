@@ -0,0 +1,357 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <cstdio>
+#include <cstdlib>
+
+// C++
+#include <iostream>
+
+// STL
+#include <string>
+#include <tr1/memory>
+#include <vector>
+
+// e
+#include <e/buffer.h>
+#include <e/endian.h>
+
+// HyperDex
+#include "datatypes/alltypes.h"
+#include "datatypes/apply.h"
+#include "datatypes/attribute.h"
+#include "datatypes/microcheck.h"
+#include "datatypes/microop.h"
+#include "datatypes/schema.h"
+#include "benchrunner.h"
+
+// The number of elements in each list, set or map the kernels start from.
+#define ELEMENTS 64
+
+typedef uint8_t* (*kernel)(const e::slice& old_value,
+                           const microop* ops, size_t num_ops,
+                           uint8_t* writeto, microerror* error);
+
+// The i'th element of the given primitive type, as a microop carries it.
+static std::string
+element(hyperdatatype type, size_t i)
+{
+    uint8_t buf[sizeof(uint64_t)];
+
+    if (type == HYPERDATATYPE_STRING)
+    {
+        char str[16];
+        snprintf(str, sizeof(str), "elem%04lu", static_cast<unsigned long>(i));
+        return std::string(str);
+    }
+    else if (type == HYPERDATATYPE_INT64)
+    {
+        e::pack64le(static_cast<int64_t>(i * 7919), buf);
+    }
+    else if (type == HYPERDATATYPE_FLOAT)
+    {
+        e::packdoublele(i * 0.5, buf);
+    }
+    else
+    {
+        abort();
+    }
+
+    return std::string(reinterpret_cast<char*>(buf), sizeof(buf));
+}
+
+// The i'th element of the given primitive type, as a container stores it.
+static std::string
+contained(hyperdatatype type, size_t i)
+{
+    std::string elem = element(type, i);
+
+    if (type == HYPERDATATYPE_STRING)
+    {
+        uint8_t sz[sizeof(uint32_t)];
+        e::pack32le(elem.size(), sz);
+        elem = std::string(reinterpret_cast<char*>(sz), sizeof(sz)) + elem;
+    }
+
+    return elem;
+}
+
+static std::string
+sequence(hyperdatatype elem)
+{
+    std::string s;
+
+    for (size_t i = 0; i < ELEMENTS; ++i)
+    {
+        s += contained(elem, i);
+    }
+
+    return s;
+}
+
+static std::string
+pairs(hyperdatatype key, hyperdatatype val)
+{
+    std::string s;
+
+    for (size_t i = 0; i < ELEMENTS; ++i)
+    {
+        s += contained(key, i);
+        s += contained(val, i);
+    }
+
+    return s;
+}
+
+static e::slice
+slice(const std::string& s)
+{
+    return e::slice(s.data(), s.size());
+}
+
+// Apply "op" to "old_value" over and over.  The kernel must accept the op, or
+// the benchmark would only measure how quickly it fails.
+static void
+run_kernel(bench::state& st, kernel k, const std::string& old_value, const microop& op)
+{
+    std::vector<uint8_t> out(old_value.size() + 2 * sizeof(uint32_t)
+                             + op.arg1.size() + op.arg2.size());
+    microerror error;
+
+    if (!k(slice(old_value), &op, 1, &out.front(), &error))
+    {
+        std::cerr << "kernel rejected the benchmark's microop" << std::endl;
+        abort();
+    }
+
+    st.set_bytes(old_value.size());
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        bench::consume(k(slice(old_value), &op, 1, &out.front(), &error));
+    }
+}
+
+static void
+run_primitive(bench::state& st, kernel k, hyperdatatype type, microaction action)
+{
+    std::string old_value = element(type, 1);
+    std::string arg = element(type, 2);
+    microop op;
+    op.attr = 1;
+    op.action = action;
+    op.arg1 = slice(arg);
+    op.arg1_datatype = type;
+    run_kernel(st, k, old_value, op);
+}
+
+static void
+run_sequence(bench::state& st, kernel k, hyperdatatype elem, microaction action)
+{
+    std::string old_value = sequence(elem);
+    std::string arg = element(elem, ELEMENTS);
+    microop op;
+    op.attr = 1;
+    op.action = action;
+    op.arg1 = slice(arg);
+    op.arg1_datatype = elem;
+    run_kernel(st, k, old_value, op);
+}
+
+static void
+run_map(bench::state& st, kernel k, hyperdatatype key, hyperdatatype val)
+{
+    std::string old_value = pairs(key, val);
+    std::string arg1 = element(val, ELEMENTS);
+    std::string arg2 = element(key, ELEMENTS);
+    microop op;
+    op.attr = 1;
+    op.action = OP_MAP_ADD;
+    op.arg1 = slice(arg1);
+    op.arg1_datatype = val;
+    op.arg2 = slice(arg2);
+    op.arg2_datatype = key;
+    run_kernel(st, k, old_value, op);
+}
+
+BENCHMARK(Apply, StringAppend, 1000000)
+{
+    run_primitive(st, apply_string, HYPERDATATYPE_STRING, OP_STRING_APPEND);
+}
+
+BENCHMARK(Apply, Int64Add, 1000000)
+{
+    run_primitive(st, apply_int64, HYPERDATATYPE_INT64, OP_NUM_ADD);
+}
+
+BENCHMARK(Apply, FloatAdd, 1000000)
+{
+    run_primitive(st, apply_float, HYPERDATATYPE_FLOAT, OP_NUM_ADD);
+}
+
+BENCHMARK(Apply, ListStringRPush, 100000)
+{
+    run_sequence(st, apply_list_string, HYPERDATATYPE_STRING, OP_LIST_RPUSH);
+}
+
+BENCHMARK(Apply, ListInt64RPush, 100000)
+{
+    run_sequence(st, apply_list_int64, HYPERDATATYPE_INT64, OP_LIST_RPUSH);
+}
+
+BENCHMARK(Apply, ListFloatRPush, 100000)
+{
+    run_sequence(st, apply_list_float, HYPERDATATYPE_FLOAT, OP_LIST_RPUSH);
+}
+
+BENCHMARK(Apply, SetStringAdd, 100000)
+{
+    run_sequence(st, apply_set_string, HYPERDATATYPE_STRING, OP_SET_ADD);
+}
+
+BENCHMARK(Apply, SetInt64Add, 100000)
+{
+    run_sequence(st, apply_set_int64, HYPERDATATYPE_INT64, OP_SET_ADD);
+}
+
+BENCHMARK(Apply, SetFloatAdd, 100000)
+{
+    run_sequence(st, apply_set_float, HYPERDATATYPE_FLOAT, OP_SET_ADD);
+}
+
+BENCHMARK(Apply, MapStringStringAdd, 100000)
+{
+    run_map(st, apply_map_string_string, HYPERDATATYPE_STRING, HYPERDATATYPE_STRING);
+}
+
+BENCHMARK(Apply, MapStringInt64Add, 100000)
+{
+    run_map(st, apply_map_string_int64, HYPERDATATYPE_STRING, HYPERDATATYPE_INT64);
+}
+
+BENCHMARK(Apply, MapStringFloatAdd, 100000)
+{
+    run_map(st, apply_map_string_float, HYPERDATATYPE_STRING, HYPERDATATYPE_FLOAT);
+}
+
+BENCHMARK(Apply, MapInt64StringAdd, 100000)
+{
+    run_map(st, apply_map_int64_string, HYPERDATATYPE_INT64, HYPERDATATYPE_STRING);
+}
+
+BENCHMARK(Apply, MapInt64Int64Add, 100000)
+{
+    run_map(st, apply_map_int64_int64, HYPERDATATYPE_INT64, HYPERDATATYPE_INT64);
+}
+
+BENCHMARK(Apply, MapInt64FloatAdd, 100000)
+{
+    run_map(st, apply_map_int64_float, HYPERDATATYPE_INT64, HYPERDATATYPE_FLOAT);
+}
+
+BENCHMARK(Apply, MapFloatStringAdd, 100000)
+{
+    run_map(st, apply_map_float_string, HYPERDATATYPE_FLOAT, HYPERDATATYPE_STRING);
+}
+
+BENCHMARK(Apply, MapFloatInt64Add, 100000)
+{
+    run_map(st, apply_map_float_int64, HYPERDATATYPE_FLOAT, HYPERDATATYPE_INT64);
+}
+
+BENCHMARK(Apply, MapFloatFloatAdd, 100000)
+{
+    run_map(st, apply_map_float_float, HYPERDATATYPE_FLOAT, HYPERDATATYPE_FLOAT);
+}
+
+// The whole of an atomic operation on a three-attribute object: one check, and
+// one op on each attribute.
+BENCHMARK(Apply, ChecksAndOps, 100000)
+{
+    attribute attrs[4];
+    attrs[0] = attribute("key", HYPERDATATYPE_STRING);
+    attrs[1] = attribute("name", HYPERDATATYPE_STRING);
+    attrs[2] = attribute("count", HYPERDATATYPE_INT64);
+    attrs[3] = attribute("tags", HYPERDATATYPE_MAP_STRING_INT64);
+    schema sc;
+    sc.attrs_sz = 4;
+    sc.attrs = attrs;
+
+    std::string key = element(HYPERDATATYPE_STRING, 0);
+    std::string name = element(HYPERDATATYPE_STRING, 1);
+    std::string count = element(HYPERDATATYPE_INT64, 1);
+    std::string tags = pairs(HYPERDATATYPE_STRING, HYPERDATATYPE_INT64);
+    std::vector<e::slice> old_value;
+    old_value.push_back(slice(name));
+    old_value.push_back(slice(count));
+    old_value.push_back(slice(tags));
+
+    std::vector<microcheck> checks(1);
+    checks[0].attr = 1;
+    checks[0].value = slice(name);
+    checks[0].datatype = HYPERDATATYPE_STRING;
+    checks[0].predicate = PRED_EQUALS;
+
+    std::string suffix = element(HYPERDATATYPE_STRING, 2);
+    std::string one = element(HYPERDATATYPE_INT64, 1);
+    std::string tag = element(HYPERDATATYPE_STRING, ELEMENTS);
+    std::vector<microop> ops(3);
+    ops[0].attr = 1;
+    ops[0].action = OP_STRING_APPEND;
+    ops[0].arg1 = slice(suffix);
+    ops[0].arg1_datatype = HYPERDATATYPE_STRING;
+    ops[1].attr = 2;
+    ops[1].action = OP_NUM_ADD;
+    ops[1].arg1 = slice(one);
+    ops[1].arg1_datatype = HYPERDATATYPE_INT64;
+    ops[2].attr = 3;
+    ops[2].action = OP_MAP_ADD;
+    ops[2].arg1 = slice(one);
+    ops[2].arg1_datatype = HYPERDATATYPE_INT64;
+    ops[2].arg2 = slice(tag);
+    ops[2].arg2_datatype = HYPERDATATYPE_STRING;
+
+    std::tr1::shared_ptr<e::buffer> new_backing;
+    e::slice new_key;
+    std::vector<e::slice> new_value;
+    microerror error;
+
+    if (apply_checks_and_ops(&sc, checks, ops, slice(key), old_value,
+                             &new_backing, &new_key, &new_value, &error)
+            != checks.size() + ops.size())
+    {
+        std::cerr << "apply_checks_and_ops rejected the benchmark's microops" << std::endl;
+        abort();
+    }
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        bench::consume(apply_checks_and_ops(&sc, checks, ops, slice(key), old_value,
+                                            &new_backing, &new_key, &new_value, &error));
+    }
+}
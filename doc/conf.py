@@ -214,8 +214,12 @@ latex_logo = '_static/hd-logo.png'
 # One entry per manual page. List of tuples
 # (source start file, name, description, authors, manual section).
 man_pages = [
+    (u'man/hyperdex-cluster-benchmark', u'hyperdex-cluster-benchmark',
+        u'HyperDex Cluster Benchmark', [u'Robert Escriva', u'Bernard Wong', u'Emin Gün Sirer'], 1),
     (u'man/hyperdex-daemon', u'hyperdex-daemon',
         u'HyperDex Daemon', [u'Robert Escriva', u'Bernard Wong', u'Emin Gün Sirer'], 1),
+    (u'man/hyperdex-reconfiguration-benchmark', u'hyperdex-reconfiguration-benchmark',
+        u'HyperDex Reconfiguration Benchmark', [u'Robert Escriva', u'Bernard Wong', u'Emin Gün Sirer'], 1),
     (u'man/hyperdex-replication-stress-test', u'hyperdex-replication-stress-test',
         u'HyperDex Replication Stress Test', [u'Robert Escriva', u'Bernard Wong', u'Emin Gün Sirer'], 1),
     (u'man/hyperdex-simple-consistency-stress-test', u'hyperdex-simple-consistency-stress-test',
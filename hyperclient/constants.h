@@ -34,6 +34,21 @@
 #define HYPERCLIENT_HEADER_SIZE (BUSYBEE_HEADER_SIZE + sizeof(uint64_t) \
                                 + sizeof(uint8_t) + 2 * sizeof(uint16_t) \
                                 + 2 * hyperdex::entityid::SERIALIZEDSIZE \
-                                + sizeof(uint64_t))
+                                + sizeof(uint64_t) + sizeof(uint64_t))
+
+// [busybee header][u8 PACKET_CLIENT_COMPACT][u8 type][u64 version][from][u32 to]
+// followed by the nonce.  "to" is the entity's number within the
+// configuration.  Requests of at most HYPERCLIENT_COMPACT_BYTES with the full
+// header, and that are not traced, are sent this way.
+#define HYPERCLIENT_COMPACT_HEADER_SIZE (BUSYBEE_HEADER_SIZE + 2 * sizeof(uint8_t) \
+                                        + sizeof(uint64_t) \
+                                        + hyperdex::entityid::SERIALIZEDSIZE \
+                                        + sizeof(uint32_t))
+#define HYPERCLIENT_COMPACT_BYTES 1024
+
+// Bounds (in nanoseconds) on how long to hold off sending ordinary requests to
+// a server that reported it is overloaded.
+#define HYPERCLIENT_BACKOFF_MIN 1000000ULL
+#define HYPERCLIENT_BACKOFF_MAX 1000000000ULL
 
 #endif // hyperclient_constants_h_
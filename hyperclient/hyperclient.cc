@@ -25,6 +25,8 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#define __STDC_LIMIT_MACROS
+
 // C++
 #include <iostream>
 
@@ -34,6 +36,9 @@
 // po6
 #include <po6/net/location.h>
 
+// e
+#include <e/timer.h>
+
 // BusyBee
 #include <busybee_returncode.h>
 #include <busybee_st.h>
@@ -93,6 +98,10 @@ hyperclient :: hyperclient(const char* coordinator, in_port_t port)
     , m_client_id(1)
     , m_old_coord_fd(-1)
     , m_have_seen_config(false)
+    , m_priority(false)
+    , m_backoff()
+    , m_trace_threshold(0)
+    , m_trace_seed(e::time() ^ reinterpret_cast<uintptr_t>(this))
 {
     m_coord->set_announce("client");
 }
@@ -469,9 +478,10 @@ hyperclient :: loop(int timeout, hyperclient_returncode* status)
         uint16_t tover;
         hyperdex::entityid from;
         hyperdex::entityid to;
+        uint64_t trace;
         int64_t nonce;
         e::buffer::unpacker up = msg->unpack_from(BUSYBEE_HEADER_SIZE);
-        up = up >> type_num >> version >> fromver >> tover >> from >> to >> nonce;
+        up = up >> type_num >> version >> fromver >> tover >> from >> to >> trace >> nonce;
 
         if (up.error())
         {
@@ -690,6 +700,13 @@ hyperclient :: add_keyop(const char* space, const char* key, size_t key_sz,
         return -1;
     }
 
+    if (!m_priority &&
+        backing_off(po6::net::location(dst_inst.address, dst_inst.inbound_port)))
+    {
+        op->set_status(HYPERCLIENT_OVERLOADED);
+        return -1;
+    }
+
     op->set_server_visible_nonce(m_server_nonce);
     ++m_server_nonce;
     op->set_entity(dst_ent);
@@ -1056,6 +1073,50 @@ hyperclient :: prepare_searchop(const char* space,
     return 0;
 }
 
+void
+hyperclient :: set_trace_rate(double rate)
+{
+    if (rate <= 0)
+    {
+        m_trace_threshold = 0;
+    }
+    else if (rate >= 1)
+    {
+        m_trace_threshold = UINT64_MAX;
+    }
+    else
+    {
+        m_trace_threshold = static_cast<uint64_t>(rate * 18446744073709551616.0);
+    }
+}
+
+// Returns a random non-zero trace id for the sampled fraction of requests, and
+// zero for the rest.
+uint64_t
+hyperclient :: sample_trace()
+{
+    if (m_trace_threshold == 0)
+    {
+        return 0;
+    }
+
+    // xorshift64*
+    m_trace_seed ^= m_trace_seed >> 12;
+    m_trace_seed ^= m_trace_seed << 25;
+    m_trace_seed ^= m_trace_seed >> 27;
+    uint64_t r = m_trace_seed * 2685821657736338717ULL;
+
+    if (r > m_trace_threshold)
+    {
+        return 0;
+    }
+
+    m_trace_seed ^= m_trace_seed >> 12;
+    m_trace_seed ^= m_trace_seed << 25;
+    m_trace_seed ^= m_trace_seed >> 27;
+    return (m_trace_seed * 2685821657736338717ULL) | 1;
+}
+
 int64_t
 hyperclient :: send(e::intrusive_ptr<pending> op,
                     std::auto_ptr<e::buffer> msg)
@@ -1064,12 +1125,22 @@ hyperclient :: send(e::intrusive_ptr<pending> op,
     const uint64_t version = m_config->version();
     const uint16_t fromver = 1;
     const uint16_t tover = op->instance().inbound_version;
-    const hyperdex::entityid from(hyperdex::configuration::CLIENTSPACE, 0, 0, 0, 0);
+    const uint8_t flags = m_priority ? hyperdex::CLIENT_PRIORITY : 0;
+    const hyperdex::entityid from(hyperdex::configuration::CLIENTSPACE, 0, 0, 0, flags);
     const hyperdex::entityid& to(op->entity());
+    const uint64_t trace = sample_trace();
     const uint64_t nonce = op->server_visible_nonce();
     e::buffer::packer pa = msg->pack_at(BUSYBEE_HEADER_SIZE);
-    pa = pa << type << version << fromver << tover << from << to << nonce;
+    pa = pa << type << version << fromver << tover << from << to << trace << nonce;
     po6::net::location dest(op->instance().address, op->instance().inbound_port);
+    uint32_t tonum;
+
+    // The compact header has no room for a trace id.
+    if (trace == 0 && msg->size() <= HYPERCLIENT_COMPACT_BYTES &&
+        m_config->entity_number(to, &tonum))
+    {
+        compact(from, tonum, &msg);
+    }
 
     switch (m_busybee->send(dest, msg))
     {
@@ -1092,6 +1163,25 @@ hyperclient :: send(e::intrusive_ptr<pending> op,
     }
 }
 
+void
+hyperclient :: compact(const hyperdex::entityid& from,
+                       uint32_t tonum,
+                       std::auto_ptr<e::buffer>* msg) const
+{
+    // The daemon looks up the instance versions itself, and can only expand
+    // "to" if it is on our configuration.  Otherwise it answers with
+    // CONFIGMISMATCH, as it would for a request to an entity it lacks.
+    const uint8_t compact = static_cast<uint8_t>(hyperdex::PACKET_CLIENT_COMPACT);
+    const size_t nonce_off = HYPERCLIENT_HEADER_SIZE - sizeof(uint64_t);
+    e::slice whole = (*msg)->as_slice();
+    uint8_t type = whole.data()[BUSYBEE_HEADER_SIZE];
+    e::slice body(whole.data() + nonce_off, whole.size() - nonce_off);
+    std::auto_ptr<e::buffer> c(e::buffer::create(HYPERCLIENT_COMPACT_HEADER_SIZE + body.size()));
+    c->pack_at(BUSYBEE_HEADER_SIZE) << compact << type << m_config->version() << from << tonum;
+    c->pack_at(HYPERCLIENT_COMPACT_HEADER_SIZE).copy(body);
+    *msg = c;
+}
+
 void
 hyperclient :: killall(const po6::net::location& loc,
                        hyperclient_returncode status)
@@ -1116,6 +1206,58 @@ hyperclient :: killall(const po6::net::location& loc,
     m_busybee->drop(loc);
 }
 
+bool
+hyperclient :: backing_off(const po6::net::location& loc)
+{
+    backoff_map_t::iterator b = m_backoff.find(loc);
+
+    if (b == m_backoff.end())
+    {
+        return false;
+    }
+
+    uint64_t now = e::time();
+
+    if (now < b->second.first)
+    {
+        return true;
+    }
+
+    // The server has stayed quiet for a full backoff period after the last one
+    // ended, so the next overload starts again from the minimum.
+    if (now >= b->second.first + b->second.second)
+    {
+        m_backoff.erase(b);
+    }
+
+    return false;
+}
+
+void
+hyperclient :: overloaded(const po6::net::location& loc)
+{
+    uint64_t now = e::time();
+    uint64_t interval = HYPERCLIENT_BACKOFF_MIN;
+    backoff_map_t::iterator b = m_backoff.find(loc);
+
+    if (b != m_backoff.end())
+    {
+        // Responses to requests sent before the backoff started do not extend
+        // it further.
+        if (now < b->second.first)
+        {
+            return;
+        }
+
+        if (now < b->second.first + b->second.second)
+        {
+            interval = std::min(b->second.second * 2, HYPERCLIENT_BACKOFF_MAX);
+        }
+    }
+
+    m_backoff[loc] = std::make_pair(now + interval, interval);
+}
+
 uint16_t
 hyperclient :: validate_attribute(schema* sc,
                                   const hyperclient_attribute* attr,
@@ -1166,6 +1308,7 @@ operator << (std::ostream& lhs, hyperclient_returncode rhs)
         stringify(HYPERCLIENT_POLLFAILED);
         stringify(HYPERCLIENT_OVERFLOW);
         stringify(HYPERCLIENT_RECONFIGURE);
+        stringify(HYPERCLIENT_OVERLOADED);
         stringify(HYPERCLIENT_TIMEOUT);
         stringify(HYPERCLIENT_UNKNOWNATTR);
         stringify(HYPERCLIENT_DUPEATTR);
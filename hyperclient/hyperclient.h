@@ -125,6 +125,7 @@ enum hyperclient_returncode
     HYPERCLIENT_POLLFAILED   = 8515,
     HYPERCLIENT_OVERFLOW     = 8516,
     HYPERCLIENT_RECONFIGURE  = 8517,
+    HYPERCLIENT_OVERLOADED   = 8518,
     HYPERCLIENT_TIMEOUT      = 8519,
     HYPERCLIENT_UNKNOWNATTR  = 8520,
     HYPERCLIENT_DUPEATTR     = 8521,
@@ -686,6 +687,27 @@ hyperclient_attribute_type(struct hyperclient* client,
                            const char* space, const char* name,
                            enum hyperclient_returncode* status);
 
+/* Mark subsequent key operations as latency-sensitive (priority != 0).
+ *
+ * An overloaded server sheds ordinary operations with HYPERCLIENT_OVERLOADED
+ * before it sheds priority operations.  After a server reports that it is
+ * overloaded, ordinary operations destined for it fail immediately with
+ * HYPERCLIENT_OVERLOADED until an exponentially growing backoff period has
+ * passed.  Priority operations are always sent.
+ */
+void
+hyperclient_set_priority(struct hyperclient* client, int priority);
+
+/* Trace a random fraction (0 <= rate <= 1) of subsequent requests.
+ *
+ * A traced request carries a trace id to every server that handles it, each of
+ * which records how long each stage of handling took.  Servers keep the most
+ * recent spans in memory; "hyperdex-coordinator-control trace" retrieves them
+ * in the Chrome trace-event format.  The default rate is 0.
+ */
+void
+hyperclient_set_trace_rate(struct hyperclient* client, double rate);
+
 /* Free an array of hyperclient_attribute objects.  This typically corresponds
  * to the value returned by the get call.
  *
@@ -836,6 +858,8 @@ class hyperclient
         // Introspect things
         hyperdatatype attribute_type(const char* space, const char* name,
                                      enum hyperclient_returncode* status);
+        void set_priority(bool priority) { m_priority = priority; }
+        void set_trace_rate(double rate);
 
     private:
         class completedop;
@@ -847,6 +871,9 @@ class hyperclient
         class pending_sorted_search;
         class pending_statusonly;
         typedef std::map<int64_t, e::intrusive_ptr<pending> > incomplete_map_t;
+        // Map a server to the time its backoff ends and the length of the
+        // backoff.
+        typedef std::map<po6::net::location, std::pair<uint64_t, uint64_t> > backoff_map_t;
 
     private:
         int64_t maintain_coord_connection(hyperclient_returncode* status);
@@ -889,9 +916,14 @@ class hyperclient
                                  std::map<hyperdex::entityid, hyperdex::instance>* search_entities,
                                  uint16_t* attrno,
                                  hyperdatatype* attrtype);
+        uint64_t sample_trace();
         int64_t send(e::intrusive_ptr<pending> op,
                      std::auto_ptr<e::buffer> msg);
+        void compact(const hyperdex::entityid& from, uint32_t tonum,
+                     std::auto_ptr<e::buffer>* msg) const;
         void killall(const po6::net::location& loc, hyperclient_returncode status);
+        bool backing_off(const po6::net::location& loc);
+        void overloaded(const po6::net::location& loc);
         uint16_t validate_attribute(schema* sc, const hyperclient_attribute* attr, hyperclient_returncode* status);
 
     private:
@@ -905,6 +937,11 @@ class hyperclient
         int64_t m_client_id;
         int m_old_coord_fd;
         bool m_have_seen_config;
+        bool m_priority;
+        backoff_map_t m_backoff;
+        // Requests are traced when a random draw is at most the threshold.
+        uint64_t m_trace_threshold;
+        uint64_t m_trace_seed;
 };
 
 std::ostream&
@@ -360,6 +360,18 @@ hyperclient_attribute_type(struct hyperclient* client,
     }
 }
 
+void
+hyperclient_set_priority(struct hyperclient* client, int priority)
+{
+    client->set_priority(priority != 0);
+}
+
+void
+hyperclient_set_trace_rate(struct hyperclient* client, double rate)
+{
+    client->set_trace_rate(rate);
+}
+
 void
 hyperclient_destroy_attrs(struct hyperclient_attribute* attrs, size_t /*attrs_sz*/)
 {
@@ -94,6 +94,7 @@ hyperclient :: pending_count :: handle_response(hyperclient* cl,
         case hyperdex::NET_NOTFOUND:
         case hyperdex::NET_CMPFAIL:
         case hyperdex::NET_OVERFLOW:
+        case hyperdex::NET_OVERLOADED:
         case hyperdex::NET_READONLY:
         case hyperdex::NET_SERVERERROR:
         default:
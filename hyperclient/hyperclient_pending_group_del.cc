@@ -91,6 +91,7 @@ hyperclient :: pending_group_del :: handle_response(hyperclient* cl,
         case hyperdex::NET_BADDIMSPEC:
         case hyperdex::NET_CMPFAIL:
         case hyperdex::NET_OVERFLOW:
+        case hyperdex::NET_OVERLOADED:
         case hyperdex::NET_READONLY:
         case hyperdex::NET_SERVERERROR:
         default:
@@ -98,6 +98,10 @@ hyperclient :: pending_statusonly :: handle_response(hyperclient* cl,
         case hyperdex::NET_READONLY:
             set_status(HYPERCLIENT_READONLY);
             break;
+        case hyperdex::NET_OVERLOADED:
+            cl->overloaded(sender);
+            set_status(HYPERCLIENT_OVERLOADED);
+            break;
         case hyperdex::NET_SERVERERROR:
         default:
             cl->killall(sender, HYPERCLIENT_SERVERERROR);
@@ -20,6 +20,7 @@ public class HyperClientException extends Exception
 		errorMap.put(hyperclient_returncode.HYPERCLIENT_POLLFAILED,"Polling Failed");
 		errorMap.put(hyperclient_returncode.HYPERCLIENT_OVERFLOW,"Integer-overflow or divide-by-zero");
 		errorMap.put(hyperclient_returncode.HYPERCLIENT_RECONFIGURE,"Reconfiguration");
+		errorMap.put(hyperclient_returncode.HYPERCLIENT_OVERLOADED,"Server is overloaded");
 		errorMap.put(hyperclient_returncode.HYPERCLIENT_TIMEOUT,"Timeout");
 		errorMap.put(hyperclient_returncode.HYPERCLIENT_UNKNOWNATTR,"Unknown attribute '%s'");
 		errorMap.put(hyperclient_returncode.HYPERCLIENT_DUPEATTR,"Duplicate attribute '%s'");
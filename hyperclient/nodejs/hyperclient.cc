@@ -353,6 +353,9 @@ void raise_exception(enum hyperclient_returncode ret)
                 case HYPERCLIENT_RECONFIGURE:
                         exception("Reconfiguration");
                         break;
+                case HYPERCLIENT_OVERLOADED:
+                        exception("Server is overloaded");
+                        break;
                 case HYPERCLIENT_TIMEOUT:
                         exception("Timeout");
                         break;
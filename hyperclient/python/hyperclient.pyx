@@ -114,6 +114,7 @@ cdef extern from "../hyperclient.h":
         HYPERCLIENT_POLLFAILED   = 8515
         HYPERCLIENT_OVERFLOW     = 8516
         HYPERCLIENT_RECONFIGURE  = 8517
+        HYPERCLIENT_OVERLOADED   = 8518
         HYPERCLIENT_TIMEOUT      = 8519
         HYPERCLIENT_UNKNOWNATTR  = 8520
         HYPERCLIENT_DUPEATTR     = 8521
@@ -189,6 +190,7 @@ class HyperClientException(Exception):
                   ,HYPERCLIENT_POLLFAILED: 'Polling Failed'
                   ,HYPERCLIENT_OVERFLOW: 'Integer-overflow or divide-by-zero'
                   ,HYPERCLIENT_RECONFIGURE: 'Reconfiguration'
+                  ,HYPERCLIENT_OVERLOADED: 'Server is overloaded'
                   ,HYPERCLIENT_TIMEOUT: 'Timeout'
                   ,HYPERCLIENT_UNKNOWNATTR: 'Unknown attribute "%s"' % attr
                   ,HYPERCLIENT_DUPEATTR: 'Duplicate attribute "%s"' % attr
@@ -209,6 +211,7 @@ class HyperClientException(Exception):
                   ,HYPERCLIENT_POLLFAILED: 'HYPERCLIENT_POLLFAILED'
                   ,HYPERCLIENT_OVERFLOW: 'HYPERCLIENT_OVERFLOW'
                   ,HYPERCLIENT_RECONFIGURE: 'HYPERCLIENT_RECONFIGURE'
+                  ,HYPERCLIENT_OVERLOADED: 'HYPERCLIENT_OVERLOADED'
                   ,HYPERCLIENT_TIMEOUT: 'HYPERCLIENT_TIMEOUT'
                   ,HYPERCLIENT_UNKNOWNATTR: 'HYPERCLIENT_UNKNOWNATTR'
                   ,HYPERCLIENT_DUPEATTR: 'HYPERCLIENT_DUPEATTR'
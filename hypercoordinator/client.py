@@ -68,7 +68,7 @@ class Client(object):
         s.connect((self._host, self._port))
         s.sendall(json.dumps({msg: args}) + '\n')
         data = ''
-        while '\n' not in data:
+        while not data.endswith('\n'):
             d = s.recv(4096)
             if len(d) == 0:
                 raise ProtocolError('server closed connection unexpectedly after sending {0}'.format(data))
@@ -166,7 +166,50 @@ def go_live(args):
 def backup_state(args):
     return send_msg(args.host, args.port, 'backup-state')
 
+
+def backup(args):
+    return send_msg(args.host, args.port, 'backup')
+
+
+def restore(args):
+    return send_msg(args.host, args.port, 'restore', args.backup_id)
+
     
+def query(host, port, msg, fmt, args=''):
+    c = Client(host, port)
+    try:
+        rv = c._send_msg(msg, args)
+    except ProtocolError as e:
+        sys.stderr.write('protocol error: ' + str(e) + '\n')
+        return 1
+    except RuntimeError as e:
+        sys.stderr.write('error: ' + str(e) + '\n')
+        return 1
+    except socket.error as e:
+        sys.stderr.write('could not reach the daemon: ' + str(e) + '\n')
+        return 1
+    sys.stdout.write(fmt(rv))
+    return 0
+
+
+def pretty_json(rv):
+    return json.dumps(rv, indent=4, sort_keys=True) + '\n'
+
+
+def metrics(args):
+    if args.text:
+        return query(args.host, args.port, 'metrics', lambda rv: rv, 'text')
+    return query(args.host, args.port, 'metrics', pretty_json, 'json')
+
+
+def trace(args):
+    return query(args.host, args.port, 'trace', lambda rv: json.dumps(rv) + '\n')
+
+
+def profile(args):
+    return query(args.host, args.port, 'profile', pretty_json)
+
+
 def validate_space(args):
     data = sys.stdin.read()
     try:
@@ -212,6 +255,18 @@ def main(args, name='hyperdex-control'):
     parser_go_live.set_defaults(func=go_live)
     parser_go_live = subparsers.add_parser('backup-state', help='backup-state help')
     parser_go_live.set_defaults(func=backup_state)
+    parser_backup = subparsers.add_parser('backup', help='back up every region without stopping writes')
+    parser_backup.set_defaults(func=backup)
+    parser_restore = subparsers.add_parser('restore', help='load every region from a backup into empty, newly created spaces with the layout they had when it was taken; do not write to them until the restore completes')
+    parser_restore.add_argument('backup_id', metavar='BACKUPID', help='the id printed by backup')
+    parser_restore.set_defaults(func=restore)
+    parser_metrics = subparsers.add_parser('metrics', help='query the metrics of the daemon at --host/--port (its HYPERDEX_METRICS_PORT)')
+    parser_metrics.add_argument('--text', action='store_true', help='one figure per line instead of JSON')
+    parser_metrics.set_defaults(func=metrics)
+    parser_trace = subparsers.add_parser('trace', help='dump the spans of traced requests recorded by the daemon at --host/--port (its HYPERDEX_METRICS_PORT) for chrome://tracing')
+    parser_trace.set_defaults(func=trace)
+    parser_profile = subparsers.add_parser('profile', help='show lock contention and the hottest keys at the daemon at --host/--port (its HYPERDEX_METRICS_PORT)')
+    parser_profile.set_defaults(func=profile)
     args = parser.parse_args(args)
     return args.func(args)
 
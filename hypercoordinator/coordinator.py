@@ -49,15 +49,49 @@ import hdjson
 
 PIPE_BUF = getattr(select, 'PIPE_BUF', 512)
 RESTRICTED_SPACES = set([0, 2**32 - 1, 2**32 - 2, 2**32 - 3, 2**32 - 4])
+# A failed transfer is retried (and resumed by the hosts) this many times
+# before the region is left short a replica.
+MAX_TRANSFER_ATTEMPTS = 16
+# The rebalancer moves a region off the busiest host when that host serves
+# this much more than the average, and at least REBALANCE_MIN_OPS ops/s.
+REBALANCE_THRESHOLD = 0.25
+REBALANCE_MIN_OPS = 100
+# Sibling regions that were split at runtime are merged again once they
+# serve less than this many ops/s between them.  A region is split at most
+# REBALANCE_MAX_DEPTH times.
+REBALANCE_MERGE_OPS = 10
+REBALANCE_MAX_DEPTH = 8
+# A host that holds an earlier configuration is sent only the lines that
+# changed, unless that is at least this fraction of the new configuration.
+# Deltas are composed from the changes of the last DELTA_HISTORY
+# configurations.
+DELTA_MAX_FRACTION = 0.5
+DELTA_CACHE_SIZE = 64
+DELTA_HISTORY = 64
+# A backup or restore is abandoned once this long passes without a region
+# reporting, so that one region its hosts keep failing cannot block splits
+# and merges for good.
+ARCHIVE_STALL_TIMEOUT = datetime.timedelta(minutes=10)
 
 # Format strings for configuration lines
-SPACE_LINE = 'space {name} {id} {dims}\n'
-SUBSPACE_LINE = 'subspace {space} {subspace} {hashes}\n'
-REGION_LINE = 'region {space} {subspace} {prefix} {mask} {hosts}\n'
-TRANSFER_LINE = 'transfer {xferid} {space} {subspace} {prefix} {mask} {instid}\n'
+VERSION_LINE = 'version {num}'
+SPACE_LINE = 'space {name} {id} {dims}'
+SUBSPACE_LINE = 'subspace {space} {subspace} {hashes}'
+REGION_LINE = 'region {space} {subspace} {prefix} {mask} {hosts}'
+TRANSFER_LINE = 'transfer {xferid} {space} {subspace} {prefix} {mask} {instid}'
 HOST_LINE = 'host {id} {ip} {inport} {inver} {outport} {outver}'
-QUIESCE_LINE = 'quiesce {state_id}\n'
-SHUTDOWN_LINE = 'shutdown\n'
+QUIESCE_LINE = 'quiesce {state_id}'
+SHUTDOWN_LINE = 'shutdown'
+BACKUP_LINE = 'backup {backup_id}'
+RESTORE_LINE = 'restore {backup_id}'
+# Lines are keyed by a tuple whose first element is one of these, and appear
+# in the text in this order so that each follows the lines it refers to.
+LINE_ORDER = ['host', 'version', 'space', 'subspace', 'region', 'transfer',
+              'quiesce', 'shutdown', 'backup', 'restore']
+
+
+def line_order(key):
+    return (LINE_ORDER.index(key[0]), key)
 
 
 def normalize_address(addr):
@@ -102,9 +136,53 @@ class Coordinator(object):
         self._spaces_by_id = {}
         self._rand = random.Random()
         self._config_counter = 0
-        self._config_data = ''
+        # The lines of the current configuration by key, with the hosts each
+        # region's lines name and how many lines name each host.  None of
+        # this is saved; a restarted coordinator regenerates every line.
+        self._config_lines = {}
+        self._region_hosts = {}
+        self._host_refs = {}
+        # What changed since the last configuration: spaces and regions map
+        # to the object whose lines to regenerate, and regions that are gone
+        # map to None.  publish() regenerates only these.
+        self._dirty_spaces = {}
+        self._dirty_regions = {}
+        self._dirty_hosts = set()
+        # config num -> [(key, old line, new line)] for the last DELTA_HISTORY
+        # configurations
+        self._steps = {}
         self._xfer_counter = 0
         self._xfers_by_id = {}
+        self._xfer_attempts = {}
+        self._xfer_progress = {}
+        # (instid, spaceid, subspaceid, regionid) -> (ops/s, bytes/s), as
+        # last reported by the hosts.  Not saved across restarts.
+        self._region_load = {}
+        # (spaceid, subspaceid, prefix, mask) -> 'split' or 'merge' for each
+        # region that a reshape created, so that it can be undone if a host
+        # cannot fill the region from the ones it replaced.  Not saved across
+        # restarts.
+        self._reshaped = {}
+        # The backup and restore in progress.  Regions are keyed by (spaceid,
+        # subspaceid, prefix, mask), and map to what their tail reported for a
+        # backup, or to {instid: objects} for a restore.  Not saved across
+        # restarts.  Each remembers when a region last reported.
+        self._backup_id = ''
+        self._backup_regions = {}
+        self._backup_progress = None
+        self._restore_id = ''
+        self._restore_regions = {}
+        self._restore_progress = None
+        # (old config num, new config num) -> the delta between them, where an
+        # old num of None means the whole configuration
+        self._deltas = {}
+        # Changes only mark the configuration stale.  The server publishes
+        # once per pass of its event loop, so a burst of changes costs one
+        # configuration, and hosts that fall behind skip straight to it.
+        self._config_stale = False
+        self._cached_service_level = None
+        # Instances reported failed whose regions have not been repaired
+        self._unrepaired_instances = set()
         self._quiesce_state_id = ''
         self._quiesce_config_num = -1
         self._quiesced_instances = set()
@@ -116,6 +194,8 @@ class Coordinator(object):
             self._quiesce_config_num = -1
             self._quiesced_instances = set()
             self._state = Coordinator.S_STARTUP
+            for spaceid, space in self._spaces_by_id.iteritems():
+                self._touch_space(spaceid, space)
         else:
             # fresh start
             self._state = Coordinator.S_NORMAL
@@ -134,10 +214,11 @@ class Coordinator(object):
         inst = hdtypes.Instance(addr, inport, inver, outport, outver, pid, token)
         # do not send config before go-live
         if self._state != Coordinator.S_STARTUP:
-            inst.add_config(self._config_counter, self._config_data)
+            inst.add_config(self._config_counter)
         # have we seen this instance before? 
         instid = self._instances_by_token.get(token, 0)
         if instid != 0:
+            self._dirty_hosts.add(instid)
             # host restat or reconnect - replace old instance with the new one
             # XXX should we do something different on reconnect only?
             # XXX preserve last_acked and last_rejected?
@@ -145,6 +226,8 @@ class Coordinator(object):
             del self._instances_by_bindings[oldinst.bindings()]
             self._instances_by_bindings[inst.bindings()] = instid
             self._instances_by_id[instid] = inst
+            if oldinst.pid != pid and self._state == Coordinator.S_NORMAL:
+                self._restarted_instance(instid)
         else:
             # new instance
             instid = self._instance_counter
@@ -154,6 +237,27 @@ class Coordinator(object):
             self._instances_by_token[token] = instid
         return inst.bindings()
 
+    def _restarted_instance(self, instid):
+        # A host that restarted without quiescing reopened its disks as of
+        # their last manifests, and may have lost writes since.  Each of its
+        # replicas becomes a transfer to it, which compares summaries and
+        # sends only what differs.  A sole replica stays as it is.
+        self._failed_instances.discard(instid)
+        self._unrepaired_instances.discard(instid)
+        for si, space in self._spaces_by_id.iteritems():
+            for ssi, subspace in enumerate(space.subspaces):
+                for ri, region in enumerate(subspace.regions):
+                    if instid not in region.replicas or region.current_f < 1:
+                        continue
+                    xferid = self._compute_transfer_id(si, ssi, ri)
+                    if xferid is None:
+                        continue
+                    region.remove_instances(set([instid]))
+                    region.transfer_initiate(xferid, instid)
+                    self._touch_region(si, ssi, region)
+        logging.info('Instance {0} restarted; catching it up by transfers.'.format(instid))
+        self._regenerate()
+
     def keepalive_instance(self, bindings):
         pass
 
@@ -177,6 +281,7 @@ class Coordinator(object):
         self._spaces_by_id[spaceid] = space
         self._spaces_by_name[space.name] = spaceid
         self._initial_layout(space)
+        self._touch_space(spaceid, space)
         self._regenerate()
 
     def del_space(self, space):
@@ -187,18 +292,22 @@ class Coordinator(object):
         if space not in self._spaces_by_name:
             raise Coordinator.UnknownSpace()
         spacenum = self._spaces_by_name[space]
+        oldspace = self._spaces_by_id[spacenum]
         del self._spaces_by_name[space]
         del self._spaces_by_id[spacenum]
+        self._touch_space(spacenum, oldspace)
         self._regenerate()
         
     def lst_spaces(self):
         return self._spaces_by_name.keys()
         
     def get_space(self, space):
+        return self._spaces_by_id[self.get_space_id(space)]
+
+    def get_space_id(self, space):
         if space not in self._spaces_by_name:
             raise Coordinator.UnknownSpace()
-        spacenum = self._spaces_by_name[space]
-        return self._spaces_by_id[spacenum]
+        return self._spaces_by_name[space]
 
     def quiesce(self):
         if self._state != Coordinator.S_NORMAL:
@@ -209,6 +318,7 @@ class Coordinator(object):
         self._state = Coordinator.S_QUIESCE
         logging.info('Cluster is quiescing under state id {0}.'.format(self._quiesce_state_id))
         self._regenerate()
+        self.publish()
         # remember current config num, so we can check if hosts ACKd quiesce
         self._quiesce_config_num = self._config_counter
         return self._quiesce_state_id
@@ -229,6 +339,7 @@ class Coordinator(object):
         self._state = Coordinator.S_SHUTDOWN
         logging.info('Requesting all nodes to shut down.')
         self._regenerate()
+        self.publish()
         # not waiting for ack, return state
         return self._dump_state()
 
@@ -236,9 +347,10 @@ class Coordinator(object):
         return len(self._instances_by_token) - len(self._failed_instances)
 
     def is_stable(self):
+        if self._config_stale:
+            return False
         for inst in self._instances_by_id.values():
-            num, data = inst.next_config()
-            if num is not None:
+            if inst.next_config() is not None:
                 return False
         return True
 
@@ -251,9 +363,16 @@ class Coordinator(object):
         s['space_counter'] = self._space_counter
         s['spaces'] = self._spaces_by_id
         s['config_counter'] = self._config_counter
-        s['config_data'] = self._config_data
+        s['config_data'] = self._config_text(self._config_counter)
         s['xfer_counter'] = self._xfer_counter
         s['xfers'] = self._xfers_by_id
+        s['xfer_progress'] = self._xfer_progress
+        s['host_load'] = self._host_load()[0]
+        s['backup_id'] = self._backup_id
+        s['backup_pending'] = self._backup_pending()
+        s['backup_regions'] = [list(k) + [v] for k, v in sorted(self._backup_regions.items())]
+        s['restore_id'] = self._restore_id
+        s['restore_pending'] = self._restore_pending()
         s['state'] = self._state
         s['quiesce_state_id'] = self._quiesce_state_id
         s['quiesced_instances'] = list(self._quiesced_instances)
@@ -276,6 +395,120 @@ class Coordinator(object):
     def backup_state(self):
         return self._dump_state()
 
+    def backup(self):
+        # Ask the tail of every region to archive it from a rolling snapshot.
+        # Writes continue throughout.  A new backup abandons an unfinished one.
+        if self._state != Coordinator.S_NORMAL:
+            raise Coordinator.InvalidState()
+        self._backup_id = binascii.hexlify(os.urandom(16))
+        self._backup_regions = dict([(k, None) for k in self._region_keys()])
+        self._backup_progress = datetime.datetime.now()
+        logging.info('Backing up {0} regions under backup id {1}.'
+                     .format(len(self._backup_regions), self._backup_id))
+        self._regenerate()
+        return self._backup_id
+
+    def restore(self, backup_id):
+        # Ask every replica to load its regions from the archives of an
+        # earlier backup.  Each host needs a copy of the backup directory, and
+        # the spaces must have the layout they had when it was taken.  Every
+        # region must be empty, as in a space that was just created, and stay
+        # free of writes until the restore completes.  A host that finds data
+        # in a region refuses to load it, and the restore is abandoned.
+        if self._state != Coordinator.S_NORMAL:
+            raise Coordinator.InvalidState()
+        if not backup_id or not backup_id.isalnum():
+            raise ValueError('invalid backup id')
+        self._restore_id = backup_id
+        self._restore_regions = dict([(k, {}) for k in self._region_keys()])
+        self._restore_progress = datetime.datetime.now()
+        logging.info('Restoring {0} regions from backup id {1}.'
+                     .format(len(self._restore_regions), self._restore_id))
+        self._regenerate()
+
+    def backup_done(self, bindings, backup_id, spaceid, subspaceid, prefix, mask, objects, watermark):
+        key = (spaceid, subspaceid, prefix, mask)
+        if backup_id != self._backup_id or key not in self._backup_regions:
+            return
+        if bindings not in self._instances_by_bindings:
+            return
+        if self._backup_regions[key] is not None:
+            return
+        self._backup_regions[key] = {'host': self._instances_by_bindings[bindings],
+                                     'objects': objects, 'watermark': watermark}
+        self._backup_progress = datetime.datetime.now()
+        if self._backup_pending() == 0:
+            logging.info('Backup {0} is complete.'.format(self._backup_id))
+            self._regenerate()
+
+    def restore_done(self, bindings, backup_id, spaceid, subspaceid, prefix, mask, objects):
+        key = (spaceid, subspaceid, prefix, mask)
+        if backup_id != self._restore_id or key not in self._restore_regions:
+            return
+        if bindings not in self._instances_by_bindings:
+            return
+        self._restore_regions[key][self._instances_by_bindings[bindings]] = objects
+        self._restore_progress = datetime.datetime.now()
+        if self._restore_pending() == 0:
+            logging.info('Restore from backup {0} is complete.'.format(self._restore_id))
+            self._regenerate()
+
+    def restore_fail(self, bindings, backup_id, spaceid, subspaceid, prefix, mask):
+        key = (spaceid, subspaceid, prefix, mask)
+        if backup_id != self._restore_id or key not in self._restore_regions:
+            return
+        if bindings not in self._instances_by_bindings:
+            return
+        logging.error('Abandoning restore from backup {0} because instance {1} holds data in '
+                      'region {2}/{3} with prefix {4} and mask {5}; restore only into empty spaces.'
+                      .format(self._restore_id, self._instances_by_bindings[bindings],
+                              spaceid, subspaceid, prefix, hex(mask).rstrip('L')))
+        self._restore_id = ''
+        self._restore_regions = {}
+        self._regenerate()
+
+    def expire_archives(self, now):
+        # Hosts retry regions that fail, and a new tail picks up a region
+        # whose tail changed, but a region can still fail for good.
+        expired = False
+        if self._backup_id and now - self._backup_progress >= ARCHIVE_STALL_TIMEOUT and \
+           self._backup_pending():
+            logging.warning('Abandoning backup {0} with {1} regions still pending.'
+                            .format(self._backup_id, self._backup_pending()))
+            self._backup_id = ''
+            self._backup_regions = {}
+            expired = True
+        if self._restore_id and now - self._restore_progress >= ARCHIVE_STALL_TIMEOUT and \
+           self._restore_pending():
+            logging.warning('Abandoning restore from backup {0} with {1} regions still pending.'
+                            .format(self._restore_id, self._restore_pending()))
+            self._restore_id = ''
+            self._restore_regions = {}
+            expired = True
+        if expired:
+            self._regenerate()
+
+    def _region_keys(self):
+        keys = {}
+        for spaceid, space in self._spaces_by_id.iteritems():
+            for subspaceid, subspace in enumerate(space.subspaces):
+                for region in subspace.regions:
+                    keys[(spaceid, subspaceid, region.prefix, region.mask)] = region
+        return keys
+
+    def _backup_pending(self):
+        return len([v for v in self._backup_regions.itervalues() if v is None])
+
+    def _restore_pending(self):
+        # A region is restored once every replica it has now has loaded it.
+        keys = self._region_keys()
+        pending = 0
+        for key, done in self._restore_regions.iteritems():
+            region = keys.get(key)
+            if region is not None and not set(region.replicas) <= set(done):
+                pending += 1
+        return pending
+
     def _compute_transfer_id(self, spaceid, subspaceid, regionid):
         xferid = None
         for i in xrange(1 << 16):
@@ -290,22 +523,79 @@ class Coordinator(object):
         return xferid
 
     def fail_host(self, ip, port):
+        # Every host that notices a failure reports it, so most reports are
+        # for instances already known to have failed.  The regions are
+        # repaired in one pass when the configuration is next published.
         badinstids = set()
         for instid, inst in self._instances_by_id.iteritems():
             if inst.addr == ip and \
                     (inst.inport == port or inst.outport == port):
                 badinstids.add(instid)
+        badinstids -= self._failed_instances
+        if not badinstids:
+            return
         self._failed_instances |= badinstids
+        self._unrepaired_instances |= badinstids
+        self._regenerate()
+
+    def _repair_regions(self):
+        badinstids = self._unrepaired_instances
+        self._unrepaired_instances = set()
+        counts = self._replica_counts()
         for si, space in self._spaces_by_id.iteritems():
             for ssi, subspace in enumerate(space.subspaces):
                 for ri, region in enumerate(subspace.regions):
+                    if not badinstids.intersection(region.replicas + region.transfers):
+                        continue
                     region.remove_instances(badinstids)
                     for i in range(region.desired_f - region.current_f):
                         xferid = self._compute_transfer_id(si, ssi, ri)
-                        newrepl = self._select_replica(region.replicas + region.transfers)
+                        newrepl = self._select_replica(region.replicas + region.transfers, counts)
                         if xferid is not None and newrepl is not None:
                             region.transfer_initiate(xferid, newrepl)
-        self._regenerate()
+                            counts[newrepl] += 1
+                    self._touch_region(si, ssi, region)
+
+    def config_delta(self, oldnum, num):
+        # Compose the changes of each configuration after oldnum.  Hosts
+        # apply the delta to the configuration they last parsed, so only line
+        # membership matters, not order.  Hosts without a configuration, or
+        # too far behind, get the whole of it.
+        if (oldnum, num) in self._deltas:
+            return self._deltas[(oldnum, num)]
+        net = {}
+        for v in xrange(num, oldnum if oldnum is not None else num, -1):
+            if v not in self._steps:
+                net = None
+                break
+            for key, old, new in self._steps[v]:
+                net[key] = (old, net.get(key, (None, new))[1])
+        delta = None
+        if oldnum is not None and net is not None:
+            removed = ['-' + old for old, new in net.itervalues() if old is not None and old != new]
+            added = ['+' + new for old, new in net.itervalues() if new is not None and old != new]
+            if len(removed) + len(added) < len(self._config_lines) * DELTA_MAX_FRACTION:
+                delta = '\n'.join(['delta {0}'.format(oldnum)] + removed + added)
+        if delta is None:
+            delta = self._config_text(num)
+        if len(self._deltas) >= DELTA_CACHE_SIZE:
+            self._deltas.clear()
+        self._deltas[(oldnum, num)] = delta
+        return delta
+
+    def _config_text(self, num):
+        # Hosts are only ever sent the configuration current when they
+        # registered or a later one, so the changes since num are at hand.
+        lines = self._config_lines
+        if num != self._config_counter:
+            lines = dict(lines)
+            for v in xrange(self._config_counter, num, -1):
+                for key, old, new in reversed(self._steps[v]):
+                    if old is None:
+                        del lines[key]
+                    else:
+                        lines[key] = old
+        return '\n'.join([lines[k] for k in sorted(lines, key=line_order)])
 
     def ack_config(self, bindings, num):
         instid = self._instances_by_bindings[bindings]
@@ -318,20 +608,17 @@ class Coordinator(object):
         inst.reject_config(num)
 
     def fetch_configs(self, instances):
-        configs = {}
         hosts = {}
         for inst in instances:
             if inst is None:
-                configs[self._config_counter] = self._config_data
                 hosts[None] = self._config_counter
             elif inst in self._instances_by_bindings:
                 instid = self._instances_by_bindings[inst]
                 realinst = self._instances_by_id[instid]
-                num, data = realinst.next_config()
+                num = realinst.next_config()
                 if num is not None:
-                    configs[num] = data
                     hosts[inst] = num
-        return configs, hosts
+        return hosts
 
     def transfer_fail(self, xferid):
         if xferid not in self._xfers_by_id:
@@ -339,8 +626,25 @@ class Coordinator(object):
         spaceid, subspaceid, regionid = self._xfers_by_id[xferid]
         if spaceid not in self._spaces_by_id:
             return
-        self._spaces_by_id[spaceid].subspaces[subspaceid].regions[regionid].transfer_fail(xferid)
+        region = self._spaces_by_id[spaceid].subspaces[subspaceid].regions[regionid]
         del self._xfers_by_id[xferid]
+        attempts = self._xfer_attempts.pop(xferid, 0) + 1
+        # Retry under a new id, so that hosts can tell the attempts apart.  The
+        # hosts carry their checkpoints over from the old id to the new one.
+        newxferid = None
+        if attempts < MAX_TRANSFER_ATTEMPTS:
+            newxferid = self._compute_transfer_id(spaceid, subspaceid, regionid)
+        progress = self._xfer_progress.pop(xferid, None)
+        if newxferid is not None and region.transfer_retry(xferid, newxferid):
+            self._xfer_attempts[newxferid] = attempts
+            if progress is not None:
+                self._xfer_progress[newxferid] = progress
+            logging.info("retrying transfer {0} as {1} (attempt {2})".format(xferid, newxferid, attempts + 1))
+        else:
+            if newxferid is not None:
+                del self._xfers_by_id[newxferid]
+            region.transfer_fail(xferid)
+        self._touch_region(spaceid, subspaceid, region)
         self._regenerate()
 
     def transfer_golive(self, xferid):
@@ -351,6 +655,7 @@ class Coordinator(object):
             return
         region = self._spaces_by_id[spaceid].subspaces[subspaceid].regions[regionid]
         if region.transfer_golive(xferid):
+            self._touch_region(spaceid, subspaceid, region)
             self._regenerate()
 
     def transfer_complete(self, xferid):
@@ -359,10 +664,249 @@ class Coordinator(object):
         spaceid, subspaceid, regionid = self._xfers_by_id[xferid]
         if spaceid not in self._spaces_by_id:
             return
-        self._spaces_by_id[spaceid].subspaces[subspaceid].regions[regionid].transfer_complete(xferid)
+        region = self._spaces_by_id[spaceid].subspaces[subspaceid].regions[regionid]
+        region.transfer_complete(xferid)
+        self._touch_region(spaceid, subspaceid, region)
         del self._xfers_by_id[xferid]
+        self._xfer_attempts.pop(xferid, None)
+        self._xfer_progress.pop(xferid, None)
+        self._regenerate()
+
+    def transfer_progress(self, xferid, objects, bytes):
+        # Reported by the sender as the receiver acknowledges objects.  Purely
+        # informational, so it never triggers a new configuration.
+        if xferid not in self._xfers_by_id:
+            return
+        self._xfer_progress[xferid] = {'objects': objects, 'bytes': bytes,
+                                       'updated': datetime.datetime.now().isoformat()}
+
+    def migrate_region(self, spaceid, subspaceid, regionid, src, dst):
+        # Copy the region to dst with a normal transfer, then drop src from
+        # the chain once the transfer completes.
+        if self._state != Coordinator.S_NORMAL:
+            raise Coordinator.InvalidState()
+        region = self._lookup_region(spaceid, subspaceid, regionid)
+        if region is None:
+            raise ValueError('no such region')
+        if dst not in self._instances_by_id or dst in self._failed_instances:
+            raise ValueError('destination is not a live instance')
+        xferid = self._compute_transfer_id(spaceid, subspaceid, regionid)
+        if xferid is None:
+            raise ValueError('out of transfer ids')
+        try:
+            region.migrate(xferid, src, dst)
+        except ValueError:
+            del self._xfers_by_id[xferid]
+            raise
+        # Assume the load follows the region until dst reports otherwise.
+        load = self._region_load.pop((src, spaceid, subspaceid, regionid), None)
+        if load is not None:
+            self._region_load[(dst, spaceid, subspaceid, regionid)] = load
+        logging.info("moving region {0}/{1}/{2} from {3} to {4} (transfer {5})"
+                     .format(spaceid, subspaceid, regionid, src, dst, xferid))
+        self._touch_region(spaceid, subspaceid, region)
+        self._regenerate()
+        return xferid
+
+    def region_load(self, bindings, spaceid, subspaceid, prefix, mask, ops, bytes, millis):
+        if bindings not in self._instances_by_bindings or spaceid not in self._spaces_by_id:
+            return
+        instid = self._instances_by_bindings[bindings]
+        space = self._spaces_by_id[spaceid]
+        if subspaceid >= len(space.subspaces):
+            return
+        for regionid, region in enumerate(space.subspaces[subspaceid].regions):
+            if region.prefix == prefix and region.mask == mask:
+                seconds = max(millis, 1) / 1000.
+                self._region_load[(instid, spaceid, subspaceid, regionid)] = \
+                        (ops / seconds, bytes / seconds)
+                return
+
+    def rebalance(self):
+        # Move one region from the busiest host to the idlest.  Only one move
+        # is in flight at a time, and nothing moves while transfers are
+        # repairing the cluster.
+        if self._state != Coordinator.S_NORMAL or self._xfers_by_id:
+            return None
+        hosts, regions = self._host_load()
+        if len(hosts) < 2:
+            return None
+        hot = max(hosts, key=hosts.get)
+        cold = min(hosts, key=hosts.get)
+        mean = sum(hosts.values()) / len(hosts)
+        if hosts[hot] < REBALANCE_MIN_OPS or \
+           hosts[hot] <= mean * (1 + REBALANCE_THRESHOLD):
+            self._merge_cold_regions()
+            return None
+        # Any region lighter than the gap leaves both hosts below the old
+        # maximum; the heaviest such region closes the gap fastest.
+        gap = hosts[hot] - hosts[cold]
+        for ops, (spaceid, subspaceid, regionid) in sorted(regions[hot], reverse=True):
+            if ops <= 0 or ops >= gap:
+                continue
+            region = self._lookup_region(spaceid, subspaceid, regionid)
+            if cold in region.replicas or cold in region.transfers:
+                continue
+            return self.migrate_region(spaceid, subspaceid, regionid, hot, cold)
+        # The busiest region is too hot to move without overshooting, so
+        # split it; a later step can move one of the halves.
+        ops, (spaceid, subspaceid, regionid) = max(regions[hot])
+        region = self._lookup_region(spaceid, subspaceid, regionid)
+        if ops >= gap and region.prefix < 64 and region.depth < REBALANCE_MAX_DEPTH:
+            self.split_region(spaceid, subspaceid, regionid)
+        return None
+
+    def split_region(self, spaceid, subspaceid, regionid, undo=False):
+        subspace = self._reshapeable_subspace(spaceid, subspaceid)
+        if regionid >= len(subspace.regions):
+            raise ValueError('no such region')
+        region = subspace.regions[regionid]
+        lower, upper = subspace.split_region(regionid)
+        self._touch_region(spaceid, subspaceid, region, removed=True)
+        self._touch_region(spaceid, subspaceid, lower)
+        self._touch_region(spaceid, subspaceid, upper)
+        if not undo:
+            for child in (lower, upper):
+                self._reshaped[(spaceid, subspaceid, child.prefix, child.mask)] = 'split'
+        # Region ids are indices, so everything above the split shifts up.
+        # Guess that the load divides evenly until the hosts report.
+        load = {}
+        for (instid, si, ssi, ri), (ops, bytes) in self._region_load.iteritems():
+            if (si, ssi) != (spaceid, subspaceid) or ri < regionid:
+                load[(instid, si, ssi, ri)] = (ops, bytes)
+            elif ri == regionid:
+                load[(instid, si, ssi, ri)] = (ops / 2, bytes / 2)
+                load[(instid, si, ssi, ri + 1)] = (ops / 2, bytes / 2)
+            else:
+                load[(instid, si, ssi, ri + 1)] = (ops, bytes)
+        self._region_load = load
+        logging.info("split region {0}/{1}/{2} into prefix {3} regions {4} and {5}"
+                     .format(spaceid, subspaceid, regionid, lower.prefix,
+                             hex(lower.mask).rstrip('L'), hex(upper.mask).rstrip('L')))
         self._regenerate()
 
+    def merge_regions(self, spaceid, subspaceid, regionid, undo=False):
+        subspace = self._reshapeable_subspace(spaceid, subspaceid)
+        children = subspace.regions[regionid:regionid + 2]
+        parent = subspace.merge_regions(regionid)
+        for child in children:
+            self._touch_region(spaceid, subspaceid, child, removed=True)
+        self._touch_region(spaceid, subspaceid, parent)
+        if not undo:
+            self._reshaped[(spaceid, subspaceid, parent.prefix, parent.mask)] = 'merge'
+        load = {}
+        for (instid, si, ssi, ri), (ops, bytes) in self._region_load.iteritems():
+            if (si, ssi) != (spaceid, subspaceid) or ri < regionid:
+                key = (instid, si, ssi, ri)
+            elif ri <= regionid + 1:
+                key = (instid, si, ssi, regionid)
+            else:
+                key = (instid, si, ssi, ri - 1)
+            o, b = load.get(key, (0., 0.))
+            load[key] = (o + ops, b + bytes)
+        self._region_load = load
+        logging.info("merged regions {0}/{1}/{2} and {0}/{1}/{3} into prefix {4} region {5}"
+                     .format(spaceid, subspaceid, regionid, regionid + 1,
+                             parent.prefix, hex(parent.mask).rstrip('L')))
+        self._regenerate()
+
+    def inherit_fail(self, bindings, spaceid, subspaceid, prefix, mask):
+        # A host could not fill its replica of a region that a split or merge
+        # created from the data it held for the regions that were replaced.
+        # It kept that data and serves nothing for the new region.  Undo the
+        # split or merge if possible; every host can rebuild the old regions
+        # from what it holds.  Otherwise copy the region to the host afresh.
+        # Hosts repeat the report until one of these happens.
+        if bindings not in self._instances_by_bindings or spaceid not in self._spaces_by_id:
+            return
+        instid = self._instances_by_bindings[bindings]
+        space = self._spaces_by_id[spaceid]
+        if subspaceid >= len(space.subspaces):
+            return
+        regions = space.subspaces[subspaceid].regions
+        for regionid, region in enumerate(regions):
+            if region.prefix == prefix and region.mask == mask:
+                break
+        else:
+            return
+        if instid not in region.replicas:
+            return
+        how = self._reshaped.pop((spaceid, subspaceid, prefix, mask), None)
+        try:
+            if how == 'split':
+                lower = regionid - 1 if mask & (1 << (64 - prefix)) else regionid
+                self.merge_regions(spaceid, subspaceid, lower, undo=True)
+            elif how == 'merge':
+                self.split_region(spaceid, subspaceid, regionid, undo=True)
+            if how is not None:
+                logging.warning("undid the {0} that created region {1}/{2}/{3} because "
+                                "instance {4} could not fill it".format(how, spaceid, subspaceid,
+                                                                        regionid, instid))
+                return
+        except ValueError as e:
+            logging.warning("could not undo the {0} that created region {1}/{2}/{3}: {4}"
+                            .format(how, spaceid, subspaceid, regionid, e))
+        if len(region.replicas) < 2:
+            logging.error("instance {0} could not fill region {1}/{2}/{3}, and no other "
+                          "replica holds it; its data stays with the regions {0} replaced"
+                          .format(instid, spaceid, subspaceid, regionid))
+            return
+        region.remove_instances(set([instid]))
+        counts = self._replica_counts()
+        for i in range(region.desired_f - region.current_f):
+            xferid = self._compute_transfer_id(spaceid, subspaceid, regionid)
+            newrepl = self._select_replica(region.replicas + region.transfers, counts)
+            if xferid is not None and newrepl is not None:
+                region.transfer_initiate(xferid, newrepl)
+                counts[newrepl] += 1
+        logging.warning("instance {0} could not fill region {1}/{2}/{3}; copying it "
+                        "from the other replicas".format(instid, spaceid, subspaceid, regionid))
+        self._touch_region(spaceid, subspaceid, region)
+        self._regenerate()
+
+    def _reshapeable_subspace(self, spaceid, subspaceid):
+        # Transfers name their region by index, so a subspace cannot change
+        # shape while any of its regions is transferring.
+        if self._state != Coordinator.S_NORMAL:
+            raise Coordinator.InvalidState()
+        space = self._spaces_by_id.get(spaceid)
+        if space is None or subspaceid >= len(space.subspaces):
+            raise ValueError('no such subspace')
+        for si, ssi, ri in self._xfers_by_id.itervalues():
+            if (si, ssi) == (spaceid, subspaceid):
+                raise ValueError('cannot reshape a subspace with transfers in progress')
+        # Backups and restores name their regions by prefix and mask.
+        if self._backup_pending() or self._restore_pending():
+            raise ValueError('cannot reshape a subspace during a backup or restore')
+        return space.subspaces[subspaceid]
+
+    def _merge_cold_regions(self):
+        load = collections.defaultdict(float)
+        reported = collections.defaultdict(set)
+        for (instid, si, ssi, ri), (ops, bytes) in self._region_load.iteritems():
+            load[(si, ssi, ri)] += ops
+            reported[(si, ssi, ri)].add(instid)
+        for spaceid, space in self._spaces_by_id.iteritems():
+            for subspaceid, subspace in enumerate(space.subspaces):
+                regions = subspace.regions
+                for ri in range(len(regions) - 1):
+                    lower, upper = regions[ri], regions[ri + 1]
+                    if lower.depth == 0 or upper.depth == 0:
+                        continue
+                    # Only merge regions every replica has vouched for.
+                    if not set(lower.replicas) <= reported[(spaceid, subspaceid, ri)] or \
+                       not set(upper.replicas) <= reported[(spaceid, subspaceid, ri + 1)]:
+                        continue
+                    if load[(spaceid, subspaceid, ri)] + \
+                       load[(spaceid, subspaceid, ri + 1)] >= REBALANCE_MERGE_OPS:
+                        continue
+                    try:
+                        self.merge_regions(spaceid, subspaceid, ri)
+                        return True
+                    except ValueError:
+                        continue
+        return False
+
     def quiesced(self, bindings, quiesce_state_id):
         # ignore quiesced message from previous quiesce
         if quiesce_state_id != self._quiesce_state_id:
@@ -382,13 +926,43 @@ class Coordinator(object):
                             still_assigning = True
                             region.add_replica(replica)
 
-    def _select_replica(self, exclude):
+    def _lookup_region(self, spaceid, subspaceid, regionid):
+        space = self._spaces_by_id.get(spaceid)
+        if space is None or subspaceid >= len(space.subspaces):
+            return None
+        regions = space.subspaces[subspaceid].regions
+        if regionid >= len(regions):
+            return None
+        return regions[regionid]
+
+    def _host_load(self):
+        # Sum the reported op rates for each live host, counting only the
+        # regions the host still serves.
+        hosts = dict([(i, 0.) for i in self._instances_by_id.keys()
+                      if i not in self._failed_instances])
+        regions = collections.defaultdict(list)
+        for (instid, spaceid, subspaceid, regionid), (ops, bytes) in self._region_load.iteritems():
+            region = self._lookup_region(spaceid, subspaceid, regionid)
+            if instid not in hosts or region is None or instid not in region.replicas:
+                continue
+            hosts[instid] += ops
+            regions[instid].append((ops, (spaceid, subspaceid, regionid)))
+        return hosts, regions
+
+    def _replica_counts(self):
         hosts = dict([(k, 0) for k in self._instances_by_id.keys()])
         for spacenum, space in self._spaces_by_id.iteritems():
             for subspacenum, subspace in enumerate(space.subspaces):
                 for region in subspace.regions:
                     for replica in region.replicas:
                         hosts[replica] += 1
+        return hosts
+
+    def _select_replica(self, exclude, hosts=None):
+        # Callers placing many replicas at once pass the counts from
+        # _replica_counts and keep them up to date themselves.
+        if hosts is None:
+            hosts = self._replica_counts()
         frequencies = collections.defaultdict(list)
         for host, frequency in hosts.iteritems():
             if host not in exclude and host not in self._failed_instances:
@@ -399,13 +973,54 @@ class Coordinator(object):
         return self._rand.choice(least_loaded)
 
     def _regenerate(self):
-        used_hosts = set()
+        self._config_stale = True
+        self._cached_service_level = None
+
+    def _touch_region(self, spaceid, subspaceid, region, removed=False):
+        # The region's lines change with the next configuration.
+        key = (spaceid, subspaceid, region.prefix, region.mask)
+        self._dirty_regions[key] = None if removed else region
+        if removed:
+            self._reshaped.pop(key, None)
+
+    def _touch_space(self, spaceid, space):
+        # A space that was added or removed, and every region in it.
+        live = self._spaces_by_id.get(spaceid) is space
+        self._dirty_spaces[spaceid] = space
+        for subspaceid, subspace in enumerate(space.subspaces):
+            for region in subspace.regions:
+                self._touch_region(spaceid, subspaceid, region, removed=not live)
+
+    def _set_line(self, changes, key, line):
+        old = self._config_lines.get(key)
+        if old == line:
+            return
+        if line is None:
+            del self._config_lines[key]
+        else:
+            self._config_lines[key] = line
+        changes.append((key, old, line))
+
+    def publish(self):
+        # Generate one configuration covering every change since the last
+        # one, and queue it for the hosts.  Only the lines of what changed
+        # are generated, and the changes are kept for composing deltas.
+        # Returns True if there was one.
+        if not self._config_stale:
+            return False
+        if self._unrepaired_instances:
+            self._repair_regions()
+        self._config_stale = False
+        self._cached_service_level = None
         self._config_counter += 1
-        config = 'version {0}\n'.format(self._config_counter)
-        for spaceid, space in self._spaces_by_id.iteritems():
+        changes = []
+        self._set_line(changes, ('version',), VERSION_LINE.format(num=self._config_counter))
+        for spaceid, space in self._dirty_spaces.iteritems():
+            live = self._spaces_by_id.get(spaceid) is space
             spacedims = ' '.join([d.name + ' ' + d.datatype for d in space.dimensions])
-            config += SPACE_LINE \
-                      .format(name=space.name, id=spaceid, dims=spacedims)
+            self._set_line(changes, ('space', spaceid),
+                           SPACE_LINE.format(name=space.name, id=spaceid, dims=spacedims)
+                           if live else None)
             for subspaceid, subspace in enumerate(space.subspaces):
                 hashes = []
                 for dim in space.dimensions:
@@ -417,60 +1032,100 @@ class Coordinator(object):
                         hashes.append('true')
                     else:
                         hashes.append('false')
-                config += SUBSPACE_LINE \
-                          .format(space=spaceid, subspace=subspaceid,
-                                  hashes=' '.join(hashes))
-                for region in subspace.regions:
-                    hosts = [str(r) for r in region.replicas]
-                    for host in region.replicas:
-                        used_hosts.add(host)
-                    config += REGION_LINE \
-                              .format(space=spaceid, subspace=subspaceid,
-                                      prefix=region.prefix,
-                                      mask=hex(region.mask).rstrip('L'),
-                                      hosts=' '.join(hosts))
-                    xferid, instid = region.transfer_in_progress
-                    if xferid is not None:
-                        config += TRANSFER_LINE \
-                                  .format(xferid=str(xferid),
-                                          space=spaceid,
-                                          subspace=subspaceid,
-                                          prefix=region.prefix,
-                                          mask=hex(region.mask).rstrip('L'),
-                                          instid=str(instid))
-                        used_hosts.add(instid)
+                self._set_line(changes, ('subspace', spaceid, subspaceid),
+                               SUBSPACE_LINE.format(space=spaceid, subspace=subspaceid,
+                                                    hashes=' '.join(hashes))
+                               if live else None)
+        hosts_touched = set(self._dirty_hosts)
+        for key, region in self._dirty_regions.iteritems():
+            spaceid, subspaceid, prefix, mask = key
+            region_line = None
+            transfer_line = None
+            hosts = []
+            if region is not None:
+                hosts = list(region.replicas)
+                region_line = REGION_LINE.format(space=spaceid, subspace=subspaceid,
+                                                 prefix=prefix,
+                                                 mask=hex(mask).rstrip('L'),
+                                                 hosts=' '.join([str(r) for r in hosts]))
+                xferid, instid = region.transfer_in_progress
+                if xferid is not None:
+                    transfer_line = TRANSFER_LINE.format(xferid=str(xferid),
+                                                         space=spaceid,
+                                                         subspace=subspaceid,
+                                                         prefix=prefix,
+                                                         mask=hex(mask).rstrip('L'),
+                                                         instid=str(instid))
+                    hosts.append(instid)
+            self._set_line(changes, ('region',) + key, region_line)
+            self._set_line(changes, ('transfer',) + key, transfer_line)
+            for hostid in self._region_hosts.pop(key, []):
+                self._host_refs[hostid] -= 1
+                hosts_touched.add(hostid)
+            if hosts:
+                self._region_hosts[key] = hosts
+            for hostid in hosts:
+                self._host_refs[hostid] = self._host_refs.get(hostid, 0) + 1
+                hosts_touched.add(hostid)
+        # Only hosts that some region or transfer names are listed.
+        for hostid in hosts_touched:
+            host_line = None
+            if self._host_refs.get(hostid, 0) > 0:
+                inst = self._instances_by_id[hostid]
+                host_line = HOST_LINE.format(id=hostid, ip=inst.addr, inport=inst.inport,
+                                             inver=inst.inver, outport=inst.outport,
+                                             outver=inst.outver)
+            else:
+                self._host_refs.pop(hostid, None)
+            self._set_line(changes, ('host', hostid), host_line)
+        self._dirty_spaces = {}
+        self._dirty_regions = {}
+        self._dirty_hosts = set()
         # quiesce request
-        if (self._state == Coordinator.S_QUIESCE):
-            config += QUIESCE_LINE.format(state_id = self._quiesce_state_id)
+        self._set_line(changes, ('quiesce',),
+                       QUIESCE_LINE.format(state_id=self._quiesce_state_id)
+                       if self._state == Coordinator.S_QUIESCE else None)
         # shutdown request
-        if (self._state == Coordinator.S_SHUTDOWN):
-            config += SHUTDOWN_LINE
-        host_lines = []
-        for hostid in sorted(used_hosts):
-            inst = self._instances_by_id[hostid]
-            host_line = HOST_LINE \
-                        .format(id=hostid, ip=inst.addr, inport=inst.inport,
-                                inver=inst.inver, outport=inst.outport,
-                                outver=inst.outver)
-            host_lines.append(host_line)
-        self._config_data = ('\n'.join(host_lines) + '\n' + config).strip()
+        self._set_line(changes, ('shutdown',),
+                       SHUTDOWN_LINE if self._state == Coordinator.S_SHUTDOWN else None)
+        # online backup and restore, until every region reports
+        self._set_line(changes, ('backup',),
+                       BACKUP_LINE.format(backup_id=self._backup_id)
+                       if self._backup_id and self._backup_pending() else None)
+        self._set_line(changes, ('restore',),
+                       RESTORE_LINE.format(backup_id=self._restore_id)
+                       if self._restore_id and self._restore_pending() else None)
+        self._steps[self._config_counter] = changes
+        self._steps.pop(self._config_counter - DELTA_HISTORY, None)
         # do not send config before go-live
         if self._state != Coordinator.S_STARTUP:
             for instid, inst in self._instances_by_id.iteritems():
-                inst.add_config(self._config_counter, self._config_data)
-        # XXX notify threads to poll for new configs
-        
+                inst.add_config(self._config_counter)
+        return True
+
     def _service_level(self):
+        # Computed at most once between changes; get_status, add_space and
+        # del_space all ask.
+        if self._unrepaired_instances:
+            self._repair_regions()
+        if self._cached_service_level is not None:
+            return self._cached_service_level
         sl = Coordinator.SL_DESIRED
         for space in self._spaces_by_id.values():
             for subspace in space.subspaces:
                 for region in subspace.regions:
                     if region.current_f < 0:
                         # no need to search more, it is bad
-                        return Coordinator.SL_DATALOSS
+                        sl = Coordinator.SL_DATALOSS
+                        break
                     if region.current_f < region.desired_f:
                         # continue search, some region could be worse
                         sl = Coordinator.SL_DEGRADED
+                if sl == Coordinator.SL_DATALOSS:
+                    break
+            if sl == Coordinator.SL_DATALOSS:
+                break
+        self._cached_service_level = sl
         return sl
 
     def _service_level_met(self):
@@ -480,10 +1135,20 @@ class Coordinator(object):
         e = hdjson.Encoder()
         s = {}
         for attr, value in self.__dict__.iteritems():
+            # load reports are stale by the time the cluster restarts, and
+            # the hosts forget backups in progress
+            if attr in [ "_region_load", "_backup_id", "_backup_regions",
+                         "_backup_progress", "_restore_id", "_restore_regions",
+                         "_restore_progress", "_deltas", "_steps",
+                         "_config_lines", "_region_hosts", "_host_refs",
+                         "_dirty_spaces", "_dirty_regions", "_dirty_hosts",
+                         "_config_stale", "_cached_service_level" ]:
+                continue
             # dict. with non-string keys must be normalized for JSON encoding
-            if attr in [ "_portcounters", "_instances_by_bindings" ]:
+            elif attr in [ "_portcounters", "_instances_by_bindings" ]:
                 s[attr] = e.normalizeDictKeys(value, hdjson.KEYS_TUPLE)
-            elif attr in [ "_instances_by_id", "_spaces_by_id", "_xfers_by_id" ]:
+            elif attr in [ "_instances_by_id", "_spaces_by_id", "_xfers_by_id",
+                           "_xfer_attempts", "_xfer_progress" ]:
                 s[attr] = e.normalizeDictKeys(value, hdjson.KEYS_INT)
             else:
                 s[attr] = value
@@ -507,7 +1172,8 @@ class Coordinator(object):
             # dict. with non-string keys must be manually denormalized from JSON encoding
             if attr in [ "_instances_by_bindings" ]:
                 setattr(self, attr, d.denormalizeDictKeys(value, hdjson.KEYS_TUPLE))
-            elif attr in [ "_instances_by_id", "_spaces_by_id", "_xfers_by_id" ]:
+            elif attr in [ "_instances_by_id", "_spaces_by_id", "_xfers_by_id",
+                           "_xfer_attempts", "_xfer_progress" ]:
                 setattr(self, attr, d.denormalizeDictKeys(value, hdjson.KEYS_INT))
             # default dict must be manually created
             elif attr == "_portcounters":
@@ -530,6 +1196,8 @@ class HostConnection(object):
         self._instance = None # Must be None unless self._identified is INSTANCE
         self._has_config_pending = False
         self._pending_config_num = -1
+        # The last configuration sent, if the host still holds it.
+        self._sent_config = None
         self._id = 'Unidentified({0}, {1})'.format(self._sock.getpeername()[0], self._sock.getpeername()[1])
         logging.info('new host uses ID ' + self._id)
 
@@ -555,6 +1223,7 @@ class HostConnection(object):
                     self._coordinator.reject_config(self._instance, self._pending_config_num)
                     logging.error("{0} rejected config (there is a bug!)".format(self._id))
                 self._has_config_pending = False
+                self._sent_config = None
             elif len(commandline) == 2 and commandline[0] == 'fail_host':
                 self.fail_host(commandline[1])
             elif len(commandline) == 2 and commandline[0] == 'transfer_fail':
@@ -566,6 +1235,21 @@ class HostConnection(object):
             elif len(commandline) == 2 and commandline[0] == 'transfer_complete':
                 self.transfer_complete(commandline[1])
                 logging.debug("transfer complete {0}".format(commandline[1]))
+            elif len(commandline) == 4 and commandline[0] == 'transfer_progress':
+                self.transfer_progress(*commandline[1:])
+            elif len(commandline) == 8 and commandline[0] == 'region_load':
+                self.region_load(*commandline[1:])
+            elif len(commandline) == 5 and commandline[0] == 'inherit_fail':
+                self.inherit_fail(*commandline[1:])
+                logging.info("inherit fail {0}".format(' '.join(commandline[1:])))
+            elif len(commandline) == 8 and commandline[0] == 'backup_done':
+                self.backup_done(*commandline[1:])
+                logging.debug("backup done {0}".format(' '.join(commandline[1:])))
+            elif len(commandline) == 7 and commandline[0] == 'restore_done':
+                self.restore_done(*commandline[1:])
+                logging.debug("restore done {0}".format(' '.join(commandline[1:])))
+            elif len(commandline) == 6 and commandline[0] == 'restore_fail':
+                self.restore_fail(*commandline[1:])
             elif len(commandline) == 2 and commandline[0] == 'quiesced':
                 self.quiesced(commandline[1])
                 logging.debug("quiesced {0}".format(commandline[1]))
@@ -647,13 +1331,69 @@ class HostConnection(object):
             raise KillConnection("host uses non-numeric transfer id for transfer_complete")
         self._coordinator.transfer_complete(xferid)
 
+    def transfer_progress(self, xferid, objects, bytes):
+        try:
+            xferid = int(xferid)
+            objects = int(objects)
+            bytes = int(bytes)
+        except ValueError:
+            raise KillConnection("host uses non-numeric values for transfer_progress")
+        self._coordinator.transfer_progress(xferid, objects, bytes)
+
+    def region_load(self, spaceid, subspaceid, prefix, mask, ops, bytes, millis):
+        if self._identified != 'INSTANCE':
+            raise KillConnection("region_load from a connection that is not an instance")
+        try:
+            args = [int(x) for x in (spaceid, subspaceid, prefix, mask, ops, bytes, millis)]
+        except ValueError:
+            raise KillConnection("host uses non-numeric values for region_load")
+        self._coordinator.region_load(self._instance, *args)
+
+    def inherit_fail(self, spaceid, subspaceid, prefix, mask):
+        if self._identified != 'INSTANCE':
+            raise KillConnection("inherit_fail from a connection that is not an instance")
+        try:
+            args = [int(x) for x in (spaceid, subspaceid, prefix, mask)]
+        except ValueError:
+            raise KillConnection("host uses non-numeric values for inherit_fail")
+        self._coordinator.inherit_fail(self._instance, *args)
+
+    def backup_done(self, backup_id, spaceid, subspaceid, prefix, mask, objects, watermark):
+        if self._identified != 'INSTANCE':
+            raise KillConnection("backup_done from a connection that is not an instance")
+        try:
+            args = [int(x) for x in (spaceid, subspaceid, prefix, mask, objects, watermark)]
+        except ValueError:
+            raise KillConnection("host uses non-numeric values for backup_done")
+        self._coordinator.backup_done(self._instance, backup_id, *args)
+
+    def restore_done(self, backup_id, spaceid, subspaceid, prefix, mask, objects):
+        if self._identified != 'INSTANCE':
+            raise KillConnection("restore_done from a connection that is not an instance")
+        try:
+            args = [int(x) for x in (spaceid, subspaceid, prefix, mask, objects)]
+        except ValueError:
+            raise KillConnection("host uses non-numeric values for restore_done")
+        self._coordinator.restore_done(self._instance, backup_id, *args)
+
+    def restore_fail(self, backup_id, spaceid, subspaceid, prefix, mask):
+        if self._identified != 'INSTANCE':
+            raise KillConnection("restore_fail from a connection that is not an instance")
+        try:
+            args = [int(x) for x in (spaceid, subspaceid, prefix, mask)]
+        except ValueError:
+            raise KillConnection("host uses non-numeric values for restore_fail")
+        self._coordinator.restore_fail(self._instance, backup_id, *args)
+
     def quiesced(self, quiesce_state_id):
         self._coordinator.quiesced(self._instance, quiesce_state_id)
 
-    def send_config(self, num, data):
+    def send_config(self, num):
         self._has_config_pending = True
-        self.outgoing += (data + '\nend of line').strip() + '\n'
+        msg = self._coordinator.config_delta(self._sent_config, num)
+        self.outgoing += (msg + '\nend of line').strip() + '\n'
         self._pending_config_num = num
+        self._sent_config = num
 
     def has_config_pending(self):
         return self._has_config_pending
@@ -709,10 +1449,22 @@ class ControlConnection(object):
                     self.go_live()
                 elif r == 'backup-state':
                     self.backup_state()
+                elif r == 'backup':
+                    self.backup()
+                elif r == 'restore':
+                    self.restore(rv)
                 elif r == 'count-servers':
                     self.count_servers()
                 elif r == 'is-stable':
                     self.is_stable()
+                elif r == 'migrate-region':
+                    self.migrate_region(rv)
+                elif r == 'rebalance':
+                    self.rebalance()
+                elif r == 'split-region':
+                    self.reshape_region(rv, self._coordinator.split_region)
+                elif r == 'merge-regions':
+                    self.reshape_region(rv, self._coordinator.merge_regions)
                 else:
                     raise KillConnection("Control connection got invalid request {0}".format(r))
                     
@@ -798,6 +1550,24 @@ class ControlConnection(object):
         self.outgoing += json.dumps({self._currreq:'SUCCESS'}) + '\n'
         logging.info("go live request processed")
 
+    def backup(self):
+        try:
+            backup_id = self._coordinator.backup()
+        except Coordinator.InvalidState as e:
+            return self._fail("Coordinator state does not allow handling this request")
+        self.outgoing += json.dumps({self._currreq:backup_id}) + '\n'
+        logging.info("backup request processed")
+
+    def restore(self, backup_id):
+        try:
+            self._coordinator.restore(backup_id)
+        except (TypeError, AttributeError, ValueError):
+            return self._fail("restore needs the id of a backup")
+        except Coordinator.InvalidState as e:
+            return self._fail("Coordinator state does not allow handling this request")
+        self.outgoing += json.dumps({self._currreq:'SUCCESS'}) + '\n'
+        logging.info("restore request processed")
+
     def count_servers(self):
         count = self._coordinator.count_servers()
         self.outgoing += json.dumps({self._currreq:count}) + '\n'
@@ -806,6 +1576,42 @@ class ControlConnection(object):
         stable = self._coordinator.is_stable()
         self.outgoing += json.dumps({self._currreq:1 if stable else 0}) + '\n'
 
+    def migrate_region(self, data):
+        try:
+            spaceid = self._coordinator.get_space_id(data['space'])
+            xferid = self._coordinator.migrate_region(spaceid,
+                                                      int(data['subspace']),
+                                                      int(data['region']),
+                                                      int(data['from']),
+                                                      int(data['to']))
+        except (KeyError, TypeError):
+            return self._fail("migrate-region needs space, subspace, region, from and to")
+        except ValueError as e:
+            return self._fail(str(e))
+        except Coordinator.UnknownSpace as e:
+            return self._fail("Space does not exist")
+        except Coordinator.InvalidState as e:
+            return self._fail("Coordinator state does not allow handling this request")
+        self.outgoing += json.dumps({self._currreq:xferid}) + '\n'
+
+    def reshape_region(self, data, reshape):
+        try:
+            spaceid = self._coordinator.get_space_id(data['space'])
+            reshape(spaceid, int(data['subspace']), int(data['region']))
+        except (KeyError, TypeError):
+            return self._fail("{0} needs space, subspace and region".format(self._currreq))
+        except ValueError as e:
+            return self._fail(str(e))
+        except Coordinator.UnknownSpace as e:
+            return self._fail("Space does not exist")
+        except Coordinator.InvalidState as e:
+            return self._fail("Coordinator state does not allow handling this request")
+        self.outgoing += json.dumps({self._currreq:'SUCCESS'}) + '\n'
+
+    def rebalance(self):
+        xferid = self._coordinator.rebalance()
+        self.outgoing += json.dumps({self._currreq:xferid}) + '\n'
+
     def _fail(self, msg):
         error = 'failing control connection {0}: {1}'.format(self._id, msg)
         self.outgoing += json.dumps({self._currreq:'ERROR', 'error':msg}) + '\n'
@@ -814,7 +1620,7 @@ class ControlConnection(object):
         
 class CoordinatorServer(object):
 
-    def __init__(self, bindto, control_port, host_port, state_data=None):
+    def __init__(self, bindto, control_port, host_port, state_data=None, rebalance_interval=0):
         self._control_listen = socket.socket(socket.AF_INET, socket.SOCK_STREAM, socket.IPPROTO_TCP)
         self._control_listen.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
         self._control_listen.bind((bindto, control_port))
@@ -828,10 +1634,16 @@ class CoordinatorServer(object):
         self._p.register(self._control_listen)
         self._conns = {}
         self._coord = Coordinator(state_data)
+        self._rebalance_interval = datetime.timedelta(seconds=rebalance_interval)
+        self._last_rebalance = datetime.datetime.now()
 
     def run(self):
         instances_to_fds = {}
         client_fds = set()
+        # Clients that may be behind the last configuration sent to clients.
+        # Only these are visited, so an idle pass does not touch every client.
+        stale_client_fds = set()
+        client_config_num = None
         while True:
             fds = self._p.poll(1000)
             for fd, ev in fds:
@@ -874,8 +1686,8 @@ class CoordinatorServer(object):
                         remove = True
                     if remove:
                         del self._conns[fd]
-                        if fd in client_fds:
-                            client_fds.remove(fd)
+                        client_fds.discard(fd)
+                        stale_client_fds.discard(fd)
                         if conn._identified == 'INSTANCE' and \
                            conn._instance in instances_to_fds:
                             del instances_to_fds[conn._instance]
@@ -886,25 +1698,38 @@ class CoordinatorServer(object):
                         except socket.error as e:
                             pass
                     else:
-                        if conn._identified == 'CLIENT':
+                        if conn._identified == 'CLIENT' and fd not in client_fds:
                             client_fds.add(fd)
+                            stale_client_fds.add(fd)
                         if conn._identified == 'INSTANCE' and \
                            not conn.has_config_pending():
                             instances_to_fds[conn._instance] = fd
+            now = datetime.datetime.now()
+            if self._rebalance_interval and \
+               now - self._last_rebalance >= self._rebalance_interval:
+                self._last_rebalance = now
+                self._coord.rebalance()
+            self._coord.expire_archives(now)
+            self._coord.publish()
             instances = set(instances_to_fds.keys())
             instances.add(None)
-            configs, hosts = self._coord.fetch_configs(instances)
+            hosts = self._coord.fetch_configs(instances)
             for instance, confignum in hosts.iteritems():
-                c = configs[confignum]
                 if instance is None:
-                    for fd in client_fds:
+                    if confignum != client_config_num:
+                        client_config_num = confignum
+                        stale_client_fds = set(client_fds)
+                    # Each client gets the delta from the configuration it
+                    # has, and config_delta computes each distinct one once.
+                    for fd in stale_client_fds:
                         conn = self._conns[fd][1]
                         if conn.last_config_num() < confignum:
-                            conn.send_config(confignum, c)
+                            conn.send_config(confignum)
                             self._p.modify(fd, select.POLLIN | select.POLLOUT)
+                    stale_client_fds = set()
                 elif instance in instances_to_fds:
                     fd = instances_to_fds[instance]
-                    self._conns[fd][1].send_config(confignum, c)
+                    self._conns[fd][1].send_config(confignum)
                     self._p.modify(fd, select.POLLIN | select.POLLOUT)
                     del instances_to_fds[instance]
 
@@ -919,6 +1744,8 @@ def main(argv):
             choices=['debug', 'info', 'warn', 'error', 'critical',
                      'DEBUG', 'INFO', 'WARN', 'ERROR', 'CRITICAL'])
     parser.add_argument('-s', '--state-file', default='')
+    parser.add_argument('-r', '--rebalance-interval', type=int, default=0,
+                        help='seconds between load rebalancing steps (0 disables)')
     args = parser.parse_args(argv)
     level = {'debug': logging.DEBUG
             ,'info': logging.INFO
@@ -929,7 +1756,8 @@ def main(argv):
     try:
         logging.basicConfig(level=level)
         state_data = open(args.state_file, 'r').read() if args.state_file else ""
-        cs = CoordinatorServer(args.bindto, args.control_port, args.host_port, state_data)
+        cs = CoordinatorServer(args.bindto, args.control_port, args.host_port, state_data,
+                               args.rebalance_interval)
         logging.info('Coordinator started')
         cs.run()
     except Coordinator.InvalidStateData as ise:
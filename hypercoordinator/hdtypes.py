@@ -87,17 +87,60 @@ class Subspace(object):
     def regions(self):
         return self._regions
 
+    def split_region(self, idx):
+        # Halve the region by extending its prefix one bit.  Both halves keep
+        # the same chain, so every replica can split its data locally.
+        region = self._regions[idx]
+        if region.transfers:
+            raise ValueError('cannot split a region with transfers in progress')
+        if region.prefix >= 64:
+            raise ValueError('cannot split a region with a 64-bit prefix')
+        bit = 1 << (63 - region.prefix)
+        lower = Region(region.prefix + 1, region.mask, region.desired_f,
+                       list(region.replicas), depth=region.depth + 1)
+        upper = Region(region.prefix + 1, region.mask | bit, region.desired_f,
+                       list(region.replicas), depth=region.depth + 1)
+        self._regions = self._regions[:idx] + (lower, upper) + self._regions[idx + 1:]
+        return lower, upper
+
+    def merge_regions(self, idx):
+        # Undo a split: merge the region at idx with its upper sibling at
+        # idx + 1.  Both must be served by the same hosts.
+        if idx + 1 >= len(self._regions):
+            raise ValueError('region has no upper sibling')
+        lower, upper = self._regions[idx], self._regions[idx + 1]
+        if lower.prefix != upper.prefix or lower.prefix == 0:
+            raise ValueError('regions are not siblings')
+        bit = 1 << (64 - lower.prefix)
+        if lower.mask & bit or upper.mask != lower.mask | bit:
+            raise ValueError('regions are not siblings')
+        if lower.transfers or upper.transfers:
+            raise ValueError('cannot merge regions with transfers in progress')
+        if sorted(lower.replicas) != sorted(upper.replicas):
+            raise ValueError('siblings must be on the same hosts to merge')
+        parent = Region(lower.prefix - 1, lower.mask,
+                        max(lower.desired_f, upper.desired_f),
+                        list(lower.replicas), depth=max(0, lower.depth - 1))
+        self._regions = self._regions[:idx] + (parent,) + self._regions[idx + 2:]
+        return parent
+
     def __repr__(self):
         return hdjson.Encoder().encode(self)
 
 class Region(object):
 
-    def __init__(self, prefix, mask, desired_f, replicas=None, transfers=None):
+    def __init__(self, prefix, mask, desired_f, replicas=None, transfers=None, retiring=None, depth=0):
         self._prefix = prefix
         self._mask = mask
         self._desired_f = desired_f
         self._replicas = replicas or []
         self._transfers = transfers or []
+        # (xferid, instid) pairs: the instance leaves the region once the
+        # transfer completes.  This is how a region moves between hosts.
+        self._retiring = retiring or []
+        # How many runtime splits separate this region from the layout the
+        # space was created with.
+        self._depth = depth
 
     @property
     def prefix(self):
@@ -111,6 +154,10 @@ class Region(object):
     def desired_f(self):
         return self._desired_f
 
+    @property
+    def depth(self):
+        return self._depth
+
     @property
     def current_f(self):
         return len(self._replicas) - 1
@@ -123,6 +170,10 @@ class Region(object):
     def transfers(self):
         return tuple([i for x, i in self._transfers])
 
+    @property
+    def migrating(self):
+        return tuple([i for x, i in self._retiring])
+
     @property
     def transfer_in_progress(self):
         if self._transfers:
@@ -137,10 +188,23 @@ class Region(object):
     def remove_instances(self, badreplicas):
         self._replicas = [r for r in self._replicas if r not in badreplicas]
         self._transfers = [t for t in self._transfers if t[1] not in badreplicas]
+        xferids = set([x for x, i in self._transfers])
+        self._retiring = [(x, i) for x, i in self._retiring
+                          if x in xferids and i not in badreplicas]
 
     def transfer_initiate(self, xferid, instid):
         self._transfers.append((xferid, instid))
 
+    def migrate(self, xferid, src, dst):
+        if src not in self._replicas:
+            raise ValueError('source does not hold the region')
+        if src in self.migrating:
+            raise ValueError('source is already moving the region')
+        if dst in self._replicas or dst in self.transfers:
+            raise ValueError('destination already holds the region')
+        self.transfer_initiate(xferid, dst)
+        self._retiring.append((xferid, src))
+
     def transfer_golive(self, xferid):
         if not self._transfers:
             raise RuntimeError('transfer "golive" message for unknown xferid')
@@ -159,12 +223,27 @@ class Region(object):
         if not self._replicas or self._transfers[0][1] != self._replicas[-1]:
             raise RuntimeError('transfer "complete" message must come after "golive"')
         self._transfers = self._transfers[1:]
+        retired = [i for x, i in self._retiring if x == xferid]
+        self._retiring = [(x, i) for x, i in self._retiring if x != xferid]
+        self._replicas = [r for r in self._replicas if r not in retired]
+
+    def transfer_retry(self, xferid, newxferid):
+        for idx, (x, i) in enumerate(self._transfers):
+            if x == xferid:
+                if idx == 0 and self._replicas and self._replicas[-1] == i:
+                    self._replicas.pop()
+                self._transfers[idx] = (newxferid, i)
+                self._retiring = [(newxferid if x == xferid else x, r)
+                                  for x, r in self._retiring]
+                return True
+        return False
 
     def transfer_fail(self, xferid):
         if self._transfers and self._transfers[0][0] == xferid:
             if self._replicas and self._replicas[-1] == self._transfers[0][1]:
                 self._replicas.pop()
         self._transfers = [(x, i) for x, i in self._transfers if x != xferid]
+        self._retiring = [(x, i) for x, i in self._retiring if x != xferid]
 
     def __eq__(self, other):
         return self.prefix == other.prefix and \
@@ -227,14 +306,17 @@ class Instance(object):
     def last_acked(self):
         return self._last_acked
 
-    def add_config(self, num, data):
-        assert not self._configs or num > self._configs[-1][0]
-        self._configs.append((num, data))
+    def add_config(self, num):
+        # Only the oldest configuration may be with the host already; any
+        # others queued behind it are superseded by this one.  The
+        # coordinator produces the text when it sends each one.
+        assert not self._configs or num > self._configs[-1]
+        self._configs = self._configs[:1] + [num]
 
     def ack_config(self, num):
         if not self._configs:
             raise RuntimeError("acking config when none are present")
-        if self._configs[0][0] != num:
+        if self._configs[0] != num:
             raise RuntimeError("acking config number which does not match the oldest pending")
         self._configs = self._configs[1:]
         self._last_acked = num
@@ -242,7 +324,7 @@ class Instance(object):
     def reject_config(self, num):
         if not self._configs:
             raise RuntimeError("rejecting config when none are present")
-        if self._configs[0][0] != num:
+        if self._configs[0] != num:
             raise RuntimeError("rejecting config number which does not match the oldest pending")
         self._configs = self._configs[1:]
         self._last_rejected = num
@@ -250,7 +332,7 @@ class Instance(object):
     def next_config(self):
         if self._configs:
             return self._configs[0]
-        return (None, None)
+        return None
 
     def bindings(self):
         return InstanceBindings(self._addr, self._inport, self._inver,
@@ -0,0 +1,155 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <stdint.h>
+
+// STL
+#include <algorithm>
+
+// e
+#include <e/timer.h>
+
+// HyperDaemon
+#include "hyperdaemon/admission_control.h"
+#include "hyperdaemon/runtimeconfig.h"
+
+hyperdaemon :: admission_control :: admission_control()
+    : m_state(0)
+    , m_lock()
+    , m_buckets()
+    , m_last_prune(0)
+{
+}
+
+hyperdaemon :: admission_control :: ~admission_control() throw ()
+{
+}
+
+bool
+hyperdaemon :: admission_control :: admit(uint64_t client, bool priority, uint64_t* ticket)
+{
+    if (!priority && CLIENT_QUEUE_DEPTH > 0 &&
+        (__sync_fetch_and_add(&m_state, 0) & 0xffffffffULL) >= CLIENT_QUEUE_DEPTH)
+    {
+        return false;
+    }
+
+    if (CLIENT_OPS_PER_SECOND > 0)
+    {
+        const double rate = CLIENT_OPS_PER_SECOND;
+        const double burst = std::max(static_cast<unsigned int>(CLIENT_OPS_BURST), 1U);
+        uint64_t now = e::time();
+        hyperdisk::profiled_mutex::hold hold(&m_lock);
+        bucket_map_t::iterator b = m_buckets.find(client);
+
+        if (b == m_buckets.end())
+        {
+            b = m_buckets.insert(std::make_pair(client, bucket())).first;
+            b->second.tokens = burst;
+        }
+        else
+        {
+            double refill = (now - b->second.last) * rate / 1000000000.;
+            b->second.tokens = std::min(burst, b->second.tokens + refill);
+        }
+
+        b->second.last = now;
+
+        if (b->second.tokens < 1)
+        {
+            return false;
+        }
+
+        b->second.tokens -= 1;
+
+        if (now - m_last_prune > 1000000000ULL)
+        {
+            prune(now, rate, burst);
+        }
+    }
+
+    *ticket = __sync_add_and_fetch(&m_state, 1) >> 32;
+    return true;
+}
+
+void
+hyperdaemon :: admission_control :: complete(uint64_t ticket)
+{
+    uint64_t state;
+
+    do
+    {
+        state = m_state;
+
+        if ((state >> 32) != ticket || (state & 0xffffffffULL) == 0)
+        {
+            return;
+        }
+    }
+    while (!__sync_bool_compare_and_swap(&m_state, state, state - 1));
+}
+
+void
+hyperdaemon :: admission_control :: reset()
+{
+    uint64_t state;
+
+    do
+    {
+        state = m_state;
+    }
+    while (!__sync_bool_compare_and_swap(&m_state, state, ((state >> 32) + 1) << 32));
+}
+
+void
+hyperdaemon :: admission_control :: lock_stats(std::map<std::string, hyperdisk::lockstats>* stats) const
+{
+    (*stats)["admission"] += m_lock.stats();
+}
+
+// Drop the buckets of clients that have been idle long enough for their bucket
+// to refill completely.  They are indistinguishable from a new bucket.
+void
+hyperdaemon :: admission_control :: prune(uint64_t now, double rate, double burst)
+{
+    bucket_map_t::iterator b = m_buckets.begin();
+
+    while (b != m_buckets.end())
+    {
+        if (b->second.tokens + (now - b->second.last) * rate / 1000000000. >= burst)
+        {
+            m_buckets.erase(b++);
+        }
+        else
+        {
+            ++b;
+        }
+    }
+
+    m_last_prune = now;
+}
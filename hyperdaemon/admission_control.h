@@ -0,0 +1,104 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef hyperdaemon_admission_control_h_
+#define hyperdaemon_admission_control_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <map>
+#include <string>
+#include <tr1/unordered_map>
+
+// HyperDisk
+#include "hyperdisk/hyperdisk/profiled_mutex.h"
+
+namespace hyperdaemon
+{
+
+// Decide which client requests the daemon will accept while it is overloaded.
+// Each client draws from its own token bucket so that one client cannot starve
+// the others, and once too many client requests are outstanding new requests
+// are shed until the backlog drains.  Requests marked as priority bypass the
+// queue-depth check, but still draw from their client's bucket.
+//
+// One instance can be shared among many threads.
+class admission_control
+{
+    public:
+        admission_control();
+        ~admission_control() throw ();
+
+    public:
+        // Every request that is admitted must be matched with exactly one call
+        // to "complete", passing the ticket "admit" handed out, when the
+        // client has been answered.
+        bool admit(uint64_t client, bool priority, uint64_t* ticket);
+        void complete(uint64_t ticket);
+        // Clients fail their outstanding operations on reconfiguration, so
+        // nothing that was outstanding will be answered.  Requests admitted
+        // before the reset that are answered anyway no longer count, so
+        // their tickets are ignored.
+        void reset();
+        uint64_t outstanding() const { return m_state & 0xffffffffULL; }
+        void lock_stats(std::map<std::string, hyperdisk::lockstats>* stats) const;
+
+    private:
+        class bucket
+        {
+            public:
+                bucket() : tokens(0), last(0) {}
+
+            public:
+                double tokens;
+                uint64_t last;
+        };
+        typedef std::tr1::unordered_map<uint64_t, bucket> bucket_map_t;
+
+    private:
+        admission_control(const admission_control&);
+
+    private:
+        void prune(uint64_t now, double rate, double burst);
+
+    private:
+        admission_control& operator = (const admission_control&);
+
+    private:
+        // The generation in the high 32 bits, and the number of requests
+        // outstanding from it in the low 32.  A ticket is the generation.
+        uint64_t m_state;
+        hyperdisk::profiled_mutex m_lock;
+        bucket_map_t m_buckets;
+        uint64_t m_last_prune;
+};
+
+} // namespace hyperdaemon
+
+#endif // hyperdaemon_admission_control_h_
@@ -0,0 +1,313 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <cstring>
+
+// STL
+#include <memory>
+#include <string>
+#include <vector>
+
+// e
+#include <e/buffer.h>
+#include <e/slice.h>
+
+// BusyBee
+#include <busybee_constants.h>
+
+// HyperDex
+#include "hyperdex/hyperdex/ids.h"
+#include "hyperdex/hyperdex/network_constants.h"
+#include "hyperdex/hyperdex/packing.h"
+#include "datatypes/microcheck.h"
+#include "datatypes/microop.h"
+#include "benchrunner.h"
+
+// These mirror the messages a client and the daemons exchange for the common
+// operations:  the header logical::send writes, followed by the client's nonce
+// and the body of a REQ_GET or REQ_ATOMIC, or by the body of a CHAIN_PUT.
+// Every iteration packs into a freshly allocated buffer, as the senders do.
+
+#define HEADER_SIZE (BUSYBEE_HEADER_SIZE + sizeof(uint8_t) + sizeof(uint64_t) \
+                     + 2 * sizeof(uint16_t) + 2 * hyperdex::entityid::SERIALIZEDSIZE \
+                     + sizeof(uint64_t))
+#define ATTRIBUTES 4
+#define VALUE_SIZE 32
+
+namespace
+{
+
+class message
+{
+    public:
+        message();
+
+    public:
+        void pack_header(e::buffer* msg, hyperdex::network_msgtype type) const;
+        bool unpack_header(const e::buffer& msg) const;
+        size_t get_size() const;
+        e::buffer* pack_get() const;
+        bool unpack_get(const e::buffer& msg) const;
+        size_t atomic_size() const;
+        e::buffer* pack_atomic() const;
+        bool unpack_atomic(const e::buffer& msg) const;
+        size_t chain_put_size() const;
+        e::buffer* pack_chain_put() const;
+        bool unpack_chain_put(const e::buffer& msg) const;
+
+    private:
+        hyperdex::entityid m_from;
+        hyperdex::entityid m_to;
+        std::string m_key;
+        std::string m_bytes;
+        std::vector<e::slice> m_value;
+        std::vector<microcheck> m_checks;
+        std::vector<microop> m_ops;
+};
+
+message :: message()
+    : m_from(UINT32_MAX - 1, 0, 0, 42, 0)
+    , m_to(7, 0, 16, 0xdeadbeefcafebabeULL, 2)
+    , m_key("user0000000042")
+    , m_bytes(ATTRIBUTES * VALUE_SIZE, 'v')
+    , m_value()
+    , m_checks()
+    , m_ops(ATTRIBUTES)
+{
+    for (size_t i = 0; i < ATTRIBUTES; ++i)
+    {
+        m_value.push_back(e::slice(m_bytes.data() + i * VALUE_SIZE, VALUE_SIZE));
+        m_ops[i].attr = i + 1;
+        m_ops[i].action = OP_SET;
+        m_ops[i].arg1 = m_value[i];
+        m_ops[i].arg1_datatype = HYPERDATATYPE_STRING;
+    }
+}
+
+void
+message :: pack_header(e::buffer* msg, hyperdex::network_msgtype type) const
+{
+    uint8_t mt = static_cast<uint8_t>(type);
+    uint64_t version = 1024;
+    uint16_t fromver = 1;
+    uint16_t tover = 1;
+    uint64_t trace = 0;
+    msg->pack_at(BUSYBEE_HEADER_SIZE)
+        << mt << version << fromver << tover << m_from << m_to << trace;
+}
+
+bool
+message :: unpack_header(const e::buffer& msg) const
+{
+    uint8_t mt;
+    uint64_t version;
+    uint16_t fromver;
+    uint16_t tover;
+    hyperdex::entityid from;
+    hyperdex::entityid to;
+    uint64_t trace;
+    e::buffer::unpacker up = msg.unpack_from(BUSYBEE_HEADER_SIZE);
+    up = up >> mt >> version >> fromver >> tover >> from >> to >> trace;
+    return !up.error() && from == m_from && to == m_to;
+}
+
+size_t
+message :: get_size() const
+{
+    return HEADER_SIZE + sizeof(uint64_t) + sizeof(uint32_t) + m_key.size();
+}
+
+e::buffer*
+message :: pack_get() const
+{
+    std::auto_ptr<e::buffer> msg(e::buffer::create(get_size()));
+    pack_header(msg.get(), hyperdex::REQ_GET);
+    uint64_t nonce = 1;
+    msg->pack_at(HEADER_SIZE) << nonce << e::slice(m_key.data(), m_key.size());
+    return msg.release();
+}
+
+bool
+message :: unpack_get(const e::buffer& msg) const
+{
+    uint64_t nonce;
+    e::slice key;
+    e::buffer::unpacker up = msg.unpack_from(HEADER_SIZE);
+    up = up >> nonce >> key;
+    return unpack_header(msg) && !up.error() && key.size() == m_key.size();
+}
+
+size_t
+message :: atomic_size() const
+{
+    size_t sz = HEADER_SIZE + sizeof(uint64_t) + sizeof(uint32_t) + m_key.size()
+              + sizeof(uint8_t) + 2 * sizeof(uint32_t);
+
+    for (size_t i = 0; i < m_checks.size(); ++i)
+    {
+        sz += pack_size(m_checks[i]);
+    }
+
+    for (size_t i = 0; i < m_ops.size(); ++i)
+    {
+        sz += pack_size(m_ops[i]);
+    }
+
+    return sz;
+}
+
+e::buffer*
+message :: pack_atomic() const
+{
+    std::auto_ptr<e::buffer> msg(e::buffer::create(atomic_size()));
+    pack_header(msg.get(), hyperdex::REQ_ATOMIC);
+    uint64_t nonce = 1;
+    uint8_t flags = 128;
+    msg->pack_at(HEADER_SIZE) << nonce << e::slice(m_key.data(), m_key.size())
+                              << flags << m_checks << m_ops;
+    return msg.release();
+}
+
+bool
+message :: unpack_atomic(const e::buffer& msg) const
+{
+    uint64_t nonce;
+    e::slice key;
+    uint8_t flags;
+    std::vector<microcheck> checks;
+    std::vector<microop> ops;
+    e::buffer::unpacker up = msg.unpack_from(HEADER_SIZE);
+    up = up >> nonce >> key >> flags >> checks >> ops;
+    return unpack_header(msg) && !up.error() && ops.size() == m_ops.size();
+}
+
+size_t
+message :: chain_put_size() const
+{
+    return HEADER_SIZE + sizeof(uint64_t) + sizeof(uint8_t)
+         + sizeof(uint32_t) + m_key.size() + hyperdex::packspace(m_value);
+}
+
+e::buffer*
+message :: pack_chain_put() const
+{
+    std::auto_ptr<e::buffer> msg(e::buffer::create(chain_put_size()));
+    pack_header(msg.get(), hyperdex::CHAIN_PUT);
+    uint64_t version = 1;
+    uint8_t flags = 1;
+    msg->pack_at(HEADER_SIZE) << version << flags
+                              << e::slice(m_key.data(), m_key.size()) << m_value;
+    return msg.release();
+}
+
+bool
+message :: unpack_chain_put(const e::buffer& msg) const
+{
+    uint64_t version;
+    uint8_t flags;
+    e::slice key;
+    std::vector<e::slice> value;
+    e::buffer::unpacker up = msg.unpack_from(HEADER_SIZE);
+    up = up >> version >> flags >> key >> value;
+    return unpack_header(msg) && !up.error() && value.size() == m_value.size();
+}
+
+} // namespace
+
+BENCHMARK(Messages, PackGet, 1000000)
+{
+    message m;
+    st.set_bytes(m.get_size());
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        std::auto_ptr<e::buffer> msg(m.pack_get());
+        bench::consume(msg->data());
+    }
+}
+
+BENCHMARK(Messages, UnpackGet, 1000000)
+{
+    message m;
+    std::auto_ptr<e::buffer> msg(m.pack_get());
+    st.set_bytes(m.get_size());
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        bench::consume(m.unpack_get(*msg));
+    }
+}
+
+BENCHMARK(Messages, PackAtomic, 1000000)
+{
+    message m;
+    st.set_bytes(m.atomic_size());
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        std::auto_ptr<e::buffer> msg(m.pack_atomic());
+        bench::consume(msg->data());
+    }
+}
+
+BENCHMARK(Messages, UnpackAtomic, 1000000)
+{
+    message m;
+    std::auto_ptr<e::buffer> msg(m.pack_atomic());
+    st.set_bytes(m.atomic_size());
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        bench::consume(m.unpack_atomic(*msg));
+    }
+}
+
+BENCHMARK(Messages, PackChainPut, 1000000)
+{
+    message m;
+    st.set_bytes(m.chain_put_size());
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        std::auto_ptr<e::buffer> msg(m.pack_chain_put());
+        bench::consume(msg->data());
+    }
+}
+
+BENCHMARK(Messages, UnpackChainPut, 1000000)
+{
+    message m;
+    std::auto_ptr<e::buffer> msg(m.pack_chain_put());
+    st.set_bytes(m.chain_put_size());
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        bench::consume(m.unpack_chain_put(*msg));
+    }
+}
@@ -35,7 +35,10 @@
 
 // STL
 #include <algorithm>
+#include <map>
+#include <set>
 #include <tr1/memory>
+#include <vector>
 
 // Google Log
 #include <glog/logging.h>
@@ -49,11 +52,14 @@
 
 // HyperDaemon
 #include "hyperdaemon/daemon.h"
+#include "hyperdaemon/admission_control.h"
 #include "hyperdaemon/datalayer.h"
 #include "hyperdaemon/logical.h"
+#include "hyperdaemon/metrics.h"
 #include "hyperdaemon/network_worker.h"
 #include "hyperdaemon/ongoing_state_transfers.h"
 #include "hyperdaemon/replication_manager.h"
+#include "hyperdaemon/runtimeconfig.h"
 #include "hyperdaemon/searches.h"
 
 // util
@@ -72,6 +78,62 @@ sig_handle(int /*signum*/)
     s_continue = false;
 }
 
+// The chain of a region, as the instances on it from head to tail.
+static std::vector<hyperdex::instance>
+chain_of(const hyperdex::configuration& config, const hyperdex::regionid& r)
+{
+    std::vector<hyperdex::instance> chain;
+    hyperdex::instance inst;
+
+    while ((inst = config.instancefor(hyperdex::entityid(r, static_cast<uint8_t>(chain.size())))) != hyperdex::instance())
+    {
+        chain.push_back(inst);
+    }
+
+    return chain;
+}
+
+// The regions we serve or receive under either configuration whose chains
+// differ between them.  Quiescing or shutting down touches every disk, so
+// fences everything.  Fencing a region also holds the transfers that copy it.
+static std::set<hyperdex::regionid>
+regions_to_fence(const hyperdex::configuration& oldconfig,
+                 const hyperdex::instance& oldinst,
+                 const hyperdex::configuration& newconfig,
+                 const hyperdex::instance& newinst)
+{
+    std::set<hyperdex::regionid> regions = oldconfig.regions_for(oldinst);
+    std::set<hyperdex::regionid> next = newconfig.regions_for(newinst);
+    regions.insert(next.begin(), next.end());
+    std::map<uint16_t, hyperdex::regionid> in = oldconfig.transfers_to(oldinst);
+    std::map<uint16_t, hyperdex::regionid> in_next = newconfig.transfers_to(newinst);
+    in.insert(in_next.begin(), in_next.end());
+
+    for (std::map<uint16_t, hyperdex::regionid>::const_iterator t = in.begin();
+            t != in.end(); ++t)
+    {
+        regions.insert(t->second);
+    }
+
+    if (newconfig.quiesce() || newconfig.shutdown())
+    {
+        return regions;
+    }
+
+    std::set<hyperdex::regionid> fenced;
+
+    for (std::set<hyperdex::regionid>::const_iterator r = regions.begin();
+            r != regions.end(); ++r)
+    {
+        if (chain_of(oldconfig, *r) != chain_of(newconfig, *r))
+        {
+            fenced.insert(*r);
+        }
+    }
+
+    return fenced;
+}
+
 int
 hyperdaemon :: daemon(const char* progname,
                       bool daemonize,
@@ -190,13 +252,26 @@ hyperdaemon :: daemon(const char* progname,
     searches ssss(&cl, &data, &comm);
     // Setup the recovery component.
     ongoing_state_transfers ost(&data, &comm, &cl);
+    // Setup the admission control component.
+    admission_control admit;
     // Setup the replication component.
-    replication_manager repl(&cl, &data, &comm, &ost);
-    // Give the ongoing_state_transfers a view into the replication component
+    replication_manager repl(&cl, &data, &comm, &ost, &admit);
+    // Give the ongoing_state_transfers and the data layer a view into the
+    // replication component
     ost.set_replication_manager(&repl);
+    data.set_replication_manager(&repl);
+    // Setup the metrics endpoint.  It is off unless given a port.
+    metrics stats(&data, &comm, &repl, &ssss, &ost, &admit);
+
+    if (METRICS_PORT > 0 && METRICS_PORT <= 65535 &&
+        !stats.listen(static_cast<in_port_t>(METRICS_PORT)))
+    {
+        LOG(ERROR) << "Continuing without a metrics endpoint.";
+    }
+
     // Start the network workers.
     LOG(INFO) << "Starting network workers.";
-    network_worker nw(&data, &comm, &ssss, &ost, &repl);
+    network_worker nw(&data, &comm, &ssss, &ost, &repl, &admit);
     std::tr1::function<void (network_worker*)> fnw(&network_worker::run);
     std::vector<thread_ptr> threads;
 
@@ -208,6 +283,7 @@ hyperdaemon :: daemon(const char* progname,
     }
 
     LOG(INFO) << "Network workers started.";
+    hyperdex::configuration installed;
     uint64_t now;
     uint64_t disconnected_at = e::time();
     uint64_t nanos_to_wait = 5000000;
@@ -237,11 +313,14 @@ hyperdaemon :: daemon(const char* progname,
 
         if (cl.unacknowledged())
         {
-            LOG(INFO) << "Installing new configuration version " << cl.config().version();
+            // Every subsystem installs this one snapshot; copies of it share
+            // its state rather than copying it.
+            const hyperdex::configuration config(cl.config());
+            LOG(INFO) << "Installing new configuration version " << config.version();
             hyperdex::instance newinst = comm.inst();
 
             // Figure out which versions we were assigned.
-            cl.config().instance_versions(&newinst);
+            config.instance_versions(&newinst);
 
             if (newinst.inbound_version == 0 ||
                 newinst.outbound_version == 0)
@@ -252,47 +331,61 @@ hyperdaemon :: daemon(const char* progname,
             // Prepare for our new configuration.
             // These operations should assume that there will be network
             // activity, and that the network threads will be in full force.
-            comm.prepare(cl.config(), newinst);
-            data.prepare(cl.config(), newinst);
-            repl.prepare(cl.config(), newinst);
-            ost.prepare(cl.config(), newinst);
-            ssss.prepare(cl.config(), newinst);
+            comm.prepare(config, newinst);
+            data.prepare(config, newinst);
+            repl.prepare(config, newinst);
+            ost.prepare(config, newinst);
+            ssss.prepare(config, newinst);
+
+            // Fence the regions whose chains change.  The network workers
+            // keep serving every other region throughout.
+            std::set<hyperdex::regionid> fenced;
+            fenced = regions_to_fence(installed, comm.inst(), config, newinst);
+            LOG(INFO) << "Fencing " << fenced.size() << " regions for reconfiguration.";
 
             // Protect ourself against exceptions.
+            e::guard g0 = e::makeobjguard(comm, &logical::unfence);
             e::guard g1 = e::makeobjguard(comm, &logical::unpause);
             e::guard g2 = e::makeobjguard(comm, &logical::shutdown);
-
-            LOG(INFO) << "Pausing communication for reconfiguration.";
-
-            // Make sure that we wait until everyone is paused.
-            comm.pause();
+            comm.fence(fenced);
 
             // Here is the critical section.  This is is mutually exclusive with the
-            // network workers' loop.
-            comm.reconfigure(cl.config(), newinst);
-            data.reconfigure(cl.config(), comm.inst());
-            repl.reconfigure(cl.config(), comm.inst());
-            ost.reconfigure(cl.config(), comm.inst());
-            ssss.reconfigure(cl.config(), comm.inst());
+            // network workers' loop, so it only swaps in the new configuration.
+            comm.pause();
+            comm.reconfigure(config, newinst);
+            repl.reconfigure(config, comm.inst());
+            ost.reconfigure(config, comm.inst());
+            ssss.reconfigure(config, comm.inst());
+            admit.reset();
             comm.unpause();
             g1.dismiss();
+
+            // The fenced regions are quiet, and so are the transfers into
+            // them, so the data layer may move data between them while the
+            // workers run.
+            data.reconfigure(config, comm.inst());
+            comm.unfence();
+            g0.dismiss();
             g2.dismiss();
-            LOG(INFO) << "Reconfiguration complete; unpausing communication.";
+            installed = config;
+            LOG(INFO) << "Reconfiguration complete; unfencing regions.";
 
             // Cleanup anything not specified by our new configuration.
             // These operations should assume that there will be network
             // activity, and that the network threads will be in full force..
-            ssss.prepare(cl.config(), comm.inst());
-            ost.cleanup(cl.config(), comm.inst());
-            repl.cleanup(cl.config(), comm.inst());
-            data.cleanup(cl.config(), comm.inst());
-            comm.cleanup(cl.config(), comm.inst());
+            ssss.prepare(config, comm.inst());
+            ost.cleanup(config, comm.inst());
+            repl.cleanup(config, comm.inst());
+            data.cleanup(config, comm.inst());
+            comm.cleanup(config, comm.inst());
             cl.acknowledge();
         }
     }
 
     LOG(INFO) << "Exiting daemon.";
 
+    // Stop answering metrics requests.
+    stats.shutdown();
     // Stop replication.
     repl.shutdown();
     // Turn off the network.
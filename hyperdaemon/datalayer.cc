@@ -29,11 +29,15 @@
 
 // C
 #include <cassert>
+#include <cerrno>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 // POSIX
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 // C++
 #include <limits>
@@ -51,6 +55,7 @@
 
 // po6
 #include <po6/pathname.h>
+#include <po6/threads/mutex.h>
 
 // e
 #include <e/timer.h>
@@ -58,6 +63,9 @@
 // util
 #include <util/atomicfile.h>
 
+// HyperDisk
+#include "hyperdisk/hyperdisk/archive.h"
+
 // HyperDex
 #include "hyperdex/hyperdex/configuration.h"
 #include "hyperdex/hyperdex/coordinatorlink.h"
@@ -65,6 +73,8 @@
 
 // HyperDaemon
 #include "hyperdaemon/datalayer.h"
+#include "hyperdaemon/metrics.h"
+#include "hyperdaemon/replication_manager.h"
 #include "hyperdaemon/runtimeconfig.h"
 
 using hyperdex::regionid;
@@ -77,21 +87,66 @@ using hyperdex::configuration_parser;
 typedef e::intrusive_ptr<hyperdisk::disk> disk_ptr;
 typedef std::map<hyperdex::regionid, disk_ptr> disk_map_t;
 
+class hyperdaemon::datalayer::archive_job
+{
+    public:
+        archive_job(const configuration& c, const std::string& i, bool r,
+                    hyperdisk::lockstats* ls)
+            : config(c), id(i), restore(r), regions(), next(0), running(0)
+            , cancelled(false), lock(ls), failed(), threads() {}
+
+    public:
+        // The configuration that started the job, for the disks a restore
+        // creates.
+        const configuration config;
+        const std::string id;
+        const bool restore;
+        std::vector<regionid> regions;
+        // The next region to claim, advanced atomically by the threads.
+        size_t next;
+        // Threads that have yet to return, decremented atomically.
+        size_t running;
+        // Set once the configuration no longer asks for this job.
+        volatile bool cancelled;
+        // Regions that failed every attempt.  Guarded by "lock", which
+        // records into the datalayer's stats for every job.
+        hyperdisk::profiled_mutex lock;
+        std::vector<regionid> failed;
+        std::vector<std::tr1::shared_ptr<po6::threads::thread> > threads;
+
+    private:
+        archive_job(const archive_job&);
+        archive_job& operator = (const archive_job&);
+};
+
 const char* hyperdaemon :: datalayer :: STATE_FILE_NAME = "datalayer_state.hd";
 const int hyperdaemon :: datalayer :: STATE_FILE_VER = 1;
 
 hyperdaemon :: datalayer :: datalayer(coordinatorlink* cl, const po6::pathname& base)
     : m_cl(cl)
+    , m_repl(NULL)
     , m_shutdown(false)
     , m_base(base)
     , m_optimistic_io_thread(std::tr1::bind(&datalayer::optimistic_io_thread, this))
     , m_flush_threads()
     , m_disks()
+    , m_swap_lock()
     , m_preallocate_rr()
     , m_last_preallocation(0)
     , m_optimistic_rr()
     , m_last_dose_of_optimism(0)
+    , m_last_load_report(e::time())
+    , m_last_checkpoint(e::time())
     , m_flushed_recently(false)
+    , m_inherit()
+    , m_inherit_failed()
+    , m_stale()
+    , m_backup_id("")
+    , m_backup_claimed()
+    , m_restore_id("")
+    , m_restore_claimed()
+    , m_archive_lockstats()
+    , m_archive_jobs()
     , m_quiesce(false)
     , m_quiesce_state_id("")
 {
@@ -123,6 +178,15 @@ hyperdaemon :: datalayer :: ~datalayer() throw ()
     {
         m_flush_threads[i]->join();
     }
+
+    for (std::list<std::tr1::shared_ptr<archive_job> >::iterator j = m_archive_jobs.begin();
+            j != m_archive_jobs.end(); ++j)
+    {
+        for (size_t i = 0; i < (*j)->threads.size(); ++i)
+        {
+            (*j)->threads[i]->join();
+        }
+    }
 }
 
 bool
@@ -244,15 +308,24 @@ hyperdaemon :: datalayer :: load_state()
 
     configuration config = cp.generate();
 
-    // Re-open the disks that are needed according to config at the time of quiesce.
+    // Re-open the disks that are needed according to the config.  Without a
+    // quiesce, each disk holds what its manifest covers, and transfers bring
+    // the rest.
     std::set<regionid> regions = config.regions_for(us);
+    std::map<uint16_t, regionid> in_transfers = config.transfers_to(us);
+
+    for (std::map<uint16_t, regionid>::iterator t = in_transfers.begin();
+            t != in_transfers.end(); ++t)
+    {
+        regions.insert(t->second);
+    }
 
     for (std::set<regionid>::const_iterator r = regions.begin();
             r != regions.end(); ++r)
     {
         if (!m_disks.contains(*r))
         {
-            // Re-open a disk quiesced on shutdown.
+            // Re-open the disk from its manifest.
             // XXX handle errors
             schema* sc = config.get_schema(r->get_space());
             assert(sc);
@@ -262,8 +335,17 @@ hyperdaemon :: datalayer :: load_state()
         }
     }
 
-    LOG(INFO) << "Datalayer state restored from quiesced state " << config.quiesce_state_id()
-              << " (loaded from file " << state_fname << ")";
+    if (config.quiesce())
+    {
+        LOG(INFO) << "Datalayer state restored from quiesced state " << config.quiesce_state_id()
+                  << " (loaded from file " << state_fname << ")";
+    }
+    else
+    {
+        LOG(INFO) << "Datalayer state restored from disk manifests after an unclean stop"
+                  << " (loaded from file " << state_fname << ")";
+    }
+
     return true;
 }
 
@@ -274,6 +356,27 @@ hyperdaemon :: datalayer :: prepare(const configuration& newconfig, const instan
     std::map<uint16_t, regionid> in_transfers = newconfig.transfers_to(us);
     std::map<uint16_t, regionid>::iterator t;
 
+    // A region that failed to inherit stays without a disk, so that it never
+    // serves a partial copy, until the coordinator deals with it.
+    for (std::set<regionid>::const_iterator f = m_inherit_failed.begin();
+            f != m_inherit_failed.end(); ++f)
+    {
+        regions.erase(*f);
+    }
+
+    // A new region that covers data we hold under other regions comes from
+    // a split or merge.  It takes that data in reconfigure(), once the old
+    // regions have been fenced.
+    for (std::set<regionid>::const_iterator r = regions.begin();
+            r != regions.end(); ++r)
+    {
+        if (!m_disks.contains(*r) &&
+            (!overlapping_disks(*r).empty() || !overlapping_stale(*r).empty()))
+        {
+            m_inherit.insert(*r);
+        }
+    }
+
     // Make sure that inbound state exists for each in-progress transfer to us.
     for (t = in_transfers.begin(); t != in_transfers.end(); ++t)
     {
@@ -298,6 +401,30 @@ hyperdaemon :: datalayer :: prepare(const configuration& newconfig, const instan
 void
 hyperdaemon :: datalayer :: reconfigure(const configuration& newconfig, const instance& us)
 {
+    hyperdisk::profiled_mutex::hold hold(&m_swap_lock);
+
+    // The regions being split or merged are fenced, so they no longer change
+    // underneath us.  A region that cannot take all of its data must not go
+    // live with part of it.  Other regions may inherit from the same disks,
+    // so failed regions are abandoned only once every region has tried.
+    std::vector<regionid> failed;
+
+    for (std::set<regionid>::iterator r = m_inherit.begin();
+            r != m_inherit.end(); ++r)
+    {
+        if (!inherit(newconfig, *r))
+        {
+            failed.push_back(*r);
+        }
+    }
+
+    m_inherit.clear();
+
+    for (size_t i = 0; i < failed.size(); ++i)
+    {
+        abandon_inherit(newconfig, us, failed[i]);
+    }
+
     // Quiesce (will quiesce multiple times if requested so).
     if (newconfig.quiesce())
     {
@@ -324,7 +451,13 @@ hyperdaemon :: datalayer :: reconfigure(const configuration& newconfig, const in
                 PLOG(ERROR) << "Could not quiesce disk " << d.key();
             }
         }
+    }
 
+    // Keep the state current so that a daemon which stops without quiescing
+    // can reopen its disks from their manifests.  Once quiesced, the state
+    // names the quiesced configuration until the daemon restarts.
+    if (!m_quiesce || newconfig.quiesce())
+    {
         if (!dump_state(newconfig, us))
         {
             // XXX fail entire host?
@@ -346,13 +479,74 @@ hyperdaemon :: datalayer :: cleanup(const configuration& newconfig, const instan
         regions.insert(t->second);
     }
 
-    for (disk_map_t::iterator d = m_disks.begin(); d != m_disks.end(); d.next())
     {
-        if (regions.find(d.key()) == regions.end())
+        hyperdisk::profiled_mutex::hold hold(&m_swap_lock);
+
+        for (disk_map_t::iterator d = m_disks.begin(); d != m_disks.end(); d.next())
         {
-            drop_disk(d.key());
+            if (regions.find(d.key()) == regions.end())
+            {
+                drop_disk(d.key());
+            }
+        }
+    }
+
+    // The coordinator has dealt with a failed inherit once the region is no
+    // longer ours, or comes back to us by transfer.  Until then, remind it
+    // every time; it ignores reports it has already acted upon.
+    std::set<regionid>::iterator f = m_inherit_failed.begin();
+
+    while (f != m_inherit_failed.end())
+    {
+        if (regions.find(*f) == regions.end() || m_disks.contains(*f))
+        {
+            m_inherit_failed.erase(f++);
+            continue;
         }
+
+        if (m_cl->inherit_fail(*f) != coordinatorlink::SUCCESS)
+        {
+            LOG(INFO) << "Could not tell the coordinator that " << *f << " failed to inherit";
+        }
+
+        ++f;
     }
+
+    // A set-aside disk is needed only while a region it would fill waits on
+    // the coordinator.  Regions that undo a reshape inherit from it in
+    // reconfigure(), before this runs.
+    stale_list_t::iterator s = m_stale.begin();
+
+    while (s != m_stale.end())
+    {
+        bool needed = false;
+
+        for (f = m_inherit_failed.begin(); f != m_inherit_failed.end(); ++f)
+        {
+            needed = needed || (f->get_subspace() == s->first.get_subspace() &&
+                                f->coord().intersects(s->first.coord()));
+        }
+
+        if (needed)
+        {
+            ++s;
+            continue;
+        }
+
+        std::ostringstream ostr;
+        ostr << s->first << ".stale";
+        s->second->drop();
+
+        if (rmdir(ostr.str().c_str()) < 0)
+        {
+            PLOG(WARNING) << "Could not remove the set-aside directory of disk " << s->first;
+        }
+
+        LOG(INFO) << "Dropped set-aside disk " << s->first;
+        s = m_stale.erase(s);
+    }
+
+    start_archive_jobs(newconfig, us);
 }
 
 void
@@ -376,7 +570,8 @@ hyperdaemon :: datalayer :: make_snapshot(const regionid& ri,
 }
 
 e::intrusive_ptr<hyperdisk::rolling_snapshot>
-hyperdaemon :: datalayer :: make_rolling_snapshot(const regionid& ri)
+hyperdaemon :: datalayer :: make_rolling_snapshot(const regionid& ri,
+                                                   hyperdisk::merkle* summary)
 {
     e::intrusive_ptr<hyperdisk::disk> r;
 
@@ -385,7 +580,59 @@ hyperdaemon :: datalayer :: make_rolling_snapshot(const regionid& ri)
         return e::intrusive_ptr<hyperdisk::rolling_snapshot>();
     }
 
-    return r->make_rolling_snapshot();
+    return r->make_rolling_snapshot(summary);
+}
+
+bool
+hyperdaemon :: datalayer :: summarize(const regionid& ri,
+                                      hyperdisk::merkle* summary)
+{
+    e::intrusive_ptr<hyperdisk::disk> r;
+
+    if (!m_disks.lookup(ri, &r))
+    {
+        return false;
+    }
+
+    return r->summarize(summary);
+}
+
+bool
+hyperdaemon :: datalayer :: reset_disk(const configuration& config, const regionid& ri)
+{
+    hyperdisk::profiled_mutex::hold hold(&m_swap_lock);
+
+    if (m_disks.contains(ri))
+    {
+        e::intrusive_ptr<hyperdisk::disk> r = set_aside(ri, ".reset");
+
+        if (!r)
+        {
+            // XXX fail this region.
+            PLOG(ERROR) << "Could not move disk " << ri << " aside to reset it";
+            return false;
+        }
+
+        r->drop();
+        std::ostringstream ostr;
+        ostr << ri << ".reset";
+
+        if (rmdir(ostr.str().c_str()) < 0)
+        {
+            PLOG(WARNING) << "Could not remove the old directory of disk " << ri;
+        }
+    }
+
+    schema* sc = config.get_schema(ri.get_space());
+    assert(sc);
+    create_disk(ri, config.disk_hasher(ri.get_subspace()), sc->attrs_sz);
+    return m_disks.contains(ri);
+}
+
+void
+hyperdaemon :: datalayer :: set_replication_manager(replication_manager* repl)
+{
+    m_repl = repl;
 }
 
 hyperdisk::returncode
@@ -437,6 +684,21 @@ hyperdaemon :: datalayer :: del(const regionid& ri,
     return r->del(backing, key);
 }
 
+hyperdisk::returncode
+hyperdaemon :: datalayer :: bulk_load(const regionid& ri,
+                                      const std::vector<hyperdisk::bulk_object>& objects,
+                                      bool unique)
+{
+    e::intrusive_ptr<hyperdisk::disk> r;
+
+    if (!m_disks.lookup(ri, &r))
+    {
+        return hyperdisk::MISSINGDISK;
+    }
+
+    return r->bulk_load(objects, unique);
+}
+
 hyperdisk::returncode
 hyperdaemon :: datalayer :: flush(const regionid& ri,
                                   size_t n,
@@ -560,6 +822,30 @@ hyperdaemon :: datalayer :: optimistic_io_thread()
             m_last_dose_of_optimism = e::time();
         }
 
+        // The coordinator's rebalancer works from these reports.
+        uint64_t now = e::time();
+
+        if (LOAD_REPORT_SECONDS > 0 &&
+            now - m_last_load_report >= LOAD_REPORT_SECONDS * 1000000000ULL)
+        {
+            report_load(now);
+        }
+
+        // A restart reopens each disk as of its last manifest.
+        if (MANIFEST_MILLIS > 0 &&
+            now - m_last_checkpoint >= MANIFEST_MILLIS * 1000000ULL)
+        {
+            for (disk_map_t::iterator d = m_disks.begin(); d != m_disks.end(); d.next())
+            {
+                if (!d.value()->checkpoint())
+                {
+                    PLOG(WARNING) << "Could not write the manifest for disk " << d.key();
+                }
+            }
+
+            m_last_checkpoint = now;
+        }
+
         (void) __sync_and_and_fetch(&m_flushed_recently, false);
 
         do
@@ -581,6 +867,7 @@ hyperdaemon :: datalayer :: flush_thread()
         for (disk_map_t::iterator d = m_disks.begin();
                 d != m_disks.end(); d.next())
         {
+            metrics::timer t(metrics::DISK_FLUSH_NANOS);
             hyperdisk::returncode ret = d.value()->flush(10000, true);
 
             if (ret == hyperdisk::SUCCESS)
@@ -589,19 +876,23 @@ hyperdaemon :: datalayer :: flush_thread()
             }
             else if (ret == hyperdisk::DIDNOTHING)
             {
+                t.cancel();
             }
             else if (ret == hyperdisk::DATAFULL || ret == hyperdisk::SEARCHFULL)
             {
+                metrics::count(metrics::DISK_MANDATORY_IO);
                 hyperdisk::returncode ioret;
                 ioret = d.value()->do_mandatory_io();
 
                 if (ioret != hyperdisk::SUCCESS && ioret != hyperdisk::DIDNOTHING)
                 {
+                    metrics::count(metrics::DISK_FLUSH_ERRORS);
                     PLOG(ERROR) << "Disk I/O returned " << ioret;
                 }
             }
             else
             {
+                metrics::count(metrics::DISK_FLUSH_ERRORS);
                 PLOG(ERROR) << "Disk flush returned " << ret;
             }
         }
@@ -617,6 +908,677 @@ hyperdaemon :: datalayer :: flush_thread()
     }
 }
 
+void
+hyperdaemon :: datalayer :: stats(std::vector<std::pair<regionid, hyperdisk::disk_stats> >* disks)
+{
+    disks->clear();
+
+    for (disk_map_t::iterator d = m_disks.begin(); d != m_disks.end(); d.next())
+    {
+        disks->push_back(std::make_pair(d.key(), hyperdisk::disk_stats()));
+        d.value()->stats(&disks->back().second);
+    }
+}
+
+void
+hyperdaemon :: datalayer :: lock_stats(std::map<std::string, hyperdisk::lockstats>* stats)
+{
+    for (disk_map_t::iterator d = m_disks.begin(); d != m_disks.end(); d.next())
+    {
+        hyperdisk::disk_stats ds;
+        d.value()->stats(&ds);
+        (*stats)["disk.shards_mutate"] += ds.shards_mutate;
+        (*stats)["disk.shards"] += ds.shards_lock;
+        (*stats)["disk.spare_shards"] += ds.spare_shards_lock;
+    }
+
+    (*stats)["datalayer.swap"] += m_swap_lock.stats();
+    (*stats)["datalayer.archive"] += m_archive_lockstats;
+}
+
+std::vector<regionid>
+hyperdaemon :: datalayer :: overlapping_disks(const regionid& ri)
+{
+    std::vector<regionid> overlapping;
+
+    for (disk_map_t::iterator d = m_disks.begin(); d != m_disks.end(); d.next())
+    {
+        if (d.key() != ri &&
+            d.key().get_subspace() == ri.get_subspace() &&
+            d.key().coord().intersects(ri.coord()))
+        {
+            overlapping.push_back(d.key());
+        }
+    }
+
+    return overlapping;
+}
+
+hyperdaemon::datalayer::stale_list_t
+hyperdaemon :: datalayer :: overlapping_stale(const regionid& ri)
+{
+    stale_list_t overlapping;
+
+    for (stale_list_t::iterator s = m_stale.begin(); s != m_stale.end(); ++s)
+    {
+        if (s->first.get_subspace() == ri.get_subspace() &&
+            s->first.coord().intersects(ri.coord()))
+        {
+            overlapping.push_back(*s);
+        }
+    }
+
+    return overlapping;
+}
+
+bool
+hyperdaemon :: datalayer :: inherit(const configuration& config, const regionid& ri)
+{
+    e::intrusive_ptr<hyperdisk::disk> to;
+
+    if (!m_disks.lookup(ri, &to))
+    {
+        return false;
+    }
+
+    // Live disks first, then the set-aside disks, newest first.  Each object
+    // comes from the first source that covers it.  The live disks are
+    // disjoint, so a set-aside disk only fills in where none of them reaches.
+    stale_list_t from;
+    std::vector<regionid> live = overlapping_disks(ri);
+
+    for (size_t i = 0; i < live.size(); ++i)
+    {
+        e::intrusive_ptr<hyperdisk::disk> d;
+
+        if (!m_disks.lookup(live[i], &d))
+        {
+            LOG(ERROR) << "Disk " << live[i] << " went away before " << ri << " could inherit from it";
+            return false;
+        }
+
+        from.push_back(std::make_pair(live[i], d));
+    }
+
+    stale_list_t stale = overlapping_stale(ri);
+    from.insert(from.end(), stale.begin(), stale.end());
+    hyperspacehashing::prefix::hasher hasher = config.repl_hasher(ri.get_subspace());
+    std::vector<regionid> covered;
+    uint64_t inherited = 0;
+
+    for (stale_list_t::iterator f = from.begin(); f != from.end(); ++f)
+    {
+        if (!f->second->flush_all())
+        {
+            LOG(ERROR) << "Could not flush disk " << f->first << " to split it into " << ri;
+            return false;
+        }
+
+        // With the log flushed, the rolling snapshot is just the shards.  The
+        // snapshot keeps them mapped while a batch refers to them, and the
+        // new disk's log stays empty so bulk_load copies the objects out.
+        e::intrusive_ptr<hyperdisk::rolling_snapshot> snap = f->second->make_rolling_snapshot();
+        std::vector<hyperdisk::bulk_object> batch;
+        size_t batch_bytes = 0;
+        bool more = true;
+
+        while (more)
+        {
+            more = snap->valid();
+
+            if (more && snap->has_value())
+            {
+                hyperspacehashing::prefix::coordinate c = hasher.hash(snap->key(), snap->value());
+                bool take = ri.coord().contains(c);
+
+                for (size_t i = 0; take && i < covered.size(); ++i)
+                {
+                    take = !covered[i].coord().contains(c);
+                }
+
+                if (take)
+                {
+                    batch.push_back(hyperdisk::bulk_object(std::tr1::shared_ptr<e::buffer>(),
+                                                           snap->key(), snap->value(),
+                                                           snap->version()));
+                    batch_bytes += snap->key().size();
+
+                    for (size_t i = 0; i < snap->value().size(); ++i)
+                    {
+                        batch_bytes += snap->value()[i].size();
+                    }
+                }
+            }
+
+            if (more)
+            {
+                snap->next();
+            }
+
+            if (batch.empty() || (more && batch_bytes < XFER_BULK_BYTES))
+            {
+                continue;
+            }
+
+            // Each object comes from one source, so keys are unique.
+            hyperdisk::returncode ret = to->bulk_load(batch, true);
+
+            if (ret != hyperdisk::SUCCESS)
+            {
+                LOG(ERROR) << "Could not load disk " << ri << " from " << f->first
+                           << ": HyperDisk returned " << ret;
+                return false;
+            }
+
+            inherited += batch.size();
+            batch.clear();
+            batch_bytes = 0;
+        }
+
+        covered.push_back(f->first);
+    }
+
+    LOG(INFO) << "Disk " << ri << " inherited " << inherited << " objects from "
+              << live.size() << " overlapping disks and " << stale.size() << " set-aside disks";
+    return true;
+}
+
+void
+hyperdaemon :: datalayer :: abandon_inherit(const configuration& config,
+                                            const instance& us,
+                                            const regionid& ri)
+{
+    LOG(ERROR) << "Disk " << ri << " could not inherit its objects; it will not "
+               << "serve until the coordinator undoes the split or merge or moves it";
+    e::intrusive_ptr<hyperdisk::disk> d;
+
+    if (m_disks.lookup(ri, &d))
+    {
+        drop_disk(ri);
+
+        if (d->drop() != hyperdisk::SUCCESS)
+        {
+            PLOG(WARNING) << "Could not remove the partial disk " << ri;
+        }
+    }
+
+    m_inherit_failed.insert(ri);
+
+    // The regions split or merged away are not in the configuration, so
+    // their disks would be dropped in cleanup().  Keep them out of the map,
+    // where nothing serves from them, and out of the way of new disks.
+    std::set<regionid> regions = config.regions_for(us);
+    std::vector<regionid> from = overlapping_disks(ri);
+
+    for (size_t i = 0; i < from.size(); ++i)
+    {
+        if (regions.find(from[i]) != regions.end())
+        {
+            continue;
+        }
+
+        e::intrusive_ptr<hyperdisk::disk> s = set_aside(from[i], ".stale");
+
+        if (!s)
+        {
+            PLOG(ERROR) << "Could not set disk " << from[i] << " aside; "
+                        << "objects of " << ri << " it holds may be lost";
+            continue;
+        }
+
+        LOG(INFO) << "Set disk " << from[i] << " aside for " << ri;
+        m_stale.push_front(std::make_pair(from[i], s));
+    }
+}
+
+e::intrusive_ptr<hyperdisk::disk>
+hyperdaemon :: datalayer :: set_aside(const regionid& ri, const char* suffix)
+{
+    e::intrusive_ptr<hyperdisk::disk> d;
+
+    if (!m_disks.lookup(ri, &d))
+    {
+        return e::intrusive_ptr<hyperdisk::disk>();
+    }
+
+    // Threads that already hold the disk keep working on its shards through
+    // the directory's file descriptor, which stays with it when it is
+    // renamed.  Once out of the map, no other thread finds it.
+    std::ostringstream ostr;
+    ostr << ri;
+    std::string path(ostr.str());
+    std::string aside(path + suffix);
+
+    if (rename(path.c_str(), aside.c_str()) < 0)
+    {
+        return e::intrusive_ptr<hyperdisk::disk>();
+    }
+
+    drop_disk(ri);
+    return d;
+}
+
+void
+hyperdaemon :: datalayer :: start_archive_jobs(const configuration& config, const instance& us)
+{
+    // Stop jobs the configuration no longer asks for, and join the jobs that
+    // are done.  A region that failed every attempt is unclaimed again, so
+    // this configuration retries it.
+    std::list<std::tr1::shared_ptr<archive_job> >::iterator j = m_archive_jobs.begin();
+
+    while (j != m_archive_jobs.end())
+    {
+        archive_job* job = j->get();
+
+        if (job->id != (job->restore ? config.restore_id() : config.backup_id()))
+        {
+            job->cancelled = true;
+        }
+
+        if (__sync_fetch_and_add(&job->running, 0) > 0)
+        {
+            ++j;
+            continue;
+        }
+
+        for (size_t i = 0; i < job->threads.size(); ++i)
+        {
+            job->threads[i]->join();
+        }
+
+        if (!job->cancelled)
+        {
+            std::set<regionid>* claimed = job->restore ? &m_restore_claimed : &m_backup_claimed;
+
+            for (size_t i = 0; i < job->failed.size(); ++i)
+            {
+                claimed->erase(job->failed[i]);
+            }
+        }
+
+        j = m_archive_jobs.erase(j);
+    }
+
+    if (config.backup_id() != m_backup_id)
+    {
+        m_backup_id = config.backup_id();
+        m_backup_claimed.clear();
+    }
+
+    if (config.restore_id() != m_restore_id)
+    {
+        m_restore_id = config.restore_id();
+        m_restore_claimed.clear();
+    }
+
+    std::set<regionid> regions = config.regions_for(us);
+    std::vector<std::tr1::shared_ptr<archive_job> > jobs;
+
+    if (!m_backup_id.empty())
+    {
+        std::tr1::shared_ptr<archive_job> job(new archive_job(config, m_backup_id, false, &m_archive_lockstats));
+
+        // The tail has applied every write that was acknowledged to a client.
+        // If the tail moves mid-backup, the new tail backs the region up too,
+        // and the coordinator keeps whichever finishes first.
+        for (std::set<regionid>::const_iterator r = regions.begin();
+                r != regions.end(); ++r)
+        {
+            if (config.instancefor(config.tailof(*r)) == us &&
+                m_backup_claimed.find(*r) == m_backup_claimed.end())
+            {
+                job->regions.push_back(*r);
+            }
+        }
+
+        po6::pathname dir = po6::join(m_base.get(), ("backup-" + m_backup_id).c_str());
+
+        if (!job->regions.empty() && mkdir(dir.get(), S_IRWXU) < 0 && errno != EEXIST)
+        {
+            PLOG(ERROR) << "Could not create backup directory " << dir;
+        }
+        else if (!job->regions.empty())
+        {
+            LOG(INFO) << "Backing up " << job->regions.size() << " regions to " << dir;
+            m_backup_claimed.insert(job->regions.begin(), job->regions.end());
+            jobs.push_back(job);
+        }
+    }
+
+    if (!m_restore_id.empty())
+    {
+        std::tr1::shared_ptr<archive_job> job(new archive_job(config, m_restore_id, true, &m_archive_lockstats));
+
+        for (std::set<regionid>::const_iterator r = regions.begin();
+                r != regions.end(); ++r)
+        {
+            if (m_restore_claimed.find(*r) == m_restore_claimed.end())
+            {
+                job->regions.push_back(*r);
+            }
+        }
+
+        if (!job->regions.empty())
+        {
+            LOG(INFO) << "Restoring " << job->regions.size() << " regions from backup " << m_restore_id;
+            m_restore_claimed.insert(job->regions.begin(), job->regions.end());
+            jobs.push_back(job);
+        }
+    }
+
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        size_t threads = std::min<size_t>(std::max<size_t>(1, ARCHIVE_THREADS), jobs[i]->regions.size());
+        jobs[i]->running = threads;
+
+        for (size_t k = 0; k < threads; ++k)
+        {
+            std::tr1::shared_ptr<po6::threads::thread>
+                t(new po6::threads::thread(std::tr1::bind(&datalayer::archive_thread, this, jobs[i].get())));
+            t->start();
+            jobs[i]->threads.push_back(t);
+        }
+
+        m_archive_jobs.push_back(jobs[i]);
+    }
+}
+
+void
+hyperdaemon :: datalayer :: archive_thread(archive_job* job)
+{
+    while (!m_shutdown && !job->cancelled)
+    {
+        size_t i = __sync_fetch_and_add(&job->next, 1);
+
+        if (i >= job->regions.size())
+        {
+            break;
+        }
+
+        const regionid& ri(job->regions[i]);
+        uint64_t objects = 0;
+        uint64_t watermark = 0;
+        unsigned int attempts = std::max(1U, static_cast<unsigned int>(ARCHIVE_ATTEMPTS));
+        bool done = false;
+
+        // Loading an archive over live data would leave neither the backup
+        // nor the live state, so the coordinator abandons the restore.
+        if (job->restore && !empty_region(ri))
+        {
+            LOG(ERROR) << "Refusing to restore " << ri << " from backup " << job->id
+                       << " because the region holds data";
+
+            if (m_cl->restore_fail(job->id, ri) != coordinatorlink::SUCCESS)
+            {
+                LOG(INFO) << "Could not tell the coordinator about restore of " << ri;
+            }
+
+            continue;
+        }
+
+        for (unsigned int attempt = 0; !done && attempt < attempts; ++attempt)
+        {
+            if (attempt > 0)
+            {
+                LOG(INFO) << "Retrying " << (job->restore ? "restore" : "backup") << " of " << ri;
+
+                for (unsigned int s = 0; !m_shutdown && !job->cancelled && s < attempt * 4; ++s)
+                {
+                    e::sleep_ms(0, 250);
+                }
+
+                if (m_shutdown || job->cancelled)
+                {
+                    break;
+                }
+            }
+
+            done = job->restore ? restore_region(job->config, job->id, ri, &objects)
+                                : backup_region(job->id, ri, &objects, &watermark);
+        }
+
+        // Empty the region again, so that the retry passes the check above.
+        if (!done && job->restore && !reset_disk(job->config, ri))
+        {
+            LOG(ERROR) << "Could not empty " << ri << " after failing to restore it";
+        }
+
+        if (!done)
+        {
+            hyperdisk::profiled_mutex::hold hold(&job->lock);
+            job->failed.push_back(ri);
+            continue;
+        }
+
+        coordinatorlink::returncode rc;
+
+        if (job->restore)
+        {
+            rc = m_cl->restore_done(job->id, ri, objects);
+        }
+        else
+        {
+            rc = m_cl->backup_done(job->id, ri, objects, watermark);
+        }
+
+        if (rc != coordinatorlink::SUCCESS)
+        {
+            LOG(INFO) << "Could not tell the coordinator about " << (job->restore ? "restore" : "backup")
+                      << " of " << ri;
+        }
+    }
+
+    __sync_fetch_and_sub(&job->running, 1);
+}
+
+bool
+hyperdaemon :: datalayer :: backup_region(const std::string& backup_id,
+                                          const regionid& ri,
+                                          uint64_t* objects,
+                                          uint64_t* watermark)
+{
+    e::intrusive_ptr<hyperdisk::disk> d;
+
+    if (!m_disks.lookup(ri, &d) || !d->flush_all())
+    {
+        LOG(ERROR) << "Could not flush disk " << ri << " to back it up";
+        return false;
+    }
+
+    // The shards hold a prefix of the region's history.  Stopping where the
+    // rolling snapshot turns to the log gives a consistent copy, while new
+    // writes carry on into the log.
+    e::intrusive_ptr<hyperdisk::rolling_snapshot> snap = d->make_rolling_snapshot();
+    std::ostringstream ostr;
+    ostr << ri;
+    std::string label(ostr.str());
+    po6::pathname path = archive_path(backup_id, ri);
+    hyperdisk::archive_writer archive;
+
+    if (!archive.open(path, e::slice(label.data(), label.size())))
+    {
+        PLOG(ERROR) << "Could not create backup archive " << path;
+        return false;
+    }
+
+    for (; !m_shutdown && snap->valid() && snap->in_snapshot(); snap->next())
+    {
+        if (!snap->has_value())
+        {
+            continue;
+        }
+
+        if (!archive.append(snap->key(), snap->value(), snap->version()))
+        {
+            PLOG(ERROR) << "Could not write backup archive " << path;
+            return false;
+        }
+    }
+
+    if (m_shutdown || !archive.close())
+    {
+        PLOG(ERROR) << "Could not finish backup archive " << path;
+        return false;
+    }
+
+    *objects = archive.objects();
+    *watermark = archive.watermark();
+    LOG(INFO) << "Backed up " << *objects << " objects of " << ri
+              << " through version " << *watermark;
+    return true;
+}
+
+bool
+hyperdaemon :: datalayer :: empty_region(const regionid& ri)
+{
+    e::intrusive_ptr<hyperdisk::rolling_snapshot> snap = make_rolling_snapshot(ri);
+
+    if (!snap)
+    {
+        return false;
+    }
+
+    while (snap->valid() && !snap->has_value())
+    {
+        snap->next();
+    }
+
+    return !snap->valid() && !(m_repl && m_repl->has_keyholders(ri));
+}
+
+bool
+hyperdaemon :: datalayer :: restore_region(const configuration& config,
+                                           const std::string& backup_id,
+                                           const regionid& ri,
+                                           uint64_t* objects)
+{
+    po6::pathname path = archive_path(backup_id, ri);
+    std::ostringstream ostr;
+    ostr << ri;
+    hyperdisk::archive_reader archive;
+
+    if (!archive.open(path))
+    {
+        PLOG(ERROR) << "Could not open backup archive " << path;
+        return false;
+    }
+
+    if (archive.label() != ostr.str())
+    {
+        LOG(ERROR) << "Backup archive " << path << " holds " << archive.label()
+                   << " and not " << ri;
+        return false;
+    }
+
+    // Start from a new disk, without even the deletions an empty one may
+    // remember, or what an earlier attempt loaded.
+    if (!reset_disk(config, ri))
+    {
+        LOG(ERROR) << "Could not create a new disk to restore " << ri << " into";
+        return false;
+    }
+
+    std::vector<hyperdisk::bulk_object> batch;
+    size_t batch_bytes = 0;
+    e::slice key;
+    std::vector<e::slice> value;
+    uint64_t version;
+    bool more = true;
+
+    while (more)
+    {
+        more = archive.next(&key, &value, &version);
+
+        if (more)
+        {
+            // The archive reuses its buffers, and the disk may need the
+            // object to outlive this batch if it lands in the log.
+            size_t sz = key.size();
+
+            for (size_t i = 0; i < value.size(); ++i)
+            {
+                sz += value[i].size();
+            }
+
+            std::tr1::shared_ptr<e::buffer> backing(e::buffer::create(sz));
+            uint8_t* ptr = backing->data();
+            memmove(ptr, key.data(), key.size());
+            e::slice k(ptr, key.size());
+            ptr += key.size();
+
+            for (size_t i = 0; i < value.size(); ++i)
+            {
+                memmove(ptr, value[i].data(), value[i].size());
+                value[i] = e::slice(ptr, value[i].size());
+                ptr += value[i].size();
+            }
+
+            batch.push_back(hyperdisk::bulk_object(backing, k, value, version));
+            batch_bytes += sz;
+        }
+
+        if (batch.empty() || (more && batch_bytes < XFER_BULK_BYTES))
+        {
+            continue;
+        }
+
+        // Keys in the archive are unique and the disk started empty, but a
+        // client that writes despite the restore must not leave a key twice.
+        hyperdisk::returncode ret = bulk_load(ri, batch, false);
+
+        if (ret != hyperdisk::SUCCESS)
+        {
+            LOG(ERROR) << "Could not restore disk " << ri << " from " << path
+                       << ": HyperDisk returned " << ret;
+            return false;
+        }
+
+        batch.clear();
+        batch_bytes = 0;
+    }
+
+    if (archive.error())
+    {
+        LOG(ERROR) << "Backup archive " << path << " is corrupt; "
+                   << ri << " is only partially restored";
+        return false;
+    }
+
+    *objects = archive.objects();
+    LOG(INFO) << "Restored " << *objects << " objects of " << ri
+              << " through version " << archive.watermark();
+    return true;
+}
+
+po6::pathname
+hyperdaemon :: datalayer :: archive_path(const std::string& backup_id,
+                                         const regionid& ri)
+{
+    std::ostringstream ostr;
+    ostr << "backup-" << backup_id << "/" << ri << ".hdb";
+    return po6::join(m_base.get(), ostr.str().c_str());
+}
+
+void
+hyperdaemon :: datalayer :: report_load(uint64_t now)
+{
+    uint64_t millis = (now - m_last_load_report) / 1000000;
+    m_last_load_report = now;
+
+    for (disk_map_t::iterator d = m_disks.begin(); d != m_disks.end(); d.next())
+    {
+        uint64_t ops;
+        uint64_t bytes;
+        d.value()->load(&ops, &bytes);
+
+        if (m_cl->region_load(d.key(), ops, bytes, millis) != coordinatorlink::SUCCESS)
+        {
+            LOG(INFO) << "Could not report load to the coordinator";
+            break;
+        }
+    }
+}
+
 void
 hyperdaemon :: datalayer :: create_disk(const regionid& ri,
                                         const hyperspacehashing::mask::hasher& hasher,
@@ -638,6 +1600,11 @@ hyperdaemon :: datalayer :: create_disk(const regionid& ri,
         return;
     }
 
+    if (LOW_LATENCY)
+    {
+        d->prefault();
+    }
+
     if (m_disks.insert(ri, d))
     {
         LOG(INFO) << "Created disk " << ri << " with " << num_columns << " columns";
@@ -676,6 +1643,11 @@ hyperdaemon :: datalayer :: open_disk(const regionid& ri,
         return;
     }
 
+    if (LOW_LATENCY)
+    {
+        d->prefault();
+    }
+
     if (m_disks.insert(ri, d))
     {
         LOG(INFO) << "Opened disk " << ri << " with " << num_columns << " columns";
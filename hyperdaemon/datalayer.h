@@ -32,7 +32,9 @@
 #include <list>
 #include <map>
 #include <set>
+#include <string>
 #include <tr1/memory>
+#include <utility>
 #include <vector>
 
 // po6
@@ -45,6 +47,7 @@
 
 // HyperDisk
 #include "hyperdisk/hyperdisk/disk.h"
+#include "hyperdisk/hyperdisk/profiled_mutex.h"
 #include "hyperdisk/hyperdisk/returncode.h"
 
 // HyperDex
@@ -58,6 +61,10 @@ class coordinatorlink;
 class instance;
 class regionid;
 }
+namespace hyperdaemon
+{
+class replication_manager;
+}
 
 namespace hyperdaemon
 {
@@ -75,7 +82,19 @@ class datalayer
         void shutdown();
         e::intrusive_ptr<hyperdisk::snapshot> make_snapshot(const hyperdex::regionid& ri,
                                                             const hyperspacehashing::search& terms);
-        e::intrusive_ptr<hyperdisk::rolling_snapshot> make_rolling_snapshot(const hyperdex::regionid& ri);
+        e::intrusive_ptr<hyperdisk::rolling_snapshot> make_rolling_snapshot(const hyperdex::regionid& ri,
+                                                                            hyperdisk::merkle* summary = NULL);
+        // Summarize everything the region's disk holds.  Returns false if
+        // there is no disk or it could not be flushed.
+        bool summarize(const hyperdex::regionid& ri, hyperdisk::merkle* summary);
+        // Replace the region's disk with an empty one.  The old disk is taken
+        // out of the map and moved aside before the new one is created, so
+        // callers that still hold it never touch the new disk's files.
+        // Returns false if the old disk could not be moved aside or the new
+        // one could not be created.
+        bool reset_disk(const hyperdex::configuration& config, const hyperdex::regionid& ri);
+        // Restores check the replication layer for writes in flight.
+        void set_replication_manager(replication_manager* repl);
 
     // Key-Value store operations.
     public:
@@ -93,14 +112,29 @@ class datalayer
         hyperdisk::returncode del(const hyperdex::regionid& ri,
                                   std::tr1::shared_ptr<e::buffer> backing,
                                   const e::slice& key);
+        // May return SUCCESS, WRONGARITY, SPLITFAILED or MISSINGDISK.
+        hyperdisk::returncode bulk_load(const hyperdex::regionid& ri,
+                                        const std::vector<hyperdisk::bulk_object>& objects,
+                                        bool unique);
         // May return SUCCESS or DIDNOTHING.
         hyperdisk::returncode flush(const hyperdex::regionid& ri, size_t n, bool nonblocking);
         hyperdisk::returncode do_mandatory_io(const hyperdex::regionid& ri);
 
+    // Reporting.
+    public:
+        void stats(std::vector<std::pair<hyperdex::regionid, hyperdisk::disk_stats> >* disks);
+        // Summed over every disk.
+        void lock_stats(std::map<std::string, hyperdisk::lockstats>* stats);
+
     private:
         static uint64_t regionid_hash(const hyperdex::regionid& r) { return r.hash(); }
         typedef e::lockfree_hash_map<hyperdex::regionid, e::intrusive_ptr<hyperdisk::disk>, regionid_hash>
                 disk_map_t;
+        typedef std::list<std::pair<hyperdex::regionid, e::intrusive_ptr<hyperdisk::disk> > >
+                stale_list_t;
+
+    private:
+        class archive_job;
 
     private:
         datalayer(const datalayer&);
@@ -108,32 +142,100 @@ class datalayer
     private:
         void optimistic_io_thread();
         void flush_thread();
+        // Tell the coordinator how busy each region has been.
+        void report_load(uint64_t now);
         // Create a blank disk.
         void create_disk(const hyperdex::regionid& ri,
                          const hyperspacehashing::mask::hasher& hasher,
                          uint16_t num_columns);
-        // Re-open a disk that was quiesced.
+        // Re-open a disk from its manifest.  An empty "quiesce_state_id"
+        // accepts whatever manifest the disk has.
         void open_disk(const hyperdex::regionid& ri,
                        const hyperspacehashing::mask::hasher& hasher,
                        uint16_t num_columns,
                        const std::string& quiesce_state_id);
         void drop_disk(const hyperdex::regionid& ri);
+        // Regions (other than "ri") in the same subspace whose disks hold
+        // objects "ri" covers.
+        std::vector<hyperdex::regionid> overlapping_disks(const hyperdex::regionid& ri);
+        // Set-aside disks that hold objects "ri" covers, newest first.
+        stale_list_t overlapping_stale(const hyperdex::regionid& ri);
+        // Fill the (empty) disk for "ri" with the objects it covers from the
+        // disks of overlapping regions, and then from set-aside disks for
+        // what no live disk covers.  This is how a replica follows a region
+        // split or merge without a transfer.  Returns false if any source
+        // could not be read or the disk could not take the objects.
+        bool inherit(const hyperdex::configuration& config, const hyperdex::regionid& ri);
+        // Undo our half of a split or merge after inherit() fails: drop the
+        // half-filled disk for "ri" and set aside the disks it was filled
+        // from, until the coordinator undoes the reshape or moves "ri".
+        void abandon_inherit(const hyperdex::configuration& config,
+                             const hyperdex::instance& us,
+                             const hyperdex::regionid& ri);
+        // Take the disk out of the map and move its directory to "ri" plus
+        // "suffix", so that a new disk for "ri" gets a directory of its own.
+        // Returns NULL, and leaves the disk in place, if it cannot be moved.
+        e::intrusive_ptr<hyperdisk::disk> set_aside(const hyperdex::regionid& ri,
+                                                    const char* suffix);
+        // Start archiving every region that the configuration's backup or
+        // restore covers and no job has claimed yet.  That is every region
+        // when a backup or restore begins, a region whose tail moved to us
+        // mid-backup, and a region whose job failed.  The work happens on
+        // ARCHIVE_THREADS threads per job, one region at a time each, while
+        // the regions keep serving requests.
+        void start_archive_jobs(const hyperdex::configuration& config, const hyperdex::instance& us);
+        void archive_thread(archive_job* job);
+        bool backup_region(const std::string& backup_id, const hyperdex::regionid& ri,
+                           uint64_t* objects, uint64_t* watermark);
+        // A restore replaces the region wholesale, so it is only allowed into
+        // a region with no objects and no writes in flight.
+        bool empty_region(const hyperdex::regionid& ri);
+        // Load the archive into a new disk for the region.
+        bool restore_region(const hyperdex::configuration& config,
+                            const std::string& backup_id, const hyperdex::regionid& ri,
+                            uint64_t* objects);
+        po6::pathname archive_path(const std::string& backup_id, const hyperdex::regionid& ri);
 
     private:
         datalayer& operator = (const datalayer&);
 
     private:
         hyperdex::coordinatorlink* m_cl;
+        hyperdaemon::replication_manager* m_repl;
         volatile bool m_shutdown;
         po6::pathname m_base;
         po6::threads::thread m_optimistic_io_thread;
         std::vector<std::tr1::shared_ptr<po6::threads::thread> > m_flush_threads;
         disk_map_t m_disks;
+        // Held while a disk is swapped out of m_disks, and while reconfiguring
+        // walks the disks to inherit, quiesce or drop them.
+        hyperdisk::profiled_mutex m_swap_lock;
         std::list<hyperdex::regionid> m_preallocate_rr;
         uint64_t m_last_preallocation;
         std::list<hyperdex::regionid> m_optimistic_rr;
         uint64_t m_last_dose_of_optimism;
+        uint64_t m_last_load_report;
+        uint64_t m_last_checkpoint;
         volatile bool m_flushed_recently;
+        // Regions created by prepare() that overlap disks we already have.
+        // Only touched by the thread that reconfigures.
+        std::set<hyperdex::regionid> m_inherit;
+        // Regions whose inherit() failed and that we still serve without a
+        // disk, and the disks they would have been filled from (newest
+        // first).  Both wait on the coordinator, which we remind on every
+        // reconfiguration.  Only touched by the thread that reconfigures.
+        std::set<hyperdex::regionid> m_inherit_failed;
+        stale_list_t m_stale;
+        // The backup and restore under way, the regions a job has claimed
+        // for each, and the jobs that have yet to be joined.  Only touched by
+        // the thread that reconfigures.
+        std::string m_backup_id;
+        std::set<hyperdex::regionid> m_backup_claimed;
+        std::string m_restore_id;
+        std::set<hyperdex::regionid> m_restore_claimed;
+        // Shared by the locks of every archive job, so it outlives them.
+        hyperdisk::lockstats m_archive_lockstats;
+        std::list<std::tr1::shared_ptr<archive_job> > m_archive_jobs;
 
     private:
         // Shutdown and restart.
@@ -0,0 +1,330 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <algorithm>
+#include <tr1/unordered_map>
+#include <utility>
+
+// Google CityHash
+#include <city.h>
+
+// HyperDaemon
+#include "hyperdaemon/hotkeys.h"
+#include "hyperdaemon/runtimeconfig.h"
+
+class hyperdaemon::hotkeys::entry
+{
+    public:
+        entry() : space(0), hash(0), key(), count(0), error(0) {}
+
+    public:
+        uint32_t space;
+        uint64_t hash;
+        std::string key;
+        uint64_t count;
+        // How many of "count" may belong to keys this entry has replaced.
+        uint64_t error;
+};
+
+// One worker's counters, kept as a min-heap on count so that the entry to
+// replace is always at the root.  Only the owner and dump take the lock.
+class hyperdaemon::hotkeys::summary
+{
+    public:
+        summary() : lock(&s_lockstats), heap(), index(), sampled(0) {}
+
+    public:
+        // Restore the heap after heap[pos].count grew.
+        void sift_down(size_t pos);
+        void sift_up(size_t pos);
+
+    public:
+        hyperdisk::profiled_mutex lock;
+        std::vector<entry> heap;
+        // Maps a key's hash to its position in the heap.
+        std::tr1::unordered_map<uint64_t, size_t> index;
+        uint64_t sampled;
+
+    private:
+        void swap(size_t a, size_t b);
+
+    private:
+        summary(const summary&);
+        summary& operator = (const summary&);
+};
+
+void
+hyperdaemon :: hotkeys :: summary :: sift_down(size_t pos)
+{
+    while (true)
+    {
+        size_t smallest = pos;
+        size_t left = 2 * pos + 1;
+        size_t right = 2 * pos + 2;
+
+        if (left < heap.size() && heap[left].count < heap[smallest].count)
+        {
+            smallest = left;
+        }
+
+        if (right < heap.size() && heap[right].count < heap[smallest].count)
+        {
+            smallest = right;
+        }
+
+        if (smallest == pos)
+        {
+            return;
+        }
+
+        swap(pos, smallest);
+        pos = smallest;
+    }
+}
+
+void
+hyperdaemon :: hotkeys :: summary :: sift_up(size_t pos)
+{
+    while (pos > 0 && heap[pos].count < heap[(pos - 1) / 2].count)
+    {
+        swap(pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
+}
+
+void
+hyperdaemon :: hotkeys :: summary :: swap(size_t a, size_t b)
+{
+    // Swap field by field; copying the keys would allocate.
+    std::swap(heap[a].space, heap[b].space);
+    std::swap(heap[a].hash, heap[b].hash);
+    heap[a].key.swap(heap[b].key);
+    std::swap(heap[a].count, heap[b].count);
+    std::swap(heap[a].error, heap[b].error);
+    index[heap[a].hash] = a;
+    index[heap[b].hash] = b;
+}
+
+hyperdisk::lockstats hyperdaemon::hotkeys::s_lockstats;
+hyperdisk::profiled_mutex hyperdaemon::hotkeys::s_summaries_lock;
+std::vector<hyperdaemon::hotkeys::summary*> hyperdaemon::hotkeys::s_summaries;
+__thread hyperdaemon::hotkeys::summary* hyperdaemon::hotkeys::t_summary = NULL;
+__thread uint64_t hyperdaemon::hotkeys::t_countdown = 0;
+
+static void
+json_string(std::ostream& out, const std::string& s)
+{
+    static const char hex[] = "0123456789abcdef";
+    out << "\"";
+
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        unsigned char c = s[i];
+
+        if (c == '"' || c == '\\')
+        {
+            out << '\\' << c;
+        }
+        else if (c >= 0x20 && c < 0x7f)
+        {
+            out << c;
+        }
+        else
+        {
+            out << "\\u00" << hex[c >> 4] << hex[c & 0xf];
+        }
+    }
+
+    out << "\"";
+}
+
+void
+hyperdaemon :: hotkeys :: observe(uint32_t space, const e::slice& key)
+{
+    unsigned int every = HOTKEY_SAMPLE;
+
+    if (every == 0 || HOTKEY_SLOTS == 0)
+    {
+        return;
+    }
+
+    if (t_countdown > 0)
+    {
+        --t_countdown;
+        return;
+    }
+
+    t_countdown = every - 1;
+    const char* data = reinterpret_cast<const char*>(key.data());
+    uint64_t hash = CityHash64WithSeed(data, key.size(), space);
+    summary* s = local();
+    hyperdisk::profiled_mutex::hold hold(&s->lock);
+    ++s->sampled;
+    std::tr1::unordered_map<uint64_t, size_t>::iterator it = s->index.find(hash);
+
+    if (it != s->index.end())
+    {
+        ++s->heap[it->second].count;
+        s->sift_down(it->second);
+        return;
+    }
+
+    size_t slot = s->heap.size();
+
+    if (slot < HOTKEY_SLOTS)
+    {
+        s->heap.push_back(entry());
+    }
+    else
+    {
+        // Replace the least-counted key.  Whatever it had is now an upper
+        // bound on how much of the count is not the new key's.  Reusing its
+        // string avoids an allocation unless the new key is longer.
+        slot = 0;
+        s->index.erase(s->heap[slot].hash);
+    }
+
+    entry& ent(s->heap[slot]);
+    ent.error = ent.count;
+    ++ent.count;
+    ent.space = space;
+    ent.hash = hash;
+    ent.key.assign(data, key.size());
+    s->index[hash] = slot;
+
+    if (slot == 0)
+    {
+        s->sift_down(slot);
+    }
+    else
+    {
+        s->sift_up(slot);
+    }
+}
+
+bool
+hyperdaemon :: hotkeys :: hotter(const entry& lhs, const entry& rhs)
+{
+    return lhs.count > rhs.count;
+}
+
+// A key missing from a full summary may still have drawn as many samples as
+// that summary's smallest counter, so the merge adds those to its count and
+// to its error.
+void
+hyperdaemon :: hotkeys :: dump(std::ostream& out)
+{
+    std::vector<summary*> summaries;
+
+    {
+        hyperdisk::profiled_mutex::hold hold(&s_summaries_lock);
+        summaries = s_summaries;
+    }
+
+    typedef std::map<std::pair<uint32_t, uint64_t>, std::pair<entry, uint64_t> > merged_t;
+    merged_t merged;
+    uint64_t sampled = 0;
+    uint64_t floors = 0;
+
+    for (size_t i = 0; i < summaries.size(); ++i)
+    {
+        std::vector<entry> heap;
+        uint64_t floor;
+
+        {
+            hyperdisk::profiled_mutex::hold hold(&summaries[i]->lock);
+            heap = summaries[i]->heap;
+            sampled += summaries[i]->sampled;
+        }
+
+        floor = !heap.empty() && heap.size() >= HOTKEY_SLOTS ? heap[0].count : 0;
+        floors += floor;
+
+        for (size_t j = 0; j < heap.size(); ++j)
+        {
+            std::pair<entry, uint64_t>& m(merged[std::make_pair(heap[j].space, heap[j].hash)]);
+
+            if (m.first.count == 0)
+            {
+                m.first.space = heap[j].space;
+                m.first.hash = heap[j].hash;
+                m.first.key = heap[j].key;
+            }
+
+            m.first.count += heap[j].count;
+            m.first.error += heap[j].error;
+            // The floors of the summaries that hold this key.
+            m.second += floor;
+        }
+    }
+
+    std::vector<entry> entries;
+
+    for (merged_t::iterator it = merged.begin(); it != merged.end(); ++it)
+    {
+        entries.push_back(it->second.first);
+        entries.back().count += floors - it->second.second;
+        entries.back().error += floors - it->second.second;
+    }
+
+    std::sort(entries.begin(), entries.end(), hotter);
+    entries.resize(std::min<size_t>(entries.size(), HOTKEY_SLOTS));
+    out << "{\"sample\": " << static_cast<unsigned int>(HOTKEY_SAMPLE)
+        << ", \"sampled\": " << sampled
+        << ", \"keys\": [";
+
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        out << (i ? ", " : "") << "{\"space\": " << entries[i].space << ", \"key\": ";
+        json_string(out, entries[i].key);
+        out << ", \"count\": " << entries[i].count
+            << ", \"error\": " << entries[i].error << "}";
+    }
+
+    out << "]}";
+}
+
+void
+hyperdaemon :: hotkeys :: lock_stats(std::map<std::string, hyperdisk::lockstats>* stats)
+{
+    (*stats)["hotkeys.summaries"] += s_lockstats;
+    (*stats)["hotkeys.registry"] += s_summaries_lock.stats();
+}
+
+hyperdaemon::hotkeys::summary*
+hyperdaemon :: hotkeys :: local()
+{
+    if (!t_summary)
+    {
+        t_summary = new summary();
+        hyperdisk::profiled_mutex::hold hold(&s_summaries_lock);
+        s_summaries.push_back(t_summary);
+    }
+
+    return t_summary;
+}
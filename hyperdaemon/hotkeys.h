@@ -0,0 +1,83 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef hyperdaemon_hotkeys_h_
+#define hyperdaemon_hotkeys_h_
+
+// C
+#include <stdint.h>
+
+// C++
+#include <iostream>
+
+// STL
+#include <map>
+#include <string>
+#include <vector>
+
+// e
+#include <e/slice.h>
+
+// HyperDisk
+#include "hyperdisk/hyperdisk/profiled_mutex.h"
+
+namespace hyperdaemon
+{
+
+// Find the keys that draw the most client operations.  Each worker feeds one
+// operation in HOTKEY_SAMPLE to its own space-saving summary of HOTKEY_SLOTS
+// counters, so sampling never waits on another worker.  The summaries are
+// merged when dumped.  Any key drawing more than 1/HOTKEY_SLOTS of a worker's
+// samples is sure to be in that worker's summary, and no key's count is
+// overestimated by more than its error.
+class hotkeys
+{
+    public:
+        static void observe(uint32_t space, const e::slice& key);
+        // Write the merged summary, hottest first, as a JSON object.
+        static void dump(std::ostream& out);
+        static void lock_stats(std::map<std::string, hyperdisk::lockstats>* stats);
+
+    private:
+        class entry;
+        class summary;
+
+    private:
+        static summary* local();
+        static bool hotter(const entry& lhs, const entry& rhs);
+
+    private:
+        static hyperdisk::lockstats s_lockstats;
+        static hyperdisk::profiled_mutex s_summaries_lock;
+        static std::vector<summary*> s_summaries;
+        static __thread summary* t_summary;
+        static __thread uint64_t t_countdown;
+};
+
+} // namespace hyperdaemon
+
+#endif // hyperdaemon_hotkeys_h_
@@ -36,11 +36,17 @@
 
 // STL
 #include <list>
+#include <set>
 #include <stdexcept>
+#include <tr1/functional>
+#include <vector>
 
 // Google Log
 #include <glog/logging.h>
 
+// e
+#include <e/timer.h>
+
 // BusyBee
 #include <busybee_constants.h>
 
@@ -49,6 +55,8 @@
 
 // HyperDaemon
 #include "hyperdaemon/logical.h"
+#include "hyperdaemon/runtimeconfig.h"
+#include "hyperdaemon/tracing.h"
 
 using hyperdex::configuration;
 using hyperdex::coordinatorlink;
@@ -62,31 +70,36 @@ using hyperdex::regionid;
 class hyperdaemon::logical::early_message
 {
     public:
-        early_message();
-        early_message(uint64_t v,
-                      const po6::net::location& l,
+        early_message(const po6::net::location& l,
                       std::auto_ptr<e::buffer> m);
         ~early_message() throw ();
 
     public:
-        uint64_t config_version;
         po6::net::location loc;
         std::auto_ptr<e::buffer> msg;
-};
 
-hyperdaemon :: logical :: early_message :: early_message()
-    : config_version(0)
-    , loc()
-    , msg()
-{
-}
+    private:
+        friend class e::intrusive_ptr<early_message>;
+
+    private:
+        early_message(const early_message&);
+
+    private:
+        void inc() { __sync_add_and_fetch(&m_ref, 1); }
+        void dec() { if (__sync_sub_and_fetch(&m_ref, 1) == 0) delete this; }
 
-hyperdaemon :: logical :: early_message :: early_message(uint64_t v,
-                                                         const po6::net::location& l,
+    private:
+        early_message& operator = (const early_message&);
+
+    private:
+        size_t m_ref;
+};
+
+hyperdaemon :: logical :: early_message :: early_message(const po6::net::location& l,
                                                          std::auto_ptr<e::buffer> m)
-    : config_version(v)
-    , loc(l)
+    : loc(l)
     , msg(m)
+    , m_ref(0)
 {
 }
 
@@ -94,6 +107,132 @@ hyperdaemon :: logical :: early_message :: ~early_message() throw ()
 {
 }
 
+//////////////////////////////////// Batches ///////////////////////////////////
+
+// A batch is a busybee message of type PACKET_BATCH holding a count followed by
+// that many length-prefixed logical messages (each without its busybee
+// header).  A lone message is sent as-is rather than wrapped in a batch.
+class hyperdaemon::logical::batch
+{
+    public:
+        static const size_t HEADER_SIZE = BUSYBEE_HEADER_SIZE + sizeof(uint8_t) + sizeof(uint32_t);
+
+    public:
+        batch(hyperdisk::lockstats* stats);
+        ~batch() throw ();
+
+    public:
+        bool empty() const { return !m_first.get() && !m_frame.get(); }
+        bool full() const;
+        // Returns false (leaving msg untouched) if msg does not fit.
+        bool append(std::auto_ptr<e::buffer>* msg);
+        std::auto_ptr<e::buffer> take();
+
+    public:
+        hyperdisk::profiled_mutex lock;
+        uint64_t started;
+        // When something last went to this peer.
+        uint64_t last_sent;
+
+    private:
+        friend class e::intrusive_ptr<batch>;
+
+    private:
+        batch(const batch&);
+
+    private:
+        void inc() { __sync_add_and_fetch(&m_ref, 1); }
+        void dec() { if (__sync_sub_and_fetch(&m_ref, 1) == 0) delete this; }
+        void pack(const e::buffer& msg);
+
+    private:
+        batch& operator = (const batch&);
+
+    private:
+        size_t m_ref;
+        std::auto_ptr<e::buffer> m_first;
+        std::auto_ptr<e::buffer> m_frame;
+        uint32_t m_count;
+};
+
+hyperdaemon :: logical :: batch :: batch(hyperdisk::lockstats* stats)
+    : lock(stats)
+    , started(0)
+    , last_sent(0)
+    , m_ref(0)
+    , m_first()
+    , m_frame()
+    , m_count(0)
+{
+}
+
+hyperdaemon :: logical :: batch :: ~batch() throw ()
+{
+}
+
+bool
+hyperdaemon :: logical :: batch :: full() const
+{
+    if (!m_frame.get())
+    {
+        return false;
+    }
+
+    return m_frame->capacity() - m_frame->size() < sizeof(uint32_t) + COALESCE_BYTES / 8;
+}
+
+bool
+hyperdaemon :: logical :: batch :: append(std::auto_ptr<e::buffer>* msg)
+{
+    if (empty())
+    {
+        m_first = *msg;
+        started = e::time();
+        return true;
+    }
+
+    if (!m_frame.get())
+    {
+        m_frame.reset(e::buffer::create(HEADER_SIZE + COALESCE_BYTES));
+        m_frame->pack_at(BUSYBEE_HEADER_SIZE)
+            << static_cast<uint8_t>(hyperdex::PACKET_BATCH) << m_count;
+        pack(*m_first);
+        m_first.reset();
+    }
+
+    if (m_frame->capacity() - m_frame->size() <
+        sizeof(uint32_t) + (*msg)->size() - BUSYBEE_HEADER_SIZE)
+    {
+        return false;
+    }
+
+    pack(**msg);
+    msg->reset();
+    return true;
+}
+
+std::auto_ptr<e::buffer>
+hyperdaemon :: logical :: batch :: take()
+{
+    if (m_frame.get())
+    {
+        m_frame->pack_at(BUSYBEE_HEADER_SIZE + sizeof(uint8_t)) << m_count;
+        m_count = 0;
+        return m_frame;
+    }
+
+    return m_first;
+}
+
+void
+hyperdaemon :: logical :: batch :: pack(const e::buffer& msg)
+{
+    e::slice whole = msg.as_slice();
+    e::slice body(whole.data() + BUSYBEE_HEADER_SIZE, whole.size() - BUSYBEE_HEADER_SIZE);
+    m_frame->pack_at(m_frame->size()) << body;
+    ++m_count;
+}
+
 ///////////////////////////////// Public Class /////////////////////////////////
 
 hyperdaemon :: logical :: logical(coordinatorlink* cl, const po6::net::ipaddr& ip,
@@ -101,11 +240,23 @@ hyperdaemon :: logical :: logical(coordinatorlink* cl, const po6::net::ipaddr& i
     : m_cl(cl)
     , m_us()
     , m_config()
+    , m_early_lock()
     , m_early_messages()
+    , m_early_bytes(0)
+    , m_fence_lock()
+    , m_fenced()
+    , m_inflight()
+    , m_fenced_messages()
+    , m_fenced_bytes(0)
     , m_client_nums()
     , m_client_locs()
     , m_client_counter(0)
     , m_busybee(ip, incoming, outgoing, num_threads)
+    , m_batch_locks()
+    , m_batches_lock()
+    , m_batches()
+    , m_shutdown(false)
+    , m_flush_thread(std::tr1::bind(&logical::flush_batches, this))
 {
     assert(m_busybee.inbound().address == m_busybee.outbound().address);
     m_us.address = m_busybee.inbound().address;
@@ -113,18 +264,35 @@ hyperdaemon :: logical :: logical(coordinatorlink* cl, const po6::net::ipaddr& i
     m_us.outbound_port = m_busybee.outbound().port;
     m_us.inbound_version = 0;
     m_us.outbound_version = 0;
+    m_flush_thread.start();
 }
 
 hyperdaemon :: logical :: ~logical() throw ()
 {
+    m_shutdown = true;
+    m_flush_thread.join();
 }
 
 typedef std::map<hyperdex::entityid, hyperdex::instance>::iterator mapiter;
 
+// [busybee header][u8 PACKET_COMPACT][u8 type][u64 version][u32 from][u32 to]
+const size_t hyperdaemon::logical::COMPACT_HEADER_SIZE = BUSYBEE_HEADER_SIZE
+                                                       + 2 * sizeof(uint8_t)
+                                                       + sizeof(uint64_t)
+                                                       + 2 * sizeof(uint32_t);
+
+// [busybee header][u8 PACKET_CLIENT_COMPACT][u8 type][u64 version][from][u32 to]
+const size_t hyperdaemon::logical::CLIENT_COMPACT_HEADER_SIZE = BUSYBEE_HEADER_SIZE
+                                                              + 2 * sizeof(uint8_t)
+                                                              + sizeof(uint64_t)
+                                                              + entityid::SERIALIZEDSIZE
+                                                              + sizeof(uint32_t);
+
 size_t
 hyperdaemon :: logical :: header_size() const
 {
-    return sizeof(uint8_t) + BUSYBEE_HEADER_SIZE + sizeof(uint64_t) + 2 * sizeof(uint16_t) + 2 * entityid::SERIALIZEDSIZE;
+    return sizeof(uint8_t) + BUSYBEE_HEADER_SIZE + sizeof(uint64_t) + 2 * sizeof(uint16_t) + 2 * entityid::SERIALIZEDSIZE
+         + sizeof(uint64_t);
 }
 
 void
@@ -140,24 +308,22 @@ hyperdaemon :: logical :: reconfigure(const configuration& newconfig,
     m_config = newconfig;
     m_us = newinst;
 
-    e::lockfree_fifo<early_message> ems;
-    early_message em;
+    // Replay, in order, every message that was waiting for this version (or an
+    // earlier one).  Messages for later versions stay where they are.
+    hyperdisk::profiled_mutex::hold hold(&m_early_lock);
+    early_map_t::iterator it = m_early_messages.begin();
 
-    while (m_early_messages.pop(&em))
+    while (it != m_early_messages.end() && it->first <= m_config.version())
     {
-        if (em.config_version <= m_config.version())
-        {
-            m_busybee.deliver(em.loc, em.msg);
-        }
-        else
+        for (early_list_t::iterator em = it->second.begin();
+                em != it->second.end(); ++em)
         {
-            ems.push(em);
+            m_early_bytes -= (*em)->msg->size();
+            m_busybee.deliver((*em)->loc, (*em)->msg);
         }
-    }
 
-    while (ems.pop(&em))
-    {
-        m_early_messages.push(em);
+        m_early_messages.erase(it);
+        it = m_early_messages.begin();
     }
 }
 
@@ -218,9 +384,10 @@ hyperdaemon :: logical :: send(const hyperdex::entityid& from,
     }
 
     uint8_t mt = static_cast<uint8_t>(msg_type);
+    uint64_t trace = tracing::current();
     assert(msg->capacity() >= header_size());
     msg->pack_at(BUSYBEE_HEADER_SIZE)
-        << mt << m_config.version() << src.outbound_version << dst.inbound_version << from << to;
+        << mt << m_config.version() << src.outbound_version << dst.inbound_version << from << to << trace;
 
     if (dst == m_us)
     {
@@ -229,36 +396,65 @@ hyperdaemon :: logical :: send(const hyperdex::entityid& from,
     else
     {
         po6::net::location loc(dst.address, dst.inbound_port);
+        e::intrusive_ptr<batch> b;
 
-        switch (m_busybee.send(loc, msg))
+        // The compact header has no room for a trace id.
+        if (trace == 0)
         {
-            case BUSYBEE_SUCCESS:
-            case BUSYBEE_QUEUED:
-                break;
-            case BUSYBEE_SHUTDOWN:
-                LOG(ERROR) << "busybee unexpectedly returned SHUTDOWN";
-                return false;
-            case BUSYBEE_POLLFAILED:
-                PLOG(ERROR) << "busybee unexpectedly returned POLLFAILED";
-                return false;
-            case BUSYBEE_DISCONNECT:
-                handle_disconnect(loc);
-                return false;
-            case BUSYBEE_CONNECTFAIL:
-                handle_connectfail(loc);
-                return false;
-            case BUSYBEE_ADDFDFAIL:
-                handle_connectfail(loc);
-                return false;
-            case BUSYBEE_BUFFERFULL:
-                return false;
-            case BUSYBEE_TIMEOUT:
-                return false;
-            case BUSYBEE_EXTERNAL:
-                return false;
-            default:
-                LOG(ERROR) << "busybee wandered into bad state, and returned garbage";
-                return false;
+            compact(from, to, &msg);
+        }
+
+        if (COALESCE_MICROS > 0 && !LOW_LATENCY)
+        {
+            hyperdisk::profiled_mutex::hold hold(&m_batches_lock);
+            batch_map_t::iterator it = m_batches.find(loc);
+
+            if (it != m_batches.end())
+            {
+                b = it->second;
+            }
+            else if (coalescable(msg_type, *msg))
+            {
+                b = new batch(&m_batch_locks);
+                m_batches.insert(std::make_pair(loc, b));
+            }
+        }
+
+        if (!b)
+        {
+            return send_direct(loc, msg);
+        }
+
+        hyperdisk::profiled_mutex::hold hold(&b->lock);
+
+        // Whatever is already waiting for this peer goes out first so that
+        // messages between two daemons are not reordered.
+        if (!coalescable(msg_type, *msg))
+        {
+            send_batch(loc, b);
+            return send_direct(loc, msg);
+        }
+
+        // A message to a quiet peer goes out at once.  Only messages that
+        // follow closely on an earlier one wait to be coalesced.
+        uint64_t now = e::time();
+
+        if (b->empty() && now - b->last_sent >= COALESCE_MICROS * 1000ULL)
+        {
+            b->last_sent = now;
+            return send_direct(loc, msg);
+        }
+
+        // An empty batch always has room, so the second append cannot fail.
+        if (!b->append(&msg))
+        {
+            send_batch(loc, b);
+            b->append(&msg);
+        }
+
+        if (b->full())
+        {
+            return send_batch(loc, b);
         }
     }
 
@@ -269,7 +465,8 @@ bool
 hyperdaemon :: logical :: recv(hyperdex::entityid* from,
                                hyperdex::entityid* to,
                                network_msgtype* msg_type,
-                               std::auto_ptr<e::buffer>* msg)
+                               std::auto_ptr<e::buffer>* msg,
+                               uint64_t* trace_id)
 {
     po6::net::location loc;
     bool fromvalid = false;
@@ -324,6 +521,20 @@ hyperdaemon :: logical :: recv(hyperdex::entityid* from,
                 continue;
         }
 
+        if ((*msg)->size() > BUSYBEE_HEADER_SIZE &&
+            (*msg)->as_slice().data()[BUSYBEE_HEADER_SIZE] == hyperdex::PACKET_COMPACT &&
+            !expand(loc, msg))
+        {
+            continue;
+        }
+
+        if ((*msg)->size() > BUSYBEE_HEADER_SIZE &&
+            (*msg)->as_slice().data()[BUSYBEE_HEADER_SIZE] == hyperdex::PACKET_CLIENT_COMPACT &&
+            !expand_client(msg))
+        {
+            continue;
+        }
+
         if ((*msg)->size() < header_size())
         {
             LOG(WARNING) << "dropping message that is too small to parse: " << (*msg)->hex();
@@ -333,9 +544,17 @@ hyperdaemon :: logical :: recv(hyperdex::entityid* from,
         // This should not throw thanks to the size check above.
         uint8_t mt;
         uint64_t version;
+        uint64_t trace;
         (*msg)->unpack_from(sizeof(uint32_t))
-            >> mt >> version >> fromver >> tover >> *from >> *to;
+            >> mt >> version >> fromver >> tover >> *from >> *to >> trace;
         *msg_type = static_cast<network_msgtype>(mt);
+        *trace_id = trace;
+
+        if (*msg_type == hyperdex::PACKET_BATCH)
+        {
+            unpack_batch(loc, *msg);
+            continue;
+        }
 
         // Checkout the sender
         if (from->space == hyperdex::configuration::CLIENTSPACE)
@@ -404,7 +623,12 @@ hyperdaemon :: logical :: recv(hyperdex::entityid* from,
             toinst == m_us && // Try again because we don't believe ourselves to be the dest entity.
             m_us.inbound_version == tover) // Try again because it is to an older version of us.
         {
-            break;
+            if (enter(loc, *from, *to, msg))
+            {
+                break;
+            }
+
+            continue;
         }
 
         // Shove the message back at the client so it fails with a reconfigure.
@@ -419,9 +643,7 @@ hyperdaemon :: logical :: recv(hyperdex::entityid* from,
         // could become valid in the future.
         else if (version > m_config.version())
         {
-            early_message em(version, loc, *msg);
-            assert(em.msg.get());
-            m_early_messages.push(em);
+            postpone(loc, version, *msg);
             continue;
         }
     }
@@ -432,6 +654,125 @@ hyperdaemon :: logical :: recv(hyperdex::entityid* from,
     return true;
 }
 
+void
+hyperdaemon :: logical :: lock_stats(std::map<std::string, hyperdisk::lockstats>* stats) const
+{
+    (*stats)["logical.early"] += m_early_lock.stats();
+    (*stats)["logical.fence"] += m_fence_lock.stats();
+    (*stats)["logical.batches"] += m_batches_lock.stats();
+    (*stats)["logical.batch"] += m_batch_locks;
+}
+
+void
+hyperdaemon :: logical :: shutdown()
+{
+    m_shutdown = true;
+    m_busybee.shutdown();
+}
+
+void
+hyperdaemon :: logical :: fence(const std::set<regionid>& regions)
+{
+    {
+        hyperdisk::profiled_mutex::hold hold(&m_fence_lock);
+        m_fenced.insert(regions.begin(), regions.end());
+    }
+
+    // Wait out the messages workers took off the network before the fence.
+    while (true)
+    {
+        {
+            hyperdisk::profiled_mutex::hold hold(&m_fence_lock);
+            bool busy = false;
+
+            for (std::set<regionid>::const_iterator r = regions.begin();
+                    !busy && r != regions.end(); ++r)
+            {
+                busy = m_inflight.find(*r) != m_inflight.end();
+            }
+
+            if (!busy)
+            {
+                return;
+            }
+        }
+
+        e::sleep_ns(0, 100000);
+    }
+}
+
+void
+hyperdaemon :: logical :: unfence()
+{
+    hyperdisk::profiled_mutex::hold hold(&m_fence_lock);
+    m_fenced.clear();
+
+    // Held messages go back through recv so they are checked against the
+    // configuration installed while they waited.
+    for (early_list_t::iterator em = m_fenced_messages.begin();
+            em != m_fenced_messages.end(); ++em)
+    {
+        m_busybee.deliver((*em)->loc, (*em)->msg);
+    }
+
+    m_fenced_messages.clear();
+    m_fenced_bytes = 0;
+}
+
+void
+hyperdaemon :: logical :: finished(const entityid& from, const entityid& to)
+{
+    hyperdisk::profiled_mutex::hold hold(&m_fence_lock);
+    std::map<regionid, uint64_t>::iterator it = m_inflight.find(fence_region(from, to));
+    assert(it != m_inflight.end());
+
+    if (--it->second == 0)
+    {
+        m_inflight.erase(it);
+    }
+}
+
+regionid
+hyperdaemon :: logical :: fence_region(const entityid& from, const entityid& to)
+{
+    if (to.space == hyperdex::configuration::TRANSFERSPACE)
+    {
+        return from.get_region();
+    }
+
+    return to.get_region();
+}
+
+bool
+hyperdaemon :: logical :: enter(const po6::net::location& loc,
+                                const entityid& from,
+                                const entityid& to,
+                                std::auto_ptr<e::buffer>* msg)
+{
+    regionid ri = fence_region(from, to);
+    hyperdisk::profiled_mutex::hold hold(&m_fence_lock);
+
+    if (m_fenced.find(ri) == m_fenced.end())
+    {
+        ++m_inflight[ri];
+        return true;
+    }
+
+    // Senders retransmit, and a transfer that loses a message fails and
+    // resumes from its checkpoint, so when the budget is exhausted it is safe
+    // to drop the message rather than grow without bound.
+    if (m_fenced_bytes + (*msg)->size() > EARLY_MESSAGE_BYTES)
+    {
+        LOG(WARNING) << "dropping message for fenced region " << ri
+                     << " because " << m_fenced_bytes << " bytes are already waiting";
+        return false;
+    }
+
+    m_fenced_bytes += (*msg)->size();
+    m_fenced_messages.push_back(new early_message(loc, *msg));
+    return false;
+}
+
 void
 hyperdaemon :: logical :: handle_connectfail(const po6::net::location& loc)
 {
@@ -481,3 +822,290 @@ hyperdaemon :: logical :: handle_disconnect(const po6::net::location& loc)
         }
     }
 }
+
+void
+hyperdaemon :: logical :: postpone(const po6::net::location& loc,
+                                   uint64_t version,
+                                   std::auto_ptr<e::buffer> msg)
+{
+    hyperdisk::profiled_mutex::hold hold(&m_early_lock);
+
+    // Senders retransmit, so when the budget is exhausted it is safe
+    // to drop the message rather than grow without bound.
+    if (m_early_bytes + msg->size() > EARLY_MESSAGE_BYTES)
+    {
+        LOG(WARNING) << "dropping early message for version " << version
+                     << " because " << m_early_bytes << " bytes are already waiting";
+        return;
+    }
+
+    m_early_bytes += msg->size();
+    m_early_messages[version].push_back(new early_message(loc, msg));
+}
+
+void
+hyperdaemon :: logical :: compact(const hyperdex::entityid& from,
+                                  const hyperdex::entityid& to,
+                                  std::auto_ptr<e::buffer>* msg) const
+{
+    uint32_t fromnum;
+    uint32_t tonum;
+
+    if ((*msg)->size() > COMPACT_HEADER_BYTES ||
+        !m_config.entity_number(from, &fromnum) ||
+        !m_config.entity_number(to, &tonum))
+    {
+        return;
+    }
+
+    // The instance versions are not sent because the receiver can only expand
+    // the header if it is on the same configuration, and then it can look them
+    // up itself.
+    uint8_t compact = static_cast<uint8_t>(hyperdex::PACKET_COMPACT);
+    e::slice whole = (*msg)->as_slice();
+    uint8_t mt = whole.data()[BUSYBEE_HEADER_SIZE];
+    e::slice body(whole.data() + header_size(), whole.size() - header_size());
+    std::auto_ptr<e::buffer> c(e::buffer::create(COMPACT_HEADER_SIZE + body.size()));
+    c->pack_at(BUSYBEE_HEADER_SIZE) << compact << mt << m_config.version() << fromnum << tonum;
+    c->pack_at(COMPACT_HEADER_SIZE).copy(body);
+    *msg = c;
+}
+
+bool
+hyperdaemon :: logical :: expand(const po6::net::location& loc,
+                                 std::auto_ptr<e::buffer>* msg)
+{
+    uint8_t compact;
+    uint8_t mt;
+    uint64_t version;
+    uint32_t fromnum;
+    uint32_t tonum;
+    e::buffer::unpacker up = (*msg)->unpack_from(BUSYBEE_HEADER_SIZE);
+    up = up >> compact >> mt >> version >> fromnum >> tonum;
+
+    if (up.error())
+    {
+        LOG(WARNING) << "dropping compact message that is too small to parse: " << (*msg)->hex();
+        return false;
+    }
+
+    if (version > m_config.version())
+    {
+        postpone(loc, version, *msg);
+        return false;
+    }
+
+    // The entity numbering of an older configuration is unknown to us.  The
+    // sender will retransmit once it learns of the new configuration.
+    if (version < m_config.version())
+    {
+        return false;
+    }
+
+    entityid from;
+    entityid to;
+
+    if (!m_config.entity_by_number(fromnum, &from) ||
+        !m_config.entity_by_number(tonum, &to))
+    {
+        LOG(WARNING) << "dropping compact message with unknown entity numbers " << fromnum << "->" << tonum;
+        return false;
+    }
+
+    uint16_t fromver = m_config.instancefor(from).outbound_version;
+    uint16_t tover = m_config.instancefor(to).inbound_version;
+    e::slice whole = (*msg)->as_slice();
+    e::slice body(whole.data() + COMPACT_HEADER_SIZE, whole.size() - COMPACT_HEADER_SIZE);
+    uint64_t trace = 0;
+    std::auto_ptr<e::buffer> full(e::buffer::create(header_size() + body.size()));
+    full->pack_at(BUSYBEE_HEADER_SIZE) << mt << version << fromver << tover << from << to << trace;
+    full->pack_at(header_size()).copy(body);
+    *msg = full;
+    return true;
+}
+
+bool
+hyperdaemon :: logical :: expand_client(std::auto_ptr<e::buffer>* msg)
+{
+    uint8_t compact;
+    uint8_t mt;
+    uint64_t version;
+    entityid from;
+    uint32_t tonum;
+    e::buffer::unpacker up = (*msg)->unpack_from(BUSYBEE_HEADER_SIZE);
+    up = up >> compact >> mt >> version >> from >> tonum;
+
+    if (up.error() || from.space != hyperdex::configuration::CLIENTSPACE)
+    {
+        LOG(WARNING) << "dropping malformed compact client message: " << (*msg)->hex();
+        return false;
+    }
+
+    // Unlike daemons, clients do not retransmit, so a request we cannot
+    // expand is not dropped.  It keeps an empty "to", which recv answers with
+    // CONFIGMISMATCH so the client retries on a fresh configuration.
+    entityid to;
+    uint16_t fromver = 1;
+    uint16_t tover = 0;
+
+    if (version == m_config.version() &&
+        m_config.entity_by_number(tonum, &to))
+    {
+        tover = m_config.instancefor(to).inbound_version;
+    }
+
+    e::slice whole = (*msg)->as_slice();
+    e::slice body(whole.data() + CLIENT_COMPACT_HEADER_SIZE, whole.size() - CLIENT_COMPACT_HEADER_SIZE);
+    uint64_t trace = 0;
+    std::auto_ptr<e::buffer> full(e::buffer::create(header_size() + body.size()));
+    full->pack_at(BUSYBEE_HEADER_SIZE) << mt << version << fromver << tover << from << to << trace;
+    full->pack_at(header_size()).copy(body);
+    *msg = full;
+    return true;
+}
+
+bool
+hyperdaemon :: logical :: coalescable(network_msgtype msg_type,
+                                      const e::buffer& msg) const
+{
+    // Coalescing trades latency for throughput, which is the opposite of what
+    // the low-latency mode asks for.
+    if (COALESCE_MICROS == 0 || LOW_LATENCY)
+    {
+        return false;
+    }
+
+    switch (msg_type)
+    {
+        case hyperdex::CHAIN_PUT:
+        case hyperdex::CHAIN_DEL:
+        case hyperdex::CHAIN_SUBSPACE:
+        case hyperdex::CHAIN_ACK:
+        case hyperdex::XFER_DATA:
+            break;
+        default:
+            return false;
+    }
+
+    return msg.size() - BUSYBEE_HEADER_SIZE <= COALESCE_BYTES / 8;
+}
+
+bool
+hyperdaemon :: logical :: send_direct(const po6::net::location& loc,
+                                      std::auto_ptr<e::buffer> msg)
+{
+    switch (m_busybee.send(loc, msg))
+    {
+        case BUSYBEE_SUCCESS:
+        case BUSYBEE_QUEUED:
+            return true;
+        case BUSYBEE_SHUTDOWN:
+            LOG(ERROR) << "busybee unexpectedly returned SHUTDOWN";
+            return false;
+        case BUSYBEE_POLLFAILED:
+            PLOG(ERROR) << "busybee unexpectedly returned POLLFAILED";
+            return false;
+        case BUSYBEE_DISCONNECT:
+            handle_disconnect(loc);
+            return false;
+        case BUSYBEE_CONNECTFAIL:
+            handle_connectfail(loc);
+            return false;
+        case BUSYBEE_ADDFDFAIL:
+            handle_connectfail(loc);
+            return false;
+        case BUSYBEE_BUFFERFULL:
+            return false;
+        case BUSYBEE_TIMEOUT:
+            return false;
+        case BUSYBEE_EXTERNAL:
+            return false;
+        default:
+            LOG(ERROR) << "busybee wandered into bad state, and returned garbage";
+            return false;
+    }
+}
+
+// The caller must hold b->lock.
+bool
+hyperdaemon :: logical :: send_batch(const po6::net::location& loc,
+                                     e::intrusive_ptr<batch> b)
+{
+    if (b->empty())
+    {
+        return true;
+    }
+
+    b->last_sent = e::time();
+    return send_direct(loc, b->take());
+}
+
+void
+hyperdaemon :: logical :: unpack_batch(const po6::net::location& loc,
+                                       std::auto_ptr<e::buffer> msg)
+{
+    uint8_t mt;
+    uint32_t count;
+    e::buffer::unpacker up = msg->unpack_from(BUSYBEE_HEADER_SIZE);
+    up = up >> mt >> count;
+
+    for (uint32_t i = 0; !up.error() && i < count; ++i)
+    {
+        e::slice body;
+        up = up >> body;
+
+        if (up.error())
+        {
+            break;
+        }
+
+        // Each message is handed back to busybee exactly as if it had arrived
+        // on its own, so it goes through all of the usual checks in recv.
+        std::auto_ptr<e::buffer> one(e::buffer::create(BUSYBEE_HEADER_SIZE + body.size()));
+        one->pack_at(BUSYBEE_HEADER_SIZE).copy(body);
+        m_busybee.deliver(loc, one);
+    }
+
+    if (up.error())
+    {
+        LOG(WARNING) << "dropping remainder of corrupt batch from " << loc << ": " << msg->hex();
+    }
+}
+
+void
+hyperdaemon :: logical :: flush_batches()
+{
+    LOG(INFO) << "Message coalescing thread started.";
+
+    while (!m_shutdown)
+    {
+        uint64_t interval = COALESCE_MICROS * 1000ULL;
+
+        if (interval == 0)
+        {
+            e::sleep_ms(250);
+            continue;
+        }
+
+        e::sleep_ns(0, interval);
+        std::vector<std::pair<po6::net::location, e::intrusive_ptr<batch> > > batches;
+
+        {
+            hyperdisk::profiled_mutex::hold hold(&m_batches_lock);
+            batches.assign(m_batches.begin(), m_batches.end());
+        }
+
+        uint64_t now = e::time();
+
+        for (size_t i = 0; i < batches.size(); ++i)
+        {
+            hyperdisk::profiled_mutex::hold hold(&batches[i].second->lock);
+
+            if (!batches[i].second->empty() &&
+                now - batches[i].second->started >= interval)
+            {
+                send_batch(batches[i].first, batches[i].second);
+            }
+        }
+    }
+}
@@ -29,15 +29,19 @@
 #define hyperdaemon_logical_h_
 
 // STL
+#include <list>
 #include <map>
+#include <set>
+#include <string>
 
 // po6
 #include <po6/net/location.h>
 #include <po6/threads/rwlock.h>
+#include <po6/threads/thread.h>
 
 // e
 #include <e/buffer.h>
-#include <e/lockfree_fifo.h>
+#include <e/intrusive_ptr.h>
 #include <e/lockfree_hash_map.h>
 
 // BusyBee
@@ -48,6 +52,9 @@
 #include "hyperdex/hyperdex/instance.h"
 #include "hyperdex/hyperdex/network_constants.h"
 
+// HyperDisk
+#include "hyperdisk/hyperdisk/profiled_mutex.h"
+
 // Forward Declarations
 namespace hyperdex
 {
@@ -81,7 +88,18 @@ class logical
     public:
         void pause() { m_busybee.pause(); }
         void unpause() { m_busybee.unpause(); }
-        void shutdown() { m_busybee.shutdown(); }
+        void shutdown();
+
+    // Fence regions while their chains change.  Messages to a fenced region,
+    // and transfer messages that copy one, are held until unfence, and fence
+    // returns once no worker is still handling one.  Every other region keeps
+    // being served.
+    public:
+        void fence(const std::set<hyperdex::regionid>& regions);
+        void unfence();
+        // Every message returned by recv must be matched with exactly one call
+        // to "finished" once the worker is done with it.
+        void finished(const hyperdex::entityid& from, const hyperdex::entityid& to);
 
     // Send and recv messages.
     public:
@@ -89,16 +107,27 @@ class logical
         bool send(const hyperdex::entityid& from, const hyperdex::entityid& to,
                   const hyperdex::network_msgtype msg_type,
                   std::auto_ptr<e::buffer> msg);
-        // Receive one message.
+        // Receive one message, and the trace it belongs to, or 0.
         bool recv(hyperdex::entityid* from, hyperdex::entityid* to,
                   hyperdex::network_msgtype* msg_type,
-                  std::auto_ptr<e::buffer>* msg);
+                  std::auto_ptr<e::buffer>* msg,
+                  uint64_t* trace_id);
+
+    // Reporting.
+    public:
+        void lock_stats(std::map<std::string, hyperdisk::lockstats>* stats) const;
 
     private:
+        static const size_t COMPACT_HEADER_SIZE;
+        static const size_t CLIENT_COMPACT_HEADER_SIZE;
         static uint64_t id(const uint64_t& i) { return i; }
 
     private:
+        class batch;
         class early_message;
+        typedef std::map<po6::net::location, e::intrusive_ptr<batch> > batch_map_t;
+        typedef std::list<e::intrusive_ptr<early_message> > early_list_t;
+        typedef std::map<uint64_t, early_list_t> early_map_t;
 
     private:
         logical(const logical&);
@@ -109,16 +138,56 @@ class logical
     private:
         void handle_connectfail(const po6::net::location& loc);
         void handle_disconnect(const po6::net::location& loc);
+        // Hold a message for a configuration we have not yet seen.
+        void postpone(const po6::net::location& loc, uint64_t version,
+                      std::auto_ptr<e::buffer> msg);
+        // The region a message acts on.  Transfers send from the sender's
+        // entity in the region they copy to the transfer's own entity.
+        static hyperdex::regionid fence_region(const hyperdex::entityid& from,
+                                               const hyperdex::entityid& to);
+        // Count the message as in flight, or hold it if its region is fenced.
+        bool enter(const po6::net::location& loc, const hyperdex::entityid& from,
+                   const hyperdex::entityid& to, std::auto_ptr<e::buffer>* msg);
+        // Small messages between entities of the configuration carry the
+        // entities' numbers within the configuration in place of the full
+        // header.  The receiver expands them back before any other checks.
+        void compact(const hyperdex::entityid& from, const hyperdex::entityid& to,
+                     std::auto_ptr<e::buffer>* msg) const;
+        bool expand(const po6::net::location& loc, std::auto_ptr<e::buffer>* msg);
+        // Requests from clients name the client entity in full, and the
+        // destination by its number.
+        bool expand_client(std::auto_ptr<e::buffer>* msg);
+        // Small chain and transfer messages between daemons are coalesced
+        // into one busybee message per peer.  The batch is sent when it fills
+        // up, or after COALESCE_MICROS, whichever comes first.  A message to
+        // a peer that has had nothing for COALESCE_MICROS is sent at once.
+        bool coalescable(hyperdex::network_msgtype msg_type, const e::buffer& msg) const;
+        bool send_direct(const po6::net::location& loc, std::auto_ptr<e::buffer> msg);
+        bool send_batch(const po6::net::location& loc, e::intrusive_ptr<batch> b);
+        void unpack_batch(const po6::net::location& loc, std::auto_ptr<e::buffer> msg);
+        void flush_batches();
 
     private:
         hyperdex::coordinatorlink* m_cl;
         hyperdex::instance m_us;
         hyperdex::configuration m_config;
-        e::lockfree_fifo<early_message> m_early_messages;
+        hyperdisk::profiled_mutex m_early_lock;
+        early_map_t m_early_messages;
+        uint64_t m_early_bytes;
+        hyperdisk::profiled_mutex m_fence_lock;
+        std::set<hyperdex::regionid> m_fenced;
+        std::map<hyperdex::regionid, uint64_t> m_inflight;
+        early_list_t m_fenced_messages;
+        uint64_t m_fenced_bytes;
         e::lockfree_hash_map<po6::net::location, uint64_t, po6::net::location::hash> m_client_nums;
         e::lockfree_hash_map<uint64_t, po6::net::location, id> m_client_locs;
         uint64_t m_client_counter;
         busybee_mta m_busybee;
+        hyperdisk::lockstats m_batch_locks;
+        hyperdisk::profiled_mutex m_batches_lock;
+        batch_map_t m_batches;
+        volatile bool m_shutdown;
+        po6::threads::thread m_flush_thread;
 };
 
 } // namespace hyperdaemon
@@ -0,0 +1,442 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <cstring>
+
+// POSIX
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// C++
+#include <sstream>
+
+// STL
+#include <map>
+#include <string>
+#include <tr1/functional>
+#include <utility>
+#include <vector>
+
+// Google Log
+#include <glog/logging.h>
+
+// po6
+#include <po6/io/fd.h>
+
+// e
+#include <e/timer.h>
+
+// HyperDaemon
+#include "hyperdaemon/admission_control.h"
+#include "hyperdaemon/datalayer.h"
+#include "hyperdaemon/hotkeys.h"
+#include "hyperdaemon/logical.h"
+#include "hyperdaemon/metrics.h"
+#include "hyperdaemon/ongoing_state_transfers.h"
+#include "hyperdaemon/replication_manager.h"
+#include "hyperdaemon/searches.h"
+#include "hyperdaemon/tracing.h"
+
+static const char* COUNTER_NAMES[] = {
+    "client_shed",
+    "disk_flush_errors",
+    "disk_mandatory_io",
+    "repl_retransmits",
+    "xfer_messages_sent",
+    "xfer_bytes_sent",
+    "xfer_bytes_acked",
+    "xfer_messages_received",
+    "xfer_bytes_received"
+};
+
+static const char* SERIES_NAMES[] = {
+    "disk_flush_nanos",
+    "xfer_ack_nanos"
+};
+
+static void
+json_histogram(std::ostream& out, const hyperdaemon::metrics::histogram& h)
+{
+    out << "{\"count\": " << h.count()
+        << ", \"min\": " << h.min()
+        << ", \"mean\": " << static_cast<uint64_t>(h.mean())
+        << ", \"p50\": " << h.percentile(0.5)
+        << ", \"p90\": " << h.percentile(0.9)
+        << ", \"p99\": " << h.percentile(0.99)
+        << ", \"p999\": " << h.percentile(0.999)
+        << ", \"max\": " << h.max() << "}";
+}
+
+static void
+text_histogram(std::ostream& out, const hyperdaemon::metrics::histogram& h)
+{
+    out << " count=" << h.count()
+        << " min=" << h.min()
+        << " mean=" << static_cast<uint64_t>(h.mean())
+        << " p50=" << h.percentile(0.5)
+        << " p90=" << h.percentile(0.9)
+        << " p99=" << h.percentile(0.99)
+        << " p999=" << h.percentile(0.999)
+        << " max=" << h.max() << "\n";
+}
+
+hyperdaemon :: metrics :: metrics(datalayer* data,
+                                  logical* comm,
+                                  replication_manager* repl,
+                                  searches* ssss,
+                                  ongoing_state_transfers* ost,
+                                  admission_control* admit)
+    : m_data(data)
+    , m_comm(comm)
+    , m_repl(repl)
+    , m_searches(ssss)
+    , m_ost(ost)
+    , m_admit(admit)
+    , m_started(e::time())
+    , m_shutdown(false)
+    , m_listen(-1)
+    , m_thread(std::tr1::bind(&metrics::serve, this))
+{
+}
+
+hyperdaemon :: metrics :: ~metrics() throw ()
+{
+    shutdown();
+}
+
+bool
+hyperdaemon :: metrics :: listen(in_port_t port)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (sock < 0)
+    {
+        PLOG(ERROR) << "could not create the metrics socket";
+        return false;
+    }
+
+    int yes = 1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) < 0 ||
+        bind(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        ::listen(sock, 16) < 0)
+    {
+        PLOG(ERROR) << "could not listen for metrics requests on port " << port;
+        close(sock);
+        return false;
+    }
+
+    m_listen = sock;
+    m_thread.start();
+    LOG(INFO) << "Serving metrics on 127.0.0.1:" << port;
+    return true;
+}
+
+void
+hyperdaemon :: metrics :: shutdown()
+{
+    if (m_listen >= 0)
+    {
+        m_shutdown = true;
+        m_thread.join();
+        close(m_listen);
+        m_listen = -1;
+    }
+}
+
+void
+hyperdaemon :: metrics :: report_json(std::ostream& out)
+{
+    totals t;
+    aggregate(&t);
+    out << "{\"uptime_ms\": " << (e::time() - m_started) / 1000000
+        << ", \"counters\": {";
+
+    for (size_t i = 0; i < NUM_COUNTERS; ++i)
+    {
+        out << (i ? ", " : "") << "\"" << COUNTER_NAMES[i] << "\": " << t.counters[i];
+    }
+
+    out << "}, \"histograms\": {";
+
+    for (size_t i = 0; i < NUM_SERIES; ++i)
+    {
+        out << (i ? ", " : "") << "\"" << SERIES_NAMES[i] << "\": ";
+        json_histogram(out, t.samples[i]);
+    }
+
+    out << "}, \"messages\": {";
+    bool first = true;
+
+    for (size_t i = 0; i < MSGTYPES; ++i)
+    {
+        if (t.messages[i].count() > 0)
+        {
+            out << (first ? "" : ", ") << "\""
+                << static_cast<hyperdex::network_msgtype>(i) << "\": ";
+            json_histogram(out, t.messages[i]);
+            first = false;
+        }
+    }
+
+    out << "}, \"disks\": [";
+    std::vector<std::pair<hyperdex::regionid, hyperdisk::disk_stats> > disks;
+    m_data->stats(&disks);
+
+    for (size_t i = 0; i < disks.size(); ++i)
+    {
+        const hyperdex::regionid& ri(disks[i].first);
+        const hyperdisk::disk_stats& ds(disks[i].second);
+        out << (i ? ", " : "")
+            << "{\"space\": " << ri.space
+            << ", \"subspace\": " << ri.subspace
+            << ", \"prefix\": " << static_cast<unsigned int>(ri.prefix)
+            << ", \"mask\": " << ri.mask
+            << ", \"shards\": " << ds.shards
+            << ", \"log_depth\": " << ds.log_depth
+            << ", \"flush_lag_nanos\": " << ds.lag_nanos
+            << ", \"logged\": " << ds.logged
+            << ", \"flushed\": " << ds.flushed << "}";
+    }
+
+    uint64_t xfers_in = 0;
+    uint64_t xfers_out = 0;
+    m_ost->count_transfers(&xfers_in, &xfers_out);
+    out << "], \"keyholders\": " << m_repl->keyholders()
+        << ", \"transfers_in\": " << xfers_in
+        << ", \"transfers_out\": " << xfers_out
+        << ", \"client_outstanding\": " << m_admit->outstanding()
+        << "}";
+}
+
+void
+hyperdaemon :: metrics :: report_text(std::ostream& out)
+{
+    totals t;
+    aggregate(&t);
+    out << "uptime_ms " << (e::time() - m_started) / 1000000 << "\n";
+
+    for (size_t i = 0; i < NUM_COUNTERS; ++i)
+    {
+        out << COUNTER_NAMES[i] << " " << t.counters[i] << "\n";
+    }
+
+    for (size_t i = 0; i < NUM_SERIES; ++i)
+    {
+        out << SERIES_NAMES[i];
+        text_histogram(out, t.samples[i]);
+    }
+
+    for (size_t i = 0; i < MSGTYPES; ++i)
+    {
+        if (t.messages[i].count() > 0)
+        {
+            out << "message " << static_cast<hyperdex::network_msgtype>(i);
+            text_histogram(out, t.messages[i]);
+        }
+    }
+
+    std::vector<std::pair<hyperdex::regionid, hyperdisk::disk_stats> > disks;
+    m_data->stats(&disks);
+
+    for (size_t i = 0; i < disks.size(); ++i)
+    {
+        const hyperdisk::disk_stats& ds(disks[i].second);
+        out << "disk " << disks[i].first
+            << " shards=" << ds.shards
+            << " log_depth=" << ds.log_depth
+            << " flush_lag_nanos=" << ds.lag_nanos
+            << " logged=" << ds.logged
+            << " flushed=" << ds.flushed << "\n";
+    }
+
+    uint64_t xfers_in = 0;
+    uint64_t xfers_out = 0;
+    m_ost->count_transfers(&xfers_in, &xfers_out);
+    out << "keyholders " << m_repl->keyholders() << "\n"
+        << "transfers_in " << xfers_in << "\n"
+        << "transfers_out " << xfers_out << "\n"
+        << "client_outstanding " << m_admit->outstanding() << "\n";
+}
+
+void
+hyperdaemon :: metrics :: report_profile(std::ostream& out)
+{
+    std::map<std::string, hyperdisk::lockstats> locks;
+    m_data->lock_stats(&locks);
+    m_comm->lock_stats(&locks);
+    m_repl->lock_stats(&locks);
+    m_searches->lock_stats(&locks);
+    m_ost->lock_stats(&locks);
+    m_admit->lock_stats(&locks);
+    hotkeys::lock_stats(&locks);
+    out << "{\"locks\": {";
+
+    for (std::map<std::string, hyperdisk::lockstats>::iterator it = locks.begin();
+            it != locks.end(); ++it)
+    {
+        out << (it == locks.begin() ? "" : ", ") << "\"" << it->first << "\": "
+            << "{\"acquisitions\": " << it->second.acquisitions
+            << ", \"contended\": " << it->second.contended
+            << ", \"wait_nanos\": " << it->second.wait_nanos
+            << ", \"hold_nanos\": " << it->second.hold_nanos << "}";
+    }
+
+    out << "}, \"hotkeys\": ";
+    hotkeys::dump(out);
+    out << "}";
+}
+
+void
+hyperdaemon :: metrics :: serve()
+{
+    LOG(INFO) << "Metrics thread started.";
+
+    while (!m_shutdown)
+    {
+        struct pollfd pfd;
+        pfd.fd = m_listen;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        if (poll(&pfd, 1, 250) <= 0)
+        {
+            continue;
+        }
+
+        po6::io::fd conn(accept(m_listen, NULL, NULL));
+
+        if (conn.get() < 0)
+        {
+            continue;
+        }
+
+        // A client that never finishes its request must not wedge us.
+        struct timeval tv;
+        tv.tv_sec = 1;
+        tv.tv_usec = 0;
+        setsockopt(conn.get(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(conn.get(), SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        answer(conn.get());
+    }
+}
+
+// Requests look like {"metrics": "json"}, {"metrics": "text"}, {"trace": ""} or
+// {"profile": ""}.  There is no JSON parser in the daemon, so it only looks for
+// those words.
+void
+hyperdaemon :: metrics :: answer(int fd)
+{
+    std::string request;
+    char buf[256];
+
+    while (request.find('\n') == std::string::npos && request.size() < 4096)
+    {
+        ssize_t amt = read(fd, buf, sizeof(buf));
+
+        if (amt <= 0)
+        {
+            break;
+        }
+
+        request.append(buf, amt);
+    }
+
+    std::ostringstream reply;
+
+    if (request.find("\"trace\"") != std::string::npos)
+    {
+        reply << "{\"trace\": ";
+        tracing::dump(reply);
+        reply << "}\n";
+    }
+    else if (request.find("\"profile\"") != std::string::npos)
+    {
+        reply << "{\"profile\": ";
+        report_profile(reply);
+        reply << "}\n";
+    }
+    else if (request.find("\"metrics\"") == std::string::npos)
+    {
+        reply << "{\"error\": \"unknown request\"}\n";
+    }
+    else if (request.find("text") != std::string::npos)
+    {
+        std::ostringstream text;
+        report_text(text);
+        reply << "{\"metrics\": \"";
+        std::string s(text.str());
+
+        for (size_t i = 0; i < s.size(); ++i)
+        {
+            if (s[i] == '\n')
+            {
+                reply << "\\n";
+            }
+            else if (s[i] == '"' || s[i] == '\\')
+            {
+                reply << '\\' << s[i];
+            }
+            else
+            {
+                reply << s[i];
+            }
+        }
+
+        reply << "\"}\n";
+    }
+    else
+    {
+        reply << "{\"metrics\": ";
+        report_json(reply);
+        reply << "}\n";
+    }
+
+    std::string s(reply.str());
+    size_t off = 0;
+
+    while (off < s.size())
+    {
+        ssize_t amt = write(fd, s.data() + off, s.size() - off);
+
+        if (amt <= 0)
+        {
+            break;
+        }
+
+        off += amt;
+    }
+}
@@ -0,0 +1,236 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef hyperdaemon_metrics_h_
+#define hyperdaemon_metrics_h_
+
+// C
+#include <stdint.h>
+
+// POSIX
+#include <netinet/in.h>
+
+// C++
+#include <iostream>
+
+// STL
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+#include <po6/threads/thread.h>
+
+// HyperDex
+#include "hyperdex/hyperdex/network_constants.h"
+
+// Forward Declarations
+namespace hyperdaemon
+{
+class admission_control;
+class datalayer;
+class logical;
+class ongoing_state_transfers;
+class replication_manager;
+class searches;
+}
+
+namespace hyperdaemon
+{
+
+// Counters and latency histograms for the whole daemon.  Each thread records
+// into its own slab without synchronization, and the slabs are only summed
+// when someone asks for a report.  Figures that describe state rather than
+// events (log depth, shard counts, keyholders) are read from the components
+// at report time.
+//
+// A report is served to local clients on METRICS_PORT, using the same
+// newline-delimited JSON exchange as the coordinator's control port.
+class metrics
+{
+    public:
+        enum counter
+        {
+            CLIENT_SHED,
+            DISK_FLUSH_ERRORS,
+            DISK_MANDATORY_IO,
+            REPL_RETRANSMITS,
+            XFER_MESSAGES_SENT,
+            XFER_BYTES_SENT,
+            XFER_BYTES_ACKED,
+            XFER_MESSAGES_RECEIVED,
+            XFER_BYTES_RECEIVED,
+            NUM_COUNTERS
+        };
+        enum series
+        {
+            // Time spent in a disk::flush that moved objects.
+            DISK_FLUSH_NANOS,
+            // Time from sending a transfer message to its acknowledgement.
+            XFER_ACK_NANOS,
+            NUM_SERIES
+        };
+        // Message types are counted modulo this.
+        static const size_t MSGTYPES = 256;
+        class histogram;
+        class timer;
+        class totals;
+
+    public:
+        // Add to the calling thread's count.
+        static void count(counter c, uint64_t n = 1);
+        // Add a sample to the calling thread's histogram.
+        static void record(series s, uint64_t value);
+        // Add the time it took to handle a message of type "t".
+        static void record(hyperdex::network_msgtype t, uint64_t nanos);
+        // Add every thread's slab into "t".
+        static void aggregate(totals* t);
+
+    public:
+        metrics(datalayer* data,
+                logical* comm,
+                replication_manager* repl,
+                searches* ssss,
+                ongoing_state_transfers* ost,
+                admission_control* admit);
+        ~metrics() throw ();
+
+    public:
+        // Serve reports on the loopback interface.  Returns false if the port
+        // could not be bound.
+        bool listen(in_port_t port);
+        void shutdown();
+        void report_json(std::ostream& out);
+        void report_text(std::ostream& out);
+        // How contended each lock has been, and which keys are hottest.
+        void report_profile(std::ostream& out);
+
+    private:
+        class slab;
+
+    private:
+        metrics(const metrics&);
+
+    private:
+        static slab* local();
+        void serve();
+        void answer(int fd);
+
+    private:
+        metrics& operator = (const metrics&);
+
+    private:
+        static po6::threads::mutex s_slabs_lock;
+        static std::vector<slab*> s_slabs;
+        static __thread slab* t_slab;
+
+    private:
+        datalayer* m_data;
+        logical* m_comm;
+        replication_manager* m_repl;
+        searches* m_searches;
+        ongoing_state_transfers* m_ost;
+        admission_control* m_admit;
+        uint64_t m_started;
+        volatile bool m_shutdown;
+        int m_listen;
+        po6::threads::thread m_thread;
+};
+
+// Values are kept to within 1/16th of their true value, as an HDR histogram
+// with one significant hex digit would, and saturate at 2^40 (about eighteen
+// minutes in nanoseconds).
+class metrics::histogram
+{
+    public:
+        static const size_t SUB_BUCKETS = 16;
+        static const size_t BUCKETS = 592;
+
+    public:
+        histogram();
+
+    public:
+        void record(uint64_t value);
+        void merge(const histogram& other);
+        uint64_t count() const { return m_count; }
+        uint64_t min() const { return m_count ? m_min : 0; }
+        uint64_t max() const { return m_max; }
+        double mean() const;
+        // The smallest value that "p" (in [0, 1]) of the samples do not
+        // exceed, to within the histogram's precision.
+        uint64_t percentile(double p) const;
+
+    private:
+        static size_t bucket(uint64_t value);
+        static uint64_t highest(size_t bucket);
+
+    private:
+        uint64_t m_count;
+        uint64_t m_sum;
+        uint64_t m_min;
+        uint64_t m_max;
+        uint64_t m_buckets[BUCKETS];
+};
+
+// The sum of every thread's slab.
+class metrics::totals
+{
+    public:
+        totals() : counters(), samples(), messages() {}
+
+    public:
+        uint64_t counters[NUM_COUNTERS];
+        histogram samples[NUM_SERIES];
+        histogram messages[MSGTYPES];
+};
+
+// Record the time between construction and destruction of the timer.
+class metrics::timer
+{
+    public:
+        explicit timer(series s);
+        explicit timer(hyperdex::network_msgtype t);
+        ~timer() throw ();
+
+    public:
+        // Record nothing.
+        void cancel() { m_cancelled = true; }
+
+    private:
+        timer(const timer&);
+        timer& operator = (const timer&);
+
+    private:
+        bool m_message;
+        series m_series;
+        hyperdex::network_msgtype m_type;
+        uint64_t m_start;
+        bool m_cancelled;
+};
+
+} // namespace hyperdaemon
+
+#endif // hyperdaemon_metrics_h_
@@ -0,0 +1,281 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <algorithm>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+
+// e
+#include <e/timer.h>
+
+// HyperDaemon
+#include "hyperdaemon/metrics.h"
+
+// The recording half of metrics: histograms, timers and the per-thread slabs
+// they feed.  It depends on nothing else in the daemon, so it can be tested
+// on its own.
+
+class hyperdaemon::metrics::slab
+{
+    public:
+        slab() : counters(), samples(), messages() {}
+
+    public:
+        uint64_t counters[NUM_COUNTERS];
+        histogram samples[NUM_SERIES];
+        // Created by the owning thread the first time it sees each type.
+        histogram* volatile messages[MSGTYPES];
+
+    private:
+        slab(const slab&);
+        slab& operator = (const slab&);
+};
+
+// Slabs outlive their threads so that nothing recorded is lost.  The daemon
+// starts a fixed set of threads, so they never pile up.
+po6::threads::mutex hyperdaemon::metrics::s_slabs_lock;
+std::vector<hyperdaemon::metrics::slab*> hyperdaemon::metrics::s_slabs;
+__thread hyperdaemon::metrics::slab* hyperdaemon::metrics::t_slab = NULL;
+
+void
+hyperdaemon :: metrics :: count(counter c, uint64_t n)
+{
+    local()->counters[c] += n;
+}
+
+void
+hyperdaemon :: metrics :: record(series s, uint64_t value)
+{
+    local()->samples[s].record(value);
+}
+
+void
+hyperdaemon :: metrics :: record(hyperdex::network_msgtype t, uint64_t nanos)
+{
+    slab* sl = local();
+    size_t idx = static_cast<size_t>(t) % MSGTYPES;
+
+    if (!sl->messages[idx])
+    {
+        histogram* h = new histogram();
+        __sync_synchronize();
+        sl->messages[idx] = h;
+    }
+
+    sl->messages[idx]->record(nanos);
+}
+
+hyperdaemon::metrics::slab*
+hyperdaemon :: metrics :: local()
+{
+    if (!t_slab)
+    {
+        t_slab = new slab();
+        po6::threads::mutex::hold hold(&s_slabs_lock);
+        s_slabs.push_back(t_slab);
+    }
+
+    return t_slab;
+}
+
+// The owners keep writing while we read, so a report may be a few samples
+// behind, but it never blocks them.
+void
+hyperdaemon :: metrics :: aggregate(totals* t)
+{
+    po6::threads::mutex::hold hold(&s_slabs_lock);
+
+    for (size_t i = 0; i < s_slabs.size(); ++i)
+    {
+        const slab* sl = s_slabs[i];
+
+        for (size_t j = 0; j < NUM_COUNTERS; ++j)
+        {
+            t->counters[j] += sl->counters[j];
+        }
+
+        for (size_t j = 0; j < NUM_SERIES; ++j)
+        {
+            t->samples[j].merge(sl->samples[j]);
+        }
+
+        for (size_t j = 0; j < MSGTYPES; ++j)
+        {
+            if (sl->messages[j])
+            {
+                t->messages[j].merge(*sl->messages[j]);
+            }
+        }
+    }
+}
+
+hyperdaemon :: metrics :: histogram :: histogram()
+    : m_count(0)
+    , m_sum(0)
+    , m_min(0)
+    , m_max(0)
+    , m_buckets()
+{
+}
+
+void
+hyperdaemon :: metrics :: histogram :: record(uint64_t value)
+{
+    m_min = m_count == 0 ? value : std::min(m_min, value);
+    m_max = std::max(m_max, value);
+    ++m_buckets[bucket(value)];
+    m_sum += value;
+    ++m_count;
+}
+
+void
+hyperdaemon :: metrics :: histogram :: merge(const histogram& other)
+{
+    uint64_t count = other.m_count;
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    m_min = m_count == 0 ? other.m_min : std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+    m_sum += other.m_sum;
+    m_count += count;
+
+    for (size_t i = 0; i < BUCKETS; ++i)
+    {
+        m_buckets[i] += other.m_buckets[i];
+    }
+}
+
+double
+hyperdaemon :: metrics :: histogram :: mean() const
+{
+    return m_count ? static_cast<double>(m_sum) / m_count : 0;
+}
+
+// The buckets are read after m_count, so they may hold a few more samples
+// than it says; the walk takes whichever comes first.
+uint64_t
+hyperdaemon :: metrics :: histogram :: percentile(double p) const
+{
+    if (m_count == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = static_cast<uint64_t>(p * m_count + 0.5);
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < BUCKETS; ++i)
+    {
+        seen += m_buckets[i];
+
+        // The last bucket also holds every value too large to fit.
+        if (seen >= rank && i + 1 < BUCKETS)
+        {
+            return std::min(highest(i), m_max);
+        }
+    }
+
+    return m_max;
+}
+
+// Values below SUB_BUCKETS get a bucket each.  Past that, each power of two
+// is split into SUB_BUCKETS buckets.
+size_t
+hyperdaemon :: metrics :: histogram :: bucket(uint64_t value)
+{
+    if (value < SUB_BUCKETS)
+    {
+        return value;
+    }
+
+    unsigned int msb = 63 - __builtin_clzll(value);
+
+    if (msb >= 40)
+    {
+        return BUCKETS - 1;
+    }
+
+    return (msb - 3) * SUB_BUCKETS + ((value >> (msb - 4)) & (SUB_BUCKETS - 1));
+}
+
+uint64_t
+hyperdaemon :: metrics :: histogram :: highest(size_t bucket)
+{
+    if (bucket < SUB_BUCKETS)
+    {
+        return bucket;
+    }
+
+    unsigned int shift = bucket / SUB_BUCKETS - 1;
+    uint64_t lowest = (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+    return lowest + (1ULL << shift) - 1;
+}
+
+hyperdaemon :: metrics :: timer :: timer(series s)
+    : m_message(false)
+    , m_series(s)
+    , m_type()
+    , m_start(e::time())
+    , m_cancelled(false)
+{
+}
+
+hyperdaemon :: metrics :: timer :: timer(hyperdex::network_msgtype t)
+    : m_message(true)
+    , m_series()
+    , m_type(t)
+    , m_start(e::time())
+    , m_cancelled(false)
+{
+}
+
+hyperdaemon :: metrics :: timer :: ~timer() throw ()
+{
+    if (m_cancelled)
+    {
+        return;
+    }
+
+    uint64_t nanos = e::time() - m_start;
+
+    if (m_message)
+    {
+        metrics::record(m_type, nanos);
+    }
+    else
+    {
+        metrics::record(m_series, nanos);
+    }
+}
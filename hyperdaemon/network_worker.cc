@@ -25,10 +25,16 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+// C
+#include <cerrno>
+
 // POSIX
 #include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <sys/socket.h>
+#include <unistd.h>
 
 // Google Log
 #include <glog/logging.h>
@@ -36,6 +42,9 @@
 // po6
 #include <po6/net/location.h>
 
+// e
+#include <e/guard.h>
+
 // HyperDisk
 #include "hyperdisk/hyperdisk/reference.h"
 
@@ -44,12 +53,17 @@
 #include "datatypes/microop.h"
 #include "hyperdex/hyperdex/network_constants.h"
 #include "hyperdex/hyperdex/packing.h"
+#include "hyperdaemon/admission_control.h"
 #include "hyperdaemon/datalayer.h"
+#include "hyperdaemon/hotkeys.h"
 #include "hyperdaemon/logical.h"
+#include "hyperdaemon/metrics.h"
 #include "hyperdaemon/network_worker.h"
 #include "hyperdaemon/ongoing_state_transfers.h"
 #include "hyperdaemon/replication_manager.h"
+#include "hyperdaemon/runtimeconfig.h"
 #include "hyperdaemon/searches.h"
+#include "hyperdaemon/tracing.h"
 
 using hyperdex::entityid;
 using hyperdex::network_msgtype;
@@ -59,13 +73,15 @@ hyperdaemon :: network_worker :: network_worker(datalayer* data,
                                                 logical* comm,
                                                 searches* ssss,
                                                 ongoing_state_transfers* ost,
-                                                replication_manager* repl)
+                                                replication_manager* repl,
+                                                admission_control* admit)
     : m_continue(true)
     , m_data(data)
     , m_comm(comm)
     , m_ssss(ssss)
     , m_ost(ost)
     , m_repl(repl)
+    , m_admit(admit)
 {
 }
 
@@ -95,16 +111,45 @@ hyperdaemon :: network_worker :: run()
         return;
     }
 
+    if (LOW_LATENCY)
+    {
+        pin();
+    }
+
     entityid from;
     entityid to;
     network_msgtype type;
     std::auto_ptr<e::buffer> msg;
+    uint64_t trace;
     unsigned int seed = pthread_self();
 
-    while (m_continue && m_comm->recv(&from, &to, &type, &msg))
+    while (m_continue && m_comm->recv(&from, &to, &type, &msg, &trace))
     {
+        // Reconfiguration waits on this before touching a fenced region.
+        e::guard fin = e::makeobjguard(*m_comm, &logical::finished, from, to);
+        fin.use_variable();
+        // Covers everything done on behalf of the message, however the
+        // iteration ends.
+        tracing::scope adopted(trace);
+        metrics::timer handled(type);
+        tracing::span traced(type);
         e::buffer::unpacker up = msg->unpack_from(m_comm->header_size());
         uint64_t nonce;
+        uint64_t ticket = 0;
+
+        // Only single-key operations are subject to admission control.
+        // Searches fan out to many servers, and shedding one piece of a search
+        // would leave the client with silently partial results.
+        if (type == hyperdex::REQ_GET || type == hyperdex::REQ_ATOMIC)
+        {
+            bool priority = from.number & hyperdex::CLIENT_PRIORITY;
+
+            if (!m_admit->admit(from.mask, priority, &ticket))
+            {
+                shed(from, to, type, msg);
+                continue;
+            }
+        }
 
         if (type == hyperdex::REQ_GET)
         {
@@ -113,9 +158,12 @@ hyperdaemon :: network_worker :: run()
             if ((up >> nonce >> key).error())
             {
                 LOG(WARNING) << "unpack of REQ_GET failed; here's some hex:  " << msg->hex();
+                m_admit->complete(ticket);
                 continue;
             }
 
+            hotkeys::observe(to.space, key);
+
             std::vector<e::slice> value;
             uint64_t version;
             hyperdisk::reference ref;
@@ -154,6 +202,7 @@ hyperdaemon :: network_worker :: run()
             e::buffer::packer pa = msg->pack_at(m_comm->header_size());
             pa = pa << nonce << static_cast<uint16_t>(result) << value;
             m_comm->send(to, from, hyperdex::RESP_GET, msg);
+            m_admit->complete(ticket);
         }
         else if (type == hyperdex::REQ_ATOMIC)
         {
@@ -166,9 +215,12 @@ hyperdaemon :: network_worker :: run()
             if (up.error())
             {
                 LOG(WARNING) << "unpack of REQ_ATOMIC failed; here's some hex:  " << msg->hex();
+                m_admit->complete(ticket);
                 continue;
             }
 
+            hotkeys::observe(to.space, key);
+
             bool fail_if_not_found = flags & 1;
             bool fail_if_found = flags & 2;
             bool has_microops = flags & 128;
@@ -176,12 +228,13 @@ hyperdaemon :: network_worker :: run()
             if (has_microops)
             {
                 m_repl->client_atomic(hyperdex::RESP_ATOMIC, from, to, nonce, msg,
-                                      fail_if_not_found, fail_if_found, key, &checks, &ops);
+                                      fail_if_not_found, fail_if_found, key, &checks, &ops,
+                                      ticket);
             }
             else
             {
                 m_repl->client_del(hyperdex::RESP_ATOMIC, from, to, nonce, msg,
-                                   key, &checks);
+                                   key, &checks, ticket);
             }
         }
         else if (type == hyperdex::REQ_SEARCH_START)
@@ -349,50 +402,72 @@ hyperdaemon :: network_worker :: run()
         }
         else if (type == hyperdex::XFER_MORE)
         {
-            m_ost->region_transfer_send(from, to);
+            // A request without an ack acknowledges nothing new.
+            uint64_t session = 0;
+            uint64_t acked = 0;
+            uint32_t leaves = 0;
+            std::vector<uint64_t> summary;
+            up = up >> session >> acked >> leaves;
+
+            for (uint32_t i = 0; !up.error() && i < leaves; ++i)
+            {
+                uint64_t leaf;
+                up = up >> leaf;
+                summary.push_back(leaf);
+            }
+
+            m_ost->region_transfer_send(from, to, session, acked, summary);
         }
         else if (type == hyperdex::XFER_DONE)
         {
             m_ost->region_transfer_done(from, to);
         }
-        else if (type == hyperdex::XFER_DATA)
+        else if (type == hyperdex::XFER_DATA || type == hyperdex::XFER_BULK)
         {
-            uint64_t xfer_num;
-            uint8_t op;
-            uint64_t version;
-            e::slice key;
-            std::vector<e::slice> value;
-
-            if ((up = up >> xfer_num >> version >> key >> op).error())
-            {
-                LOG(WARNING) << "unpack of XFER_DATA failed; here's some hex:  " << msg->hex();
-                continue;
-            }
-
-            if (op)
-            {
-                if ((up >> value).error())
-                {
-                    LOG(WARNING) << "unpack of XFER_DATA failed; here's some hex:  " << msg->hex();
-                    continue;
-                }
-            }
-
-            m_ost->region_transfer_recv(from, to.subspace, xfer_num,
-                                        op == 1, version, msg, key, value);
+            m_ost->region_transfer_recv(from, to.subspace, type, msg);
         }
         else
         {
             LOG(INFO) << "Message of unknown type received.";
         }
 
-        if (rand_r(&seed) < (0.01 * RAND_MAX))
+        // In low-latency mode the flush threads alone drain the WAL so that
+        // no client request waits behind an inline flush.
+        if (!LOW_LATENCY && rand_r(&seed) < (0.01 * RAND_MAX))
         {
             m_data->flush(to.get_region(), 100000, true);
         }
     }
 }
 
+void
+hyperdaemon :: network_worker :: pin()
+{
+    static size_t next_cpu = 0;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (cpus <= 0)
+    {
+        PLOG(ERROR) << "sysconf(_SC_NPROCESSORS_ONLN)";
+        return;
+    }
+
+    size_t cpu = __sync_fetch_and_add(&next_cpu, 1) % cpus;
+    cpu_set_t cs;
+    CPU_ZERO(&cs);
+    CPU_SET(cpu, &cs);
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs);
+
+    if (ret != 0)
+    {
+        errno = ret;
+        PLOG(ERROR) << "could not pin network worker to CPU " << cpu;
+        return;
+    }
+
+    LOG(INFO) << "Pinned network worker to CPU " << cpu;
+}
+
 void
 hyperdaemon :: network_worker :: shutdown()
 {
@@ -400,3 +475,29 @@ hyperdaemon :: network_worker :: shutdown()
     // two-stage process, and requires global coordination.
     m_continue = false;
 }
+
+void
+hyperdaemon :: network_worker :: shed(const entityid& from,
+                                      const entityid& to,
+                                      network_msgtype type,
+                                      std::auto_ptr<e::buffer> msg)
+{
+    metrics::count(metrics::CLIENT_SHED);
+    uint64_t nonce;
+
+    if ((msg->unpack_from(m_comm->header_size()) >> nonce).error())
+    {
+        LOG(WARNING) << "unpack of " << type << " failed; here's some hex:  " << msg->hex();
+        return;
+    }
+
+    // Both RESP_GET and RESP_ATOMIC begin with the nonce and result, and the
+    // client reads no further than that when the result is not NET_SUCCESS.
+    network_msgtype resp = type == hyperdex::REQ_GET ? hyperdex::RESP_GET
+                                                     : hyperdex::RESP_ATOMIC;
+    uint16_t result = static_cast<uint16_t>(hyperdex::NET_OVERLOADED);
+    size_t sz = m_comm->header_size() + sizeof(uint64_t) + sizeof(uint16_t);
+    msg.reset(e::buffer::create(sz));
+    msg->pack_at(m_comm->header_size()) << nonce << result;
+    m_comm->send(to, from, resp, msg);
+}
@@ -28,9 +28,20 @@
 #ifndef hyperdaemon_network_worker_h_
 #define hyperdaemon_network_worker_h_
 
+// STL
+#include <memory>
+
+// e
+#include <e/buffer.h>
+
+// HyperDex
+#include "hyperdex/hyperdex/ids.h"
+#include "hyperdex/hyperdex/network_constants.h"
+
 // Forward Declarations
 namespace hyperdaemon
 {
+class admission_control;
 class datalayer;
 class logical;
 class ongoing_state_transfers;
@@ -49,7 +60,8 @@ class network_worker
                        logical* comm,
                        searches* ssss,
                        ongoing_state_transfers* ost,
-                       replication_manager* repl);
+                       replication_manager* repl,
+                       admission_control* admit);
         ~network_worker() throw ();
 
     public:
@@ -59,6 +71,14 @@ class network_worker
     private:
         network_worker(const network_worker&);
 
+    private:
+        // Bind the calling thread to a CPU, handing out CPUs round-robin.
+        void pin();
+        void shed(const hyperdex::entityid& from,
+                  const hyperdex::entityid& to,
+                  hyperdex::network_msgtype type,
+                  std::auto_ptr<e::buffer> msg);
+
     private:
         network_worker& operator = (const network_worker&);
 
@@ -69,6 +89,7 @@ class network_worker
         searches* m_ssss;
         ongoing_state_transfers* m_ost;
         replication_manager* m_repl;
+        admission_control* m_admit;
 };
 
 } // namespace hyperdaemon
@@ -27,8 +27,17 @@
 
 #define __STDC_LIMIT_MACROS
 
+// C
+#include <cassert>
+
 // STL
+#include <algorithm>
+#include <deque>
 #include <map>
+#include <tr1/unordered_map>
+
+// Google CityHash
+#include <city.h>
 
 // Google Log
 #include <glog/logging.h>
@@ -37,6 +46,7 @@
 #include <e/timer.h>
 
 // HyperDisk
+#include "hyperdisk/hyperdisk/merkle.h"
 #include "hyperdisk/hyperdisk/snapshot.h"
 
 // HyperDex
@@ -48,6 +58,7 @@
 // HyperDaemon
 #include "hyperdaemon/datalayer.h"
 #include "hyperdaemon/logical.h"
+#include "hyperdaemon/metrics.h"
 #include "hyperdaemon/ongoing_state_transfers.h"
 #include "hyperdaemon/replication_manager.h"
 #include "hyperdaemon/runtimeconfig.h"
@@ -66,11 +77,12 @@ class hyperdaemon::ongoing_state_transfers::transfer_in
         class op
         {
             public:
-                op(bool hv, uint64_t ver,
+                op(bool hv, bool fs, uint64_t ver,
                    std::tr1::shared_ptr<e::buffer> b,
                    const e::slice& k,
                    const std::vector<e::slice>& val)
                     : has_value(hv)
+                    , from_snapshot(fs)
                     , version(ver)
                     , backing(b)
                     , key(k)
@@ -81,6 +93,7 @@ class hyperdaemon::ongoing_state_transfers::transfer_in
 
             public:
                 bool has_value;
+                bool from_snapshot;
                 uint64_t version;
                 std::tr1::shared_ptr<e::buffer> backing;
                 const e::slice key;
@@ -97,16 +110,62 @@ class hyperdaemon::ongoing_state_transfers::transfer_in
                 size_t m_ref;
         };
 
+        class slice_hash
+        {
+            public:
+                size_t operator () (const e::slice& s) const
+                { return CityHash64(reinterpret_cast<const char*>(s.data()), s.size()); }
+        };
+        // The versions of a key that act as triggers, along with the buffers
+        // that back them.  The first backs the key itself.
+        typedef std::vector<std::pair<uint64_t, std::tr1::shared_ptr<e::buffer> > > versions_t;
+        typedef std::tr1::unordered_map<e::slice, versions_t, slice_hash> trigger_map_t;
+
+    public:
+        transfer_in(const hyperdex::entityid& from, hyperdisk::lockstats* stats,
+                    hyperdisk::lockstats* trigger_stats);
+
     public:
-        transfer_in(const hyperdex::entityid& from);
+        // Hold "o" until every op before it has been applied.  Returns false if
+        // "seq" is too far ahead of xfer_num to be genuine.
+        bool queue(uint64_t seq, e::intrusive_ptr<op> o);
+        // The op that follows xfer_num, if it has arrived.
+        e::intrusive_ptr<op> next_op(size_t skip = 0) const;
+        void pop(size_t n = 1);
+        void add_trigger(const e::slice& key, uint64_t version,
+                         std::tr1::shared_ptr<e::buffer> backing);
+        // True if "key" triggers at "version".  Sets "any" if "key" triggers
+        // at some version.
+        bool is_trigger(const e::slice& key, uint64_t version, bool* any) const;
+        bool has_triggers() const;
 
     public:
-        po6::threads::mutex lock;
-        std::map<uint64_t, e::intrusive_ptr<op> > ops;
-        // "triggers" is protected by the replication lock.
-        std::map<std::pair<e::slice, uint64_t>, std::tr1::shared_ptr<e::buffer> > triggers;
+        hyperdisk::profiled_mutex lock;
+        // ops[i] holds op xfer_num + 1 + i, or NULL if it has yet to arrive.
+        std::deque<e::intrusive_ptr<op> > ops;
+        // Triggers are added under the replication lock of the acked key,
+        // and looked up under the replication lock of the key being
+        // transferred, so the two may race.  "triggers" is guarded by
+        // "trigger_lock", which is taken innermost, after "lock" and the
+        // replication lock.
+        mutable hyperdisk::profiled_mutex trigger_lock;
+        trigger_map_t triggers;
         const hyperdex::entityid replicate_from;
+        // The sender's attempt at this transfer, and the last object we have
+        // applied from it.  Together they are the checkpoint a retry of the
+        // transfer resumes from.
+        uint64_t session;
         uint64_t xfer_num;
+        // Messages received since the last one that let us make progress.
+        uint64_t stalled;
+        // What our copy held before the sender first answered us.
+        hyperdisk::merkle summary;
+        bool summarized;
+        // The disk may hold objects from an earlier attempt.
+        bool dirty;
+        // None of the keys in the sender's snapshot were on disk when we
+        // adopted its session.
+        bool fresh;
         bool failed;
         bool started;
         bool go_live;
@@ -123,12 +182,21 @@ class hyperdaemon::ongoing_state_transfers::transfer_in
         size_t m_ref;
 };
 
-hyperdaemon :: ongoing_state_transfers :: transfer_in :: transfer_in(const hyperdex::entityid& from)
-    : lock()
+hyperdaemon :: ongoing_state_transfers :: transfer_in :: transfer_in(const hyperdex::entityid& from,
+                                                                     hyperdisk::lockstats* stats,
+                                                                     hyperdisk::lockstats* trigger_stats)
+    : lock(stats)
     , ops()
+    , trigger_lock(trigger_stats)
     , triggers()
     , replicate_from(from)
+    , session(0)
     , xfer_num(0)
+    , stalled(0)
+    , summary()
+    , summarized(false)
+    , dirty(false)
+    , fresh(false)
     , failed(false)
     , started(false)
     , go_live(false)
@@ -137,18 +205,183 @@ hyperdaemon :: ongoing_state_transfers :: transfer_in :: transfer_in(const hyper
 {
 }
 
+bool
+hyperdaemon :: ongoing_state_transfers :: transfer_in :: queue(uint64_t seq,
+                                                               e::intrusive_ptr<op> o)
+{
+    assert(seq > xfer_num);
+    uint64_t idx = seq - xfer_num - 1;
+
+    // The sender never has more than XFER_WINDOW_MAX_OBJECTS unacknowledged,
+    // and we acknowledge no more than we have applied.
+    if (idx >= XFER_WINDOW_MAX_OBJECTS)
+    {
+        return false;
+    }
+
+    if (idx >= ops.size())
+    {
+        ops.resize(idx + 1);
+    }
+
+    if (!ops[idx])
+    {
+        ops[idx] = o;
+    }
+
+    return true;
+}
+
+e::intrusive_ptr<hyperdaemon::ongoing_state_transfers::transfer_in::op>
+hyperdaemon :: ongoing_state_transfers :: transfer_in :: next_op(size_t skip) const
+{
+    if (skip < ops.size())
+    {
+        return ops[skip];
+    }
+
+    return e::intrusive_ptr<op>();
+}
+
+void
+hyperdaemon :: ongoing_state_transfers :: transfer_in :: pop(size_t n)
+{
+    ops.erase(ops.begin(), ops.begin() + n);
+    xfer_num += n;
+}
+
+void
+hyperdaemon :: ongoing_state_transfers :: transfer_in :: add_trigger(const e::slice& key,
+                                                                     uint64_t version,
+                                                                     std::tr1::shared_ptr<e::buffer> backing)
+{
+    hyperdisk::profiled_mutex::hold hold(&trigger_lock);
+    versions_t& versions(triggers[key]);
+
+    for (size_t i = 0; i < versions.size(); ++i)
+    {
+        if (versions[i].first == version)
+        {
+            return;
+        }
+    }
+
+    versions.push_back(std::make_pair(version, backing));
+}
+
+bool
+hyperdaemon :: ongoing_state_transfers :: transfer_in :: is_trigger(const e::slice& key,
+                                                                    uint64_t version,
+                                                                    bool* any) const
+{
+    hyperdisk::profiled_mutex::hold hold(&trigger_lock);
+    trigger_map_t::const_iterator it = triggers.find(key);
+    *any = it != triggers.end();
+
+    if (!*any)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < it->second.size(); ++i)
+    {
+        if (it->second[i].first == version)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool
+hyperdaemon :: ongoing_state_transfers :: transfer_in :: has_triggers() const
+{
+    hyperdisk::profiled_mutex::hold hold(&trigger_lock);
+    return !triggers.empty();
+}
+
 ///////////////////////////////// Transfers Out ////////////////////////////////
 
 class hyperdaemon::ongoing_state_transfers::transfer_out
 {
     public:
-        transfer_out(e::intrusive_ptr<hyperdisk::rolling_snapshot> s);
+        class unacked
+        {
+            public:
+                unacked(uint64_t l, size_t b, uint64_t w)
+                    : last(l), bytes(b), when(w) {}
+
+            public:
+                uint64_t last;
+                size_t bytes;
+                uint64_t when;
+        };
+
+    public:
+        transfer_out(const hyperdex::regionid& r,
+                     const hyperdex::instance& d,
+                     e::intrusive_ptr<hyperdisk::rolling_snapshot> s,
+                     const hyperdisk::merkle& sum,
+                     hyperdisk::lockstats* stats);
+
+    public:
+        // Pick up where an earlier attempt to send the same region left off.
+        void resume(const transfer_out& other);
+        // Step "s" past objects in the snapshot that the receiver already
+        // has.  Log entries are never skipped.
+        void skip(e::intrusive_ptr<hyperdisk::rolling_snapshot> s);
+
+    // Flow control.  The window is sized to twice the bandwidth-delay product,
+    // estimated from the best delivery rate seen recently and the smallest
+    // round trip seen.  While the link keeps up the window doubles every round
+    // trip; once it is the bottleneck the window stops growing.  The number of
+    // unacknowledged objects is bounded too, because that is what the
+    // receiver has to buffer.
+    public:
+        bool window_open() const
+        { return outstanding < window && unacked_objects() < XFER_WINDOW_MAX_OBJECTS; }
+        uint64_t unacked_objects() const { return xfer_num - 1 - checkpoint_num; }
+        void sent(size_t bytes);
+        void acked(uint64_t seq);
 
     public:
-        po6::threads::mutex lock;
+        hyperdisk::profiled_mutex lock;
+        const hyperdex::regionid region;
+        const hyperdex::instance dest;
+        uint64_t session;
         e::intrusive_ptr<hyperdisk::rolling_snapshot> snap;
         uint64_t xfer_num;
+        // A copy of "snap" that trails it, positioned just past the last
+        // object the receiver has acknowledged.
+        e::intrusive_ptr<hyperdisk::rolling_snapshot> checkpoint;
+        uint64_t checkpoint_num;
+        // Summarizes the snapshot portion of "snap".  If the receiver sent a
+        // summary of its own copy, "differ" has a bit set for every leaf in
+        // which the two disagree, and only those leaves are sent.  It goes
+        // out with every message until the receiver acknowledges this
+        // session.
+        hyperdisk::merkle summary;
+        std::vector<uint64_t> differ;
+        bool adopted;
         bool failed;
+        // Where XFER_MORE requests come from and are addressed to.  Both are
+        // unknown until the first one arrives.
+        hyperdex::entityid peer;
+        hyperdex::entityid self;
+        // Bytes we may still send before the next refill, and whether we
+        // stopped sending for lack of them.
+        int64_t allowance;
+        bool throttled;
+        uint64_t acked_bytes;
+        uint64_t reported;
+        std::deque<unacked> inflight;
+        uint64_t outstanding;
+        uint64_t window;
+        uint64_t min_rtt;
+        double max_rate;
+        uint64_t epoch_start;
+        uint64_t epoch_bytes;
 
     private:
         friend class e::intrusive_ptr<transfer_out>;
@@ -161,15 +394,123 @@ class hyperdaemon::ongoing_state_transfers::transfer_out
         size_t m_ref;
 };
 
-hyperdaemon :: ongoing_state_transfers :: transfer_out :: transfer_out(e::intrusive_ptr<hyperdisk::rolling_snapshot> s)
-    : lock()
+hyperdaemon :: ongoing_state_transfers :: transfer_out :: transfer_out(const hyperdex::regionid& r,
+                                                                       const hyperdex::instance& d,
+                                                                       e::intrusive_ptr<hyperdisk::rolling_snapshot> s,
+                                                                       const hyperdisk::merkle& sum,
+                                                                       hyperdisk::lockstats* stats)
+    : lock(stats)
+    , region(r)
+    , dest(d)
+    , session(e::time() | 1)
     , snap(s)
     , xfer_num(1)
+    , checkpoint(s->clone())
+    , checkpoint_num(0)
+    , summary(sum)
+    , differ()
+    , adopted(false)
     , failed(false)
+    , peer()
+    , self()
+    , allowance(0)
+    , throttled(false)
+    , acked_bytes(0)
+    , reported(0)
+    , inflight()
+    , outstanding(0)
+    , window(XFER_WINDOW_MIN_BYTES)
+    , min_rtt(UINT64_MAX)
+    , max_rate(0)
+    , epoch_start(e::time())
+    , epoch_bytes(0)
     , m_ref(0)
 {
 }
 
+void
+hyperdaemon :: ongoing_state_transfers :: transfer_out :: resume(const transfer_out& other)
+{
+    session = other.session;
+    checkpoint = other.checkpoint;
+    checkpoint_num = other.checkpoint_num;
+    snap = checkpoint->clone();
+    xfer_num = checkpoint_num + 1;
+    summary = other.summary;
+    differ = other.differ;
+    adopted = other.adopted;
+}
+
+void
+hyperdaemon :: ongoing_state_transfers :: transfer_out :: skip(e::intrusive_ptr<hyperdisk::rolling_snapshot> s)
+{
+    while (!differ.empty() && s->in_snapshot() &&
+           !hyperdisk::merkle::differs(differ, s->key()))
+    {
+        s->next();
+    }
+}
+
+void
+hyperdaemon :: ongoing_state_transfers :: transfer_out :: sent(size_t bytes)
+{
+    inflight.push_back(unacked(xfer_num - 1, bytes, e::time()));
+    outstanding += bytes;
+}
+
+void
+hyperdaemon :: ongoing_state_transfers :: transfer_out :: acked(uint64_t seq)
+{
+    uint64_t now = e::time();
+
+    while (!inflight.empty() && inflight.front().last <= seq)
+    {
+        metrics::record(metrics::XFER_ACK_NANOS, now - inflight.front().when);
+        metrics::count(metrics::XFER_BYTES_ACKED, inflight.front().bytes);
+        min_rtt = std::min(min_rtt, now - inflight.front().when);
+        outstanding -= inflight.front().bytes;
+        epoch_bytes += inflight.front().bytes;
+        acked_bytes += inflight.front().bytes;
+        inflight.pop_front();
+    }
+
+    while (checkpoint_num < seq)
+    {
+        skip(checkpoint);
+
+        if (!checkpoint->valid())
+        {
+            break;
+        }
+
+        checkpoint->next();
+        ++checkpoint_num;
+    }
+
+    // A resumed receiver may already hold objects this attempt has yet to
+    // send; skip straight past them.
+    if (checkpoint_num >= xfer_num)
+    {
+        snap = checkpoint->clone();
+        xfer_num = checkpoint_num + 1;
+    }
+
+    // Take one rate sample per round trip, and let old maxima decay so that
+    // the window shrinks if the path gets slower.
+    if (min_rtt == UINT64_MAX || now - epoch_start < min_rtt || epoch_bytes == 0)
+    {
+        return;
+    }
+
+    double rate = static_cast<double>(epoch_bytes) / (now - epoch_start);
+    max_rate = std::max(rate, max_rate * 0.9);
+    epoch_start = now;
+    epoch_bytes = 0;
+    double bdp = max_rate * min_rtt;
+    window = std::max<uint64_t>(XFER_WINDOW_MIN_BYTES, 2 * bdp);
+    window = std::min<uint64_t>(XFER_WINDOW_MAX_BYTES, window);
+}
+
 ///////////////////////////////// Public Class /////////////////////////////////
 
 hyperdaemon :: ongoing_state_transfers :: ongoing_state_transfers(datalayer* data,
@@ -180,13 +521,27 @@ hyperdaemon :: ongoing_state_transfers :: ongoing_state_transfers(datalayer* dat
     , m_cl(cl)
     , m_repl(NULL)
     , m_config()
+    , m_transfer_locks()
+    , m_trigger_locks()
     , m_transfers_in(STATE_TRANSFER_HASHTABLE_SIZE)
     , m_transfers_out(STATE_TRANSFER_HASHTABLE_SIZE)
     , m_shutdown(false)
+    , m_active_out(0)
     , m_periodic_lock()
     , m_periodic_thread(std::tr1::bind(&ongoing_state_transfers::periodic, this))
+    , m_transfer_threads()
 {
     m_periodic_thread.start();
+
+    // Without a cap, a transfer sends as fast as its window allows and the
+    // transfer threads have nothing to refill.
+    for (size_t i = 0; XFER_BYTES_PER_SECOND && i < std::max<size_t>(1, XFER_THREADS); ++i)
+    {
+        std::tr1::shared_ptr<po6::threads::thread>
+            t(new po6::threads::thread(std::tr1::bind(&ongoing_state_transfers::transfer_thread, this, i)));
+        t->start();
+        m_transfer_threads.push_back(t);
+    }
 }
 
 hyperdaemon :: ongoing_state_transfers :: ~ongoing_state_transfers() throw ()
@@ -197,13 +552,18 @@ hyperdaemon :: ongoing_state_transfers :: ~ongoing_state_transfers() throw ()
     }
 
     m_periodic_thread.join();
+
+    for (size_t i = 0; i < m_transfer_threads.size(); ++i)
+    {
+        m_transfer_threads[i]->join();
+    }
 }
 
 void
 hyperdaemon :: ongoing_state_transfers :: prepare(const configuration& newconfig,
                                                   const instance& us)
 {
-    po6::threads::mutex::hold hold(&m_periodic_lock);
+    hyperdisk::profiled_mutex::hold hold(&m_periodic_lock);
     std::map<uint16_t, regionid> in_transfers = newconfig.transfers_to(us);
     std::map<uint16_t, regionid> out_transfers = newconfig.transfers_from(us);
     std::map<uint16_t, regionid>::iterator t;
@@ -215,7 +575,35 @@ hyperdaemon :: ongoing_state_transfers :: prepare(const configuration& newconfig
         {
             LOG(INFO) << "Initiating inbound transfer #" << t->first;
             e::intrusive_ptr<transfer_in> xfer;
-            xfer = new transfer_in(newconfig.tailof(t->second));
+            xfer = new transfer_in(newconfig.tailof(t->second), &m_transfer_locks,
+                                   &m_trigger_locks);
+
+            // The coordinator retries a failed transfer under a new number.
+            // If the old attempt is from the same source, carry its
+            // checkpoint over.  Either way, its objects are on our disk.
+            for (transfers_in_map_t::iterator old = m_transfers_in.begin();
+                    old != m_transfers_in.end(); old.next())
+            {
+                if (old.value()->replicate_from.get_region() != t->second)
+                {
+                    continue;
+                }
+
+                hyperdisk::profiled_mutex::hold hold_old(&old.value()->lock);
+                xfer->dirty = true;
+
+                if (old.value()->replicate_from == xfer->replicate_from &&
+                    m_config.instancefor(old.value()->replicate_from) ==
+                    newconfig.instancefor(xfer->replicate_from))
+                {
+                    LOG(INFO) << "Resuming inbound transfer #" << t->first
+                              << " from transfer #" << old.key()
+                              << " at object " << old.value()->xfer_num;
+                    xfer->session = old.value()->session;
+                    xfer->xfer_num = old.value()->xfer_num;
+                }
+            }
+
             m_transfers_in.insert(t->first, xfer);
         }
     }
@@ -226,11 +614,30 @@ hyperdaemon :: ongoing_state_transfers :: prepare(const configuration& newconfig
         if (!m_transfers_out.contains(t->first))
         {
             LOG(INFO) << "Initiating outbound transfer #" << t->first;
+            instance dest = newconfig.instancefortransfer(t->first);
             e::intrusive_ptr<hyperdisk::rolling_snapshot> snap;
-            snap = m_data->make_rolling_snapshot(t->second);
+            hyperdisk::merkle summary;
+            snap = m_data->make_rolling_snapshot(t->second, &summary);
             e::intrusive_ptr<transfer_out> xfer;
-            xfer = new transfer_out(snap);
+            xfer = new transfer_out(t->second, dest, snap, summary, &m_transfer_locks);
+
+            for (transfers_out_map_t::iterator old = m_transfers_out.begin();
+                    old != m_transfers_out.end(); old.next())
+            {
+                if (old.value()->region == t->second && old.value()->dest == dest)
+                {
+                    hyperdisk::profiled_mutex::hold hold_old(&old.value()->lock);
+                    LOG(INFO) << "Resuming outbound transfer #" << t->first
+                              << " from transfer #" << old.key()
+                              << " at object " << old.value()->checkpoint_num;
+                    xfer->resume(*old.value());
+                }
+            }
+
             m_transfers_out.insert(t->first, xfer);
+            // Count the transfer now, so that it takes its share of the cap
+            // from the first tick rather than from the next progress report.
+            ++m_active_out;
         }
     }
 }
@@ -239,7 +646,7 @@ void
 hyperdaemon :: ongoing_state_transfers :: reconfigure(const configuration& config,
                                                       const instance&)
 {
-    po6::threads::mutex::hold hold(&m_periodic_lock);
+    hyperdisk::profiled_mutex::hold hold(&m_periodic_lock);
     m_config = config;
     __sync_synchronize();
 }
@@ -248,7 +655,7 @@ void
 hyperdaemon :: ongoing_state_transfers :: cleanup(const configuration& newconfig,
                                                   const instance& us)
 {
-    po6::threads::mutex::hold hold(&m_periodic_lock);
+    hyperdisk::profiled_mutex::hold hold(&m_periodic_lock);
     std::map<uint16_t, regionid> in_transfers = newconfig.transfers_to(us);
     std::map<uint16_t, regionid> out_transfers = newconfig.transfers_from(us);
 
@@ -287,6 +694,13 @@ hyperdaemon :: ongoing_state_transfers :: cleanup(const configuration& newconfig
         if (out_transfers.find(to.key()) == out_transfers.end())
         {
             LOG(INFO) << "Stopping outgoing transfer #" << to.key();
+            hyperdisk::profiled_mutex::hold hold_t(&to.value()->lock);
+
+            if (!to.value()->failed && to.value()->snap->valid() && m_active_out > 0)
+            {
+                --m_active_out;
+            }
+
             m_transfers_out.remove(to.key());
         }
     }
@@ -300,7 +714,10 @@ hyperdaemon :: ongoing_state_transfers :: shutdown()
 
 void
 hyperdaemon :: ongoing_state_transfers :: region_transfer_send(const entityid& from,
-                                                               const entityid& to)
+                                                               const entityid& to,
+                                                               uint64_t session,
+                                                               uint64_t acked,
+                                                               const std::vector<uint64_t>& summary)
 {
     // Find the outgoing transfer state
     e::intrusive_ptr<transfer_out> t;
@@ -317,137 +734,298 @@ hyperdaemon :: ongoing_state_transfers :: region_transfer_send(const entityid& f
         return;
     }
 
-    network_msgtype type;
-    std::auto_ptr<e::buffer> msg;
+    hyperdisk::profiled_mutex::hold hold(&t->lock);
+    t->peer = from;
+    t->self = to;
+
+    // An ack for another attempt tells us nothing.
+    if (session == t->session)
+    {
+        t->adopted = true;
+        t->acked(acked);
+    }
+    // The receiver already holds a copy of the region.  If we have yet to
+    // send anything, send only the leaves in which it differs from ours.
+    else if (!summary.empty() && !t->adopted && t->xfer_num == 1 && t->differ.empty())
+    {
+        if (t->summary.compare(summary, &t->differ))
+        {
+            size_t leaves = 0;
+
+            for (size_t i = 0; i < t->differ.size(); ++i)
+            {
+                leaves += __builtin_popcountll(t->differ[i]);
+            }
+
+            LOG(INFO) << "transfer #" << from.subspace << " differs in " << leaves
+                      << " of " << hyperdisk::merkle::LEAVES << " leaves";
+        }
+    }
+
+    send_window(t);
+}
+
+void
+hyperdaemon :: ongoing_state_transfers :: region_transfer_recv(const hyperdex::entityid& from,
+                                                               uint16_t xfer_id,
+                                                               network_msgtype type,
+                                                               std::auto_ptr<e::buffer> msg)
+{
+    // Find the incoming transfer state
+    e::intrusive_ptr<transfer_in> t;
+
+    if (!m_transfers_in.lookup(xfer_id, &t))
+    {
+        LOG(INFO) << "received " << type << " for transfer #" << xfer_id << ", but we know nothing about it";
+        return;
+    }
+
+    // Grab a lock to ensure we can safely update the transfer object.
+    hyperdisk::profiled_mutex::hold hold_t(&t->lock);
 
-    po6::threads::mutex::hold hold(&t->lock);
+    if (t->failed)
+    {
+        LOG(INFO) << "received " << type << " for transfer #" << xfer_id << ", but we have failed it";
+        m_cl->transfer_fail(xfer_id);
+        return;
+    }
 
-    if (t->snap->valid())
+    // If we've triggered, then we can safely drop the message.
+    if (t->triggered)
     {
-        size_t size = m_comm->header_size()
-                    + sizeof(uint64_t)
-                    + sizeof(uint64_t)
-                    + sizeof(uint32_t)
-                    + t->snap->key().size()
-                    + sizeof(uint8_t);
-        type = hyperdex::XFER_DATA;
+        return;
+    }
 
-        if (t->snap->has_value())
+    metrics::count(metrics::XFER_MESSAGES_RECEIVED);
+    metrics::count(metrics::XFER_BYTES_RECEIVED, msg->size());
+
+    // Every op shares the one message as its backing.  Objects in an
+    // XFER_BULK come from the snapshot and always have a value; objects in an
+    // XFER_DATA come from the log and carry a flag saying if they do.
+    std::tr1::shared_ptr<e::buffer> back(msg);
+    e::buffer::unpacker up = back->unpack_from(m_comm->header_size());
+    uint64_t session;
+    uint64_t xfer_num;
+    uint32_t count;
+    uint32_t words;
+    std::vector<uint64_t> differ;
+    up = up >> session >> xfer_num >> count >> words;
+
+    for (uint32_t i = 0; !up.error() && i < words; ++i)
+    {
+        uint64_t word;
+        up = up >> word;
+        differ.push_back(word);
+    }
+
+    // The sender is not resuming our checkpoint, so it starts from a fresh
+    // snapshot.  Anything on disk from before may since have been deleted at
+    // the source, so it has to go.  If the sender compared our summary to
+    // its own, that is only what lies in the leaves that differ.
+    if (!up.error() && session != t->session)
+    {
+        if (!differ.empty())
+        {
+            LOG(INFO) << "transfer #" << xfer_id << " repairs the partial copy where it differs";
+            purge(t, differ);
+        }
+        else if (t->dirty)
         {
-            size += hyperdex::packspace(t->snap->value());
+            LOG(INFO) << "transfer #" << xfer_id << " restarted from scratch; clearing the partial copy";
+
+            if (!m_data->reset_disk(m_config, t->replicate_from.get_region()))
+            {
+                LOG(ERROR) << "transfer " << xfer_id << " failed because its disk could not be reset";
+                t->failed = true;
+                m_cl->transfer_fail(xfer_id);
+                return;
+            }
         }
 
-        msg.reset(e::buffer::create(size));
-        e::buffer::packer pa = msg->pack_at(m_comm->header_size());
-        pa = pa << t->xfer_num
-                << t->snap->version()
-                << t->snap->key();
+        t->session = session;
+        t->xfer_num = 0;
+        t->stalled = 0;
+        t->ops.clear();
+        t->dirty = true;
+        // Either the disk is now empty, or the sender only sends leaves we
+        // purged.
+        t->fresh = true;
+    }
 
-        if (t->snap->has_value())
+    bool corrupt = false;
+
+    for (uint32_t i = 0; !up.error() && !corrupt && i < count; ++i)
+    {
+        uint64_t version;
+        e::slice key;
+        uint8_t op = 1;
+        std::vector<e::slice> value;
+        up = up >> version >> key;
+
+        if (type == hyperdex::XFER_DATA)
         {
-            pa = pa << static_cast<uint8_t>(1) << t->snap->value();
+            up = up >> op;
         }
-        else
+
+        if (op)
         {
-            pa = pa << static_cast<uint8_t>(0);
+            up = up >> value;
         }
 
-        ++t->xfer_num;
-        t->snap->next();
+        // Objects at or before our checkpoint are already on disk.
+        if (!up.error() && xfer_num + i > t->xfer_num)
+        {
+            e::intrusive_ptr<transfer_in::op> o = new transfer_in::op(op == 1, type == hyperdex::XFER_BULK,
+                                                                     version, back, key, value);
+
+            corrupt = !t->queue(xfer_num + i, o);
+        }
     }
-    else
+
+    if (up.error() || corrupt)
     {
-        type = hyperdex::XFER_DONE;
-        msg.reset(e::buffer::create(m_comm->header_size()));
+        LOG(ERROR) << "transfer " << xfer_id << " failed because of a corrupt " << type << " message";
+        t->failed = true;
+        m_cl->transfer_fail(xfer_id);
+        return;
     }
 
-    if (!m_comm->send(to, from, type, msg))
+    if (apply_ops(t, from, xfer_id))
     {
-        t->failed = true;
-        m_cl->transfer_fail(from.subspace);
+        request_more(t, xfer_id);
     }
 }
 
 void
-hyperdaemon :: ongoing_state_transfers :: region_transfer_recv(const hyperdex::entityid& from,
-                                                               uint16_t xfer_id,
-                                                               uint64_t xfer_num,
-                                                               bool has_value,
-                                                               uint64_t version,
-                                                               std::auto_ptr<e::buffer> backing,
-                                                               const e::slice& key,
-                                                               const std::vector<e::slice>& value)
+hyperdaemon :: ongoing_state_transfers :: region_transfer_done(const entityid& from,
+                                                               const entityid& to)
 {
     // Find the incoming transfer state
     e::intrusive_ptr<transfer_in> t;
 
-    if (!m_transfers_in.lookup(xfer_id, &t))
+    if (!m_transfers_in.lookup(to.subspace, &t))
     {
-        LOG(INFO) << "received XFER_DATA for transfer #" << xfer_id << ", but we know nothing about it";
+        LOG(INFO) << "received XFER_DONE for transfer #" << to.subspace << ", but we know nothing about it";
         return;
     }
 
-    // Grab a lock to ensure we can safely update the transfer object.
-    po6::threads::mutex::hold hold_t(&t->lock);
+    hyperdisk::profiled_mutex::hold hold(&t->lock);
 
     if (t->failed)
     {
-        LOG(INFO) << "received XFER_DATA for transfer #" << xfer_id << ", but we have failed it";
-        m_cl->transfer_fail(xfer_id);
+        LOG(INFO) << "received XFER_DONE for transfer #" << to.subspace << ", but we have failed it";
+        m_cl->transfer_fail(to.subspace);
         return;
     }
 
-    // If we've triggered, then we can safely drop the message.
-    if (t->triggered)
+    if (from != t->replicate_from)
     {
+        LOG(WARNING) << "another host is stepping on transfer #" << to.subspace;
         return;
     }
 
-    // This is a probabilistic test of the remote end's failure.  If we have
-    // queued more than TRANSFERS_IN_FLIGHT messages, then somewhere one got
-    // dropped as the other end inserts them into the queue in FIFO order, and
-    // they are delivered to threads in FIFO order.  There is always a chance
-    // that what really happened was one thread pulled off the missing message,
-    // and then was blocked arbitrarily long while other threads worked through
-    // several messages.  The large constant ensures that this is exceedingly
-    // unlikely (but admittedly still possible).  Best chances are when the
-    // constant is many times the number of network threads
-    //  XXX Autotune this.
-    if (t->ops.size() > TRANSFERS_IN_FLIGHT * 64)
+    t->started = true;
+
+    if (!t->go_live)
+    {
+        LOG(WARNING) << "transfer #" << to.subspace << " is asking to go live";
+        t->go_live = true;
+        m_cl->transfer_golive(to.subspace);
+    }
+}
+
+void
+hyperdaemon :: ongoing_state_transfers :: add_trigger(const hyperdex::regionid& reg,
+                                                      std::tr1::shared_ptr<e::buffer> backing,
+                                                      const e::slice& key,
+                                                      uint64_t rev)
+{
+    uint16_t xfer_id = m_config.transfer_id(reg);
+    e::intrusive_ptr<transfer_in> t;
+
+    if (!m_transfers_in.lookup(xfer_id, &t) || !t)
     {
-        t->failed = true;
-        m_cl->transfer_fail(xfer_id);
         return;
     }
 
-    // Insert the new operation.
-    std::tr1::shared_ptr<e::buffer> back(backing);
-    e::intrusive_ptr<transfer_in::op> o = new transfer_in::op(has_value, version, back, key, value);
-    t->ops.insert(std::make_pair(xfer_num, o));
+    t->add_trigger(key, rev, backing);
+}
+
+void
+hyperdaemon :: ongoing_state_transfers :: set_replication_manager(replication_manager* repl)
+{
+    m_repl = repl;
+}
+
+void
+hyperdaemon :: ongoing_state_transfers :: lock_stats(std::map<std::string, hyperdisk::lockstats>* stats) const
+{
+    (*stats)["transfers.periodic"] += m_periodic_lock.stats();
+    (*stats)["transfers.transfer"] += m_transfer_locks;
+    (*stats)["transfers.triggers"] += m_trigger_locks;
+}
+
+void
+hyperdaemon :: ongoing_state_transfers :: count_transfers(uint64_t* in, uint64_t* out)
+{
+    *in = 0;
+    *out = 0;
+
+    for (transfers_in_map_t::iterator t = m_transfers_in.begin();
+            t != m_transfers_in.end(); t.next())
+    {
+        ++*in;
+    }
+
+    for (transfers_out_map_t::iterator t = m_transfers_out.begin();
+            t != m_transfers_out.end(); t.next())
+    {
+        ++*out;
+    }
+}
+
+bool
+hyperdaemon :: ongoing_state_transfers :: apply_ops(e::intrusive_ptr<transfer_in> t,
+                                                    const hyperdex::entityid& from,
+                                                    uint16_t xfer_id)
+{
+    uint64_t xfer_num = t->xfer_num;
 
-    while (!t->ops.empty() && t->ops.begin()->first == t->xfer_num + 1)
+    for (e::intrusive_ptr<transfer_in::op> next = t->next_op(); next; next = t->next_op())
     {
-        transfer_in::op& oneop(*t->ops.begin()->second);
+        // Until we go live nobody else writes to the region, so the snapshot
+        // may skip the log and the per-key locks.
+        if (next->from_snapshot && !t->go_live && !t->has_triggers())
+        {
+            if (!load_snapshot(t, xfer_id))
+            {
+                return false;
+            }
+
+            continue;
+        }
+
+        transfer_in::op& oneop(*next);
 
         // XXX We should do better than being friends with m_repl.
         // Grab a lock to ensure that we order the puts to disk correctly.
-        e::striped_lock<po6::threads::mutex>::hold hold(&m_repl->m_locks, m_repl->get_lock_num(from.get_region(), oneop.key));
+        hyperdisk::striped_mutex::hold hold(&m_repl->m_locks, m_repl->get_lock_num(from.get_region(), oneop.key));
 
         // If this op acts as a trigger
-        if (t->triggers.find(std::make_pair(oneop.key, oneop.version)) !=
-                t->triggers.end())
+        bool any_version = false;
+
+        if (t->is_trigger(oneop.key, oneop.version, &any_version))
         {
             t->triggered = true;
             m_cl->transfer_complete(xfer_id);
-            return;
+            return false;
         }
 
         // This op can only be put to disk when there is not another version of
         // the key in the triggers.  If there is another version in the
         // triggers, then this version or another has already been written to
         // disk and we cannot overwrite it.
-        if (t->triggers.lower_bound(std::make_pair(oneop.key, 0)) ==
-                t->triggers.upper_bound(std::make_pair(oneop.key, UINT64_MAX)))
+        if (!any_version)
         {
             hyperdisk::returncode res;
 
@@ -465,7 +1043,7 @@ hyperdaemon :: ongoing_state_transfers :: region_transfer_recv(const hyperdex::e
                 LOG(ERROR) << "transfer " << xfer_id << " failed because HyperDisk returned " << res;
                 t->failed = true;
                 m_cl->transfer_fail(xfer_id);
-                return;
+                return false;
             }
 
             m_repl->check_for_deferred_operations(from.get_region(),
@@ -473,81 +1051,359 @@ hyperdaemon :: ongoing_state_transfers :: region_transfer_recv(const hyperdex::e
                     oneop.value);
         }
 
-        t->ops.erase(t->ops.begin());
-        ++t->xfer_num;
+        t->pop();
+    }
+
+    // This is a probabilistic test of the remote end's failure.  If we have
+    // received more than TRANSFERS_IN_FLIGHT messages without making
+    // progress, then somewhere one got dropped as the other end inserts them
+    // into the queue in FIFO order, and they are delivered to threads in FIFO
+    // order.  There is always a chance that what really happened was one
+    // thread pulled off the missing message, and then was blocked arbitrarily
+    // long while other threads worked through several messages.  The large
+    // constant ensures that this is exceedingly unlikely (but admittedly still
+    // possible).  Best chances are when the constant is many times the number
+    // of network threads
+    //  XXX Autotune this.
+    if (t->xfer_num != xfer_num)
+    {
+        t->stalled = 0;
+    }
+    else if (++t->stalled > TRANSFERS_IN_FLIGHT * 64)
+    {
+        t->failed = true;
+        m_cl->transfer_fail(xfer_id);
+        return false;
+    }
+
+    return true;
+}
+
+bool
+hyperdaemon :: ongoing_state_transfers :: load_snapshot(e::intrusive_ptr<transfer_in> t,
+                                                        uint16_t xfer_id)
+{
+    std::vector<hyperdisk::bulk_object> objects;
+    e::intrusive_ptr<transfer_in::op> op;
+
+    while ((op = t->next_op(objects.size())) && op->from_snapshot)
+    {
+        objects.push_back(hyperdisk::bulk_object(op->backing, op->key,
+                                                 op->value, op->version));
+    }
+
+    hyperdisk::returncode res;
+    res = m_data->bulk_load(t->replicate_from.get_region(), objects, t->fresh);
+
+    if (res != hyperdisk::SUCCESS)
+    {
+        LOG(ERROR) << "transfer " << xfer_id << " failed because HyperDisk returned " << res;
+        t->failed = true;
+        m_cl->transfer_fail(xfer_id);
+        return false;
     }
 
+    t->pop(objects.size());
+    return true;
+}
+
+void
+hyperdaemon :: ongoing_state_transfers :: request_more(e::intrusive_ptr<transfer_in> t,
+                                                       uint16_t xfer_id)
+{
     t->started = true;
-    std::auto_ptr<e::buffer> msg(e::buffer::create(m_comm->header_size()));
 
     if (!m_comm->send(entityid(configuration::TRANSFERSPACE, xfer_id, 0, 0, 0),
-                      t->replicate_from, hyperdex::XFER_MORE, msg))
+                      t->replicate_from, hyperdex::XFER_MORE, more_message(t)))
     {
         t->failed = true;
         m_cl->transfer_fail(xfer_id);
-        return;
     }
 }
 
 void
-hyperdaemon :: ongoing_state_transfers :: region_transfer_done(const entityid& from,
-                                                               const entityid& to)
+hyperdaemon :: ongoing_state_transfers :: send_window(e::intrusive_ptr<transfer_out> t)
 {
-    // Find the incoming transfer state
-    e::intrusive_ptr<transfer_in> t;
+    t->skip(t->snap);
 
-    if (!m_transfers_in.lookup(to.subspace, &t))
+    if (!t->snap->valid())
     {
-        LOG(INFO) << "received XFER_DONE for transfer #" << to.subspace << ", but we know nothing about it";
+        std::auto_ptr<e::buffer> msg(e::buffer::create(m_comm->header_size()));
+
+        if (!m_comm->send(t->self, t->peer, hyperdex::XFER_DONE, msg))
+        {
+            t->failed = true;
+            m_cl->transfer_fail(t->peer.subspace);
+        }
+
         return;
     }
 
-    po6::threads::mutex::hold hold(&t->lock);
+    // Fill the window.  Acks are cumulative, so a lost XFER_MORE costs nothing
+    // as long as a later one arrives.  Under a bandwidth cap, a message may
+    // overdraw the allowance; the debt is repaid before the next one goes.
+    while (t->window_open() && t->snap->valid())
+    {
+        if (XFER_BYTES_PER_SECOND && t->allowance <= 0)
+        {
+            t->throttled = true;
+            return;
+        }
 
-    if (t->failed)
+        network_msgtype type;
+        std::auto_ptr<e::buffer> msg;
+
+        if (t->snap->in_snapshot())
+        {
+            type = hyperdex::XFER_BULK;
+            msg = bulk_message(t);
+        }
+        else
+        {
+            type = hyperdex::XFER_DATA;
+            msg = data_message(t);
+        }
+
+        t->sent(msg->size());
+        t->allowance -= msg->size();
+        metrics::count(metrics::XFER_MESSAGES_SENT);
+        metrics::count(metrics::XFER_BYTES_SENT, msg->size());
+
+        if (!m_comm->send(t->self, t->peer, type, msg))
+        {
+            t->failed = true;
+            m_cl->transfer_fail(t->peer.subspace);
+            return;
+        }
+    }
+}
+
+void
+hyperdaemon :: ongoing_state_transfers :: transfer_thread(size_t idx)
+{
+    LOG(WARNING) << "State transfer thread " << idx << " started.";
+    const uint64_t TICKS_PER_SECOND = 100;
+
+    while (!m_shutdown)
     {
-        LOG(INFO) << "received XFER_DONE for transfer #" << to.subspace << ", but we have failed it";
-        m_cl->transfer_fail(to.subspace);
-        return;
+        e::sleep_ms(1000 / TICKS_PER_SECOND);
+
+        if (!XFER_BYTES_PER_SECOND)
+        {
+            continue;
+        }
+
+        // Every sending transfer gets an equal share of the cap each tick.  A
+        // transfer may bank at most one tick's worth, so that those held back
+        // by their window do not later burst past the cap.
+        int64_t share = XFER_BYTES_PER_SECOND / TICKS_PER_SECOND
+                      / std::max<size_t>(1, m_active_out);
+
+        for (transfers_out_map_t::iterator to = m_transfers_out.begin();
+                to != m_transfers_out.end(); to.next())
+        {
+            if (to.key() % std::max<size_t>(1, XFER_THREADS) != idx)
+            {
+                continue;
+            }
+
+            e::intrusive_ptr<transfer_out> t = to.value();
+            hyperdisk::profiled_mutex::hold hold(&t->lock);
+            t->allowance = std::min(t->allowance + share, share);
+
+            if (t->throttled && t->allowance > 0 && !t->failed)
+            {
+                t->throttled = false;
+                send_window(t);
+            }
+        }
     }
+}
 
-    if (from != t->replicate_from)
+std::auto_ptr<e::buffer>
+hyperdaemon :: ongoing_state_transfers :: more_message(e::intrusive_ptr<transfer_in> t)
+{
+    // Every XFER_MORE acknowledges all objects up to and including xfer_num.
+    // Until the sender answers, it also carries the summary of what we hold.
+    const std::vector<uint64_t>& leaves(t->summary.leaves());
+    bool with_summary = !t->started && !t->summary.empty();
+    size_t size = m_comm->header_size() + 2 * sizeof(uint64_t);
+
+    if (with_summary)
     {
-        LOG(WARNING) << "another host is stepping on transfer #" << to.subspace;
-        return;
+        size += sizeof(uint32_t) + leaves.size() * sizeof(uint64_t);
     }
 
-    t->started = true;
+    std::auto_ptr<e::buffer> msg(e::buffer::create(size));
+    e::buffer::packer pa = msg->pack_at(m_comm->header_size());
+    pa = pa << t->session << t->xfer_num;
 
-    if (!t->go_live)
+    if (with_summary)
     {
-        LOG(WARNING) << "transfer #" << to.subspace << " is asking to go live";
-        t->go_live = true;
-        m_cl->transfer_golive(to.subspace);
+        pa = pa << static_cast<uint32_t>(leaves.size());
+
+        for (size_t i = 0; i < leaves.size(); ++i)
+        {
+            pa = pa << leaves[i];
+        }
+    }
+
+    return msg;
+}
+
+size_t
+hyperdaemon :: ongoing_state_transfers :: preamble_size(e::intrusive_ptr<transfer_out> t)
+{
+    size_t size = 2 * sizeof(uint64_t) + 2 * sizeof(uint32_t);
+
+    if (!t->adopted)
+    {
+        size += t->differ.size() * sizeof(uint64_t);
     }
+
+    return size;
 }
 
 void
-hyperdaemon :: ongoing_state_transfers :: add_trigger(const hyperdex::regionid& reg,
-                                                      std::tr1::shared_ptr<e::buffer> backing,
-                                                      const e::slice& key,
-                                                      uint64_t rev)
+hyperdaemon :: ongoing_state_transfers :: pack_preamble(e::intrusive_ptr<transfer_out> t,
+                                                        e::buffer* msg,
+                                                        uint64_t first,
+                                                        uint32_t count)
 {
-    uint16_t xfer_id = m_config.transfer_id(reg);
-    e::intrusive_ptr<transfer_in> t;
+    uint32_t words = t->adopted ? 0 : t->differ.size();
+    e::buffer::packer pa = msg->pack_at(m_comm->header_size());
+    pa = pa << t->session << first << count << words;
 
-    if (!m_transfers_in.lookup(xfer_id, &t) || !t)
+    for (uint32_t i = 0; i < words; ++i)
+    {
+        pa = pa << t->differ[i];
+    }
+}
+
+void
+hyperdaemon :: ongoing_state_transfers :: purge(e::intrusive_ptr<transfer_in> t,
+                                                const std::vector<uint64_t>& differ)
+{
+    const regionid& reg(t->replicate_from.get_region());
+    schema* sc = m_config.get_schema(reg.get_space());
+    assert(sc);
+    hyperspacehashing::search terms(sc->attrs_sz);
+    e::intrusive_ptr<hyperdisk::snapshot> snap = m_data->make_snapshot(reg, terms);
+
+    if (!snap)
     {
         return;
     }
 
-    t->triggers[std::make_pair(key, rev)] = backing;
+    for (; snap->valid(); snap->next())
+    {
+        if (!hyperdisk::merkle::differs(differ, snap->key()))
+        {
+            continue;
+        }
+
+        // The snapshot's key does not outlive it, but the delete will.
+        std::tr1::shared_ptr<e::buffer> backing(e::buffer::create(snap->key().size()));
+        backing->pack_at(0).copy(snap->key());
+        m_data->del(reg, backing, backing->as_slice());
+    }
 }
 
-void
-hyperdaemon :: ongoing_state_transfers :: set_replication_manager(replication_manager* repl)
+std::auto_ptr<e::buffer>
+hyperdaemon :: ongoing_state_transfers :: bulk_message(e::intrusive_ptr<transfer_out> t)
 {
-    m_repl = repl;
+    // Keys and values from the frozen snapshot stay put as we advance, so we
+    // can collect them all before sizing the message.
+    std::vector<std::pair<uint64_t, std::pair<e::slice, std::vector<e::slice> > > > objs;
+    const size_t header = m_comm->header_size() + preamble_size(t);
+    size_t size = header;
+    t->skip(t->snap);
+
+    while (t->snap->in_snapshot() && (objs.empty() || size < XFER_BULK_BYTES) &&
+           t->unacked_objects() + objs.size() < XFER_WINDOW_MAX_OBJECTS)
+    {
+        size += sizeof(uint64_t)
+              + sizeof(uint32_t) + t->snap->key().size()
+              + hyperdex::packspace(t->snap->value());
+        objs.push_back(std::make_pair(t->snap->version(),
+                                      std::make_pair(t->snap->key(), t->snap->value())));
+        t->snap->next();
+        t->skip(t->snap);
+    }
+
+    std::auto_ptr<e::buffer> msg(e::buffer::create(size));
+    pack_preamble(t, msg.get(), t->xfer_num, objs.size());
+    e::buffer::packer pa = msg->pack_at(header);
+
+    for (size_t i = 0; i < objs.size(); ++i)
+    {
+        pa = pa << objs[i].first << objs[i].second.first << objs[i].second.second;
+    }
+
+    t->xfer_num += objs.size();
+    return msg;
+}
+
+std::auto_ptr<e::buffer>
+hyperdaemon :: ongoing_state_transfers :: data_message(e::intrusive_ptr<transfer_out> t)
+{
+    // Log entries may be released as soon as we step past them, so each one is
+    // packed before advancing.  The message is sized up front, and the first
+    // entry always goes in, even if it alone exceeds the budget.
+    const size_t header = m_comm->header_size() + preamble_size(t);
+    size_t capacity = std::max<size_t>(header + XFER_BULK_BYTES,
+                                       header + data_size(t));
+    std::auto_ptr<e::buffer> msg(e::buffer::create(capacity));
+    e::buffer::packer pa = msg->pack_at(header);
+    uint64_t first = t->xfer_num;
+    uint32_t count = 0;
+    size_t size = header;
+
+    while (t->snap->valid() && !t->snap->in_snapshot() &&
+           t->unacked_objects() < XFER_WINDOW_MAX_OBJECTS)
+    {
+        size_t sz = data_size(t);
+
+        if (count > 0 && size + sz > capacity)
+        {
+            break;
+        }
+
+        size += sz;
+        pa = pa << t->snap->version() << t->snap->key();
+
+        if (t->snap->has_value())
+        {
+            pa = pa << static_cast<uint8_t>(1) << t->snap->value();
+        }
+        else
+        {
+            pa = pa << static_cast<uint8_t>(0);
+        }
+
+        ++count;
+        ++t->xfer_num;
+        t->snap->next();
+    }
+
+    pack_preamble(t, msg.get(), first, count);
+    return msg;
+}
+
+size_t
+hyperdaemon :: ongoing_state_transfers :: data_size(e::intrusive_ptr<transfer_out> t)
+{
+    size_t size = sizeof(uint64_t)
+                + sizeof(uint32_t)
+                + t->snap->key().size()
+                + sizeof(uint8_t);
+
+    if (t->snap->has_value())
+    {
+        size += hyperdex::packspace(t->snap->value());
+    }
+
+    return size;
 }
 
 void
@@ -576,6 +1432,7 @@ hyperdaemon :: ongoing_state_transfers :: periodic()
             if (i % 4 == 0)
             {
                 finish_transfers();
+                report_progress();
             }
         }
         catch (std::exception& e)
@@ -593,16 +1450,28 @@ hyperdaemon :: ongoing_state_transfers :: start_transfers()
     for (transfers_in_map_t::iterator t = m_transfers_in.begin();
             t != m_transfers_in.end(); t.next())
     {
-        po6::threads::mutex::hold hold(&m_periodic_lock);
+        hyperdisk::profiled_mutex::hold hold(&m_periodic_lock);
 
+        // One request opens the sender's whole window.
         if (!t.value()->started)
         {
-            for (size_t i = 0; i < TRANSFERS_IN_FLIGHT; ++i)
+            hyperdisk::profiled_mutex::hold hold_t(&t.value()->lock);
+
+            if (!t.value()->summarized)
             {
-                std::auto_ptr<e::buffer> msg(e::buffer::create(m_comm->header_size()));
-                m_comm->send(entityid(configuration::TRANSFERSPACE, t.key(), 0, 0, 0),
-                             t.value()->replicate_from, hyperdex::XFER_MORE, msg);
+                t.value()->summarized = true;
+
+                if (m_data->summarize(t.value()->replicate_from.get_region(),
+                                      &t.value()->summary) &&
+                    !t.value()->summary.empty())
+                {
+                    t.value()->dirty = true;
+                }
             }
+
+            m_comm->send(entityid(configuration::TRANSFERSPACE, t.key(), 0, 0, 0),
+                         t.value()->replicate_from, hyperdex::XFER_MORE,
+                         more_message(t.value()));
         }
     }
 }
@@ -613,13 +1482,15 @@ hyperdaemon :: ongoing_state_transfers :: finish_transfers()
     for (transfers_in_map_t::iterator t = m_transfers_in.begin();
             t != m_transfers_in.end(); t.next())
     {
-        po6::threads::mutex::hold hold(&m_periodic_lock);
+        hyperdisk::profiled_mutex::hold hold(&m_periodic_lock);
 
         if (t.value()->go_live)
         {
-            std::auto_ptr<e::buffer> msg(e::buffer::create(m_comm->header_size()));
+            hyperdisk::profiled_mutex::hold hold_t(&t.value()->lock);
+
             if (!m_comm->send(entityid(configuration::TRANSFERSPACE, t.key(), 0, 0, 0),
-                              t.value()->replicate_from, hyperdex::XFER_MORE, msg))
+                              t.value()->replicate_from, hyperdex::XFER_MORE,
+                              more_message(t.value())))
             {
                 t.value()->failed = true;
                 m_cl->transfer_fail(t.key());
@@ -627,3 +1498,30 @@ hyperdaemon :: ongoing_state_transfers :: finish_transfers()
         }
     }
 }
+
+void
+hyperdaemon :: ongoing_state_transfers :: report_progress()
+{
+    hyperdisk::profiled_mutex::hold hold(&m_periodic_lock);
+    size_t active = 0;
+
+    for (transfers_out_map_t::iterator t = m_transfers_out.begin();
+            t != m_transfers_out.end(); t.next())
+    {
+        hyperdisk::profiled_mutex::hold hold_t(&t.value()->lock);
+
+        if (!t.value()->failed && t.value()->snap->valid())
+        {
+            ++active;
+        }
+
+        if (t.value()->checkpoint_num != t.value()->reported)
+        {
+            t.value()->reported = t.value()->checkpoint_num;
+            m_cl->transfer_progress(t.key(), t.value()->checkpoint_num,
+                                    t.value()->acked_bytes);
+        }
+    }
+
+    m_active_out = active;
+}
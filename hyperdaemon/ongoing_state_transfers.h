@@ -29,7 +29,11 @@
 #define hyperdaemon_ongoing_state_transfers_h_
 
 // STL
+#include <map>
 #include <memory>
+#include <string>
+#include <tr1/memory>
+#include <vector>
 
 // e
 #include <e/buffer.h>
@@ -37,6 +41,12 @@
 #include <e/lockfree_hash_map.h>
 #include <e/slice.h>
 
+// HyperDex
+#include "hyperdex/hyperdex/network_constants.h"
+
+// HyperDisk
+#include "hyperdisk/hyperdisk/profiled_mutex.h"
+
 // Forward Declarations
 namespace hyperdex
 {
@@ -72,13 +82,21 @@ class ongoing_state_transfers
 
     // Netowrk workers call these methods.
     public:
-        void region_transfer_send(const hyperdex::entityid& from, const hyperdex::entityid& to);
+        // The receiver has applied every object up to and including "acked"
+        // from the sender's attempt "session".  A receiver that has yet to
+        // hear from us sends the leaves of a summary of its copy in
+        // "summary", which is empty if it holds nothing.
+        void region_transfer_send(const hyperdex::entityid& from,
+                                  const hyperdex::entityid& to,
+                                  uint64_t session,
+                                  uint64_t acked,
+                                  const std::vector<uint64_t>& summary);
+        // Many objects packed back to back.  Each object consumes one transfer
+        // sequence number.
         void region_transfer_recv(const hyperdex::entityid& from,
-                                  uint16_t xfer_id, uint64_t xfer_num,
-                                  bool has_value, uint64_t version,
-                                  std::auto_ptr<e::buffer> backing,
-                                  const e::slice& key,
-                                  const std::vector<e::slice>& value);
+                                  uint16_t xfer_id,
+                                  hyperdex::network_msgtype type,
+                                  std::auto_ptr<e::buffer> msg);
         void region_transfer_done(const hyperdex::entityid& from, const hyperdex::entityid& to);
 
     // Interactions with the replication layer.
@@ -89,6 +107,11 @@ class ongoing_state_transfers
                          uint64_t rev);
         void set_replication_manager(replication_manager* repl);
 
+    // Reporting.
+    public:
+        void count_transfers(uint64_t* in, uint64_t* out);
+        void lock_stats(std::map<std::string, hyperdisk::lockstats>* stats) const;
+
     private:
         class transfer_in;
         class transfer_out;
@@ -103,9 +126,40 @@ class ongoing_state_transfers
         ongoing_state_transfers(const ongoing_state_transfers&);
 
     private:
+        // Pack the next message of a transfer.  XFER_BULK covers the
+        // snapshot, XFER_DATA the log; both stop at XFER_BULK_BYTES.
+        std::auto_ptr<e::buffer> bulk_message(e::intrusive_ptr<transfer_out> t);
+        std::auto_ptr<e::buffer> data_message(e::intrusive_ptr<transfer_out> t);
+        size_t data_size(e::intrusive_ptr<transfer_out> t);
+        std::auto_ptr<e::buffer> more_message(e::intrusive_ptr<transfer_in> t);
+        // Every XFER_BULK and XFER_DATA starts with the same fields.
+        size_t preamble_size(e::intrusive_ptr<transfer_out> t);
+        void pack_preamble(e::intrusive_ptr<transfer_out> t, e::buffer* msg,
+                           uint64_t first, uint32_t count);
+        // Delete every object in the leaves set in "differ".
+        void purge(e::intrusive_ptr<transfer_in> t,
+                   const std::vector<uint64_t>& differ);
+        // Apply, in order, every queued op that is next in sequence.  Returns
+        // false if the transfer failed or completed and the sender should not
+        // be asked for more data.  The caller must hold the transfer's lock.
+        bool apply_ops(e::intrusive_ptr<transfer_in> t,
+                       const hyperdex::entityid& from,
+                       uint16_t xfer_id);
+        // Write the run of snapshot objects at the head of the queue straight
+        // to disk.  Returns false if the transfer failed.
+        bool load_snapshot(e::intrusive_ptr<transfer_in> t, uint16_t xfer_id);
+        void request_more(e::intrusive_ptr<transfer_in> t, uint16_t xfer_id);
+        // Send as much as the window and the transfer's share of the
+        // bandwidth allow.  The caller must hold the transfer's lock.
+        void send_window(e::intrusive_ptr<transfer_out> t);
+        // Each transfer thread refills the bandwidth allowance of the outbound
+        // transfers assigned to it, and resumes those that ran out.  They run
+        // only when XFER_BYTES_PER_SECOND is set.
+        void transfer_thread(size_t idx);
         void periodic();
         void start_transfers();
         void finish_transfers();
+        void report_progress();
 
     private:
         ongoing_state_transfers& operator = (const ongoing_state_transfers&);
@@ -116,11 +170,17 @@ class ongoing_state_transfers
         hyperdex::coordinatorlink* m_cl;
         hyperdaemon::replication_manager* m_repl;
         hyperdex::configuration m_config;
+        hyperdisk::lockstats m_transfer_locks;
+        hyperdisk::lockstats m_trigger_locks;
         transfers_in_map_t m_transfers_in;
         transfers_out_map_t m_transfers_out;
         bool m_shutdown;
-        po6::threads::mutex m_periodic_lock;
+        // Outbound transfers that still have data to send.  They split
+        // XFER_BYTES_PER_SECOND evenly.  Guarded by m_periodic_lock.
+        size_t m_active_out;
+        hyperdisk::profiled_mutex m_periodic_lock;
         po6::threads::thread m_periodic_thread;
+        std::vector<std::tr1::shared_ptr<po6::threads::thread> > m_transfer_threads;
 };
 
 } // namespace hyperdaemon
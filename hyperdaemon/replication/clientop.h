@@ -44,7 +44,8 @@ class clientop
 
     public:
         clientop();
-        clientop(const hyperdex::regionid& r, const hyperdex::entityid& f, uint32_t n);
+        clientop(const hyperdex::regionid& r, const hyperdex::entityid& f,
+                 uint64_t n, uint64_t t = 0);
 
     public:
         bool operator < (const clientop& rhs) const { return compare(rhs) < 0; }
@@ -58,6 +59,9 @@ class clientop
         hyperdex::regionid region;
         hyperdex::entityid from;
         uint64_t nonce;
+        // The admission ticket to hand back once the client is answered.  It
+        // is not part of the op's identity.
+        uint64_t ticket;
 
     private:
         int compare (const clientop& rhs) const;
@@ -75,16 +79,19 @@ clientop :: clientop()
     : region()
     , from()
     , nonce()
+    , ticket()
 {
 }
 
 inline
 clientop :: clientop(const hyperdex::regionid& r,
                      const hyperdex::entityid& f,
-                     uint32_t n)
+                     uint64_t n,
+                     uint64_t t)
     : region(r)
     , from(f)
     , nonce(n)
+    , ticket(t)
 {
 }
 
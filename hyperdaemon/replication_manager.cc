@@ -34,6 +34,7 @@
 // STL
 #include <algorithm>
 #include <queue>
+#include <set>
 #include <tr1/functional>
 #include <utility>
 
@@ -60,14 +61,17 @@
 #include "hyperdex/hyperdex/coordinatorlink.h"
 #include "hyperdex/hyperdex/network_constants.h"
 #include "hyperdex/hyperdex/packing.h"
+#include "hyperdaemon/admission_control.h"
 #include "hyperdaemon/datalayer.h"
 #include "hyperdaemon/logical.h"
+#include "hyperdaemon/metrics.h"
 #include "hyperdaemon/ongoing_state_transfers.h"
 #include "hyperdaemon/replication_manager.h"
 #include "hyperdaemon/replication_manager_deferred.h"
 #include "hyperdaemon/replication_manager_keyholder.h"
 #include "hyperdaemon/replication_manager_pending.h"
 #include "hyperdaemon/runtimeconfig.h"
+#include "hyperdaemon/tracing.h"
 #include "hyperspacehashing/hashes_internal.h"
 
 using hyperspacehashing::prefix::coordinate;
@@ -88,20 +92,23 @@ using hyperdaemon::replication::keypair;
 // appropriate lock for the request.  E should be an entity whose region the key
 // resides in.  K is the key for the object being protected.
 #define HOLD_LOCK_FOR_KEY(E, K) \
-    e::striped_lock<po6::threads::mutex>::hold CONCAT(_anon, __LINE__)(&m_locks, get_lock_num(E.get_region(), K))
+    hyperdisk::striped_mutex::hold CONCAT(_anon, __LINE__)(&m_locks, get_lock_num(E.get_region(), K))
 
 hyperdaemon :: replication_manager :: replication_manager(coordinatorlink* cl,
                                                           datalayer* data,
                                                           logical* comm,
-                                                          ongoing_state_transfers* ost)
+                                                          ongoing_state_transfers* ost,
+                                                          admission_control* admit)
     : m_cl(cl)
     , m_data(data)
     , m_comm(comm)
     , m_ost(ost)
+    , m_admit(admit)
     , m_config()
     , m_locks(LOCK_STRIPING)
     , m_keyholders_lock()
     , m_keyholders(REPLICATION_HASHTABLE_SIZE)
+    , m_keyholders_seen(0)
     , m_us()
     , m_quiesce(false)
     , m_quiesce_state_id_lock()
@@ -134,7 +141,7 @@ hyperdaemon :: replication_manager :: reconfigure(const configuration& newconfig
     // Mark as quiescing if config says so.
     if (newconfig.quiesce())
     {
-        po6::threads::mutex::hold hold(&m_quiesce_state_id_lock);
+        hyperdisk::profiled_mutex::hold hold(&m_quiesce_state_id_lock);
 
         // OK to see multiple quiesce requests - we will take new id each time, but we 
         // cannot go back to normal operation without shutdown.
@@ -145,17 +152,63 @@ hyperdaemon :: replication_manager :: reconfigure(const configuration& newconfig
     // Install a new configuration.
     m_config = newconfig;
     m_us = us;
-    po6::threads::mutex::hold hold(&m_keyholders_lock);
+    std::set<regionid> regions = m_config.regions_for(us);
+    hyperdisk::profiled_mutex::hold hold(&m_keyholders_lock);
 
     for (keyholder_map_t::iterator khiter = m_keyholders.begin();
-            khiter != m_keyholders.begin(); khiter.next())
+            khiter != m_keyholders.end(); khiter.next())
     {
-        // Drop the keyholder if we don't need it.
-        if (!m_config.in_region(us, khiter.key().region))
+        if (m_config.in_region(us, khiter.key().region))
         {
-            m_keyholders.remove(khiter.key());
             continue;
         }
+
+        // The region was split or merged.  Writes that have not been acked
+        // live only here, and the data layer inherits only what is on disk,
+        // so they move to the region now holding their point.  Retransmission
+        // sends them down the new chain, and the acks put them on its disk.
+        e::intrusive_ptr<keyholder> kh = khiter.value();
+        e::intrusive_ptr<pending> pend;
+
+        if (kh->has_committable_ops())
+        {
+            pend = kh->oldest_committable_op();
+        }
+        else if (kh->has_blocked_ops())
+        {
+            pend = kh->oldest_blocked_op();
+        }
+
+        std::set<regionid>::const_iterator r = regions.end();
+
+        if (pend)
+        {
+            coordinate point(64, pend->point_this);
+
+            for (r = regions.begin(); r != regions.end(); ++r)
+            {
+                if (r->get_subspace() == khiter.key().region.get_subspace() &&
+                    r->coord().contains(point))
+                {
+                    break;
+                }
+            }
+        }
+
+        if (r != regions.end())
+        {
+            keypair kp(*r, khiter.key().key);
+
+            if (!m_keyholders.insert(kp, kh))
+            {
+                LOG(ERROR) << "could not move pending writes from " << khiter.key().region
+                           << " to " << *r << " because the key already has some there";
+            }
+        }
+
+        // Deferred writes were never applied here, so the upstream replica
+        // retransmits them.
+        m_keyholders.remove(khiter.key());
     }
 }
 
@@ -181,12 +234,15 @@ hyperdaemon :: replication_manager :: client_atomic(const hyperdex::network_msgt
                                                     bool fail_if_found,
                                                     const e::slice& key,
                                                     std::vector<microcheck>* checks,
-                                                    std::vector<microop>* ops)
+                                                    std::vector<microop>* ops,
+                                                    uint64_t ticket)
 {
+    clientop co(to.get_region(), from, nonce, ticket);
+
     // Fail as read only if we are quiescing.
     if (m_quiesce)
     {
-        respond_to_client(to, from, nonce, opcode, hyperdex::NET_READONLY);
+        respond_to_client(to, co, opcode, hyperdex::NET_READONLY);
         return;
     }
 
@@ -195,19 +251,19 @@ hyperdaemon :: replication_manager :: client_atomic(const hyperdex::network_msgt
 
     if (!validate_as_type(key, sc->attrs[0].type))
     {
-        respond_to_client(to, from, nonce, opcode, hyperdex::NET_BADDIMSPEC);
+        respond_to_client(to, co, opcode, hyperdex::NET_BADDIMSPEC);
         return;
     }
 
     // Make sure this message is to the point-leader.
     if (!m_config.is_point_leader(to))
     {
-        respond_to_client(to, from, nonce, opcode, hyperdex::NET_NOTUS);
+        respond_to_client(to, co, opcode, hyperdex::NET_NOTUS);
         return;
     }
 
     // Automatically respond with "SERVERERROR" whenever we return without g.dismiss()
-    e::guard g = e::makeobjguard(*this, &replication_manager::respond_to_client, to, from, nonce, opcode, hyperdex::NET_SERVERERROR);
+    e::guard g = e::makeobjguard(*this, &replication_manager::respond_to_client, to, co, opcode, hyperdex::NET_SERVERERROR);
 
     // Grab the lock that protects this key.
     HOLD_LOCK_FOR_KEY(to, key);
@@ -230,7 +286,7 @@ hyperdaemon :: replication_manager :: client_atomic(const hyperdex::network_msgt
     // We allow "atomic" if and only if it already exists.
     if (!has_old_value && fail_if_not_found)
     {
-        respond_to_client(to, from, nonce, opcode, hyperdex::NET_NOTFOUND);
+        respond_to_client(to, co, opcode, hyperdex::NET_NOTFOUND);
         g.dismiss();
         return;
     }
@@ -241,7 +297,7 @@ hyperdaemon :: replication_manager :: client_atomic(const hyperdex::network_msgt
 
     if (has_old_value && fail_if_found)
     {
-        respond_to_client(to, from, nonce, opcode, hyperdex::NET_CMPFAIL);
+        respond_to_client(to, co, opcode, hyperdex::NET_CMPFAIL);
         g.dismiss();
         return;
     }
@@ -260,19 +316,24 @@ hyperdaemon :: replication_manager :: client_atomic(const hyperdex::network_msgt
     std::tr1::shared_ptr<e::buffer> new_backing;
     e::slice new_key;
     std::vector<e::slice> new_value;
-    size_t passed = apply_checks_and_ops(sc, *checks, *ops, key, old_value,
-                                         &new_backing, &new_key, &new_value, &error);
+    size_t passed;
+
+    {
+        tracing::span traced("apply_checks_and_ops");
+        passed = apply_checks_and_ops(sc, *checks, *ops, key, old_value,
+                                      &new_backing, &new_key, &new_value, &error);
+    }
 
     if (passed != checks->size() + ops->size())
     {
         /* XXX */
-        respond_to_client(to, from, nonce, opcode, error == MICROERR_OVERFLOW ? hyperdex::NET_OVERFLOW : hyperdex::NET_CMPFAIL);
+        respond_to_client(to, co, opcode, error == MICROERR_OVERFLOW ? hyperdex::NET_OVERFLOW : hyperdex::NET_CMPFAIL);
         g.dismiss();
         return;
     }
 
     e::intrusive_ptr<pending> new_pend;
-    new_pend = new pending(true, new_backing, key, new_value, clientop(to.get_region(), from, nonce));
+    new_pend = new pending(true, new_backing, key, new_value, co);
     new_pend->retcode = opcode;
     new_pend->ref = ref;
     new_pend->key = new_key;
@@ -280,7 +341,7 @@ hyperdaemon :: replication_manager :: client_atomic(const hyperdex::network_msgt
 
     if (!prev_and_next(to.get_region(), new_pend->key, true, new_pend->value, has_old_value, old_value, new_pend))
     {
-        respond_to_client(to, from, nonce, opcode, hyperdex::NET_NOTUS);
+        respond_to_client(to, co, opcode, hyperdex::NET_NOTUS);
         g.dismiss();
         return;
     }
@@ -298,12 +359,15 @@ hyperdaemon :: replication_manager :: client_del(const hyperdex::network_msgtype
                                                  uint64_t nonce,
                                                  std::auto_ptr<e::buffer> backing,
                                                  const e::slice& key,
-                                                 std::vector<microcheck>* checks)
+                                                 std::vector<microcheck>* checks,
+                                                 uint64_t ticket)
 {
+    clientop co(to.get_region(), from, nonce, ticket);
+
     // Fail as read only if we are quiescing.
     if (m_quiesce)
     {
-        respond_to_client(to, from, nonce, hyperdex::RESP_ATOMIC, hyperdex::NET_READONLY);
+        respond_to_client(to, co, hyperdex::RESP_ATOMIC, hyperdex::NET_READONLY);
         return;
     }
 
@@ -312,19 +376,19 @@ hyperdaemon :: replication_manager :: client_del(const hyperdex::network_msgtype
 
     if (!validate_as_type(key, sc->attrs[0].type))
     {
-        respond_to_client(to, from, nonce, opcode, hyperdex::NET_BADDIMSPEC);
+        respond_to_client(to, co, opcode, hyperdex::NET_BADDIMSPEC);
         return;
     }
 
     // Make sure this message is to the point-leader.
     if (!m_config.is_point_leader(to))
     {
-        respond_to_client(to, from, nonce, hyperdex::RESP_ATOMIC, hyperdex::NET_NOTUS);
+        respond_to_client(to, co, hyperdex::RESP_ATOMIC, hyperdex::NET_NOTUS);
         return;
     }
 
     // Automatically respond with "SERVERERROR" whenever we return without g.dismiss()
-    e::guard g = e::makeobjguard(*this, &replication_manager::respond_to_client, to, from, nonce, hyperdex::RESP_ATOMIC, hyperdex::NET_SERVERERROR);
+    e::guard g = e::makeobjguard(*this, &replication_manager::respond_to_client, to, co, hyperdex::RESP_ATOMIC, hyperdex::NET_SERVERERROR);
 
     // Grab the lock that protects this key.
     HOLD_LOCK_FOR_KEY(to, key);
@@ -344,20 +408,20 @@ hyperdaemon :: replication_manager :: client_del(const hyperdex::network_msgtype
 
     if (!has_old_value)
     {
-        respond_to_client(to, from, nonce, hyperdex::RESP_ATOMIC, hyperdex::NET_NOTFOUND);
+        respond_to_client(to, co, hyperdex::RESP_ATOMIC, hyperdex::NET_NOTFOUND);
         g.dismiss();
         return;
     }
 
     e::intrusive_ptr<pending> new_pend;
     std::tr1::shared_ptr<e::buffer> sharedbacking(backing.release());
-    new_pend = new pending(false, sharedbacking, key, old_value, clientop(to.get_region(), from, nonce));
+    new_pend = new pending(false, sharedbacking, key, old_value, co);
     new_pend->retcode = hyperdex::RESP_ATOMIC;
     new_pend->ref = ref;
 
     if (!prev_and_next(to.get_region(), new_pend->key, false, new_pend->value, has_old_value, old_value, new_pend))
     {
-        respond_to_client(to, from, nonce, hyperdex::RESP_ATOMIC, hyperdex::NET_NOTUS);
+        respond_to_client(to, co, hyperdex::RESP_ATOMIC, hyperdex::NET_NOTUS);
         g.dismiss();
         return;
     }
@@ -500,6 +564,7 @@ hyperdaemon :: replication_manager :: chain_ack(const entityid& from,
         return;
     }
 
+    tracing::scope adopted(pend->trace);
     std::tr1::shared_ptr<e::buffer> shared_backing(backing.release());
     m_ost->add_trigger(to.get_region(), shared_backing, key, version);
     pend->acked = true;
@@ -517,8 +582,7 @@ hyperdaemon :: replication_manager :: chain_ack(const entityid& from,
     {
         if (pend->co.from.space == UINT32_MAX)
         {
-            respond_to_client(to, pend->co.from, pend->co.nonce,
-                              pend->retcode, hyperdex::NET_SUCCESS);
+            respond_to_client(to, pend->co, pend->retcode, hyperdex::NET_SUCCESS);
             pend->co = clientop();
         }
     }
@@ -639,6 +703,39 @@ hyperdaemon :: replication_manager :: chain_common(bool has_value,
     move_operations_between_queues(to, key, kh);
 }
 
+void
+hyperdaemon :: replication_manager :: lock_stats(std::map<std::string, hyperdisk::lockstats>* stats) const
+{
+    (*stats)["replication.keyholders"] += m_keyholders_lock.stats();
+    (*stats)["replication.key_stripes"] += m_locks.stats();
+    (*stats)["replication.key_stripes.hottest"] += m_locks.hottest();
+    (*stats)["replication.quiesce"] += m_quiesce_state_id_lock.stats();
+}
+
+bool
+hyperdaemon :: replication_manager :: has_keyholders(const hyperdex::regionid& reg)
+{
+    for (keyholder_map_t::iterator khiter = m_keyholders.begin();
+            khiter != m_keyholders.end(); khiter.next())
+    {
+        if (khiter.key().region != reg)
+        {
+            continue;
+        }
+
+        // Empty keyholders linger until retransmit() erases them.
+        e::slice key(khiter.key().key.data(), khiter.key().key.size());
+        hyperdisk::striped_mutex::hold hold(&m_locks, get_lock_num(reg, key));
+
+        if (!khiter.value()->empty())
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 uint64_t
 hyperdaemon :: replication_manager :: get_lock_num(const hyperdex::regionid& reg,
                                                    const e::slice& key)
@@ -685,6 +782,7 @@ hyperdaemon :: replication_manager :: retrieve_latest(const hyperdex::regionid&
                                                       std::vector<e::slice>* old_value,
                                                       hyperdisk::reference* ref)
 {
+    tracing::span traced("retrieve_latest");
     *old_version = 0;
     *has_old_value = false;
 
@@ -751,6 +849,7 @@ hyperdaemon :: replication_manager :: put_to_disk(const regionid& pending_in,
         return true;
     }
 
+    tracing::span traced("wal_append");
     e::intrusive_ptr<pending> op = kh->get_by_version(version);
 
     bool success = true;
@@ -954,6 +1053,7 @@ hyperdaemon :: replication_manager :: check_for_deferred_operations(const hyperd
         newop = new pending(op->has_value, op->backing, op->key, op->value);
         newop->fresh = false;
         newop->ref = op->ref;
+        newop->trace = op->trace;
         newop->recv_e = op->from_ent;
         newop->recv_i = m_config.instancefor(op->from_ent);
 
@@ -1019,6 +1119,7 @@ hyperdaemon :: replication_manager :: move_operations_between_queues(const hyper
         newop = new pending(op->has_value, op->backing, op->key, op->value);
         newop->fresh = false;
         newop->ref = op->ref;
+        newop->trace = op->trace;
         newop->recv_e = op->from_ent;
         newop->recv_i = m_config.instancefor(op->from_ent);
 
@@ -1068,6 +1169,8 @@ hyperdaemon :: replication_manager :: send_message(const entityid& us,
         return;
     }
 
+    tracing::scope adopted(op->trace);
+    tracing::span traced("chain_send");
     size_t sz_msg = m_comm->header_size()
                   + sizeof(uint64_t)
                   + sizeof(uint8_t)
@@ -1178,6 +1281,7 @@ hyperdaemon :: replication_manager :: send_ack(const entityid& from,
                                                uint64_t version,
                                                const e::slice& key)
 {
+    tracing::span traced("ack_send");
     size_t sz = m_comm->header_size()
               + sizeof(uint64_t)
               + sizeof(uint32_t)
@@ -1189,16 +1293,17 @@ hyperdaemon :: replication_manager :: send_ack(const entityid& from,
 
 void
 hyperdaemon :: replication_manager :: respond_to_client(const entityid& us,
-                                                        const entityid& client,
-                                                        uint64_t nonce,
+                                                        const clientop& co,
                                                         network_msgtype type,
                                                         network_returncode ret)
 {
+    tracing::span traced("respond");
     uint16_t result = static_cast<uint16_t>(ret);
     size_t sz = m_comm->header_size() + sizeof(uint64_t) +sizeof(uint16_t);
     std::auto_ptr<e::buffer> msg(e::buffer::create(sz));
-    msg->pack_at(m_comm->header_size()) << nonce << result;
-    m_comm->send(us, client, type, msg);
+    msg->pack_at(m_comm->header_size()) << co.nonce << result;
+    m_comm->send(us, co.from, type, msg);
+    m_admit->complete(co.ticket);
 }
 
 void
@@ -1217,7 +1322,7 @@ hyperdaemon :: replication_manager :: periodic()
             if (m_quiesce && processed <= 0)
             {
                 // Lock needed to access quiesce state.
-                po6::threads::mutex::hold hold(&m_quiesce_state_id_lock);
+                hyperdisk::profiled_mutex::hold hold(&m_quiesce_state_id_lock);
                 
                 // Let the coordinator know replication is quiesced.
                 // XXX error handling?
@@ -1248,10 +1353,10 @@ hyperdaemon :: replication_manager :: retransmit()
     {
         processed++;
         
-        po6::threads::mutex::hold holdkh(&m_keyholders_lock);
+        hyperdisk::profiled_mutex::hold holdkh(&m_keyholders_lock);
         // Grab the lock that protects this object.
         e::slice key(khiter.key().key.data(), khiter.key().key.size());
-        e::striped_lock<po6::threads::mutex>::hold hold(&m_locks, get_lock_num(khiter.key().region, key));
+        hyperdisk::striped_mutex::hold hold(&m_locks, get_lock_num(khiter.key().region, key));
 
         // Grab some references.
         e::intrusive_ptr<keyholder> kh = khiter.value();
@@ -1291,8 +1396,10 @@ hyperdaemon :: replication_manager :: retransmit()
             pend->sent_i = instance();
             entityid ent = m_config.entityfor(m_us, khiter.key().region);
             send_message(ent, kh->oldest_committable_version(), key, pend);
+            metrics::count(metrics::REPL_RETRANSMITS);
         }
     }
-   
+
+    m_keyholders_seen = processed;
     return processed;
 }
@@ -30,6 +30,8 @@
 
 // STL
 #include <limits>
+#include <map>
+#include <string>
 #include <tr1/functional>
 #include <tr1/unordered_map>
 
@@ -40,7 +42,9 @@
 #include <e/bitfield.h>
 #include <e/intrusive_ptr.h>
 #include <e/lockfree_hash_set.h>
-#include <e/striped_lock.h>
+
+// HyperDisk
+#include "hyperdisk/hyperdisk/profiled_mutex.h"
 
 // HyperDex
 #include "hyperdex/hyperdex/configuration.h"
@@ -58,6 +62,7 @@ class instance;
 }
 namespace hyperdaemon
 {
+class admission_control;
 class datalayer;
 class logical;
 class ongoing_state_transfers;
@@ -73,7 +78,8 @@ class replication_manager
         replication_manager(hyperdex::coordinatorlink* cl,
                             datalayer* dl,
                             logical* comm,
-                            ongoing_state_transfers* ost);
+                            ongoing_state_transfers* ost,
+                            admission_control* admit);
         ~replication_manager() throw ();
 
     // Reconfigure this layer.
@@ -96,14 +102,16 @@ class replication_manager
                            bool fail_if_found,
                            const e::slice& key,
                            std::vector<microcheck>* checks,
-                           std::vector<microop>* ops);
+                           std::vector<microop>* ops,
+                           uint64_t ticket);
         void client_del(const hyperdex::network_msgtype opcode,
                         const hyperdex::entityid& from,
                         const hyperdex::entityid& to,
                         uint64_t nonce,
                         std::auto_ptr<e::buffer> backing,
                         const e::slice& key,
-                        std::vector<microcheck>* checks);
+                        std::vector<microcheck>* checks,
+                        uint64_t ticket);
         // These are called in response to messages from other hosts.
         void chain_put(const hyperdex::entityid& from,
                        const hyperdex::entityid& to,
@@ -130,6 +138,14 @@ class replication_manager
                        std::auto_ptr<e::buffer> backing,
                        const e::slice& key);
 
+    // Reporting.
+    public:
+        // The keyholders seen by the last retransmit pass.
+        uint64_t keyholders() const { return m_keyholders_seen; }
+        // True if some write to the region is not yet acked.
+        bool has_keyholders(const hyperdex::regionid& reg);
+        void lock_stats(std::map<std::string, hyperdisk::lockstats>* stats) const;
+
     private:
         class deferred;
         class pending;
@@ -201,8 +217,7 @@ class replication_manager
                       uint64_t version,
                       const e::slice& key);
         void respond_to_client(const hyperdex::entityid& us,
-                               const hyperdex::entityid& client,
-                               uint64_t nonce,
+                               const replication::clientop& co,
                                hyperdex::network_msgtype type,
                                hyperdex::network_returncode ret);
         // Periodically do things related to replication.
@@ -215,13 +230,15 @@ class replication_manager
         datalayer* m_data;
         logical* m_comm;
         ongoing_state_transfers* m_ost;
+        admission_control* m_admit;
         hyperdex::configuration m_config;
-        e::striped_lock<po6::threads::mutex> m_locks;
-        po6::threads::mutex m_keyholders_lock;
+        hyperdisk::striped_mutex m_locks;
+        hyperdisk::profiled_mutex m_keyholders_lock;
         keyholder_map_t m_keyholders;
+        uint64_t m_keyholders_seen;
         hyperdex::instance m_us;
         volatile bool m_quiesce; // acessed from multiple threads
-        po6::threads::mutex m_quiesce_state_id_lock; 
+        hyperdisk::profiled_mutex m_quiesce_state_id_lock;
         std::string m_quiesce_state_id;
         volatile bool m_shutdown; // acessed from multiple threads
         po6::threads::thread m_periodic_thread;
@@ -28,6 +28,9 @@
 #ifndef hyperdaemon_replication_manager_deferred
 #define hyperdaemon_replication_manager_deferred
 
+// HyperDaemon
+#include "hyperdaemon/tracing.h"
+
 class hyperdaemon::replication_manager::deferred
 {
     public:
@@ -48,6 +51,7 @@ class hyperdaemon::replication_manager::deferred
         const hyperdex::entityid from_ent;
         const hyperdex::instance from_inst;
         hyperdisk::reference ref;
+        const uint64_t trace;
 
     private:
         friend class e::intrusive_ptr<deferred>;
@@ -74,6 +78,7 @@ hyperdaemon :: replication_manager :: deferred :: deferred(const bool hv,
     , from_ent(e)
     , from_inst(i)
     , ref(r)
+    , trace(tracing::current())
     , m_ref(0)
 {
 }
@@ -30,6 +30,7 @@
 
 // HyperDaemon
 #include "hyperdaemon/replication/clientop.h"
+#include "hyperdaemon/tracing.h"
 
 class hyperdaemon::replication_manager::pending
 {
@@ -52,6 +53,9 @@ class hyperdaemon::replication_manager::pending
         hyperdex::network_msgtype retcode;
         e::intrusive_ptr<pending> backing2;
         hyperdisk::reference ref;
+        // The trace of the message that created this op.  Messages sent on
+        // the op's behalf carry it, whichever message is being handled.
+        uint64_t trace;
 
         hyperdex::entityid recv_e; // We recv from here
         hyperdex::instance recv_i; // We recv from here
@@ -90,6 +94,7 @@ hyperdaemon :: replication_manager :: pending :: pending(bool hv,
     , retcode()
     , backing2()
     , ref()
+    , trace(tracing::current())
     , recv_e()
     , recv_i()
     , sent_e()
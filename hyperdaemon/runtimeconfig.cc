@@ -35,3 +35,25 @@ e::envconfig<size_t> hyperdaemon::LOCK_STRIPING("HYPERDEX_LOCK_STRIPING", 1024);
 e::envconfig<size_t> hyperdaemon::TRANSFERS_IN_FLIGHT("HYPERDEX_TRANSFERS_IN_FLIGHT", 8);
 e::envconfig<uint16_t> hyperdaemon::REPLICATION_HASHTABLE_SIZE("HYPERDEX_REPLICATION_HASHTABLE_SIZE", 10);
 e::envconfig<uint16_t> hyperdaemon::STATE_TRANSFER_HASHTABLE_SIZE("HYPERDEX_STATE_TRANSFER_HASHTABLE_SIZE", 10);
+e::envconfig<unsigned int> hyperdaemon::CLIENT_OPS_PER_SECOND("HYPERDEX_CLIENT_OPS_PER_SECOND", 0);
+e::envconfig<unsigned int> hyperdaemon::CLIENT_OPS_BURST("HYPERDEX_CLIENT_OPS_BURST", 1000);
+e::envconfig<size_t> hyperdaemon::CLIENT_QUEUE_DEPTH("HYPERDEX_CLIENT_QUEUE_DEPTH", 16384);
+e::envconfig<unsigned int> hyperdaemon::COALESCE_MICROS("HYPERDEX_COALESCE_MICROS", 0);
+e::envconfig<size_t> hyperdaemon::COALESCE_BYTES("HYPERDEX_COALESCE_BYTES", 16384);
+e::envconfig<size_t> hyperdaemon::EARLY_MESSAGE_BYTES("HYPERDEX_EARLY_MESSAGE_BYTES", 64 * 1024 * 1024);
+e::envconfig<unsigned int> hyperdaemon::LOW_LATENCY("HYPERDEX_LOW_LATENCY", 0);
+e::envconfig<size_t> hyperdaemon::COMPACT_HEADER_BYTES("HYPERDEX_COMPACT_HEADER_BYTES", 1024);
+e::envconfig<size_t> hyperdaemon::XFER_BULK_BYTES("HYPERDEX_XFER_BULK_BYTES", 1024 * 1024);
+e::envconfig<size_t> hyperdaemon::XFER_WINDOW_MIN_BYTES("HYPERDEX_XFER_WINDOW_MIN_BYTES", 4 * 1024 * 1024);
+e::envconfig<size_t> hyperdaemon::XFER_WINDOW_MAX_BYTES("HYPERDEX_XFER_WINDOW_MAX_BYTES", 256 * 1024 * 1024);
+e::envconfig<size_t> hyperdaemon::XFER_WINDOW_MAX_OBJECTS("HYPERDEX_XFER_WINDOW_MAX_OBJECTS", 65536);
+e::envconfig<unsigned int> hyperdaemon::XFER_THREADS("HYPERDEX_XFER_THREADS", 4);
+e::envconfig<size_t> hyperdaemon::XFER_BYTES_PER_SECOND("HYPERDEX_XFER_BYTES_PER_SECOND", 0);
+e::envconfig<unsigned int> hyperdaemon::LOAD_REPORT_SECONDS("HYPERDEX_LOAD_REPORT_SECONDS", 10);
+e::envconfig<unsigned int> hyperdaemon::ARCHIVE_THREADS("HYPERDEX_ARCHIVE_THREADS", 4);
+e::envconfig<unsigned int> hyperdaemon::ARCHIVE_ATTEMPTS("HYPERDEX_ARCHIVE_ATTEMPTS", 3);
+e::envconfig<unsigned int> hyperdaemon::MANIFEST_MILLIS("HYPERDEX_MANIFEST_MILLIS", 1000);
+e::envconfig<unsigned int> hyperdaemon::METRICS_PORT("HYPERDEX_METRICS_PORT", 0);
+e::envconfig<size_t> hyperdaemon::TRACE_SPANS("HYPERDEX_TRACE_SPANS", 65536);
+e::envconfig<unsigned int> hyperdaemon::HOTKEY_SAMPLE("HYPERDEX_HOTKEY_SAMPLE", 64);
+e::envconfig<size_t> hyperdaemon::HOTKEY_SLOTS("HYPERDEX_HOTKEY_SLOTS", 128);
@@ -46,6 +46,36 @@ extern e::envconfig<size_t> LOCK_STRIPING;
 extern e::envconfig<size_t> TRANSFERS_IN_FLIGHT;
 extern e::envconfig<uint16_t> REPLICATION_HASHTABLE_SIZE;
 extern e::envconfig<uint16_t> STATE_TRANSFER_HASHTABLE_SIZE;
+extern e::envconfig<unsigned int> CLIENT_OPS_PER_SECOND;
+extern e::envconfig<unsigned int> CLIENT_OPS_BURST;
+extern e::envconfig<size_t> CLIENT_QUEUE_DEPTH;
+extern e::envconfig<unsigned int> COALESCE_MICROS;
+extern e::envconfig<size_t> COALESCE_BYTES;
+extern e::envconfig<size_t> EARLY_MESSAGE_BYTES;
+// Pins network workers to CPUs, prefaults shards, leaves WAL flushing to the
+// flush threads and disables message coalescing.  Sockets are not busy-polled;
+// busybee owns them and blocks in epoll.
+extern e::envconfig<unsigned int> LOW_LATENCY;
+extern e::envconfig<size_t> COMPACT_HEADER_BYTES;
+extern e::envconfig<size_t> XFER_BULK_BYTES;
+extern e::envconfig<size_t> XFER_WINDOW_MIN_BYTES;
+extern e::envconfig<size_t> XFER_WINDOW_MAX_BYTES;
+extern e::envconfig<size_t> XFER_WINDOW_MAX_OBJECTS;
+extern e::envconfig<unsigned int> XFER_THREADS;
+extern e::envconfig<size_t> XFER_BYTES_PER_SECOND;
+extern e::envconfig<unsigned int> LOAD_REPORT_SECONDS;
+extern e::envconfig<unsigned int> ARCHIVE_THREADS;
+// How many times an archive thread tries a region before it gives up until
+// the next configuration.  It waits a second longer after each failure.
+extern e::envconfig<unsigned int> ARCHIVE_ATTEMPTS;
+// How often each disk that changed writes its manifest.  Every manifest costs
+// an msync of the shards' new data and an fsync.  0 leaves manifests to
+// quiesce and to shard cleaning and splitting.
+extern e::envconfig<unsigned int> MANIFEST_MILLIS;
+extern e::envconfig<unsigned int> METRICS_PORT;
+extern e::envconfig<size_t> TRACE_SPANS;
+extern e::envconfig<unsigned int> HOTKEY_SAMPLE;
+extern e::envconfig<size_t> HOTKEY_SLOTS;
 
 } // namespace hyperdaemon
 
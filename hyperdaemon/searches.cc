@@ -58,11 +58,12 @@ class hyperdaemon::searches::search_state
                      const hyperspacehashing::mask::coordinate& search_coord,
                      std::auto_ptr<e::buffer> msg,
                      const hyperspacehashing::search& terms,
-                     e::intrusive_ptr<hyperdisk::snapshot> snap);
+                     e::intrusive_ptr<hyperdisk::snapshot> snap,
+                     hyperdisk::lockstats* stats);
         ~search_state() throw ();
 
     public:
-        po6::threads::mutex lock;
+        hyperdisk::profiled_mutex lock;
         const hyperdex::regionid region;
         const hyperspacehashing::mask::coordinate search_coord;
         const std::auto_ptr<e::buffer> backing;
@@ -115,6 +116,7 @@ hyperdaemon :: searches :: searches(coordinatorlink* cl,
     , m_data(data)
     , m_comm(comm)
     , m_config()
+    , m_state_locks()
     , m_searches(16)
 {
 }
@@ -172,7 +174,7 @@ hyperdaemon :: searches :: start(const hyperdex::entityid& us,
     hyperspacehashing::mask::hasher hasher(m_config.disk_hasher(us.get_subspace()));
     hyperspacehashing::mask::coordinate coord(hasher.hash(terms));
     e::intrusive_ptr<hyperdisk::snapshot> snap = m_data->make_snapshot(us.get_region(), terms);
-    e::intrusive_ptr<search_state> state = new search_state(us.get_region(), coord, msg, terms, snap);
+    e::intrusive_ptr<search_state> state = new search_state(us.get_region(), coord, msg, terms, snap, &m_state_locks);
     m_searches.insert(key, state);
     next(us, client, search_num, nonce);
 }
@@ -192,7 +194,7 @@ hyperdaemon :: searches :: next(const hyperdex::entityid& us,
         return;
     }
 
-    po6::threads::mutex::hold hold(&state->lock);
+    hyperdisk::profiled_mutex::hold hold(&state->lock);
 
     while (state->snap->valid())
     {
@@ -520,6 +522,12 @@ hyperdaemon :: searches :: sorted_search(const hyperdex::entityid& us,
     m_comm->send(us, client, hyperdex::RESP_SORTED_SEARCH, msg);
 }
 
+void
+hyperdaemon :: searches :: lock_stats(std::map<std::string, hyperdisk::lockstats>* stats) const
+{
+    (*stats)["search.state"] += m_state_locks;
+}
+
 uint64_t
 hyperdaemon :: searches :: hash(const search_id& si)
 {
@@ -564,8 +572,9 @@ hyperdaemon :: searches :: search_state :: search_state(const regionid& r,
                                                         const coordinate& sc,
                                                         std::auto_ptr<e::buffer> msg,
                                                         const hyperspacehashing::search& t,
-                                                        e::intrusive_ptr<hyperdisk::snapshot> s)
-    : lock()
+                                                        e::intrusive_ptr<hyperdisk::snapshot> s,
+                                                        hyperdisk::lockstats* stats)
+    : lock(stats)
     , region(r)
     , search_coord(sc)
     , backing(msg)
@@ -28,8 +28,9 @@
 #ifndef hyperdaemon_searches_h_
 #define hyperdaemon_searches_h_
 
-// po6
-#include <po6/threads/mutex.h>
+// STL
+#include <map>
+#include <string>
 
 // e
 #include <e/intrusive_ptr.h>
@@ -42,6 +43,9 @@
 // HyperDex
 #include "hyperdex/hyperdex/ids.h"
 
+// HyperDisk
+#include "hyperdisk/hyperdisk/profiled_mutex.h"
+
 // Forward Declarations
 namespace hyperdex
 {
@@ -99,6 +103,9 @@ class searches
                            uint16_t sort_by,
                            bool maximize);
 
+    public:
+        void lock_stats(std::map<std::string, hyperdisk::lockstats>* stats) const;
+
     private:
         class search_state;
         class search_id;
@@ -120,6 +127,7 @@ class searches
         datalayer* m_data;
         logical* m_comm;
         hyperdex::configuration m_config;
+        hyperdisk::lockstats m_state_locks;
         e::lockfree_hash_map<search_id, e::intrusive_ptr<search_state>, hash> m_searches;
 };
 
@@ -0,0 +1,111 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Google Test
+#include <gtest/gtest.h>
+
+// HyperDaemon
+#include "hyperdaemon/admission_control.h"
+#include "hyperdaemon/runtimeconfig.h"
+
+#pragma GCC diagnostic ignored "-Wswitch-default"
+
+namespace
+{
+
+TEST(AdmissionControlTest, CtorAndDtor)
+{
+    hyperdaemon::admission_control ac;
+    ASSERT_EQ(0U, ac.outstanding());
+}
+
+TEST(AdmissionControlTest, AdmitAndComplete)
+{
+    hyperdaemon::admission_control ac;
+    uint64_t a;
+    uint64_t b;
+    ASSERT_TRUE(ac.admit(1, false, &a));
+    ASSERT_TRUE(ac.admit(2, false, &b));
+    ASSERT_EQ(2U, ac.outstanding());
+    ac.complete(a);
+    ASSERT_EQ(1U, ac.outstanding());
+    ac.complete(b);
+    ASSERT_EQ(0U, ac.outstanding());
+    // Extra completions do not wrap the counter.
+    ac.complete(b);
+    ASSERT_EQ(0U, ac.outstanding());
+}
+
+TEST(AdmissionControlTest, ResetIgnoresEarlierTickets)
+{
+    hyperdaemon::admission_control ac;
+    uint64_t before[3];
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+        ASSERT_TRUE(ac.admit(i, false, &before[i]));
+    }
+
+    ac.reset();
+    ASSERT_EQ(0U, ac.outstanding());
+    uint64_t after;
+    ASSERT_TRUE(ac.admit(1, false, &after));
+    ASSERT_NE(before[0], after);
+
+    // Requests admitted before the reset and answered after it must not
+    // take their count from those admitted since.
+    for (size_t i = 0; i < 3; ++i)
+    {
+        ac.complete(before[i]);
+    }
+
+    ASSERT_EQ(1U, ac.outstanding());
+    ac.complete(after);
+    ASSERT_EQ(0U, ac.outstanding());
+}
+
+TEST(AdmissionControlTest, QueueDepth)
+{
+    hyperdaemon::admission_control ac;
+    uint64_t ticket = 0;
+
+    for (size_t i = 0; i < hyperdaemon::CLIENT_QUEUE_DEPTH; ++i)
+    {
+        ASSERT_TRUE(ac.admit(i, false, &ticket));
+    }
+
+    ASSERT_FALSE(ac.admit(0, false, &ticket));
+    // Priority requests bypass the queue-depth check.
+    ASSERT_TRUE(ac.admit(0, true, &ticket));
+    ac.complete(ticket);
+    ac.complete(ticket);
+    ASSERT_TRUE(ac.admit(0, false, &ticket));
+    ac.reset();
+    ASSERT_TRUE(ac.admit(0, false, &ticket));
+}
+
+} // namespace
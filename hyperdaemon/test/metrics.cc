@@ -0,0 +1,215 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <memory>
+#include <tr1/functional>
+#include <tr1/memory>
+#include <vector>
+
+// po6
+#include <po6/threads/thread.h>
+
+// Google Test
+#include <gtest/gtest.h>
+
+// HyperDaemon
+#include "hyperdaemon/metrics.h"
+
+#pragma GCC diagnostic ignored "-Wswitch-default"
+
+using hyperdaemon::metrics;
+
+// gtest takes its arguments by reference.
+static const uint64_t SUB_BUCKETS = metrics::histogram::SUB_BUCKETS;
+
+namespace
+{
+
+TEST(MetricsTest, HistogramEmpty)
+{
+    metrics::histogram h;
+    ASSERT_EQ(0U, h.count());
+    ASSERT_EQ(0U, h.min());
+    ASSERT_EQ(0U, h.max());
+    ASSERT_EQ(0U, h.percentile(0.5));
+}
+
+TEST(MetricsTest, HistogramSmallValuesAreExact)
+{
+    metrics::histogram h;
+
+    for (uint64_t i = 0; i < SUB_BUCKETS; ++i)
+    {
+        h.record(i);
+    }
+
+    ASSERT_EQ(SUB_BUCKETS, h.count());
+    ASSERT_EQ(0U, h.min());
+    ASSERT_EQ(SUB_BUCKETS - 1, h.max());
+
+    for (uint64_t i = 0; i < SUB_BUCKETS; ++i)
+    {
+        ASSERT_EQ(i, h.percentile((i + 1.0) / SUB_BUCKETS));
+    }
+}
+
+TEST(MetricsTest, HistogramPrecision)
+{
+    // Every value lands in a bucket whose highest value is no more than
+    // 1/16th above it.
+    for (uint64_t v = 1; v < (1ULL << 40); v = v * 3 + 1)
+    {
+        metrics::histogram h;
+        h.record(v);
+        h.record(v + (v >> 5));
+        h.record(UINT64_MAX);
+        uint64_t p = h.percentile(0.3);
+        ASSERT_LE(v, p);
+        ASSERT_LE(p - v, v / SUB_BUCKETS);
+    }
+}
+
+TEST(MetricsTest, HistogramSaturates)
+{
+    metrics::histogram h;
+    h.record(1ULL << 50);
+    h.record(UINT64_MAX);
+    ASSERT_EQ(2U, h.count());
+    ASSERT_EQ(1ULL << 50, h.min());
+    ASSERT_EQ(UINT64_MAX, h.max());
+    ASSERT_EQ(UINT64_MAX, h.percentile(0.5));
+}
+
+TEST(MetricsTest, HistogramPercentiles)
+{
+    metrics::histogram h;
+
+    for (uint64_t i = 1; i <= 1000; ++i)
+    {
+        h.record(i * 1000);
+    }
+
+    ASSERT_EQ(1000U, h.count());
+    ASSERT_EQ(1000U, h.min());
+    ASSERT_EQ(1000000U, h.max());
+    ASSERT_DOUBLE_EQ(500500.0, h.mean());
+    uint64_t p50 = h.percentile(0.5);
+    uint64_t p99 = h.percentile(0.99);
+    ASSERT_LE(500000U, p50);
+    ASSERT_LE(p50, 500000U + 500000U / 16);
+    ASSERT_LE(990000U, p99);
+    ASSERT_LE(p99, 990000U + 990000U / 16);
+    ASSERT_EQ(1000000U, h.percentile(1.0));
+}
+
+TEST(MetricsTest, HistogramMerge)
+{
+    metrics::histogram a;
+    metrics::histogram b;
+    metrics::histogram both;
+
+    for (uint64_t i = 0; i < 100; ++i)
+    {
+        a.record(i * 7);
+        b.record(i * 11 + 5);
+        both.record(i * 7);
+        both.record(i * 11 + 5);
+    }
+
+    metrics::histogram empty;
+    a.merge(empty);
+    a.merge(b);
+    ASSERT_EQ(both.count(), a.count());
+    ASSERT_EQ(both.min(), a.min());
+    ASSERT_EQ(both.max(), a.max());
+    ASSERT_DOUBLE_EQ(both.mean(), a.mean());
+
+    for (double p = 0.05; p < 1; p += 0.05)
+    {
+        ASSERT_EQ(both.percentile(p), a.percentile(p));
+    }
+
+    // Merging into an empty histogram takes the other's minimum.
+    empty.merge(b);
+    ASSERT_EQ(b.min(), empty.min());
+}
+
+void
+record_some(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; ++i)
+    {
+        metrics::count(metrics::CLIENT_SHED);
+        metrics::count(metrics::XFER_BYTES_SENT, 10);
+        metrics::record(metrics::DISK_FLUSH_NANOS, i);
+        metrics::record(hyperdex::REQ_GET, 1000 + i);
+    }
+}
+
+TEST(MetricsTest, SlabsMerge)
+{
+    std::auto_ptr<metrics::totals> before(new metrics::totals());
+    metrics::aggregate(before.get());
+    const uint64_t THREADS = 4;
+    const uint64_t N = 1000;
+
+    {
+        std::vector<std::tr1::shared_ptr<po6::threads::thread> > threads;
+
+        for (uint64_t i = 0; i < THREADS; ++i)
+        {
+            std::tr1::shared_ptr<po6::threads::thread> t(
+                    new po6::threads::thread(std::tr1::bind(record_some, N)));
+            t->start();
+            threads.push_back(t);
+        }
+
+        for (uint64_t i = 0; i < THREADS; ++i)
+        {
+            threads[i]->join();
+        }
+    }
+
+    // Slabs outlive their threads, so nothing they recorded is lost.
+    std::auto_ptr<metrics::totals> after(new metrics::totals());
+    metrics::aggregate(after.get());
+    size_t get = static_cast<size_t>(hyperdex::REQ_GET) % metrics::MSGTYPES;
+    ASSERT_EQ(THREADS * N, after->counters[metrics::CLIENT_SHED]
+                           - before->counters[metrics::CLIENT_SHED]);
+    ASSERT_EQ(10 * THREADS * N, after->counters[metrics::XFER_BYTES_SENT]
+                                - before->counters[metrics::XFER_BYTES_SENT]);
+    ASSERT_EQ(0U, after->counters[metrics::DISK_MANDATORY_IO]
+                  - before->counters[metrics::DISK_MANDATORY_IO]);
+    ASSERT_EQ(THREADS * N, after->samples[metrics::DISK_FLUSH_NANOS].count()
+                           - before->samples[metrics::DISK_FLUSH_NANOS].count());
+    ASSERT_EQ(THREADS * N, after->messages[get].count()
+                           - before->messages[get].count());
+    ASSERT_EQ(1000U + N - 1, after->messages[get].max());
+}
+
+} // namespace
@@ -0,0 +1,221 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// C
+#include <time.h>
+
+// POSIX
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// C++
+#include <iomanip>
+
+// HyperDaemon
+#include "hyperdaemon/runtimeconfig.h"
+#include "hyperdaemon/tracing.h"
+
+class hyperdaemon::tracing::entry
+{
+    public:
+        entry() : seq(0), trace(0), name(NULL), start(0), end(0), tid(0) {}
+
+    public:
+        // Zero while the entry is being written, and one more than its
+        // position in the sequence of spans otherwise.
+        volatile uint64_t seq;
+        uint64_t trace;
+        const char* name;
+        uint64_t start;
+        uint64_t end;
+        uint64_t tid;
+};
+
+__thread uint64_t hyperdaemon::tracing::t_current = 0;
+hyperdaemon::tracing::entry* hyperdaemon::tracing::s_ring = NULL;
+size_t hyperdaemon::tracing::s_ring_size = 0;
+uint64_t hyperdaemon::tracing::s_next = 0;
+static __thread uint64_t t_tid = 0;
+
+static uint64_t
+wallclock()
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const char*
+message_name(hyperdex::network_msgtype type)
+{
+    switch (type)
+    {
+        case hyperdex::REQ_GET: return "REQ_GET";
+        case hyperdex::REQ_ATOMIC: return "REQ_ATOMIC";
+        case hyperdex::REQ_SEARCH_START: return "REQ_SEARCH_START";
+        case hyperdex::REQ_SEARCH_NEXT: return "REQ_SEARCH_NEXT";
+        case hyperdex::REQ_SEARCH_STOP: return "REQ_SEARCH_STOP";
+        case hyperdex::REQ_SORTED_SEARCH: return "REQ_SORTED_SEARCH";
+        case hyperdex::REQ_GROUP_DEL: return "REQ_GROUP_DEL";
+        case hyperdex::REQ_COUNT: return "REQ_COUNT";
+        case hyperdex::CHAIN_PUT: return "CHAIN_PUT";
+        case hyperdex::CHAIN_DEL: return "CHAIN_DEL";
+        case hyperdex::CHAIN_PENDING: return "CHAIN_PENDING";
+        case hyperdex::CHAIN_SUBSPACE: return "CHAIN_SUBSPACE";
+        case hyperdex::CHAIN_ACK: return "CHAIN_ACK";
+        default: return "message";
+    }
+}
+
+void
+hyperdaemon :: tracing :: dump(std::ostream& out)
+{
+    entry* r = s_ring;
+    __sync_synchronize();
+    uint64_t next = __sync_add_and_fetch(&s_next, 0);
+    uint64_t pid = getpid();
+    bool first = true;
+    char fill = out.fill('0');
+    out << "{\"traceEvents\": [";
+
+    for (uint64_t pos = next > s_ring_size ? next - s_ring_size : 0;
+            r && pos < next; ++pos)
+    {
+        entry* e = r + pos % s_ring_size;
+        uint64_t seq = e->seq;
+        __sync_synchronize();
+        entry copy;
+        copy.trace = e->trace;
+        copy.name = e->name;
+        copy.start = e->start;
+        copy.end = e->end;
+        copy.tid = e->tid;
+        __sync_synchronize();
+
+        // Skip entries that are being written, or were overwritten while we
+        // copied them.
+        if (seq != pos + 1 || e->seq != seq)
+        {
+            continue;
+        }
+
+        uint64_t dur = copy.end > copy.start ? copy.end - copy.start : 0;
+        out << (first ? "" : ", ") << "{\"name\": \"" << copy.name << "\""
+            << ", \"cat\": \"hyperdex\", \"ph\": \"X\""
+            << ", \"ts\": " << copy.start / 1000 << "." << std::setw(3) << copy.start % 1000
+            << ", \"dur\": " << dur / 1000 << "." << std::setw(3) << dur % 1000
+            << ", \"pid\": " << pid
+            << ", \"tid\": " << copy.tid
+            << ", \"args\": {\"trace\": \"" << std::hex << std::setw(16) << copy.trace << std::dec << "\"}}";
+        first = false;
+    }
+
+    out << "], \"displayTimeUnit\": \"ns\"}";
+    out.fill(fill);
+}
+
+// The ring is only allocated once something is traced.
+hyperdaemon::tracing::entry*
+hyperdaemon :: tracing :: ring()
+{
+    entry* r = s_ring;
+
+    if (r || TRACE_SPANS == 0)
+    {
+        return r;
+    }
+
+    size_t sz = TRACE_SPANS;
+    r = new entry[sz];
+
+    if (__sync_bool_compare_and_swap(&s_ring_size, 0, sz))
+    {
+        __sync_synchronize();
+        s_ring = r;
+        return r;
+    }
+
+    delete[] r;
+
+    while (!s_ring)
+    {
+        __sync_synchronize();
+    }
+
+    return s_ring;
+}
+
+void
+hyperdaemon :: tracing :: record(uint64_t trace, const char* name,
+                                 uint64_t start, uint64_t end)
+{
+    entry* r = ring();
+
+    if (!r)
+    {
+        return;
+    }
+
+    if (t_tid == 0)
+    {
+        t_tid = syscall(SYS_gettid);
+    }
+
+    uint64_t pos = __sync_fetch_and_add(&s_next, 1);
+    entry* e = r + pos % s_ring_size;
+    e->seq = 0;
+    __sync_synchronize();
+    e->trace = trace;
+    e->name = name;
+    e->start = start;
+    e->end = end;
+    e->tid = t_tid;
+    __sync_synchronize();
+    e->seq = pos + 1;
+}
+
+hyperdaemon :: tracing :: span :: span(const char* name)
+    : m_trace(t_current)
+    , m_name(name)
+    , m_start(m_trace ? wallclock() : 0)
+{
+}
+
+hyperdaemon :: tracing :: span :: span(hyperdex::network_msgtype type)
+    : m_trace(t_current)
+    , m_name(message_name(type))
+    , m_start(m_trace ? wallclock() : 0)
+{
+}
+
+hyperdaemon :: tracing :: span :: ~span() throw ()
+{
+    if (m_trace)
+    {
+        record(m_trace, m_name, m_start, wallclock());
+    }
+}
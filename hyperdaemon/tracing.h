@@ -0,0 +1,121 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef hyperdaemon_tracing_h_
+#define hyperdaemon_tracing_h_
+
+// C
+#include <stddef.h>
+#include <stdint.h>
+
+// C++
+#include <iostream>
+
+// HyperDex
+#include "hyperdex/hyperdex/network_constants.h"
+
+namespace hyperdaemon
+{
+
+// Sampled request tracing.  A client chooses which requests to trace and
+// stamps each with a trace id.  Every message sent on the request's behalf
+// carries the id in its header, from hop to hop along the chain and back.
+//
+// A worker thread adopts the id of a traced message while it handles that
+// message.  Work done later on an operation's behalf, such as forwarding a
+// deferred update, adopts the id stored with the operation.  While a thread
+// holds an id, spans record the time spent in each stage into a process-wide
+// ring of the last TRACE_SPANS spans.  Threads handling untraced messages pay
+// only for a thread-local load and a branch.
+class tracing
+{
+    public:
+        class scope;
+        class span;
+
+    public:
+        // The trace the calling thread is working on, or 0.
+        static uint64_t current() { return t_current; }
+        // Write the spans in the ring as a single line holding a Chrome
+        // trace-event JSON object, which chrome://tracing and most trace
+        // viewers load directly.  Spans are stamped with the wall clock so
+        // dumps from several daemons can be merged.
+        static void dump(std::ostream& out);
+
+    private:
+        class entry;
+
+    private:
+        static entry* ring();
+        static void record(uint64_t trace, const char* name,
+                           uint64_t start, uint64_t end);
+
+    private:
+        static __thread uint64_t t_current;
+        static entry* s_ring;
+        static size_t s_ring_size;
+        static uint64_t s_next;
+};
+
+// Work on "trace" between construction and destruction, then go back to
+// whatever the thread was working on before.
+class tracing::scope
+{
+    public:
+        explicit scope(uint64_t trace) : m_prev(t_current) { t_current = trace; }
+        ~scope() throw () { t_current = m_prev; }
+
+    private:
+        scope(const scope&);
+        scope& operator = (const scope&);
+
+    private:
+        uint64_t m_prev;
+};
+
+// Record the time between construction and destruction under "name", if the
+// thread is working on a trace.  "name" must be a string literal.
+class tracing::span
+{
+    public:
+        explicit span(const char* name);
+        explicit span(hyperdex::network_msgtype type);
+        ~span() throw ();
+
+    private:
+        span(const span&);
+        span& operator = (const span&);
+
+    private:
+        uint64_t m_trace;
+        const char* m_name;
+        uint64_t m_start;
+};
+
+} // namespace hyperdaemon
+
+#endif // hyperdaemon_tracing_h_
@@ -29,6 +29,7 @@
 
 // C
 #include <cassert>
+#include <cstring>
 #include <stdint.h>
 
 // STL
@@ -45,101 +46,193 @@
 const uint32_t hyperdex::configuration::CLIENTSPACE = UINT32_MAX;
 const uint32_t hyperdex::configuration::TRANSFERSPACE = UINT32_MAX - 1;
 
+hyperdex :: configuration :: layout :: layout()
+    : config(NULL)
+    , config_sz(0)
+    , attributes(NULL)
+    , attributes_sz(0)
+    , schemas(NULL)
+    , schemas_sz(0)
+    , space_ids_to_schemas()
+    , space_assignment()
+    , space_sizes()
+    , repl_hashers()
+    , disk_hashers()
+{
+}
+
+hyperdex :: configuration :: layout :: layout(const char* _config, size_t _config_sz,
+                                              const std::map<spaceid, std::vector<attribute> >& spaces,
+                                              const std::map<std::string, spaceid>& _space_assignment,
+                                              const std::map<spaceid, uint16_t>& _space_sizes,
+                                              const std::map<subspaceid, hyperspacehashing::prefix::hasher>& _repl_hashers,
+                                              const std::map<subspaceid, hyperspacehashing::mask::hasher>& _disk_hashers)
+    : config(NULL)
+    , config_sz(_config_sz)
+    , attributes(NULL)
+    , attributes_sz(0)
+    , schemas(NULL)
+    , schemas_sz(spaces.size())
+    , space_ids_to_schemas(spaces.size())
+    , space_assignment(_space_assignment)
+    , space_sizes(_space_sizes)
+    , repl_hashers(_repl_hashers)
+    , disk_hashers(_disk_hashers)
+{
+    config = new char[config_sz];
+    memmove(config.get(), _config, config_sz);
+    std::map<spaceid, std::vector<attribute> >::const_iterator ci;
+
+    for (ci = spaces.begin(); ci != spaces.end(); ++ci)
+    {
+        attributes_sz += ci->second.size();
+    }
+
+    // Create the "schema" objects that are needed for the attributes, and
+    // reseat each attribute's name to point into our copy of the config.
+    attributes = new attribute[attributes_sz];
+    schemas = new schema[schemas_sz];
+    size_t schema_idx = 0;
+    size_t attr_idx = 0;
+
+    for (ci = spaces.begin(); ci != spaces.end(); ++ci)
+    {
+        space_ids_to_schemas[schema_idx].first = ci->first;
+        space_ids_to_schemas[schema_idx].second = &schemas[schema_idx];
+        schemas[schema_idx].attrs_sz = ci->second.size();
+        schemas[schema_idx].attrs = &attributes[attr_idx];
+        ++schema_idx;
+
+        for (size_t i = 0; i < ci->second.size(); ++i)
+        {
+            size_t off = ci->second[i].name - _config;
+            assert(off < config_sz);
+            attributes[attr_idx].name = config.get() + off;
+            attributes[attr_idx].type = ci->second[i].type;
+            ++attr_idx;
+        }
+    }
+}
+
+hyperdex :: configuration :: layout :: ~layout() throw ()
+{
+}
+
+hyperdex :: configuration :: chain :: chain(const std::string& _line,
+                                            const std::vector<instance>& _members)
+    : line(_line)
+    , members(_members)
+{
+}
+
+hyperdex :: configuration :: chain :: ~chain() throw ()
+{
+}
+
+hyperdex :: configuration :: chains :: chains()
+    : regions()
+    , by_num()
+{
+}
+
+hyperdex :: configuration :: chains :: chains(const std::map<regionid, std::tr1::shared_ptr<const chain> >& _regions)
+    : regions(_regions)
+    , by_num()
+{
+    std::map<regionid, std::tr1::shared_ptr<const chain> >::const_iterator reg;
+    by_num.reserve(regions.size());
+
+    for (reg = regions.begin(); reg != regions.end(); ++reg)
+    {
+        by_num.push_back(reg->first);
+    }
+}
+
+hyperdex :: configuration :: chains :: ~chains() throw ()
+{
+}
+
+hyperdex :: configuration :: xfer :: xfer(const std::string& _line,
+                                          const regionid& _region,
+                                          const instance& _dest)
+    : line(_line)
+    , region(_region)
+    , dest(_dest)
+{
+}
+
+hyperdex :: configuration :: xfer :: ~xfer() throw ()
+{
+}
+
+hyperdex :: configuration :: xfers :: xfers()
+    : transfers()
+{
+}
+
+hyperdex :: configuration :: xfers :: xfers(const std::map<uint16_t, std::tr1::shared_ptr<const xfer> >& _transfers)
+    : transfers(_transfers)
+{
+}
+
+hyperdex :: configuration :: xfers :: ~xfers() throw ()
+{
+}
+
+hyperdex :: configuration :: state :: state()
+    : layout(new configuration::layout())
+    , chains(new configuration::chains())
+    , xfers(new configuration::xfers())
+    , header_text("")
+    , version(0)
+    , hosts()
+    , quiesce(false)
+    , quiesce_state_id("")
+    , shutdown(false)
+    , backup_id("")
+    , restore_id("")
+{
+}
+
+hyperdex :: configuration :: state :: ~state() throw ()
+{
+}
+
 hyperdex :: configuration :: configuration()
-    : m_config(NULL)
-    , m_config_sz(0)
-    , m_schemas(NULL)
-    , m_schemas_sz(0)
-    , m_attributes(NULL)
-    , m_attributes_sz(0)
-    , m_space_ids_to_schemas()
-
-    , m_config_text("")
-    , m_version(0)
-    , m_hosts()
-    , m_space_assignment()
-    , m_space_sizes()
-    , m_entities()
-    , m_repl_hashers()
-    , m_disk_hashers()
-    , m_transfers()
-    , m_transfers_by_num(65536)
-    , m_quiesce(false)
-    , m_quiesce_state_id("")
-    , m_shutdown(false)
-{
-}
-
-hyperdex :: configuration :: configuration(e::array_ptr<char> config, size_t config_sz,
-                                           e::array_ptr<schema> schemas, size_t schemas_sz,
-                                           e::array_ptr<attribute> attributes, size_t attributes_sz,
-                                           const std::vector<std::pair<spaceid, schema*> > space_ids_to_schemas,
-                                           const std::string& _config_text,
+    : m_state(new state())
+{
+}
+
+hyperdex :: configuration :: configuration(std::tr1::shared_ptr<const layout> l,
+                                           std::tr1::shared_ptr<const chains> c,
+                                           std::tr1::shared_ptr<const xfers> x,
+                                           const std::string& _header_text,
                                            uint64_t ver,
                                            const std::vector<instance>& hosts,
-                                           const std::map<std::string, spaceid>& space_assignment,
-                                           const std::map<spaceid, uint16_t>& space_sizes,
-                                           const std::map<entityid, instance>& entities,
-                                           const std::map<subspaceid, hyperspacehashing::prefix::hasher>& repl_hashers,
-                                           const std::map<subspaceid, hyperspacehashing::mask::hasher>& disk_hashers,
-                                           const std::map<std::pair<instance, uint16_t>, hyperdex::regionid>& transfers,
                                            bool _quiesce, const std::string& _quiesce_state_id,
+                                           const std::string& _backup_id,
+                                           const std::string& _restore_id,
                                            bool _shutdown)
-    : m_config(config)
-    , m_config_sz(config_sz)
-    , m_schemas(schemas)
-    , m_schemas_sz(schemas_sz)
-    , m_attributes(attributes)
-    , m_attributes_sz(attributes_sz)
-    , m_space_ids_to_schemas(space_ids_to_schemas)
-
-    , m_config_text(_config_text)
-    , m_version(ver)
-    , m_hosts(hosts)
-    , m_space_assignment(space_assignment)
-    , m_space_sizes(space_sizes)
-    , m_entities(entities)
-    , m_repl_hashers(repl_hashers)
-    , m_disk_hashers(disk_hashers)
-    , m_transfers(transfers)
-    , m_transfers_by_num(65536)
-    , m_quiesce(_quiesce)
-    , m_quiesce_state_id(_quiesce_state_id)
-    , m_shutdown(_shutdown)
-{
-    std::map<std::pair<instance, uint16_t>, hyperdex::regionid>::iterator it;
-
-    for (it = m_transfers.begin(); it != m_transfers.end(); ++it)
-    {
-        assert(m_transfers_by_num[it->first.second] == instance());
-        m_transfers_by_num[it->first.second] = it->first.first;
-    }
+    : m_state()
+{
+    std::tr1::shared_ptr<state> s(new state());
+    s->layout = l;
+    s->chains = c;
+    s->xfers = x;
+    s->header_text = _header_text;
+    s->version = ver;
+    s->hosts = hosts;
+    s->quiesce = _quiesce;
+    s->quiesce_state_id = _quiesce_state_id;
+    s->shutdown = _shutdown;
+    s->backup_id = _backup_id;
+    s->restore_id = _restore_id;
+    m_state = s;
 }
 
 hyperdex :: configuration :: configuration(const configuration& other)
-    : m_config(NULL)
-    , m_config_sz(0)
-    , m_schemas(NULL)
-    , m_schemas_sz(0)
-    , m_attributes(NULL)
-    , m_attributes_sz(0)
-    , m_space_ids_to_schemas()
-
-    , m_config_text("")
-    , m_version(0)
-    , m_hosts()
-    , m_space_assignment()
-    , m_space_sizes()
-    , m_entities()
-    , m_repl_hashers()
-    , m_disk_hashers()
-    , m_transfers()
-    , m_transfers_by_num(65536)
-    , m_quiesce(false)
-    , m_quiesce_state_id("")
-    , m_shutdown(false)
-{
-    copy(other, this);
+    : m_state(other.m_state)
+{
 }
 
 hyperdex :: configuration :: ~configuration() throw ()
@@ -163,12 +256,12 @@ schema*
 hyperdex :: configuration :: get_schema(const spaceid& sp) const
 {
     std::vector<std::pair<spaceid, schema*> >::const_iterator it;
-    it = std::lower_bound(m_space_ids_to_schemas.begin(),
-                          m_space_ids_to_schemas.end(),
+    it = std::lower_bound(m_state->layout->space_ids_to_schemas.begin(),
+                          m_state->layout->space_ids_to_schemas.end(),
                           std::make_pair(sp, static_cast<schema*>(NULL)),
                           compare_space_ids_to_schemas);
 
-    if (it == m_space_ids_to_schemas.end())
+    if (it == m_state->layout->space_ids_to_schemas.end())
     {
         return NULL;
     }
@@ -176,14 +269,44 @@ hyperdex :: configuration :: get_schema(const spaceid& sp) const
     return it->second;
 }
 
+std::string
+hyperdex :: configuration :: config_text() const
+{
+    std::string text(m_state->header_text);
+    chain_map::const_iterator reg;
+    std::map<uint16_t, std::tr1::shared_ptr<const xfer> >::const_iterator t;
+
+    for (reg = m_state->chains->regions.begin();
+            reg != m_state->chains->regions.end(); ++reg)
+    {
+        text += reg->second->line;
+        text += '\n';
+    }
+
+    for (t = m_state->xfers->transfers.begin();
+            t != m_state->xfers->transfers.end(); ++t)
+    {
+        text += t->second->line;
+        text += '\n';
+    }
+
+    return text;
+}
+
+uint64_t
+hyperdex :: configuration :: version() const
+{
+    return m_state->version;
+}
+
 hyperdex::spaceid
 hyperdex :: configuration :: space(const char* spacename) const
 {
     std::string s(spacename);
     std::map<std::string, spaceid>::const_iterator sai;
-    sai = m_space_assignment.find(s);
+    sai = m_state->layout->space_assignment.find(s);
 
-    if (sai == m_space_assignment.end())
+    if (sai == m_state->layout->space_assignment.end())
     {
         return spaceid();
     }
@@ -197,7 +320,7 @@ hyperdex :: configuration :: subspaces(const spaceid& s)
 {
     std::map<spaceid, uint16_t>::const_iterator si;
 
-    if ((si = m_space_sizes.find(s)) == m_space_sizes.end())
+    if ((si = m_state->layout->space_sizes.find(s)) == m_state->layout->space_sizes.end())
     {
         return -1;
     }
@@ -209,16 +332,13 @@ hyperdex::entityid
 hyperdex :: configuration :: entityfor(const instance& i, const regionid& r)
                              const
 {
-    std::map<entityid, instance>::const_iterator lower;
-    std::map<entityid, instance>::const_iterator upper;
-    lower = m_entities.lower_bound(entityid(r, 0));
-    upper = m_entities.upper_bound(entityid(r, UINT8_MAX));
+    const chain* c = _chainof(r);
 
-    for (; lower != upper; ++lower)
+    for (size_t n = 0; c && n < c->members.size(); ++n)
     {
-        if (lower->second == i)
+        if (c->members[n] == i)
         {
-            return lower->first;
+            return entityid(r, static_cast<uint8_t>(n));
         }
     }
 
@@ -229,12 +349,11 @@ hyperdex::instance
 hyperdex :: configuration :: instancefor(const entityid& e)
                              const
 {
-    std::map<entityid, instance>::const_iterator ent;
-    ent = m_entities.find(e);
+    const chain* c = _chainof(e.get_region());
 
-    if (ent != m_entities.end())
+    if (c && e.number < c->members.size())
     {
-        return ent->second;
+        return c->members[e.number];
     }
 
     return instance();
@@ -246,7 +365,7 @@ hyperdex :: configuration :: instance_versions(instance* i)
 {
     std::vector<instance>::const_iterator h;
 
-    for (h = m_hosts.begin(); h != m_hosts.end(); ++h)
+    for (h = m_state->hosts.begin(); h != m_state->hosts.end(); ++h)
     {
         if (h->address == i->address &&
             h->inbound_port == i->inbound_port &&
@@ -266,32 +385,69 @@ hyperdex :: configuration :: regions_for(const instance& i)
                              const
 {
     std::set<regionid> ret;
-    std::map<entityid, instance>::const_iterator e;
+    chain_map::const_iterator reg;
 
-    for (e = m_entities.begin(); e != m_entities.end(); ++e)
+    for (reg = m_state->chains->regions.begin();
+            reg != m_state->chains->regions.end(); ++reg)
     {
-        if (e->second == i)
+        const std::vector<instance>& members(reg->second->members);
+
+        if (std::find(members.begin(), members.end(), i) != members.end())
         {
-            ret.insert(e->first.get_region());
+            ret.insert(reg->first);
         }
     }
 
     return ret;
 }
 
+bool
+hyperdex :: configuration :: entity_number(const entityid& e, uint32_t* num)
+                             const
+{
+    const std::vector<regionid>& by_num(m_state->chains->by_num);
+    std::vector<regionid>::const_iterator it;
+    it = std::lower_bound(by_num.begin(), by_num.end(), e.get_region());
+
+    if (it == by_num.end() || *it != e.get_region() ||
+        instancefor(e) == instance())
+    {
+        return false;
+    }
+
+    *num = (static_cast<uint32_t>(it - by_num.begin()) << 8) | e.number;
+    return true;
+}
+
+bool
+hyperdex :: configuration :: entity_by_number(uint32_t num, entityid* e)
+                             const
+{
+    size_t idx = num >> 8;
+
+    if (idx >= m_state->chains->by_num.size())
+    {
+        return false;
+    }
+
+    *e = entityid(m_state->chains->by_num[idx], static_cast<uint8_t>(num & UINT8_MAX));
+    return instancefor(*e) != instance();
+}
+
 hyperdex::entityid
 hyperdex :: configuration :: sloppy_lookup(const entityid& ent)
                              const
 {
-    std::map<entityid, instance>::const_iterator e;
+    chain_map::const_iterator reg;
 
-    for (e = m_entities.begin(); e != m_entities.end(); ++e)
+    for (reg = m_state->chains->regions.begin();
+            reg != m_state->chains->regions.end(); ++reg)
     {
-        if (e->first.get_subspace() == ent.get_subspace()
-                && e->first.coord().contains(ent.coord())
-                && e->first.number == ent.number)
+        if (reg->first.get_subspace() == ent.get_subspace()
+                && reg->first.coord().contains(ent.coord())
+                && ent.number < reg->second->members.size())
         {
-            return e->first;
+            return entityid(reg->first, ent.number);
         }
     }
 
@@ -363,16 +519,16 @@ hyperdex :: configuration :: chain_prev(const entityid& e)
 hyperdex::entityid
 hyperdex :: configuration :: headof(const regionid& r) const
 {
-    typedef std::map<hyperdex::entityid, hyperdex::instance>::const_iterator mapiter;
-    mapiter i = m_entities.begin();
+    chain_map::const_iterator reg = m_state->chains->regions.begin();
     hyperspacehashing::prefix::coordinate c = r.coord();
 
-    for (; i != m_entities.end(); ++i)
+    for (; reg != m_state->chains->regions.end(); ++reg)
     {
-        if (r.get_subspace() == i->first.get_subspace() &&
-                c.intersects(i->first.get_region().coord()))
+        if (r.get_subspace() == reg->first.get_subspace() &&
+                c.intersects(reg->first.coord()) &&
+                !reg->second->members.empty())
         {
-            return i->first;
+            return entityid(reg->first, 0);
         }
     }
 
@@ -382,16 +538,16 @@ hyperdex :: configuration :: headof(const regionid& r) const
 hyperdex::entityid
 hyperdex :: configuration :: tailof(const regionid& r) const
 {
-    typedef std::map<hyperdex::entityid, hyperdex::instance>::const_reverse_iterator mapiter;
-    mapiter i = m_entities.rbegin();
+    chain_map::const_reverse_iterator reg = m_state->chains->regions.rbegin();
     hyperspacehashing::prefix::coordinate c = r.coord();
 
-    for (; i != m_entities.rend(); ++i)
+    for (; reg != m_state->chains->regions.rend(); ++reg)
     {
-        if (r.get_subspace() == i->first.get_subspace() &&
-                c.intersects(i->first.get_region().coord()))
+        if (r.get_subspace() == reg->first.get_subspace() &&
+                c.intersects(reg->first.coord()) &&
+                !reg->second->members.empty())
         {
-            return i->first;
+            return entityid(reg->first, static_cast<uint8_t>(reg->second->members.size() - 1));
         }
     }
 
@@ -402,8 +558,8 @@ hyperspacehashing::mask::hasher
 hyperdex :: configuration :: disk_hasher(const subspaceid& subspace) const
 {
     std::map<subspaceid, hyperspacehashing::mask::hasher>::const_iterator hashiter;
-    hashiter = m_disk_hashers.find(subspace);
-    assert(hashiter != m_disk_hashers.end());
+    hashiter = m_state->layout->disk_hashers.find(subspace);
+    assert(hashiter != m_state->layout->disk_hashers.end());
     return hashiter->second;
 }
 
@@ -411,8 +567,8 @@ hyperspacehashing::prefix::hasher
 hyperdex :: configuration :: repl_hasher(const subspaceid& subspace) const
 {
     std::map<subspaceid, hyperspacehashing::prefix::hasher>::const_iterator hashiter;
-    hashiter = m_repl_hashers.find(subspace);
-    assert(hashiter != m_repl_hashers.end());
+    hashiter = m_state->layout->repl_hashers.find(subspace);
+    assert(hashiter != m_state->layout->repl_hashers.end());
     return hashiter->second;
 }
 
@@ -424,8 +580,8 @@ hyperdex :: configuration :: point_leader_entity(const spaceid& s,
 {
     subspaceid ssi(s, 0);
     std::map<subspaceid, hyperspacehashing::prefix::hasher>::const_iterator hashiter;
-    hashiter = m_repl_hashers.find(ssi);
-    assert(hashiter != m_repl_hashers.end());
+    hashiter = m_state->layout->repl_hashers.find(ssi);
+    assert(hashiter != m_state->layout->repl_hashers.end());
     hyperspacehashing::prefix::coordinate coord = hashiter->second.hash(key);
     hyperdex::regionid point_leader(ssi, coord.prefix, coord.point);
     *ent = headof(point_leader);
@@ -437,10 +593,10 @@ std::map<hyperdex::entityid, hyperdex::instance>
 hyperdex :: configuration :: search_entities(const spaceid& si,
                                              const hyperspacehashing::search& s) const
 {
-    std::map<entityid, instance>::const_iterator start;
-    std::map<entityid, instance>::const_iterator end;
-    start = m_entities.lower_bound(hyperdex::entityid(si.space, 0, 0, 0, 0));
-    end   = m_entities.upper_bound(hyperdex::entityid(si.space, UINT16_MAX, UINT8_MAX, UINT64_MAX, UINT8_MAX));
+    chain_map::const_iterator start;
+    chain_map::const_iterator end;
+    start = m_state->chains->regions.lower_bound(hyperdex::regionid(si.space, 0, 0, 0));
+    end   = m_state->chains->regions.upper_bound(hyperdex::regionid(si.space, UINT16_MAX, UINT8_MAX, UINT64_MAX));
     return _search_entities(start, end, s);
 }
 
@@ -448,29 +604,37 @@ std::map<hyperdex::entityid, hyperdex::instance>
 hyperdex :: configuration :: search_entities(const subspaceid& ssi,
                                              const hyperspacehashing::search& s) const
 {
-    std::map<entityid, instance>::const_iterator start;
-    std::map<entityid, instance>::const_iterator end;
-    start = m_entities.lower_bound(hyperdex::entityid(ssi.space, ssi.subspace, 0, 0, 0));
-    end   = m_entities.upper_bound(hyperdex::entityid(ssi.space, ssi.subspace, UINT8_MAX, UINT64_MAX, UINT8_MAX));
+    chain_map::const_iterator start;
+    chain_map::const_iterator end;
+    start = m_state->chains->regions.lower_bound(hyperdex::regionid(ssi.space, ssi.subspace, 0, 0));
+    end   = m_state->chains->regions.upper_bound(hyperdex::regionid(ssi.space, ssi.subspace, UINT8_MAX, UINT64_MAX));
     return _search_entities(start, end, s);
 }
 
 hyperdex::instance
 hyperdex :: configuration :: instancefortransfer(uint16_t xfer_id) const
 {
-    return m_transfers_by_num[xfer_id];
+    std::map<uint16_t, std::tr1::shared_ptr<const xfer> >::const_iterator t;
+    t = m_state->xfers->transfers.find(xfer_id);
+
+    if (t == m_state->xfers->transfers.end())
+    {
+        return instance();
+    }
+
+    return t->second->dest;
 }
 
 uint16_t
 hyperdex :: configuration :: transfer_id(const regionid& reg) const
 {
-    std::map<std::pair<instance, uint16_t>, hyperdex::regionid>::const_iterator t;
+    std::map<uint16_t, std::tr1::shared_ptr<const xfer> >::const_iterator t;
 
-    for (t = m_transfers.begin(); t != m_transfers.end(); ++t)
+    for (t = m_state->xfers->transfers.begin(); t != m_state->xfers->transfers.end(); ++t)
     {
-        if (t->second == reg)
+        if (t->second->region == reg)
         {
-            return t->first.second;
+            return t->first;
         }
     }
 
@@ -481,14 +645,14 @@ std::map<uint16_t, hyperdex::regionid>
 hyperdex :: configuration :: transfers_to(const instance& inst) const
 {
     std::map<uint16_t, hyperdex::regionid> ret;
-    std::map<std::pair<instance, uint16_t>, hyperdex::regionid>::const_iterator lower;
-    std::map<std::pair<instance, uint16_t>, hyperdex::regionid>::const_iterator upper;
-    lower = m_transfers.lower_bound(std::make_pair(inst, 0));
-    upper = m_transfers.upper_bound(std::make_pair(inst, UINT16_MAX));
+    std::map<uint16_t, std::tr1::shared_ptr<const xfer> >::const_iterator t;
 
-    for (; lower != upper; ++lower)
+    for (t = m_state->xfers->transfers.begin(); t != m_state->xfers->transfers.end(); ++t)
     {
-        ret.insert(std::make_pair(lower->first.second, lower->second));
+        if (t->second->dest == inst)
+        {
+            ret.insert(std::make_pair(t->first, t->second->region));
+        }
     }
 
     return ret;
@@ -498,30 +662,32 @@ std::map<uint16_t, hyperdex::regionid>
 hyperdex :: configuration :: transfers_from(const instance& inst) const
 {
     std::map<uint16_t, hyperdex::regionid> ret;
-    std::map<std::pair<instance, uint16_t>, hyperdex::regionid>::const_iterator t;
-    t = m_transfers.begin();
+    std::map<uint16_t, std::tr1::shared_ptr<const xfer> >::const_iterator t;
+    t = m_state->xfers->transfers.begin();
 
-    for (; t != m_transfers.end(); ++t)
+    for (; t != m_state->xfers->transfers.end(); ++t)
     {
+        const regionid& reg(t->second->region);
+
         // If the region has gone live and the tail of the region is now the
         // recipient of the transfer.
-        if (instancefor(tailof(t->second)) == t->first.first)
+        if (instancefor(tailof(reg)) == t->second->dest)
         {
-            entityid ent = tailof(t->second);
+            entityid ent = tailof(reg);
             assert(chain_has_prev(ent));
             ent = chain_prev(ent);
 
             if (instancefor(ent) == inst)
             {
-                ret.insert(std::make_pair(t->first.second, t->second));
+                ret.insert(std::make_pair(t->first, reg));
             }
         }
         // Otherwise the tail of the region is the sender of the transfer.
         else
         {
-            if (instancefor(tailof(t->second)) == inst)
+            if (instancefor(tailof(reg)) == inst)
             {
-                ret.insert(std::make_pair(t->first.second, t->second));
+                ret.insert(std::make_pair(t->first, reg));
             }
         }
     }
@@ -529,99 +695,66 @@ hyperdex :: configuration :: transfers_from(const instance& inst) const
     return ret;
 }
 
+const hyperdex::configuration::chain*
+hyperdex :: configuration :: chain_piece(const regionid& r) const
+{
+    return _chainof(r);
+}
+
+const hyperdex::configuration::xfer*
+hyperdex :: configuration :: xfer_piece(uint16_t xfer_id) const
+{
+    std::map<uint16_t, std::tr1::shared_ptr<const xfer> >::const_iterator t;
+    t = m_state->xfers->transfers.find(xfer_id);
+
+    if (t == m_state->xfers->transfers.end())
+    {
+        return NULL;
+    }
+
+    return t->second.get();
+}
+
 bool 
 hyperdex :: configuration :: quiesce() const
 {
-    return m_quiesce;
+    return m_state->quiesce;
 }
 
 std::string 
 hyperdex :: configuration :: quiesce_state_id() const
 {
-    return m_quiesce_state_id;
+    return m_state->quiesce_state_id;
 }
 
 bool 
 hyperdex :: configuration :: shutdown() const
 {
-    return m_shutdown;
+    return m_state->shutdown;
 }
 
-hyperdex::configuration&
-hyperdex :: configuration :: operator = (const configuration& rhs)
+std::string
+hyperdex :: configuration :: backup_id() const
 {
-    if (this != &rhs)
-    {
-        copy(rhs, this);
-    }
-
-    return *this;
+    return m_state->backup_id;
 }
 
-void
-hyperdex :: configuration :: copy(const configuration& rhs, configuration* to)
+std::string
+hyperdex :: configuration :: restore_id() const
 {
-    // Copy m_config
-    to->m_config_sz = rhs.m_config_sz;
-    to->m_config = new char[to->m_config_sz];
-    memmove(to->m_config.get(), rhs.m_config.get(), to->m_config_sz);
-
-    // Copy m_attributes, reseating each to point into m_config
-    to->m_attributes_sz = rhs.m_attributes_sz;
-    to->m_attributes = new attribute[to->m_attributes_sz];
-
-    for (size_t i = 0; i < to->m_attributes_sz; ++i)
-    {
-        size_t off = rhs.m_attributes[i].name - rhs.m_config.get();
-        assert(off < rhs.m_config_sz);
-        to->m_attributes[i].name = to->m_config.get() + off;
-        to->m_attributes[i].type = rhs.m_attributes[i].type;
-        assert(strcmp(to->m_attributes[i].name, rhs.m_attributes[i].name) == 0);
-    }
-
-    // Copy m_schemas, reseating each to point into m_attributes
-    to->m_schemas_sz = rhs.m_schemas_sz;
-    to->m_schemas = new schema[to->m_schemas_sz];
-
-    for (size_t i = 0; i < to->m_schemas_sz; ++i)
-    {
-        size_t off = rhs.m_schemas[i].attrs - rhs.m_attributes.get();
-        assert(off < rhs.m_attributes_sz);
-        to->m_schemas[i].attrs_sz = rhs.m_schemas[i].attrs_sz;
-        to->m_schemas[i].attrs = to->m_attributes.get() + off;
-    }
-
-    // Copy m_space_ids_to_schemas, reseating each to point into m_schemas
-    to->m_space_ids_to_schemas.resize(rhs.m_space_ids_to_schemas.size());
-
-    for (size_t i = 0; i < rhs.m_space_ids_to_schemas.size(); ++i)
-    {
-        size_t off = rhs.m_space_ids_to_schemas[i].second - rhs.m_schemas.get();
-        assert(off < rhs.m_schemas_sz);
-        to->m_space_ids_to_schemas[i].first = rhs.m_space_ids_to_schemas[i].first;
-        to->m_space_ids_to_schemas[i].second = to->m_schemas.get() + off;
-    }
+    return m_state->restore_id;
+}
 
-    // Straight copies
-    to->m_config_text = rhs.m_config_text;
-    to->m_config_text = rhs.m_config_text;
-    to->m_version = rhs.m_version;
-    to->m_hosts = rhs.m_hosts;
-    to->m_space_assignment = rhs.m_space_assignment;
-    to->m_space_sizes = rhs.m_space_sizes;
-    to->m_entities = rhs.m_entities;
-    to->m_repl_hashers = rhs.m_repl_hashers;
-    to->m_disk_hashers = rhs.m_disk_hashers;
-    to->m_transfers = rhs.m_transfers;
-    to->m_transfers_by_num = rhs.m_transfers_by_num;
-    to->m_quiesce = rhs.m_quiesce;
-    to->m_quiesce_state_id = rhs.m_quiesce_state_id;
-    to->m_shutdown = rhs.m_shutdown;
+hyperdex::configuration&
+hyperdex :: configuration :: operator = (const configuration& rhs)
+{
+    m_state = rhs.m_state;
+    return *this;
 }
 
 std::map<hyperdex::entityid, hyperdex::instance>
-hyperdex :: configuration :: _search_entities(std::map<entityid, instance>::const_iterator iter,
-                                              std::map<entityid, instance>::const_iterator end,
+hyperdex :: configuration :: _search_entities(chain_map::const_iterator iter,
+                                              chain_map::const_iterator end,
                                               const hyperspacehashing::search& s) const
 {
     typedef std::map<uint16_t, std::map<hyperdex::entityid, hyperdex::instance> > candidates_map;
@@ -630,13 +763,12 @@ hyperdex :: configuration :: _search_entities(std::map<entityid, instance>::cons
     bool hashed = false;
     uint16_t hashed_subspace = 0;
     hyperspacehashing::prefix::search_coordinate sc;
-    hyperdex::regionid prevreg;
 
     for (; iter != end; ++iter)
     {
         std::map<subspaceid, hyperspacehashing::prefix::hasher>::const_iterator hashiter;
-        hashiter = m_repl_hashers.find(iter->first.get_subspace());
-        assert(hashiter != m_repl_hashers.end());
+        hashiter = m_state->layout->repl_hashers.find(iter->first.get_subspace());
+        assert(hashiter != m_state->layout->repl_hashers.end());
 
         if (!hashed || hashed_subspace != iter->first.subspace)
         {
@@ -645,10 +777,10 @@ hyperdex :: configuration :: _search_entities(std::map<entityid, instance>::cons
             hashed_subspace = iter->first.subspace;
         }
 
-        if (iter->first.get_region() != prevreg && sc.matches(iter->first.coord()))
+        if (!iter->second->members.empty() && sc.matches(iter->first.coord()))
         {
-            candidates[iter->first.subspace].insert(*iter);
-            prevreg = iter->first.get_region();
+            candidates[iter->first.subspace].insert(std::make_pair(entityid(iter->first, 0),
+                                                                   iter->second->members[0]));
         }
     }
 
@@ -666,3 +798,16 @@ hyperdex :: configuration :: _search_entities(std::map<entityid, instance>::cons
 
     return ret;
 }
+
+const hyperdex::configuration::chain*
+hyperdex :: configuration :: _chainof(const regionid& r) const
+{
+    chain_map::const_iterator reg = m_state->chains->regions.find(r);
+
+    if (reg == m_state->chains->regions.end())
+    {
+        return NULL;
+    }
+
+    return reg->second.get();
+}
@@ -27,6 +27,9 @@
 
 #define __STDC_LIMIT_MACROS
 
+// STL
+#include <algorithm>
+
 // HyperDex
 #include "hyperdex/hyperdex/configuration_parser.h"
 
@@ -37,20 +40,25 @@ hyperdex :: configuration_parser :: configuration_parser()
     , m_attributes_sz(0)
     , m_schemas(NULL)
     , m_schemas_sz(0)
-    , m_config_text("")
     , m_version(0)
     , m_hosts()
+    , m_host_lines()
+    , m_other_lines()
     , m_space_assignment()
     , m_spaces()
     , m_subspaces()
     , m_repl_attrs()
     , m_disk_attrs()
     , m_regions()
-    , m_entities()
     , m_transfers()
     , m_quiesce(false)
     , m_quiesce_state_id("")
+    , m_backup_id("")
+    , m_restore_id("")
     , m_shutdown(false)
+    , m_layout()
+    , m_chains()
+    , m_xfers()
 {
     reset();
 }
@@ -62,80 +70,70 @@ hyperdex :: configuration_parser :: ~configuration_parser() throw ()
 hyperdex::configuration
 hyperdex :: configuration_parser :: generate()
 {
-    std::vector<std::pair<spaceid, schema*> > space_ids_to_schemas;
-
-    // Create the "schema" objects that are needed for the attributes.
-    size_t attrs_sz = 0;
-
-    for (std::map<spaceid, std::vector<attribute> >::const_iterator ci = m_spaces.begin();
-            ci != m_spaces.end(); ++ci)
+    if (!m_layout)
     {
-        attrs_sz += ci->second.size();
-    }
+        std::map<spaceid, uint16_t> space_sizes;
 
-    space_ids_to_schemas.resize(m_spaces.size());
-    e::array_ptr<schema> schemas(new schema[m_spaces.size()]);
-    size_t schemas_sz(m_spaces.size());
-    e::array_ptr<attribute> attrs(new attribute[attrs_sz]);
-    size_t schema_idx = 0;
-    size_t attr_idx = 0;
+        for (std::set<subspaceid>::const_iterator ci = m_subspaces.begin();
+                ci != m_subspaces.end(); ++ci)
+        {
+            ++space_sizes[ci->get_space()];
+        }
 
-    for (std::map<spaceid, std::vector<attribute> >::const_iterator ci = m_spaces.begin();
-            ci != m_spaces.end(); ++ci)
-    {
-        space_ids_to_schemas[schema_idx].first = ci->first;
-        space_ids_to_schemas[schema_idx].second = &schemas[schema_idx];
-        schemas[schema_idx].attrs_sz = ci->second.size();
-        schemas[schema_idx].attrs = &attrs[attr_idx];
-        ++schema_idx;
+        std::map<subspaceid, hyperspacehashing::prefix::hasher> repl_hashers;
+        std::map<subspaceid, hyperspacehashing::mask::hasher> disk_hashers;
+        std::map<subspaceid, std::vector<bool> >::const_iterator ri;
+        std::map<subspaceid, std::vector<bool> >::const_iterator di;
 
-        for (size_t i = 0; i < ci->second.size(); ++i)
+        for (ri = m_repl_attrs.begin(); ri != m_repl_attrs.end(); ++ri)
         {
-            attrs[attr_idx] = ci->second[i];
-            ++attr_idx;
+            hyperspacehashing::prefix::hasher h(attrs_to_hashfuncs(ri->first, ri->second));
+            repl_hashers.insert(std::make_pair(ri->first, h));
         }
-    }
 
-    // Do the rest of the generation
-    std::vector<instance> hosts;
-    hosts.reserve(m_hosts.size());
+        for (di = m_disk_attrs.begin(); di != m_disk_attrs.end(); ++di)
+        {
+            hyperspacehashing::mask::hasher h(attrs_to_hashfuncs(di->first, di->second));
+            disk_hashers.insert(std::make_pair(di->first, h));
+        }
 
-    for (std::map<uint64_t, instance>::const_iterator ci = m_hosts.begin();
-            ci != m_hosts.end(); ++ci)
-    {
-        hosts.push_back(ci->second);
+        m_layout.reset(new configuration::layout(m_config.get(), m_config_sz,
+                                                 m_spaces, m_space_assignment,
+                                                 space_sizes, repl_hashers,
+                                                 disk_hashers));
     }
 
-    std::map<spaceid, uint16_t> space_sizes;
+    if (!m_chains)
+    {
+        m_chains.reset(new configuration::chains(m_regions));
+    }
 
-    for (std::set<subspaceid>::const_iterator ci = m_subspaces.begin();
-            ci != m_subspaces.end(); ++ci)
+    if (!m_xfers)
     {
-        ++space_sizes[ci->get_space()];
+        m_xfers.reset(new configuration::xfers(m_transfers));
     }
 
-    std::map<subspaceid, hyperspacehashing::prefix::hasher> repl_hashers;
-    std::map<subspaceid, hyperspacehashing::mask::hasher> disk_hashers;
-    std::map<subspaceid, std::vector<bool> >::const_iterator ri;
-    std::map<subspaceid, std::vector<bool> >::const_iterator di;
+    std::vector<instance> hosts;
+    std::string header;
+    hosts.reserve(m_hosts.size());
 
-    for (ri = m_repl_attrs.begin(); ri != m_repl_attrs.end(); ++ri)
+    for (std::map<uint64_t, instance>::const_iterator ci = m_hosts.begin();
+            ci != m_hosts.end(); ++ci)
     {
-        hyperspacehashing::prefix::hasher h(attrs_to_hashfuncs(ri->first, ri->second));
-        repl_hashers.insert(std::make_pair(ri->first, h));
+        hosts.push_back(ci->second);
+        header += m_host_lines[ci->first];
+        header += '\n';
     }
 
-    for (di = m_disk_attrs.begin(); di != m_disk_attrs.end(); ++di)
+    for (size_t i = 0; i < m_other_lines.size(); ++i)
     {
-        hyperspacehashing::mask::hasher h(attrs_to_hashfuncs(di->first, di->second));
-        disk_hashers.insert(std::make_pair(di->first, h));
+        header += m_other_lines[i];
+        header += '\n';
     }
 
-    return configuration(m_config, m_config_text.size() + 1, schemas, schemas_sz,
-                         attrs, attrs_sz, space_ids_to_schemas,
-                         m_config_text, m_version, hosts, m_space_assignment,
-                         space_sizes, m_entities, repl_hashers, disk_hashers,
-                         m_transfers, m_quiesce, m_quiesce_state_id, m_shutdown);
+    return configuration(m_layout, m_chains, m_xfers, header, m_version,
+                         hosts, m_quiesce, m_quiesce_state_id, m_backup_id,
+                         m_restore_id, m_shutdown);
 }
 
 #define _CONCAT(x,y) x ## y
@@ -153,7 +151,6 @@ hyperdex::configuration_parser::error
 hyperdex :: configuration_parser :: parse(const std::string& config)
 {
     reset();
-    m_config_text = config;
     m_config_sz = config.size() + 1;
     m_config = new char[m_config_sz];
     memmove(m_config.get(), config.c_str(), m_config_sz);
@@ -162,44 +159,7 @@ hyperdex :: configuration_parser :: parse(const std::string& config)
 
     while (eol)
     {
-        if (strncmp("version ", start, 8) == 0)
-        {
-            ABORT_ON_ERROR(parse_version(start, eol));
-        }
-        else if (strncmp("host ", start, 5) == 0)
-        {
-            ABORT_ON_ERROR(parse_host(start, eol));
-        }
-        else if (strncmp("space ", start, 6) == 0)
-        {
-            ABORT_ON_ERROR(parse_space(start, eol));
-        }
-        else if (strncmp("subspace ", start, 9) == 0)
-        {
-            ABORT_ON_ERROR(parse_subspace(start, eol));
-        }
-        else if (strncmp("region ", start, 7) == 0)
-        {
-            ABORT_ON_ERROR(parse_region(start, eol));
-        }
-        else if (strncmp("transfer ", start, 9) == 0)
-        {
-            ABORT_ON_ERROR(parse_transfer(start, eol));
-        }
-        else if (strncmp("quiesce ", start, 8) == 0)
-        {
-            ABORT_ON_ERROR(parse_quiesce(start, eol));
-        }
-        // shutdown has no space after (no args)
-        else if (strncmp("shutdown", start, 8) == 0)
-        {
-            ABORT_ON_ERROR(parse_shutdown(start, eol));
-        }
-        else
-        {
-            return CP_UNKNOWN_CMD;
-        }
-
+        ABORT_ON_ERROR(parse_line(start, eol));
         *eol = '\0';
         start = eol + 1;
         eol = strchr(start, '\n');
@@ -217,20 +177,204 @@ void
 hyperdex :: configuration_parser :: reset()
 {
     m_config = NULL;
-    m_config_text = std::string();
+    m_config_sz = 0;
     m_version = 0;
     m_hosts.clear();
+    m_host_lines.clear();
+    m_other_lines.clear();
     m_space_assignment.clear();
     m_spaces.clear();
     m_subspaces.clear();
     m_repl_attrs.clear();
     m_disk_attrs.clear();
     m_regions.clear();
-    m_entities.clear();
     m_transfers.clear();
     m_quiesce = false;
     m_quiesce_state_id = std::string();
+    m_backup_id = std::string();
+    m_restore_id = std::string();
     m_shutdown = false;
+    m_layout.reset();
+    m_chains.reset();
+    m_xfers.reset();
+}
+
+// The order in which lines of each kind must appear, so that every line
+// follows the lines it refers to.
+static size_t
+line_rank(const std::string& line)
+{
+    static const char* kinds[] = {"host ", "version ", "space ", "subspace ",
+                                  "region ", "transfer "};
+    static const size_t kinds_sz = sizeof(kinds) / sizeof(kinds[0]);
+
+    for (size_t i = 0; i < kinds_sz; ++i)
+    {
+        if (line.compare(0, strlen(kinds[i]), kinds[i]) == 0)
+        {
+            return i;
+        }
+    }
+
+    return kinds_sz;
+}
+
+hyperdex::configuration_parser::error
+hyperdex :: configuration_parser :: apply(const std::string& delta)
+{
+    std::vector<std::string> removed;
+    std::vector<std::string> added;
+    std::map<std::string, size_t> to_remove;
+    bool reshaped = false;
+    size_t start = 0;
+    size_t eol = delta.find('\n');
+
+    if (eol == std::string::npos || delta.compare(0, 6, "delta ") != 0)
+    {
+        return CP_BAD_DELTA;
+    }
+
+    std::string header(delta, 6, eol - 6);
+    char* end = NULL;
+    uint64_t base = strtoull(header.c_str(), &end, 10);
+
+    if (header.empty() || *end != '\0' || base != m_version)
+    {
+        return CP_BAD_DELTA;
+    }
+
+    for (start = eol + 1; (eol = delta.find('\n', start)) != std::string::npos; start = eol + 1)
+    {
+        std::string line(delta, start + 1, eol - start - 1);
+
+        if (eol == start || (delta[start] != '-' && delta[start] != '+'))
+        {
+            return CP_BAD_DELTA;
+        }
+
+        size_t rank = line_rank(line);
+        reshaped |= rank == line_rank("space ") || rank == line_rank("subspace ");
+
+        if (delta[start] == '-')
+        {
+            removed.push_back(line);
+            ++to_remove[line];
+        }
+        else
+        {
+            added.push_back(line);
+        }
+    }
+
+    if (start != delta.size())
+    {
+        return CP_BAD_DELTA;
+    }
+
+    std::vector<std::vector<std::string> > kinds(line_rank("") + 1);
+
+    // Schemas point into the text they were parsed from, so a new or removed
+    // space means parsing everything.  The new text is the lines we keep
+    // followed by the new ones, grouped by kind.  It parses to the same
+    // configuration as the coordinator's.
+    if (reshaped)
+    {
+        std::vector<std::string> kept;
+
+        for (std::map<uint64_t, std::string>::const_iterator h = m_host_lines.begin();
+                h != m_host_lines.end(); ++h)
+        {
+            kept.push_back(h->second);
+        }
+
+        kept.insert(kept.end(), m_other_lines.begin(), m_other_lines.end());
+
+        for (std::map<regionid, std::tr1::shared_ptr<const configuration::chain> >::const_iterator r = m_regions.begin();
+                r != m_regions.end(); ++r)
+        {
+            kept.push_back(r->second->line);
+        }
+
+        for (std::map<uint16_t, std::tr1::shared_ptr<const configuration::xfer> >::const_iterator t = m_transfers.begin();
+                t != m_transfers.end(); ++t)
+        {
+            kept.push_back(t->second->line);
+        }
+
+        for (size_t i = 0; i < kept.size(); ++i)
+        {
+            std::map<std::string, size_t>::iterator r = to_remove.find(kept[i]);
+
+            if (r != to_remove.end() && r->second > 0)
+            {
+                --r->second;
+                continue;
+            }
+
+            kinds[line_rank(kept[i])].push_back(kept[i]);
+        }
+
+        for (std::map<std::string, size_t>::iterator r = to_remove.begin();
+                r != to_remove.end(); ++r)
+        {
+            if (r->second > 0)
+            {
+                return CP_BAD_DELTA;
+            }
+        }
+
+        for (size_t i = 0; i < added.size(); ++i)
+        {
+            kinds[line_rank(added[i])].push_back(added[i]);
+        }
+
+        std::string text;
+
+        for (size_t i = 0; i < kinds.size(); ++i)
+        {
+            for (size_t j = 0; j < kinds[i].size(); ++j)
+            {
+                text += kinds[i][j];
+                text += '\n';
+            }
+        }
+
+        return parse(text);
+    }
+
+    // Otherwise touch only the pieces the delta names.  Apply the additions
+    // in the same order as the text, so that a region exists before any
+    // transfer that refers to it.
+    std::vector<std::string> ordered(removed);
+
+    for (size_t i = 0; i < added.size(); ++i)
+    {
+        kinds[line_rank(added[i])].push_back(added[i]);
+    }
+
+    for (size_t i = 0; i < kinds.size(); ++i)
+    {
+        ordered.insert(ordered.end(), kinds[i].begin(), kinds[i].end());
+    }
+
+    for (size_t i = 0; i < ordered.size(); ++i)
+    {
+        bool remove = i < removed.size();
+        const std::string& line(ordered[i]);
+        std::vector<char> buf(line.begin(), line.end());
+        buf.push_back('\n');
+        buf.push_back('\0');
+        error e = remove ? remove_line(&buf[0], &buf[0] + line.size())
+                         : parse_line(&buf[0], &buf[0] + line.size());
+
+        if (e != CP_SUCCESS)
+        {
+            reset();
+            return e;
+        }
+    }
+
+    return CP_SUCCESS;
 }
 
 #define SKIP_WHITESPACE(ptr, eol) \
@@ -245,6 +389,177 @@ hyperdex :: configuration_parser :: reset()
     *end = '\0'; \
     ABORT_ON_ERROR(extract(start, end, &store))
 
+hyperdex::configuration_parser::error
+hyperdex :: configuration_parser :: parse_line(char* start,
+                                               char* const eol)
+{
+    std::string line(start, eol);
+    error e;
+
+    if (strncmp("version ", start, 8) == 0)
+    {
+        e = parse_version(start, eol);
+    }
+    else if (strncmp("host ", start, 5) == 0)
+    {
+        return parse_host(line, start, eol);
+    }
+    else if (strncmp("space ", start, 6) == 0)
+    {
+        m_layout.reset();
+        e = parse_space(start, eol);
+    }
+    else if (strncmp("subspace ", start, 9) == 0)
+    {
+        m_layout.reset();
+        e = parse_subspace(start, eol);
+    }
+    else if (strncmp("region ", start, 7) == 0)
+    {
+        m_chains.reset();
+        return parse_region(line, start, eol);
+    }
+    else if (strncmp("transfer ", start, 9) == 0)
+    {
+        m_xfers.reset();
+        return parse_transfer(line, start, eol);
+    }
+    else if (strncmp("quiesce ", start, 8) == 0)
+    {
+        e = parse_quiesce(start, eol);
+    }
+    else if (strncmp("backup ", start, 7) == 0)
+    {
+        e = parse_backup(start, eol);
+    }
+    else if (strncmp("restore ", start, 8) == 0)
+    {
+        e = parse_restore(start, eol);
+    }
+    // shutdown has no space after (no args)
+    else if (strncmp("shutdown", start, 8) == 0)
+    {
+        e = parse_shutdown(start, eol);
+    }
+    else
+    {
+        return CP_UNKNOWN_CMD;
+    }
+
+    if (e == CP_SUCCESS)
+    {
+        m_other_lines.push_back(line);
+    }
+
+    return e;
+}
+
+hyperdex::configuration_parser::error
+hyperdex :: configuration_parser :: remove_line(char* start,
+                                                char* const eol)
+{
+    std::string line(start, eol);
+    char* end;
+
+    if (strncmp("host ", start, 5) == 0)
+    {
+        uint64_t id;
+        start += 5;
+        PARSE_TOKEN(extract_uint64_t, id);
+        std::map<uint64_t, std::string>::iterator hl = m_host_lines.find(id);
+
+        if (hl == m_host_lines.end() || hl->second != line)
+        {
+            return CP_BAD_DELTA;
+        }
+
+        m_hosts.erase(id);
+        m_host_lines.erase(hl);
+        return CP_SUCCESS;
+    }
+    else if (strncmp("region ", start, 7) == 0)
+    {
+        uint32_t space;
+        uint16_t subspace;
+        uint8_t prefix;
+        uint64_t mask;
+        start += 7;
+        PARSE_TOKEN(extract_uint32_t, space);
+        start = end + 1;
+        PARSE_TOKEN(extract_uint16_t, subspace);
+        start = end + 1;
+        PARSE_TOKEN(extract_uint8_t, prefix);
+        start = end + 1;
+        PARSE_TOKEN(extract_uint64_t, mask);
+        std::map<regionid, std::tr1::shared_ptr<const configuration::chain> >::iterator it;
+        it = m_regions.find(regionid(space, subspace, prefix, mask));
+
+        if (it == m_regions.end() || it->second->line != line)
+        {
+            return CP_BAD_DELTA;
+        }
+
+        m_regions.erase(it);
+        m_chains.reset();
+        return CP_SUCCESS;
+    }
+    else if (strncmp("transfer ", start, 9) == 0)
+    {
+        uint16_t xfer_id;
+        start += 9;
+        PARSE_TOKEN(extract_uint16_t, xfer_id);
+        std::map<uint16_t, std::tr1::shared_ptr<const configuration::xfer> >::iterator it;
+        it = m_transfers.find(xfer_id);
+
+        if (it == m_transfers.end() || it->second->line != line)
+        {
+            return CP_BAD_DELTA;
+        }
+
+        m_transfers.erase(it);
+        m_xfers.reset();
+        return CP_SUCCESS;
+    }
+
+    std::vector<std::string>::iterator other;
+    other = std::find(m_other_lines.begin(), m_other_lines.end(), line);
+
+    if (other == m_other_lines.end())
+    {
+        return CP_BAD_DELTA;
+    }
+
+    if (strncmp("version ", start, 8) == 0)
+    {
+        m_version = 0;
+    }
+    else if (strncmp("quiesce ", start, 8) == 0)
+    {
+        m_quiesce = false;
+        m_quiesce_state_id = std::string();
+    }
+    else if (strncmp("backup ", start, 7) == 0)
+    {
+        m_backup_id = std::string();
+    }
+    else if (strncmp("restore ", start, 8) == 0)
+    {
+        m_restore_id = std::string();
+    }
+    else if (strncmp("shutdown", start, 8) == 0)
+    {
+        m_shutdown = false;
+    }
+    else
+    {
+        // apply() parses from scratch when spaces change.
+        return CP_BAD_DELTA;
+    }
+
+    m_other_lines.erase(other);
+    return CP_SUCCESS;
+}
+
 hyperdex::configuration_parser::error
 hyperdex :: configuration_parser :: parse_version(char* start,
                                                   char* const eol)
@@ -274,7 +589,8 @@ hyperdex :: configuration_parser :: parse_version(char* start,
 }
 
 hyperdex::configuration_parser::error
-hyperdex :: configuration_parser :: parse_host(char* start,
+hyperdex :: configuration_parser :: parse_host(const std::string& line,
+                                               char* start,
                                                char* const eol)
 {
     char* end;
@@ -317,6 +633,7 @@ hyperdex :: configuration_parser :: parse_host(char* start,
     }
 
     m_hosts[id] = instance(ip, iport, iver, oport, over);
+    m_host_lines[id] = line;
     return CP_SUCCESS;
 }
 
@@ -496,7 +813,8 @@ hyperdex :: configuration_parser :: parse_subspace(char* start,
 }
 
 hyperdex::configuration_parser::error
-hyperdex :: configuration_parser :: parse_region(char* start,
+hyperdex :: configuration_parser :: parse_region(const std::string& line,
+                                                 char* start,
                                                  char* const eol)
 {
     char* end;
@@ -529,13 +847,14 @@ hyperdex :: configuration_parser :: parse_region(char* start,
         return CP_MISSING_SUBSPACE;
     }
 
-    if (m_regions.find(regionid(space, subspace, prefix, mask)) != m_regions.end())
+    regionid reg(space, subspace, prefix, mask);
+
+    if (m_regions.find(reg) != m_regions.end())
     {
         return CP_DUPE_REGION;
     }
 
-    m_regions.insert(regionid(space, subspace, prefix, mask));
-    uint8_t number = 0;
+    std::vector<instance> members;
 
     while (start < eol)
     {
@@ -543,8 +862,8 @@ hyperdex :: configuration_parser :: parse_region(char* start,
         PARSE_TOKEN(extract_uint64_t, id);
         start = end + 1;
 
-        if (m_entities.find(entityid(space, subspace, prefix, mask, number)) !=
-                m_entities.end())
+        // Entity numbers are a byte wide.
+        if (members.size() > UINT8_MAX)
         {
             return CP_DUPE_ENTITY;
         }
@@ -556,9 +875,7 @@ hyperdex :: configuration_parser :: parse_region(char* start,
             return CP_UNKNOWN_HOST;
         }
 
-        m_entities[entityid(space, subspace, prefix, mask, number)]
-            = host->second;
-        ++number;
+        members.push_back(host->second);
     }
 
     if (end != eol)
@@ -566,11 +883,13 @@ hyperdex :: configuration_parser :: parse_region(char* start,
         return CP_EXCESS_DATA;
     }
 
+    m_regions[reg].reset(new configuration::chain(line, members));
     return CP_SUCCESS;
 }
 
 hyperdex::configuration_parser::error
-hyperdex :: configuration_parser :: parse_transfer(char* start,
+hyperdex :: configuration_parser :: parse_transfer(const std::string& line,
+                                                   char* start,
                                                    char* const eol)
 {
     char* end;
@@ -604,8 +923,10 @@ hyperdex :: configuration_parser :: parse_transfer(char* start,
     start = end + 1;
 
     regionid reg(space, subspace, prefix, mask);
+    std::map<regionid, std::tr1::shared_ptr<const configuration::chain> >::const_iterator chain;
+    chain = m_regions.find(reg);
 
-    if (m_regions.find(reg) == m_regions.end())
+    if (chain == m_regions.end())
     {
         return CP_MISSING_REGION;
     }
@@ -615,14 +936,9 @@ hyperdex :: configuration_parser :: parse_transfer(char* start,
         return CP_EXCESS_DATA;
     }
 
-    std::map<std::pair<instance, uint16_t>, hyperdex::regionid>::iterator it;
-
-    for (it = m_transfers.begin(); it != m_transfers.end(); ++it)
+    if (m_transfers.find(xfer_id) != m_transfers.end())
     {
-        if (it->first.second == xfer_id)
-        {
-            return CP_DUPE_XFER;
-        }
+        return CP_DUPE_XFER;
     }
 
     std::map<uint64_t, instance>::iterator host;
@@ -633,26 +949,16 @@ hyperdex :: configuration_parser :: parse_transfer(char* start,
         return CP_UNKNOWN_HOST;
     }
 
-    size_t count = 0;
-    bool live = false;
-
-    for (std::map<entityid, instance>::iterator ent = m_entities.lower_bound(entityid(reg, 0));
-            ent != m_entities.upper_bound(entityid(reg, UINT8_MAX)); ++ent)
-    {
-        ++count;
-
-        if (ent->second == host->second)
-        {
-            live = true;
-        }
-    }
+    const std::vector<instance>& members(chain->second->members);
+    size_t count = members.size();
+    bool live = std::find(members.begin(), members.end(), host->second) != members.end();
 
     if (count < 1 + (live ? 1 : 0))
     {
         return CP_F_FAILURES;
     }
 
-    m_transfers.insert(std::make_pair(std::make_pair(host->second, xfer_id), reg));
+    m_transfers[xfer_id].reset(new configuration::xfer(line, reg, host->second));
     return CP_SUCCESS;
 }
 
@@ -685,6 +991,52 @@ hyperdex :: configuration_parser :: parse_quiesce(char* start,
     return CP_SUCCESS;
 }
 
+hyperdex::configuration_parser::error 
+hyperdex :: configuration_parser :: parse_backup(char* start,
+                                                 char* const eol)
+{
+    char* end;
+    char* backup_id;
+
+    // Skip "backup "
+    start += 7;
+
+    // Pull out the backup id
+    PARSE_TOKEN(extract_cstring, backup_id);
+    start = end + 1;
+
+    if (end != eol)
+    {
+        return CP_EXCESS_DATA;
+    }
+
+    m_backup_id = backup_id;
+    return CP_SUCCESS;
+}
+
+hyperdex::configuration_parser::error 
+hyperdex :: configuration_parser :: parse_restore(char* start,
+                                                  char* const eol)
+{
+    char* end;
+    char* restore_id;
+
+    // Skip "restore "
+    start += 8;
+
+    // Pull out the backup id
+    PARSE_TOKEN(extract_cstring, restore_id);
+    start = end + 1;
+
+    if (end != eol)
+    {
+        return CP_EXCESS_DATA;
+    }
+
+    m_restore_id = restore_id;
+    return CP_SUCCESS;
+}
+
 hyperdex::configuration_parser::error 
 hyperdex :: configuration_parser :: parse_shutdown(char* start,
                                                    char* const eol)
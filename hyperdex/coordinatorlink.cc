@@ -44,6 +44,7 @@ hyperdex :: coordinatorlink :: coordinatorlink(const po6::net::hostname& coordin
     , m_announce()
     , m_acknowledged(true)
     , m_config()
+    , m_parser()
     , m_sock()
     , m_buffer()
     , m_reported_failures()
@@ -139,6 +140,41 @@ hyperdex :: coordinatorlink :: transfer_complete(uint16_t xfer_id)
     return send_to_coordinator(ostr.str().c_str(), ostr.str().size());
 }
 
+hyperdex::coordinatorlink::returncode
+hyperdex :: coordinatorlink :: transfer_progress(uint16_t xfer_id,
+                                                 uint64_t objects,
+                                                 uint64_t bytes)
+{
+    po6::threads::mutex::hold hold(&m_lock);
+    std::ostringstream ostr;
+    ostr << "transfer_progress\t" << xfer_id << "\t" << objects << "\t" << bytes << "\n";
+    return send_to_coordinator(ostr.str().c_str(), ostr.str().size());
+}
+
+hyperdex::coordinatorlink::returncode
+hyperdex :: coordinatorlink :: region_load(const regionid& ri,
+                                           uint64_t ops,
+                                           uint64_t bytes,
+                                           uint64_t millis)
+{
+    po6::threads::mutex::hold hold(&m_lock);
+    std::ostringstream ostr;
+    ostr << "region_load\t" << ri.space << "\t" << ri.subspace
+         << "\t" << static_cast<unsigned int>(ri.prefix) << "\t" << ri.mask
+         << "\t" << ops << "\t" << bytes << "\t" << millis << "\n";
+    return send_to_coordinator(ostr.str().c_str(), ostr.str().size());
+}
+
+hyperdex::coordinatorlink::returncode
+hyperdex :: coordinatorlink :: inherit_fail(const regionid& ri)
+{
+    po6::threads::mutex::hold hold(&m_lock);
+    std::ostringstream ostr;
+    ostr << "inherit_fail\t" << ri.space << "\t" << ri.subspace
+         << "\t" << static_cast<unsigned int>(ri.prefix) << "\t" << ri.mask << "\n";
+    return send_to_coordinator(ostr.str().c_str(), ostr.str().size());
+}
+
 int
 hyperdex :: coordinatorlink :: poll_on()
 {
@@ -154,6 +190,44 @@ hyperdex :: coordinatorlink :: quiesced(const std::string& quiesce_state_id)
     return send_to_coordinator(ostr.str().c_str(), ostr.str().size());
 }
 
+hyperdex::coordinatorlink::returncode
+hyperdex :: coordinatorlink :: backup_done(const std::string& backup_id,
+                                           const regionid& ri,
+                                           uint64_t objects,
+                                           uint64_t watermark)
+{
+    po6::threads::mutex::hold hold(&m_lock);
+    std::ostringstream ostr;
+    ostr << "backup_done\t" << backup_id << "\t" << ri.space << "\t" << ri.subspace
+         << "\t" << static_cast<unsigned int>(ri.prefix) << "\t" << ri.mask
+         << "\t" << objects << "\t" << watermark << "\n";
+    return send_to_coordinator(ostr.str().c_str(), ostr.str().size());
+}
+
+hyperdex::coordinatorlink::returncode
+hyperdex :: coordinatorlink :: restore_done(const std::string& backup_id,
+                                            const regionid& ri,
+                                            uint64_t objects)
+{
+    po6::threads::mutex::hold hold(&m_lock);
+    std::ostringstream ostr;
+    ostr << "restore_done\t" << backup_id << "\t" << ri.space << "\t" << ri.subspace
+         << "\t" << static_cast<unsigned int>(ri.prefix) << "\t" << ri.mask
+         << "\t" << objects << "\n";
+    return send_to_coordinator(ostr.str().c_str(), ostr.str().size());
+}
+
+hyperdex::coordinatorlink::returncode
+hyperdex :: coordinatorlink :: restore_fail(const std::string& backup_id,
+                                            const regionid& ri)
+{
+    po6::threads::mutex::hold hold(&m_lock);
+    std::ostringstream ostr;
+    ostr << "restore_fail\t" << backup_id << "\t" << ri.space << "\t" << ri.subspace
+         << "\t" << static_cast<unsigned int>(ri.prefix) << "\t" << ri.mask << "\n";
+    return send_to_coordinator(ostr.str().c_str(), ostr.str().size());
+}
+
 hyperdex::coordinatorlink::returncode
 hyperdex :: coordinatorlink :: poll(int connect_attempts, int timeout)
 {
@@ -234,15 +308,22 @@ hyperdex :: coordinatorlink :: poll(int connect_attempts, int timeout)
             std::string configtext = m_buffer.substr(0, index);
             m_buffer = m_buffer.substr(index + 12);
 
-            // Parse the config
-            configuration_parser cp;
+            // Parse the config, or apply the delta to the last one.
             configuration_parser::error e;
-            e = cp.parse(configtext);
+
+            if (configtext.compare(0, 6, "delta ") == 0)
+            {
+                e = m_parser.apply(configtext);
+            }
+            else
+            {
+                e = m_parser.parse(configtext);
+            }
 
             if (e == configuration_parser::CP_SUCCESS)
             {
                 m_acknowledged = false;
-                m_config = cp.generate();
+                m_config = m_parser.generate();
 
                 if (!m_config.shutdown())
                 {
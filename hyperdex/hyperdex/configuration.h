@@ -31,7 +31,10 @@
 // STL
 #include <map>
 #include <set>
+#include <string>
 #include <tr1/functional>
+#include <tr1/memory>
+#include <vector>
 
 // po6
 #include <po6/net/location.h>
@@ -59,22 +62,31 @@ class configuration
         const static uint32_t CLIENTSPACE;
         const static uint32_t TRANSFERSPACE;
 
+    // A configuration is a handle on one immutable state, so copying it
+    // costs a reference count and old copies stay valid after a new version
+    // is installed.  The bulk of the state lives in three immutable parts,
+    // which later versions that leave them alone share.  Chains and
+    // transfers are in turn made of one immutable piece per line, so a new
+    // version rebuilds only the pieces whose lines changed.
+    public:
+        class layout;
+        class chain;
+        class chains;
+        class xfer;
+        class xfers;
+        class state;
+
     public:
         configuration();
-        configuration(e::array_ptr<char> config, size_t config_sz,
-                      e::array_ptr<schema> schemas, size_t schemas_sz,
-                      e::array_ptr<attribute> attributes, size_t attributes_sz,
-                      const std::vector<std::pair<spaceid, schema*> > space_ids_to_schemas,
-                      const std::string& config_text,
+        configuration(std::tr1::shared_ptr<const layout> l,
+                      std::tr1::shared_ptr<const chains> c,
+                      std::tr1::shared_ptr<const xfers> x,
+                      const std::string& header_text,
                       uint64_t version,
                       const std::vector<instance>& hosts,
-                      const std::map<std::string, spaceid>& space_assignment,
-                      const std::map<spaceid, uint16_t>& space_sizes,
-                      const std::map<entityid, instance>& entities,
-                      const std::map<subspaceid, hyperspacehashing::prefix::hasher>& repl_hashers,
-                      const std::map<subspaceid, hyperspacehashing::mask::hasher>& disk_hashers,
-                      const std::map<std::pair<instance, uint16_t>, hyperdex::regionid>& transfers,
                       bool quiesce, const std::string& quiesce_state_id,
+                      const std::string& backup_id,
+                      const std::string& restore_id,
                       bool shutdown);
         configuration(const configuration& other);
         ~configuration() throw ();
@@ -85,13 +97,14 @@ class configuration
 
     // XXX API IN JEOPARDY
 
-    // The original config text
+    // The config text.  It parses to this configuration, but its lines may
+    // be in a different order than the coordinator's.
     public:
-        std::string config_text() const { return m_config_text; }
+        std::string config_text() const;
 
     // The version of this config
     public:
-        uint64_t version() const { return m_version; }
+        uint64_t version() const;
 
     // Data-layout (not hashing)
     public:
@@ -107,6 +120,13 @@ class configuration
         // Sets the port versions to the match the given IP/ports, or 0 if there
         // is no instance with the given IP/ports
         void instance_versions(instance* i) const;
+        // Every entity in the configuration has a number, which is its
+        // region's index in the sorted regions followed by a byte holding the
+        // entity's own number.  The numbering is a pure function of the
+        // configuration, so two hosts on the same version agree on it without
+        // any negotiation.
+        bool entity_number(const entityid& e, uint32_t* num) const;
+        bool entity_by_number(uint32_t num, entityid* e) const;
         // The set of regions to which an instance is assigned
         std::set<regionid> regions_for(const instance& i) const;
         // Return the containing entity (number is preserved).
@@ -146,55 +166,177 @@ class configuration
         uint16_t transfer_id(const regionid& reg) const;
         std::map<uint16_t, regionid> transfers_to(const instance& inst) const;
         std::map<uint16_t, regionid> transfers_from(const instance& inst) const;
-        
+
+    // Sharing
+    public:
+        // The pieces behind one region's chain and one transfer, or NULL.
+        // Versions that leave the line alone hold the very same piece.
+        const chain* chain_piece(const regionid& r) const;
+        const xfer* xfer_piece(uint16_t xfer_id) const;
+
     // Quesce and Shutdown
     public:
         bool quiesce() const;
         std::string quiesce_state_id() const;
         bool shutdown() const;
 
+    // Online backup and restore
+    public:
+        // Empty unless the coordinator asked the tail of each region to
+        // archive it under this id.
+        std::string backup_id() const;
+        // Empty unless the coordinator asked every replica to load its
+        // regions from the archives taken under this id.
+        std::string restore_id() const;
+
     // Copying
     public:
         configuration& operator = (const configuration& rhs);
 
     private:
-        void copy(const configuration& rhs, configuration* to);
-        std::map<entityid, instance> _search_entities(std::map<entityid, instance>::const_iterator start,
-                                                      std::map<entityid, instance>::const_iterator end,
+        typedef std::map<regionid, std::tr1::shared_ptr<const chain> > chain_map;
+        std::map<entityid, instance> _search_entities(chain_map::const_iterator start,
+                                                      chain_map::const_iterator end,
                                                       const hyperspacehashing::search& s) const;
+        const chain* _chainof(const regionid& r) const;
 
     private:
-        e::array_ptr<char> m_config;
-        size_t m_config_sz;
-        e::array_ptr<schema> m_schemas;
-        size_t m_schemas_sz;
-        e::array_ptr<attribute> m_attributes;
-        size_t m_attributes_sz;
-        std::vector<std::pair<spaceid, schema*> > m_space_ids_to_schemas;
-
-
-        // XXX Slim these down.  there is too much redundancy, and the use of
-        // "map" everywhere nearly guarantees it will be slow.
-        std::string m_config_text;
-        uint64_t m_version;
-        std::vector<instance> m_hosts;
-        std::map<std::string, spaceid> m_space_assignment;
+        std::tr1::shared_ptr<const state> m_state;
+};
+
+// Everything that makes up one version of the configuration.
+class configuration::state
+{
+    public:
+        state();
+        ~state() throw ();
+
+    public:
+        std::tr1::shared_ptr<const configuration::layout> layout;
+        std::tr1::shared_ptr<const configuration::chains> chains;
+        std::tr1::shared_ptr<const configuration::xfers> xfers;
+        // The lines of the config text that precede the regions.
+        std::string header_text;
+        uint64_t version;
+        std::vector<instance> hosts;
+        // Quiesce and shutdown.
+        bool quiesce;
+        std::string quiesce_state_id;
+        bool shutdown;
+        std::string backup_id;
+        std::string restore_id;
+
+    private:
+        state(const state&);
+        state& operator = (const state&);
+};
+
+// The spaces, their schemas, and their hashers.  Only adding or removing a
+// space changes these.
+class configuration::layout
+{
+    public:
+        layout();
+        // Attribute names must point into "config", which is copied.
+        layout(const char* config, size_t config_sz,
+               const std::map<spaceid, std::vector<attribute> >& spaces,
+               const std::map<std::string, spaceid>& space_assignment,
+               const std::map<spaceid, uint16_t>& space_sizes,
+               const std::map<subspaceid, hyperspacehashing::prefix::hasher>& repl_hashers,
+               const std::map<subspaceid, hyperspacehashing::mask::hasher>& disk_hashers);
+        ~layout() throw ();
+
+    public:
+        e::array_ptr<char> config;
+        size_t config_sz;
+        e::array_ptr<attribute> attributes;
+        size_t attributes_sz;
+        e::array_ptr<schema> schemas;
+        size_t schemas_sz;
+        std::vector<std::pair<spaceid, schema*> > space_ids_to_schemas;
+        std::map<std::string, spaceid> space_assignment;
         // The number of subspaces in the space.
-        std::map<spaceid, uint16_t> m_space_sizes;
-        // Map an entity id onto the hyperdex instance.
-        std::map<entityid, instance> m_entities;
+        std::map<spaceid, uint16_t> space_sizes;
         // Hash-calculating objects that work for the replication layer.
-        std::map<subspaceid, hyperspacehashing::prefix::hasher> m_repl_hashers;
+        std::map<subspaceid, hyperspacehashing::prefix::hasher> repl_hashers;
         // Hash-calculating objects that work for the disk layer.
-        std::map<subspaceid, hyperspacehashing::mask::hasher> m_disk_hashers;
-        // Transfers specified in the config.
-        std::map<std::pair<instance, uint16_t>, hyperdex::regionid> m_transfers;
-        // Transfers by number.
-        std::vector<instance> m_transfers_by_num;
-        // Quiesce and shutdown.
-        bool m_quiesce;
-        std::string m_quiesce_state_id;
-        bool m_shutdown;
+        std::map<subspaceid, hyperspacehashing::mask::hasher> disk_hashers;
+
+    private:
+        layout(const layout&);
+        layout& operator = (const layout&);
+};
+
+// The chain of one region, from head to tail.  An entity's number is its
+// index in the chain.
+class configuration::chain
+{
+    public:
+        chain(const std::string& line, const std::vector<instance>& members);
+        ~chain() throw ();
+
+    public:
+        // The "region" line this chain was parsed from.
+        std::string line;
+        std::vector<instance> members;
+
+    private:
+        chain(const chain&);
+        chain& operator = (const chain&);
+};
+
+// The chain of every region.
+class configuration::chains
+{
+    public:
+        chains();
+        chains(const std::map<regionid, std::tr1::shared_ptr<const chain> >& regions);
+        ~chains() throw ();
+
+    public:
+        std::map<regionid, std::tr1::shared_ptr<const chain> > regions;
+        // The keys of regions in order; a region's index gives the high bits
+        // of its entities' numbers.
+        std::vector<regionid> by_num;
+
+    private:
+        chains(const chains&);
+        chains& operator = (const chains&);
+};
+
+// One transfer specified in the config.
+class configuration::xfer
+{
+    public:
+        xfer(const std::string& line, const regionid& region, const instance& dest);
+        ~xfer() throw ();
+
+    public:
+        // The "transfer" line this was parsed from.
+        std::string line;
+        regionid region;
+        // The recipient of the transfer.
+        instance dest;
+
+    private:
+        xfer(const xfer&);
+        xfer& operator = (const xfer&);
+};
+
+// Transfers specified in the config, by transfer id.
+class configuration::xfers
+{
+    public:
+        xfers();
+        xfers(const std::map<uint16_t, std::tr1::shared_ptr<const xfer> >& transfers);
+        ~xfers() throw ();
+
+    public:
+        std::map<uint16_t, std::tr1::shared_ptr<const xfer> > transfers;
+
+    private:
+        xfers(const xfers&);
+        xfers& operator = (const xfers&);
 };
 
 inline std::ostream&
@@ -74,6 +74,7 @@ class configuration_parser
             CP_BAD_UINT8,
             CP_BAD_ATTR_CHOICE,
             CP_BAD_TYPE,
+            CP_BAD_DELTA,
             EOE
         };
 
@@ -82,25 +83,43 @@ class configuration_parser
         ~configuration_parser() throw ();
 
     public:
+        // Only the parts of the configuration that changed since the last
+        // call are built anew.  The rest is shared with earlier results.
         configuration generate();
         error parse(const std::string& config);
+        // Update the last configuration parsed with a delta.  A delta is a
+        // line "delta <version>" naming the version it applies to, followed
+        // by "-<line>" for each line removed and "+<line>" for each line
+        // added.  On error the parser must be given a full configuration.
+        error apply(const std::string& delta);
 
     private:
         void reset();
+        error parse_line(char* start,
+                         char* const eol);
+        error remove_line(char* start,
+                          char* const eol);
         error parse_version(char* start,
                             char* const eol);
-        error parse_host(char* start,
+        error parse_host(const std::string& line,
+                         char* start,
                          char* const eol);
         error parse_space(char* start,
                           char* const eol);
         error parse_subspace(char* start,
                              char* const eol);
-        error parse_region(char* start,
+        error parse_region(const std::string& line,
+                           char* start,
                            char* const eol);
-        error parse_transfer(char* start,
+        error parse_transfer(const std::string& line,
+                             char* start,
                              char* const eol);
         error parse_quiesce(char* start,
                             char* const eol);
+        error parse_backup(char* start,
+                           char* const eol);
+        error parse_restore(char* start,
+                            char* const eol);
         error parse_shutdown(char* start,
                              char* const eol);
         error extract_bool(char* start,
@@ -141,20 +160,32 @@ class configuration_parser
 
 
         // XXX Much of this can be simplified
-        std::string m_config_text;
         uint64_t m_version;
         std::map<uint64_t, instance> m_hosts;
+        std::map<uint64_t, std::string> m_host_lines;
+        // The lines that are not hosts, regions, or transfers, in the order
+        // they were given.
+        std::vector<std::string> m_other_lines;
         std::map<std::string, spaceid> m_space_assignment;
         std::map<spaceid, std::vector<attribute> > m_spaces;
         std::set<subspaceid> m_subspaces;
         std::map<subspaceid, std::vector<bool> > m_repl_attrs;
         std::map<subspaceid, std::vector<bool> > m_disk_attrs;
-        std::set<regionid> m_regions;
-        std::map<entityid, instance> m_entities;
-        std::map<std::pair<instance, uint16_t>, hyperdex::regionid> m_transfers;
+        // One piece per region or transfer line.  A changed line replaces
+        // its own piece, and the rest stay shared with earlier results.
+        std::map<regionid, std::tr1::shared_ptr<const configuration::chain> > m_regions;
+        std::map<uint16_t, std::tr1::shared_ptr<const configuration::xfer> > m_transfers;
         bool m_quiesce;
         std::string m_quiesce_state_id;
+        std::string m_backup_id;
+        std::string m_restore_id;
         bool m_shutdown;
+        // What generate() built last, until the lines behind them change.
+        // Rebuilding chains or xfers copies the maps of pieces above, not
+        // the pieces.
+        std::tr1::shared_ptr<const configuration::layout> m_layout;
+        std::tr1::shared_ptr<const configuration::chains> m_chains;
+        std::tr1::shared_ptr<const configuration::xfers> m_xfers;
 };
 
 } // namespace hyperdex
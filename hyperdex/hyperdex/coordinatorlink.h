@@ -42,6 +42,7 @@
 
 // HyperDex
 #include "hyperdex/hyperdex/configuration.h"
+#include "hyperdex/hyperdex/configuration_parser.h"
 
 namespace hyperdex
 {
@@ -65,6 +66,8 @@ class coordinatorlink
     public:
         bool unacknowledged();
         returncode acknowledge();
+        // A snapshot of the most recent configuration.  It shares state with
+        // the link's copy, so take it once and pass it around.
         hyperdex::configuration config();
 
     // Interact with the coordinator
@@ -75,7 +78,24 @@ class coordinatorlink
         returncode transfer_fail(uint16_t xfer_id);
         returncode transfer_golive(uint16_t xfer_id);
         returncode transfer_complete(uint16_t xfer_id);
+        returncode transfer_progress(uint16_t xfer_id, uint64_t objects, uint64_t bytes);
+        // Report the operations and bytes served for a region over the last
+        // "millis" milliseconds.
+        returncode region_load(const regionid& ri, uint64_t ops, uint64_t bytes, uint64_t millis);
+        // Report that the region, new from a split or merge, could not take
+        // its objects from the regions it replaced, and serves nothing.
+        returncode inherit_fail(const regionid& ri);
         returncode quiesced(const std::string& quiesce_state_id);
+        // Report that the region was archived under "backup_id".  The
+        // watermark is the highest version in the archive.
+        returncode backup_done(const std::string& backup_id, const regionid& ri,
+                               uint64_t objects, uint64_t watermark);
+        // Report that the region was loaded from the archive "backup_id".
+        returncode restore_done(const std::string& backup_id, const regionid& ri,
+                                uint64_t objects);
+        // Report that the region holds data, so it cannot be restored from
+        // the archive "backup_id".
+        returncode restore_fail(const std::string& backup_id, const regionid& ri);
 
     // Do network I/O
     public:
@@ -111,6 +131,9 @@ class coordinatorlink
         std::string m_announce;
         bool m_acknowledged;
         configuration m_config;
+        // Holds the last configuration received, so the coordinator can
+        // send deltas against it.
+        configuration_parser m_parser;
         po6::net::socket m_sock;
         std::string m_buffer;
         std::set<po6::net::location> m_reported_failures;
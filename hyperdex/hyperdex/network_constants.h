@@ -45,7 +45,15 @@ enum network_returncode
     NET_CMPFAIL     = 8325,
     NET_BADMICROS   = 8326,
     NET_READONLY    = 8327,
-    NET_OVERFLOW    = 8328
+    NET_OVERFLOW    = 8328,
+    NET_OVERLOADED  = 8329
+};
+
+// Clients have no use for the "number" field of their entityid, so they use it
+// to carry per-request flags to the daemon.
+enum network_clientflags
+{
+    CLIENT_PRIORITY = 1
 };
 
 enum network_msgtype
@@ -80,7 +88,11 @@ enum network_msgtype
     XFER_MORE       = 96,
     XFER_DATA       = 97,
     XFER_DONE       = 98,
+    XFER_BULK       = 99,
 
+    PACKET_CLIENT_COMPACT   = 251,
+    PACKET_COMPACT  = 252,
+    PACKET_BATCH    = 253,
     CONFIGMISMATCH  = 254,
     PACKET_NOP      = 255
 };
@@ -117,6 +129,10 @@ operator << (std::ostream& lhs, const network_msgtype& rhs)
         stringify(XFER_MORE);
         stringify(XFER_DATA);
         stringify(XFER_DONE);
+        stringify(XFER_BULK);
+        stringify(PACKET_CLIENT_COMPACT);
+        stringify(PACKET_COMPACT);
+        stringify(PACKET_BATCH);
         stringify(CONFIGMISMATCH);
         stringify(PACKET_NOP);
         default:
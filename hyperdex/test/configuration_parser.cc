@@ -0,0 +1,196 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// STL
+#include <algorithm>
+#include <sstream>
+
+// Google Test
+#include <gtest/gtest.h>
+
+// HyperDex
+#include "hyperdex/hyperdex/configuration_parser.h"
+
+#pragma GCC diagnostic ignored "-Wswitch-default"
+
+using hyperdex::configuration;
+using hyperdex::configuration_parser;
+using hyperdex::regionid;
+
+namespace
+{
+
+const char* BASE =
+    "host 1 127.0.0.1 2000 1 2001 1\n"
+    "host 2 127.0.0.1 2002 1 2003 1\n"
+    "host 3 127.0.0.1 2004 1 2005 1\n"
+    "version 1\n"
+    "space kv 1 k string v string\n"
+    "subspace 1 0 true true false false\n"
+    "subspace 1 1 false false true true\n"
+    "region 1 0 1 0 1 2\n"
+    "region 1 0 1 9223372036854775808 2 3\n"
+    "region 1 1 0 0 1 3\n"
+    "transfer 1 1 1 0 0 2\n"
+    "transfer 3 1 0 1 9223372036854775808 1\n";
+
+// BASE with one chain and one transfer replaced.
+const char* NEXT =
+    "host 1 127.0.0.1 2000 1 2001 1\n"
+    "host 2 127.0.0.1 2002 1 2003 1\n"
+    "host 3 127.0.0.1 2004 1 2005 1\n"
+    "version 2\n"
+    "space kv 1 k string v string\n"
+    "subspace 1 0 true true false false\n"
+    "subspace 1 1 false false true true\n"
+    "region 1 0 1 0 1 3\n"
+    "region 1 0 1 9223372036854775808 2 3\n"
+    "region 1 1 0 0 1 3\n"
+    "transfer 2 1 1 0 0 2\n"
+    "transfer 3 1 0 1 9223372036854775808 1\n";
+
+// Takes BASE to NEXT.
+const char* DELTA =
+    "delta 1\n"
+    "-version 1\n"
+    "+version 2\n"
+    "-region 1 0 1 0 1 2\n"
+    "+region 1 0 1 0 1 3\n"
+    "-transfer 1 1 1 0 0 2\n"
+    "+transfer 2 1 1 0 0 2\n";
+
+const regionid CHANGED(1, 0, 1, 0);
+const regionid UNCHANGED(1, 0, 1, 9223372036854775808ULL);
+
+// The lines of a config text, which need not be in the coordinator's order.
+std::vector<std::string>
+lines(const std::string& text)
+{
+    std::vector<std::string> ret;
+    std::istringstream istr(text);
+    std::string line;
+
+    while (std::getline(istr, line))
+    {
+        ret.push_back(line);
+    }
+
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+TEST(ConfigurationParserTest, DeltaMatchesFullParse)
+{
+    configuration_parser full;
+    ASSERT_EQ(configuration_parser::CP_SUCCESS, full.parse(NEXT));
+    configuration expected = full.generate();
+
+    configuration_parser cp;
+    ASSERT_EQ(configuration_parser::CP_SUCCESS, cp.parse(BASE));
+    ASSERT_EQ(1U, cp.generate().version());
+    ASSERT_EQ(configuration_parser::CP_SUCCESS, cp.apply(DELTA));
+    configuration applied = cp.generate();
+
+    ASSERT_EQ(2U, applied.version());
+    ASSERT_TRUE(lines(expected.config_text()) == lines(applied.config_text()));
+    ASSERT_EQ(expected.headof(CHANGED), applied.headof(CHANGED));
+    ASSERT_EQ(expected.tailof(CHANGED), applied.tailof(CHANGED));
+    ASSERT_EQ(expected.instancefor(expected.tailof(CHANGED)),
+              applied.instancefor(applied.tailof(CHANGED)));
+    ASSERT_EQ(expected.transfer_id(CHANGED), applied.transfer_id(CHANGED));
+    ASSERT_EQ(expected.transfer_id(UNCHANGED), applied.transfer_id(UNCHANGED));
+    ASSERT_TRUE(expected.regions_for(expected.instancefor(expected.headof(CHANGED))) ==
+                applied.regions_for(applied.instancefor(applied.headof(CHANGED))));
+}
+
+TEST(ConfigurationParserTest, DeltaOnWrongBase)
+{
+    configuration_parser cp;
+    ASSERT_EQ(configuration_parser::CP_SUCCESS, cp.parse(NEXT));
+    ASSERT_EQ(configuration_parser::CP_BAD_DELTA, cp.apply(DELTA));
+
+    configuration_parser other;
+    ASSERT_EQ(configuration_parser::CP_SUCCESS, other.parse(BASE));
+    ASSERT_EQ(configuration_parser::CP_BAD_DELTA, other.apply("delta 0\n+version 2\n"));
+    ASSERT_EQ(configuration_parser::CP_BAD_DELTA, other.apply("delta 1x\n"));
+    ASSERT_EQ(configuration_parser::CP_BAD_DELTA, other.apply("version 2\n"));
+}
+
+TEST(ConfigurationParserTest, DeltaRemovesMissingLine)
+{
+    // A region that does not exist.
+    configuration_parser a;
+    ASSERT_EQ(configuration_parser::CP_SUCCESS, a.parse(BASE));
+    ASSERT_EQ(configuration_parser::CP_BAD_DELTA, a.apply("delta 1\n-region 1 1 1 0 1 3\n"));
+
+    // A region that exists, with a different chain.
+    configuration_parser b;
+    ASSERT_EQ(configuration_parser::CP_SUCCESS, b.parse(BASE));
+    ASSERT_EQ(configuration_parser::CP_BAD_DELTA, b.apply("delta 1\n-region 1 1 0 0 3 1\n"));
+
+    // A transfer, a host and another line that are not there.
+    configuration_parser c;
+    ASSERT_EQ(configuration_parser::CP_SUCCESS, c.parse(BASE));
+    ASSERT_EQ(configuration_parser::CP_BAD_DELTA, c.apply("delta 1\n-transfer 9 1 1 0 0 2\n"));
+    configuration_parser d;
+    ASSERT_EQ(configuration_parser::CP_SUCCESS, d.parse(BASE));
+    ASSERT_EQ(configuration_parser::CP_BAD_DELTA, d.apply("delta 1\n-host 4 127.0.0.1 2006 1 2007 1\n"));
+    configuration_parser e;
+    ASSERT_EQ(configuration_parser::CP_SUCCESS, e.parse(BASE));
+    ASSERT_EQ(configuration_parser::CP_BAD_DELTA, e.apply("delta 1\n-backup nightly\n"));
+}
+
+TEST(ConfigurationParserTest, UnchangedPiecesAreShared)
+{
+    configuration_parser cp;
+    ASSERT_EQ(configuration_parser::CP_SUCCESS, cp.parse(BASE));
+    configuration before = cp.generate();
+    ASSERT_EQ(configuration_parser::CP_SUCCESS, cp.apply(DELTA));
+    configuration after = cp.generate();
+
+    ASSERT_TRUE(before.chain_piece(UNCHANGED) != NULL);
+    ASSERT_EQ(before.chain_piece(UNCHANGED), after.chain_piece(UNCHANGED));
+    ASSERT_EQ(before.chain_piece(regionid(1, 1, 0, 0)), after.chain_piece(regionid(1, 1, 0, 0)));
+    ASSERT_TRUE(before.xfer_piece(3) != NULL);
+    ASSERT_EQ(before.xfer_piece(3), after.xfer_piece(3));
+
+    // The replaced lines have new pieces, and the old version keeps its own.
+    ASSERT_NE(before.chain_piece(CHANGED), after.chain_piece(CHANGED));
+    ASSERT_EQ("region 1 0 1 0 1 2", before.chain_piece(CHANGED)->line);
+    ASSERT_EQ("region 1 0 1 0 1 3", after.chain_piece(CHANGED)->line);
+    ASSERT_TRUE(before.xfer_piece(1) != NULL);
+    ASSERT_TRUE(after.xfer_piece(1) == NULL);
+    ASSERT_TRUE(before.xfer_piece(2) == NULL);
+    ASSERT_TRUE(after.xfer_piece(2) != NULL);
+
+    // A full parse of the same text shares nothing with earlier versions.
+    configuration_parser fresh;
+    ASSERT_EQ(configuration_parser::CP_SUCCESS, fresh.parse(NEXT));
+    ASSERT_NE(after.chain_piece(UNCHANGED), fresh.generate().chain_piece(UNCHANGED));
+}
+
+} // namespace
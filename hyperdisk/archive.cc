@@ -0,0 +1,394 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <cstdio>
+#include <cstring>
+
+// POSIX
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// STL
+#include <algorithm>
+
+// zlib
+#include <zlib.h>
+
+// e
+#include <e/endian.h>
+
+// Google CityHash
+#include <city.h>
+
+// HyperDisk
+#include "hyperdisk/hyperdisk/archive.h"
+
+const uint64_t hyperdisk :: archive_writer :: MAGIC = 0x485944584241434bULL; // "HYDXBACK"
+const uint32_t hyperdisk :: archive_writer :: FORMAT = 1;
+
+// Blocks are cut once they grow past this many uncompressed bytes.  The reader
+// refuses blocks larger than MAX_BLOCK_BYTES rather than trust a corrupt size.
+static const size_t BLOCK_BYTES = 1024 * 1024;
+static const size_t MAX_BLOCK_BYTES = 1024 * 1024 * 1024;
+static const size_t BLOCK_HEADER_BYTES = 2 * sizeof(uint32_t) + sizeof(uint64_t);
+
+static bool
+write_all(po6::io::fd* fd, const uint8_t* data, size_t sz)
+{
+    return fd->xwrite(data, sz) == static_cast<ssize_t>(sz);
+}
+
+static bool
+read_all(po6::io::fd* fd, uint8_t* data, size_t sz)
+{
+    return fd->xread(data, sz) == static_cast<ssize_t>(sz);
+}
+
+static uint64_t
+checksum(const uint8_t* data, size_t sz)
+{
+    return CityHash64(reinterpret_cast<const char*>(data), sz);
+}
+
+hyperdisk :: archive_writer :: archive_writer()
+    : m_fd()
+    , m_path()
+    , m_tmp()
+    , m_block()
+    , m_stored()
+    , m_objects(0)
+    , m_watermark(0)
+{
+}
+
+hyperdisk :: archive_writer :: ~archive_writer() throw ()
+{
+    if (m_fd.get() >= 0)
+    {
+        unlink(m_tmp.get());
+    }
+}
+
+bool
+hyperdisk :: archive_writer :: open(const po6::pathname& path, const e::slice& label)
+{
+    m_path = path;
+    m_tmp = po6::pathname(std::string(path.get()) + ".tmp");
+    m_fd = ::open(m_tmp.get(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+
+    if (m_fd.get() < 0)
+    {
+        return false;
+    }
+
+    std::vector<uint8_t> header(sizeof(uint64_t) + 2 * sizeof(uint32_t) + label.size());
+    uint8_t* ptr = &header.front();
+    ptr = e::pack64le(MAGIC, ptr);
+    ptr = e::pack32le(FORMAT, ptr);
+    ptr = e::pack32le(label.size(), ptr);
+    memmove(ptr, label.data(), label.size());
+    return write_all(&m_fd, &header.front(), header.size());
+}
+
+bool
+hyperdisk :: archive_writer :: append(const e::slice& key,
+                                      const std::vector<e::slice>& value,
+                                      uint64_t version)
+{
+    size_t sz = sizeof(uint64_t) + 2 * sizeof(uint32_t) + key.size();
+
+    for (size_t i = 0; i < value.size(); ++i)
+    {
+        sz += sizeof(uint32_t) + value[i].size();
+    }
+
+    size_t off = m_block.size();
+    m_block.resize(off + sz);
+    uint8_t* ptr = &m_block[off];
+    ptr = e::pack64le(version, ptr);
+    ptr = e::pack32le(key.size(), ptr);
+    memmove(ptr, key.data(), key.size());
+    ptr += key.size();
+    ptr = e::pack32le(value.size(), ptr);
+
+    for (size_t i = 0; i < value.size(); ++i)
+    {
+        ptr = e::pack32le(value[i].size(), ptr);
+        memmove(ptr, value[i].data(), value[i].size());
+        ptr += value[i].size();
+    }
+
+    ++m_objects;
+    m_watermark = std::max(m_watermark, version);
+    return m_block.size() < BLOCK_BYTES || flush_block();
+}
+
+bool
+hyperdisk :: archive_writer :: close()
+{
+    if (!flush_block())
+    {
+        return false;
+    }
+
+    uint8_t trailer[BLOCK_HEADER_BYTES + 3 * sizeof(uint64_t)];
+    memset(trailer, 0, BLOCK_HEADER_BYTES);
+    uint8_t* ptr = trailer + BLOCK_HEADER_BYTES;
+    ptr = e::pack64le(m_objects, ptr);
+    ptr = e::pack64le(m_watermark, ptr);
+    e::pack64le(checksum(trailer + BLOCK_HEADER_BYTES, 2 * sizeof(uint64_t)), ptr);
+
+    if (!write_all(&m_fd, trailer, sizeof(trailer)) || fsync(m_fd.get()) < 0)
+    {
+        return false;
+    }
+
+    m_fd.close();
+
+    if (rename(m_tmp.get(), m_path.get()) < 0)
+    {
+        unlink(m_tmp.get());
+        return false;
+    }
+
+    return true;
+}
+
+bool
+hyperdisk :: archive_writer :: flush_block()
+{
+    if (m_block.empty())
+    {
+        return true;
+    }
+
+    uLongf stored = compressBound(m_block.size());
+    m_stored.resize(BLOCK_HEADER_BYTES + stored);
+
+    if (compress2(&m_stored[BLOCK_HEADER_BYTES], &stored,
+                  &m_block.front(), m_block.size(), Z_BEST_SPEED) != Z_OK)
+    {
+        return false;
+    }
+
+    uint8_t* ptr = &m_stored.front();
+    ptr = e::pack32le(m_block.size(), ptr);
+    ptr = e::pack32le(stored, ptr);
+    e::pack64le(checksum(&m_stored[BLOCK_HEADER_BYTES], stored), ptr);
+    m_block.clear();
+    return write_all(&m_fd, &m_stored.front(), BLOCK_HEADER_BYTES + stored);
+}
+
+hyperdisk :: archive_reader :: archive_reader()
+    : m_fd()
+    , m_label()
+    , m_block()
+    , m_stored()
+    , m_off(0)
+    , m_done(false)
+    , m_error(false)
+    , m_seen(0)
+    , m_objects(0)
+    , m_watermark(0)
+{
+}
+
+hyperdisk :: archive_reader :: ~archive_reader() throw ()
+{
+}
+
+bool
+hyperdisk :: archive_reader :: open(const po6::pathname& path)
+{
+    m_fd = ::open(path.get(), O_RDONLY);
+
+    if (m_fd.get() < 0)
+    {
+        return false;
+    }
+
+    uint8_t header[sizeof(uint64_t) + 2 * sizeof(uint32_t)];
+    uint64_t magic;
+    uint32_t format;
+    uint32_t label_sz;
+
+    if (!read_all(&m_fd, header, sizeof(header)))
+    {
+        return false;
+    }
+
+    const uint8_t* ptr = header;
+    ptr = e::unpack64le(ptr, &magic);
+    ptr = e::unpack32le(ptr, &format);
+    ptr = e::unpack32le(ptr, &label_sz);
+
+    if (magic != archive_writer::MAGIC || format != archive_writer::FORMAT ||
+        label_sz > MAX_BLOCK_BYTES)
+    {
+        return false;
+    }
+
+    std::vector<uint8_t> label(label_sz);
+
+    if (label_sz > 0 && !read_all(&m_fd, &label.front(), label_sz))
+    {
+        return false;
+    }
+
+    m_label.assign(label.begin(), label.end());
+    return true;
+}
+
+bool
+hyperdisk :: archive_reader :: next(e::slice* key,
+                                    std::vector<e::slice>* value,
+                                    uint64_t* version)
+{
+    while (m_off >= m_block.size())
+    {
+        if (m_done || m_error || !read_block())
+        {
+            return false;
+        }
+    }
+
+    const uint8_t* ptr = &m_block[m_off];
+    const uint8_t* end = &m_block.front() + m_block.size();
+    uint32_t sz;
+    uint32_t n;
+
+    if (end - ptr < static_cast<ssize_t>(sizeof(uint64_t) + sizeof(uint32_t)))
+    {
+        m_error = true;
+        return false;
+    }
+
+    ptr = e::unpack64le(ptr, version);
+    ptr = e::unpack32le(ptr, &sz);
+
+    if (end - ptr < static_cast<ssize_t>(sz + sizeof(uint32_t)))
+    {
+        m_error = true;
+        return false;
+    }
+
+    *key = e::slice(ptr, sz);
+    ptr = e::unpack32le(ptr + sz, &n);
+    value->clear();
+
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        if (end - ptr < static_cast<ssize_t>(sizeof(uint32_t)))
+        {
+            m_error = true;
+            return false;
+        }
+
+        ptr = e::unpack32le(ptr, &sz);
+
+        if (end - ptr < static_cast<ssize_t>(sz))
+        {
+            m_error = true;
+            return false;
+        }
+
+        value->push_back(e::slice(ptr, sz));
+        ptr += sz;
+    }
+
+    m_off = ptr - &m_block.front();
+    ++m_seen;
+    return true;
+}
+
+bool
+hyperdisk :: archive_reader :: read_block()
+{
+    uint8_t header[BLOCK_HEADER_BYTES];
+    uint32_t raw;
+    uint32_t stored;
+    uint64_t sum;
+    m_error = true;
+
+    if (!read_all(&m_fd, header, sizeof(header)))
+    {
+        return false;
+    }
+
+    const uint8_t* ptr = header;
+    ptr = e::unpack32le(ptr, &raw);
+    ptr = e::unpack32le(ptr, &stored);
+    ptr = e::unpack64le(ptr, &sum);
+
+    if (raw == 0)
+    {
+        uint8_t trailer[3 * sizeof(uint64_t)];
+
+        if (!read_all(&m_fd, trailer, sizeof(trailer)))
+        {
+            return false;
+        }
+
+        ptr = trailer;
+        ptr = e::unpack64le(ptr, &m_objects);
+        ptr = e::unpack64le(ptr, &m_watermark);
+        ptr = e::unpack64le(ptr, &sum);
+        m_done = true;
+        m_error = sum != checksum(trailer, 2 * sizeof(uint64_t)) ||
+                  m_seen != m_objects;
+        return false;
+    }
+
+    if (raw > MAX_BLOCK_BYTES || stored == 0 || stored > MAX_BLOCK_BYTES)
+    {
+        return false;
+    }
+
+    m_stored.resize(stored);
+
+    if (!read_all(&m_fd, &m_stored.front(), stored) ||
+        sum != checksum(&m_stored.front(), stored))
+    {
+        return false;
+    }
+
+    uLongf len = raw;
+    m_block.resize(raw);
+
+    if (uncompress(&m_block.front(), &len, &m_stored.front(), stored) != Z_OK ||
+        len != raw)
+    {
+        return false;
+    }
+
+    m_off = 0;
+    m_error = false;
+    return true;
+}
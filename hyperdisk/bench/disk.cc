@@ -0,0 +1,163 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// STL
+#include <tr1/memory>
+#include <vector>
+
+// e
+#include <e/buffer.h>
+#include <e/endian.h>
+
+// HyperspaceHashing
+#include "hyperspacehashing/hyperspacehashing/hashes.h"
+#include "hyperspacehashing/hyperspacehashing/mask.h"
+
+// HyperDisk
+#include "hyperdisk/hyperdisk/disk.h"
+#include "hyperdisk/hyperdisk/reference.h"
+
+// HyperDex
+#include "benchrunner.h"
+
+// Enough objects that flushing them splits the starting shard a few times.
+#define OBJECTS 131072
+#define VALUE_SIZE 64
+#define DISK_DIR "bench-disk"
+
+namespace
+{
+
+// Every object is backed by the same buffer, holding OBJECTS keys followed by
+// one value.
+class objects
+{
+    public:
+        objects();
+
+    public:
+        std::tr1::shared_ptr<e::buffer> backing() const { return m_backing; }
+        e::slice key(size_t i) const { return e::slice(m_backing->data() + i * sizeof(uint64_t), sizeof(uint64_t)); }
+        const std::vector<e::slice>& value() const { return m_value; }
+
+    private:
+        std::tr1::shared_ptr<e::buffer> m_backing;
+        std::vector<e::slice> m_value;
+};
+
+objects :: objects()
+    : m_backing(e::buffer::create(OBJECTS * sizeof(uint64_t) + VALUE_SIZE))
+    , m_value()
+{
+    bench::generator gen(OBJECTS);
+    uint8_t* ptr = m_backing->data();
+
+    for (size_t i = 0; i < OBJECTS; ++i)
+    {
+        ptr = e::pack64le(gen.next(), ptr);
+    }
+
+    memset(ptr, 'v', VALUE_SIZE);
+    m_value.push_back(e::slice(ptr, VALUE_SIZE));
+}
+
+e::intrusive_ptr<hyperdisk::disk>
+create()
+{
+    std::vector<hyperspacehashing::hash_t> hf(2, hyperspacehashing::EQUALITY);
+    hyperspacehashing::mask::hasher hasher(hf);
+    return hyperdisk::disk::create(DISK_DIR, hasher, 2);
+}
+
+void
+append(const objects& objs, e::intrusive_ptr<hyperdisk::disk> d, size_t num)
+{
+    for (size_t i = 0; i < num; ++i)
+    {
+        d->put(objs.backing(), objs.key(i), objs.value(), i);
+    }
+}
+
+} // namespace
+
+// Appending to the write-ahead log, which is all a put does before a flush.
+BENCHMARK(Disk, Put, OBJECTS)
+{
+    st.pause();
+    objects objs;
+    e::intrusive_ptr<hyperdisk::disk> d = create();
+    st.set_bytes(sizeof(uint64_t) + VALUE_SIZE);
+    st.resume();
+
+    append(objs, d, st.iterations());
+
+    st.pause();
+    d->drop();
+    st.resume();
+}
+
+// Moving the log to the shards, including the splits it forces.
+BENCHMARK(Disk, Flush, OBJECTS)
+{
+    st.pause();
+    objects objs;
+    e::intrusive_ptr<hyperdisk::disk> d = create();
+    append(objs, d, st.iterations());
+    st.set_bytes(sizeof(uint64_t) + VALUE_SIZE);
+    st.resume();
+
+    bool flushed = d->flush_all();
+
+    st.pause();
+    bench::consume(flushed);
+    d->drop();
+    st.resume();
+}
+
+BENCHMARK(Disk, Get, OBJECTS)
+{
+    st.pause();
+    objects objs;
+    e::intrusive_ptr<hyperdisk::disk> d = create();
+    append(objs, d, st.iterations());
+    d->flush_all();
+    std::vector<e::slice> value;
+    uint64_t version;
+    hyperdisk::reference ref;
+    st.set_bytes(sizeof(uint64_t) + VALUE_SIZE);
+    st.resume();
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        bench::consume(d->get(objs.key(i), &value, &version, &ref));
+    }
+
+    st.pause();
+    d->drop();
+    st.resume();
+}
@@ -0,0 +1,219 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#define __STDC_LIMIT_MACROS
+
+// POSIX
+#include <fcntl.h>
+#include <unistd.h>
+
+// STL
+#include <vector>
+
+// e
+#include <e/endian.h>
+
+// HyperspaceHashing
+#include "hyperspacehashing/hyperspacehashing/mask.h"
+
+// HyperDisk
+#include "hyperdisk/shard.h"
+#include "hyperdisk/shard_constants.h"
+#include "hyperdisk/shard_snapshot.h"
+
+// HyperDex
+#include "benchrunner.h"
+
+// Half of what a shard can index, so that a put never finds the shard full.
+#define OBJECTS (SEARCH_INDEX_ENTRIES / 2)
+#define VALUE_SIZE 64
+#define SHARD_FILE "bench-shard"
+
+namespace
+{
+
+class objects
+{
+    public:
+        objects();
+
+    public:
+        uint32_t primary(size_t i) const { return m_primary[i]; }
+        hyperspacehashing::mask::coordinate coord(size_t i) const;
+        e::slice key(size_t i) const { return e::slice(&m_keys[i * sizeof(uint64_t)], sizeof(uint64_t)); }
+        const std::vector<e::slice>& value() const { return m_value; }
+
+    private:
+        std::vector<uint32_t> m_primary;
+        std::vector<uint32_t> m_secondary;
+        std::vector<uint8_t> m_keys;
+        std::vector<uint8_t> m_value_bytes;
+        std::vector<e::slice> m_value;
+};
+
+objects :: objects()
+    : m_primary(OBJECTS)
+    , m_secondary(OBJECTS)
+    , m_keys(OBJECTS * sizeof(uint64_t))
+    , m_value_bytes(VALUE_SIZE, 'v')
+    , m_value(1, e::slice(&m_value_bytes.front(), VALUE_SIZE))
+{
+    bench::generator gen(OBJECTS);
+
+    for (size_t i = 0; i < OBJECTS; ++i)
+    {
+        uint64_t num = gen.next();
+        m_primary[i] = static_cast<uint32_t>(num);
+        m_secondary[i] = static_cast<uint32_t>(num >> 32);
+        e::pack64le(i, &m_keys[i * sizeof(uint64_t)]);
+    }
+}
+
+hyperspacehashing::mask::coordinate
+objects :: coord(size_t i) const
+{
+    return hyperspacehashing::mask::coordinate(UINT64_MAX, m_primary[i],
+                                               UINT64_MAX, m_secondary[i], 0, 0);
+}
+
+e::intrusive_ptr<hyperdisk::shard>
+fill(const objects& objs)
+{
+    po6::io::fd cwd(AT_FDCWD);
+    e::intrusive_ptr<hyperdisk::shard> s = hyperdisk::shard::create(cwd, SHARD_FILE);
+
+    for (size_t i = 0; i < OBJECTS; ++i)
+    {
+        s->put(objs.coord(i), objs.key(i), objs.value(), i);
+    }
+
+    return s;
+}
+
+} // namespace
+
+BENCHMARK(Shard, Put, OBJECTS)
+{
+    st.pause();
+    objects objs;
+    po6::io::fd cwd(AT_FDCWD);
+    e::intrusive_ptr<hyperdisk::shard> s = hyperdisk::shard::create(cwd, SHARD_FILE);
+    st.set_bytes(sizeof(uint64_t) + VALUE_SIZE);
+    st.resume();
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        s->put(objs.coord(i), objs.key(i), objs.value(), i);
+    }
+
+    st.pause();
+    s = NULL;
+    unlink(SHARD_FILE);
+    st.resume();
+}
+
+BENCHMARK(Shard, Get, OBJECTS)
+{
+    st.pause();
+    objects objs;
+    e::intrusive_ptr<hyperdisk::shard> s = fill(objs);
+    std::vector<e::slice> value;
+    uint64_t version;
+    st.set_bytes(sizeof(uint64_t) + VALUE_SIZE);
+    st.resume();
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        bench::consume(s->get(objs.primary(i), objs.key(i), &value, &version));
+    }
+
+    st.pause();
+    s = NULL;
+    unlink(SHARD_FILE);
+    st.resume();
+}
+
+BENCHMARK(Shard, GetMissing, OBJECTS)
+{
+    st.pause();
+    objects objs;
+    e::intrusive_ptr<hyperdisk::shard> s = fill(objs);
+    uint8_t missing[sizeof(uint64_t) + 1] = {0};
+    std::vector<e::slice> value;
+    uint64_t version;
+    st.resume();
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        // The primary hash collides with a stored object but the key does not.
+        bench::consume(s->get(objs.primary(i), e::slice(missing, sizeof(missing)), &value, &version));
+    }
+
+    st.pause();
+    s = NULL;
+    unlink(SHARD_FILE);
+    st.resume();
+}
+
+BENCHMARK(Shard, Del, OBJECTS)
+{
+    st.pause();
+    objects objs;
+    e::intrusive_ptr<hyperdisk::shard> s = fill(objs);
+    st.resume();
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        s->del(objs.primary(i), objs.key(i));
+    }
+
+    st.pause();
+    s = NULL;
+    unlink(SHARD_FILE);
+    st.resume();
+}
+
+BENCHMARK(Shard, SnapshotIterate, OBJECTS)
+{
+    st.pause();
+    objects objs;
+    e::intrusive_ptr<hyperdisk::shard> s = fill(objs);
+    st.set_bytes(sizeof(uint64_t) + VALUE_SIZE);
+    st.resume();
+
+    for (hyperdisk::shard_snapshot snap = s->make_snapshot(); snap.valid(); snap.next())
+    {
+        bench::consume(snap.key());
+        bench::consume(snap.value());
+    }
+
+    st.pause();
+    s = NULL;
+    unlink(SHARD_FILE);
+    st.resume();
+}
@@ -30,18 +30,27 @@
 // C
 #include <cstdio>
 #include <cmath>
+#include <cstring>
 
 // POSIX
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 // C++
+#include <algorithm>
 #include <iomanip>
 #include <sstream>
 #include <fstream>
 
 // e
+#include <e/endian.h>
 #include <e/guard.h>
+#include <e/timer.h>
+
+// Google CityHash
+#include <city.h>
 
 // HyperspaceHashing
 #include "hyperspacehashing/hyperspacehashing/mask.h"
@@ -85,9 +94,19 @@ using hyperspacehashing::mask::coordinate;
 // the WAL.  Trickle does this by using locking when exchanging the
 // shard_vectors.
 
+const uint64_t hyperdisk :: disk :: MANIFEST_MAGIC = 0x485944584d414e49ULL; // "HYDXMANI"
+const uint32_t hyperdisk :: disk :: MANIFEST_FORMAT = 1;
+const char* hyperdisk :: disk :: MANIFEST_FILE_NAME = "manifest.hd";
 const int hyperdisk :: disk :: STATE_FILE_VER = 1;
 const char* hyperdisk :: disk :: STATE_FILE_NAME = "disk_state.hd";
 
+// A manifest is a header (magic, format, the quiesce state id and the number
+// of shards), a fixed-size record per shard, and a CityHash64 of everything
+// before it.
+static const size_t MANIFEST_HEADER_BYTES = sizeof(uint64_t) + 2 * sizeof(uint32_t);
+static const size_t MANIFEST_SHARD_BYTES = 6 * sizeof(uint64_t) + 2 * sizeof(uint32_t);
+static const size_t MANIFEST_MAX_BYTES = 64 * 1024 * 1024;
+
 e::intrusive_ptr<hyperdisk::disk>
 hyperdisk :: disk :: create(const po6::pathname& directory,
                             const hyperspacehashing::mask::hasher& hasher,
@@ -111,36 +130,11 @@ bool
 hyperdisk :: disk :: quiesce(const std::string& quiesce_state_id)
 {
     // Flush all data to O/S buffers.
-    bool flushed = false;
-    while (!flushed)
+    if (!flush_all())
     {
-        returncode rc = flush(-1, false);
-
-        switch (rc)
-        {
-            case DIDNOTHING:
-                // All data is flushed, move on.
-                flushed = true;
-                break;
-            case SUCCESS:
-                // Some data flushed, try again.
-                continue;
-            case DATAFULL:
-            case SEARCHFULL:
-                // Split the shards and try agian.
-                do_mandatory_io();
-                continue;
-            case NOTFOUND:
-            case WRONGARITY:
-            case SYNCFAILED:
-            case DROPFAILED:
-            case MISSINGDISK:
-            case SPLITFAILED:
-            default:
-                return false;
-        }
+        return false;
     }
-    
+
     // Flush O/S buffers to disk.
     returncode rc = sync();
     if (SUCCESS != rc)
@@ -148,40 +142,211 @@ hyperdisk :: disk :: quiesce(const std::string& quiesce_state_id)
         return false;
     }
     
-    // Persist the state into a file.
-    return dump_state(quiesce_state_id);
+    // Persist the state into the manifest.
+    profiled_mutex::hold hold(&m_shards_mutate);
+    return write_manifest(quiesce_state_id);
 }
 
 bool
-hyperdisk :: disk :: dump_state(const std::string& quiesce_state_id)
+hyperdisk :: disk :: checkpoint()
 {
-    // Dump state information.
-    e::intrusive_ptr<shard_vector> shards;
+    if (!m_shards_mutate.trylock())
     {
-        po6::threads::mutex::hold b(&m_shards_lock);
-        shards = m_shards;
+        return true;
     }
-    
-    std::ostringstream s;
-    s << "version " << STATE_FILE_VER << std::endl;
-    s << "state_id " << quiesce_state_id << std::endl;
+
+    e::guard hold = e::makeobjguard(m_shards_mutate, &profiled_mutex::unlock);
+    hold.use_variable();
+    // A manifest written on quiesce stands until the shards change.
+    std::vector<uint8_t> manifest;
+    encode_manifest(m_manifest_state_id, &manifest);
+
+    if (manifest == m_manifest)
+    {
+        return true;
+    }
+
+    return write_manifest("");
+}
+
+void
+hyperdisk :: disk :: encode_manifest(const std::string& quiesce_state_id,
+                                     std::vector<uint8_t>* manifest)
+{
+    e::intrusive_ptr<shard_vector> shards = m_shards;
+    manifest->resize(MANIFEST_HEADER_BYTES + sizeof(uint32_t) + quiesce_state_id.size()
+                     + shards->size() * MANIFEST_SHARD_BYTES + sizeof(uint64_t));
+    uint8_t* ptr = &manifest->front();
+    ptr = e::pack64le(MANIFEST_MAGIC, ptr);
+    ptr = e::pack32le(MANIFEST_FORMAT, ptr);
+    ptr = e::pack32le(quiesce_state_id.size(), ptr);
+    memmove(ptr, quiesce_state_id.data(), quiesce_state_id.size());
+    ptr += quiesce_state_id.size();
+    ptr = e::pack32le(shards->size(), ptr);
+
     for (size_t i = 0; i < shards->size(); ++i)
     {
-        coordinate c = shards->get_coordinate(i);
-        uint32_t o = shards->get_offset(i);
-        s << "shard";
-        s << " " << c.primary_mask;
-        s << " " << c.primary_hash;
-        s << " " << c.secondary_lower_mask;
-        s << " " << c.secondary_lower_hash;
-        s << " " << c.secondary_upper_mask;
-        s << " " << c.secondary_upper_hash;
-        s << " " << o;
-        s << std::endl;
+        const coordinate& c(shards->get_coordinate(i));
+        ptr = e::pack64le(c.primary_mask, ptr);
+        ptr = e::pack64le(c.primary_hash, ptr);
+        ptr = e::pack64le(c.secondary_lower_mask, ptr);
+        ptr = e::pack64le(c.secondary_lower_hash, ptr);
+        ptr = e::pack64le(c.secondary_upper_mask, ptr);
+        ptr = e::pack64le(c.secondary_upper_hash, ptr);
+        ptr = e::pack32le(shards->get_shard(i)->data_offset(), ptr);
+        ptr = e::pack32le(shards->get_shard(i)->search_offset(), ptr);
     }
-    
-    // Rewrite the state file atomically.
-    return util::atomicfile::rewrite(m_base_filename.get(), STATE_FILE_NAME, s.str().c_str());
+
+    size_t sz = ptr - &manifest->front();
+    ptr = e::pack64le(CityHash64(reinterpret_cast<const char*>(&manifest->front()), sz), ptr);
+    assert(ptr == &manifest->front() + manifest->size());
+}
+
+bool
+hyperdisk :: disk :: write_manifest(const std::string& quiesce_state_id)
+{
+    std::vector<uint8_t> manifest;
+    encode_manifest(quiesce_state_id, &manifest);
+
+    if (manifest == m_manifest)
+    {
+        return true;
+    }
+
+    // The manifest vouches for everything before the offsets it records, so
+    // that has to reach the disk first.  The page cache alone would survive
+    // a process crash, but not a power loss.
+    e::intrusive_ptr<shard_vector> shards = m_shards;
+
+    for (size_t i = 0; i < shards->size(); ++i)
+    {
+        if (shards->get_shard(i)->sync_written() != SUCCESS)
+        {
+            return false;
+        }
+    }
+
+    // Write a temporary file and rename it over the manifest, so that a
+    // crash leaves either the old manifest or the new one.
+    std::string tmp(std::string(MANIFEST_FILE_NAME) + ".tmp");
+    po6::io::fd fd(openat(m_base.get(), tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR));
+
+    if (fd.get() < 0)
+    {
+        return false;
+    }
+
+    if (fd.xwrite(&manifest.front(), manifest.size()) != static_cast<ssize_t>(manifest.size()) ||
+        fsync(fd.get()) < 0 ||
+        renameat(m_base.get(), tmp.c_str(), m_base.get(), MANIFEST_FILE_NAME) < 0)
+    {
+        unlinkat(m_base.get(), tmp.c_str(), 0);
+        return false;
+    }
+
+    m_manifest.swap(manifest);
+    m_manifest_state_id = quiesce_state_id;
+    return true;
+}
+
+bool
+hyperdisk :: disk :: load_manifest(const std::string& quiesce_state_id)
+{
+    po6::io::fd fd(openat(m_base.get(), MANIFEST_FILE_NAME, O_RDONLY));
+    struct stat st;
+
+    if (fd.get() < 0 || fstat(fd.get(), &st) < 0)
+    {
+        return false;
+    }
+
+    if (st.st_size < static_cast<off_t>(MANIFEST_HEADER_BYTES + 2 * sizeof(uint32_t) + sizeof(uint64_t)) ||
+        st.st_size > static_cast<off_t>(MANIFEST_MAX_BYTES))
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    std::vector<uint8_t> manifest(st.st_size);
+
+    if (fd.xread(&manifest.front(), manifest.size()) != static_cast<ssize_t>(manifest.size()))
+    {
+        errno = EIO;
+        return false;
+    }
+
+    const uint8_t* ptr = &manifest.front();
+    const uint8_t* end = ptr + manifest.size() - sizeof(uint64_t);
+    uint64_t magic;
+    uint32_t format;
+    uint32_t sid_sz;
+    uint64_t checksum;
+    e::unpack64le(end, &checksum);
+
+    if (checksum != CityHash64(reinterpret_cast<const char*>(ptr), end - ptr))
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    ptr = e::unpack64le(ptr, &magic);
+    ptr = e::unpack32le(ptr, &format);
+    ptr = e::unpack32le(ptr, &sid_sz);
+
+    if (magic != MANIFEST_MAGIC || format != MANIFEST_FORMAT ||
+        static_cast<size_t>(end - ptr) < sid_sz + sizeof(uint32_t))
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Does the manifest match the quiesced state we are loading?
+    std::string sid(reinterpret_cast<const char*>(ptr), sid_sz);
+    ptr += sid_sz;
+
+    if (!quiesce_state_id.empty() && quiesce_state_id != sid)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    uint32_t num;
+    ptr = e::unpack32le(ptr, &num);
+
+    if (num == 0 || static_cast<size_t>(end - ptr) != num * MANIFEST_SHARD_BYTES)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Restore the shards.
+    std::vector<std::pair<coordinate, e::intrusive_ptr<shard> > > shards;
+
+    for (uint32_t i = 0; i < num; ++i)
+    {
+        uint64_t ct[6];
+        uint32_t data_offset;
+        uint32_t search_offset;
+
+        for (int j = 0; j < 6; ++j)
+        {
+            ptr = e::unpack64le(ptr, &ct[j]);
+        }
+
+        ptr = e::unpack32le(ptr, &data_offset);
+        ptr = e::unpack32le(ptr, &search_offset);
+        coordinate c(ct[0], ct[1], ct[2], ct[3], ct[4], ct[5]);
+        shards.push_back(std::make_pair(c, shard::open(m_base, shard_filename(c),
+                                                       data_offset, search_offset)));
+    }
+
+    // Re-install the reopened shards into the disk.
+    profiled_mutex::hold a(&m_shards_mutate);
+    profiled_mutex::hold b(&m_shards_lock);
+    m_shards = new shard_vector(1, &shards);
+    m_manifest.swap(manifest);
+    m_manifest_state_id = sid;
+    return true;
 }
 
 bool
@@ -271,13 +436,26 @@ hyperdisk :: disk :: load_state(const std::string& quiesce_state_id)
     }
 
     // Re-install the reopened shards into the disk.
-    po6::threads::mutex::hold a(&m_shards_mutate);
-    po6::threads::mutex::hold b(&m_shards_lock);
+    profiled_mutex::hold a(&m_shards_mutate);
+    profiled_mutex::hold b(&m_shards_lock);
     m_shards = new shard_vector(1, &shards);
  
     return true;
 }
 
+static uint64_t
+object_bytes(const e::slice& key, const std::vector<e::slice>& value)
+{
+    uint64_t bytes = key.size();
+
+    for (size_t i = 0; i < value.size(); ++i)
+    {
+        bytes += value[i].size();
+    }
+
+    return bytes;
+}
+
 hyperdisk::returncode
 hyperdisk :: disk :: get(const e::slice& key,
                          std::vector<e::slice>* value,
@@ -290,7 +468,7 @@ hyperdisk :: disk :: get(const e::slice& key,
     e::locking_iterable_fifo<log_entry>::iterator it = m_log.iterate();
 
     {
-        po6::threads::mutex::hold b(&m_shards_lock);
+        profiled_mutex::hold b(&m_shards_lock);
         shards = m_shards;
     }
 
@@ -333,12 +511,15 @@ hyperdisk :: disk :: get(const e::slice& key,
         }
     }
 
-    if (found)
+    returncode ret = found ? wal_res : shard_res;
+    __sync_add_and_fetch(&m_ops, 1);
+
+    if (ret == SUCCESS)
     {
-        return wal_res;
+        __sync_add_and_fetch(&m_bytes, object_bytes(key, *value));
     }
 
-    return shard_res;
+    return ret;
 }
 
 hyperdisk::returncode
@@ -353,7 +534,10 @@ hyperdisk :: disk :: put(std::tr1::shared_ptr<e::buffer> backing,
     }
 
     coordinate coord = m_hasher.hash(key, value);
+    __sync_add_and_fetch(&m_logged, 1);
     m_log.append(log_entry(coord, backing, key, value, version));
+    __sync_add_and_fetch(&m_ops, 1);
+    __sync_add_and_fetch(&m_bytes, object_bytes(key, value));
     return SUCCESS;
 }
 
@@ -362,7 +546,10 @@ hyperdisk :: disk :: del(std::tr1::shared_ptr<e::buffer> backing,
                          const e::slice& key)
 {
     coordinate coord = m_hasher.hash(key);
+    __sync_add_and_fetch(&m_logged, 1);
     m_log.append(log_entry(coord, backing, key));
+    __sync_add_and_fetch(&m_ops, 1);
+    __sync_add_and_fetch(&m_bytes, key.size());
     return SUCCESS;
 }
 
@@ -374,7 +561,7 @@ hyperdisk :: disk :: make_snapshot(const hyperspacehashing::search& terms)
     e::locking_iterable_fifo<offset_update>::iterator it = m_offsets.iterate();
 
     {
-        po6::threads::mutex::hold b(&m_shards_lock);
+        profiled_mutex::hold b(&m_shards_lock);
         shards = m_shards;
     }
 
@@ -410,21 +597,49 @@ hyperdisk :: disk :: make_snapshot(const hyperspacehashing::search& terms)
 }
 
 e::intrusive_ptr<hyperdisk::rolling_snapshot>
-hyperdisk :: disk :: make_rolling_snapshot()
+hyperdisk :: disk :: make_rolling_snapshot(merkle* summary)
 {
     hyperspacehashing::search terms(m_arity);
     e::locking_iterable_fifo<log_entry>::iterator iter(m_log.iterate());
-    e::intrusive_ptr<snapshot> snap = make_snapshot(terms);
+    e::intrusive_ptr<snapshot> snap;
+
+    if (summary)
+    {
+        // Keep flush from moving the shards between the two.
+        profiled_mutex::hold a(&m_shards_mutate);
+        snap = make_snapshot(terms);
+        rebuild_summary();
+        *summary = m_summary;
+    }
+    else
+    {
+        snap = make_snapshot(terms);
+    }
+
     e::intrusive_ptr<rolling_snapshot> ret = new rolling_snapshot(iter, snap);
     return ret;
 }
 
+bool
+hyperdisk :: disk :: summarize(merkle* summary)
+{
+    if (!flush_all())
+    {
+        return false;
+    }
+
+    profiled_mutex::hold a(&m_shards_mutate);
+    rebuild_summary();
+    *summary = m_summary;
+    return true;
+}
+
 hyperdisk::returncode
 hyperdisk :: disk :: drop()
 {
-    po6::threads::mutex::hold a(&m_shards_mutate);
-    po6::threads::mutex::hold b(&m_shards_lock);
-    po6::threads::mutex::hold c(&m_spare_shards_lock);
+    profiled_mutex::hold a(&m_shards_mutate);
+    profiled_mutex::hold b(&m_shards_lock);
+    profiled_mutex::hold c(&m_spare_shards_lock);
     returncode ret = SUCCESS;
     e::intrusive_ptr<shard_vector> shards = m_shards;
 
@@ -446,6 +661,9 @@ hyperdisk :: disk :: drop()
         }
     }
 
+    unlinkat(m_base.get(), MANIFEST_FILE_NAME, 0);
+    unlinkat(m_base.get(), STATE_FILE_NAME, 0);
+
     if (ret == SUCCESS)
     {
         if (rmdir(m_base_filename.get()) < 0)
@@ -458,6 +676,42 @@ hyperdisk :: disk :: drop()
     return SUCCESS;
 }
 
+void
+hyperdisk :: disk :: load(uint64_t* ops, uint64_t* bytes)
+{
+    *ops = __sync_lock_test_and_set(&m_ops, 0);
+    *bytes = __sync_lock_test_and_set(&m_bytes, 0);
+}
+
+void
+hyperdisk :: disk :: stats(disk_stats* s)
+{
+    e::intrusive_ptr<shard_vector> shards;
+
+    {
+        profiled_mutex::hold b(&m_shards_lock);
+        shards = m_shards;
+    }
+
+    // Writers count an object before appending it, and flush counts it
+    // after, so reading m_flushed first keeps the depth from going negative.
+    s->flushed = __sync_add_and_fetch(&m_flushed, 0);
+    s->logged = __sync_add_and_fetch(&m_logged, 0);
+    s->log_depth = s->logged - s->flushed;
+    s->lag_nanos = 0;
+    s->shards = shards->size();
+    s->shards_mutate = m_shards_mutate.stats();
+    s->shards_lock = m_shards_lock.stats();
+    s->spare_shards_lock = m_spare_shards_lock.stats();
+
+    if (s->log_depth > 0)
+    {
+        uint64_t drained_at = __sync_add_and_fetch(&m_drained_at, 0);
+        uint64_t now = e::time();
+        s->lag_nanos = now > drained_at ? now - drained_at : 0;
+    }
+}
+
 // This operation will return SUCCESS as long as it knows that progress is being
 // made.  It will return DIDNOTHING if there was nothing to do.
 hyperdisk::returncode
@@ -475,7 +729,7 @@ hyperdisk :: disk :: flush(ssize_t num, bool nonblocking)
         m_shards_mutate.lock();
     }
 
-    e::guard hold = e::makeobjguard(m_shards_mutate, &po6::threads::mutex::unlock);
+    e::guard hold = e::makeobjguard(m_shards_mutate, &profiled_mutex::unlock);
 
     bool flushed = false;
     returncode flush_status = SUCCESS;
@@ -485,165 +739,129 @@ hyperdisk :: disk :: flush(ssize_t num, bool nonblocking)
     // num == -1 means flush all
     for (ssize_t nf = 0; (nf < num || num < 0) && it.valid(); ++nf, it.next())
     {
-        const coordinate& coord = it->coord;
-        const e::slice& key = it->key;
-        bool del_needed = false;
-        size_t del_num = 0;
-        uint32_t del_offset = 0;
+        returncode rc = write(it->coord, it->key,
+                              it->is_put ? &it->value : NULL,
+                              it->version, true);
 
-        for (size_t i = 0; !del_needed && i < m_shards->size(); ++i)
+        if (rc != SUCCESS)
         {
-            if (!m_shards->get_coordinate(i).primary_intersects(coord))
+            if (rc != DIDNOTHING)
             {
-                continue;
+                flush_status = rc;
             }
 
-            returncode ret;
-            ret = m_shards->get_shard(i)->get(coord.primary_hash, key);
-
-            if (ret == SUCCESS)
-            {
-                del_needed = true;
-                del_num = i;
-            }
-            else if (ret == NOTFOUND)
-            {
-            }
-            else
-            {
-                abort();
-            }
+            break;
         }
 
-        bool put_performed = false;
-        size_t put_num = 0;
-        uint32_t put_offset = 0;
+        flushed = true;
+        __sync_add_and_fetch(&m_flushed, 1);
+    }
 
-        if (it->is_put)
-        {
-            const std::vector<e::slice>& value = it->value;
-            const uint64_t version = it->version;
+    m_log.advance_to(it);
 
-            // This must start at the last position and work downward so that
-            // the last arg to "shard_vector->replace" will be considered first.
-            for (ssize_t i = m_shards->size() - 1; !put_performed && i >= 0; --i)
-            {
-                if (!m_shards->get_coordinate(i).intersects(coord))
-                {
-                    continue;
-                }
+    if (!it.valid())
+    {
+        __sync_lock_test_and_set(&m_drained_at, e::time());
+    }
 
-                returncode ret;
-                ret = m_shards->get_shard(i)->put(coord, key, value,
-                                                  version, &put_offset);
+    if (flush_status != SUCCESS)
+    {
+        return flush_status;
+    }
 
-                if (ret == SUCCESS)
-                {
-                    put_performed = true;
-                    put_num = i;
-                }
-                else if (ret == DATAFULL || ret == SEARCHFULL)
-                {
-                    m_needs_io = i;
-                    flush_status = ret;
-                    break;
-                }
-                else
-                {
-                    abort();
-                }
-            }
+    if (flushed)
+    {
+        return SUCCESS;
+    }
+    else
+    {
+        return DIDNOTHING;
+    }
+    return SUCCESS;
+}
 
-            if (!put_performed)
-            {
-                break;
-            }
-        }
+static bool
+bulk_order(const std::pair<coordinate, size_t>& lhs,
+           const std::pair<coordinate, size_t>& rhs)
+{
+    return lhs.first.primary_hash < rhs.first.primary_hash;
+}
 
-        if (del_needed && (!put_performed || del_num != put_num))
+hyperdisk::returncode
+hyperdisk :: disk :: bulk_load(const std::vector<bulk_object>& objects, bool unique)
+{
+    profiled_mutex::hold hold(&m_shards_mutate);
+
+    // Anything in the log must reach the shards before these objects do.
+    // That is the flush threads' job, so fall back to the log.
+    if (m_log.iterate().valid())
+    {
+        for (size_t i = 0; i < objects.size(); ++i)
         {
-            switch (m_shards->get_shard(del_num)->del(coord.primary_hash, key, &del_offset))
+            if (objects[i].value.size() + 1 != m_arity)
             {
-                case SUCCESS:
-                    break;
-                case NOTFOUND:
-                case DATAFULL:
-                case WRONGARITY:
-                case SEARCHFULL:
-                case SYNCFAILED:
-                case DROPFAILED:
-                case MISSINGDISK:
-                case SPLITFAILED:
-                case DIDNOTHING:
-                default:
-                    abort();
+                return WRONGARITY;
             }
+
+            coordinate coord = m_hasher.hash(objects[i].key, objects[i].value);
+            __sync_add_and_fetch(&m_logged, 1);
+            m_log.append(log_entry(coord, objects[i].backing, objects[i].key,
+                                   objects[i].value, objects[i].version));
         }
 
-        flushed = true;
+        return SUCCESS;
+    }
 
-        // Here we prepare two offset_updates that we can push onto the offsets
-        // log.  We then make the offset changes to the shard_vector, and then
-        // finish by removing the items we put on the log.
-        std::vector<offset_update> updates;
+    // Visit the objects in hash order so that consecutive writes land near
+    // each other in the shards' hash tables.
+    std::vector<std::pair<coordinate, size_t> > order;
+    order.reserve(objects.size());
 
-        if (del_needed && (!put_performed || del_num != put_num))
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        if (objects[i].value.size() + 1 != m_arity)
         {
-            updates.push_back(offset_update());
-            updates.back().shard_generation = m_shards->generation();
-            updates.back().shard_num = del_num;
-            updates.back().new_offset = del_offset;
+            return WRONGARITY;
         }
 
-        if (put_performed)
-        {
-            updates.push_back(offset_update());
-            updates.back().shard_generation = m_shards->generation();
-            updates.back().shard_num = put_num;
-            updates.back().new_offset = put_offset;
-        }
+        order.push_back(std::make_pair(m_hasher.hash(objects[i].key, objects[i].value), i));
+    }
 
-        // Log our intentions.
-        m_offsets.batch_append(updates);
+    std::stable_sort(order.begin(), order.end(), bulk_order);
 
-        // Do our updates.
-        for (size_t i = 0; i < updates.size(); ++i)
+    for (size_t i = 0; i < order.size(); )
+    {
+        const bulk_object& obj(objects[order[i].second]);
+        returncode rc = write(order[i].first, obj.key, &obj.value, obj.version, !unique);
+
+        if (rc == SUCCESS)
         {
-            assert(updates[i].shard_generation == m_shards->generation());
-            assert(updates[i].new_offset > m_shards->get_offset(updates[i].shard_num));
-            m_shards->set_offset(updates[i].shard_num, updates[i].new_offset);
+            ++i;
         }
+        else if (rc == DATAFULL || rc == SEARCHFULL)
+        {
+            size_t needs_io = m_needs_io;
+            m_needs_io = -1;
+            rc = deal_with_full_shard(needs_io);
 
-        // Remove our updates from the log.
-        for (size_t i = 0; i < updates.size(); ++i)
+            if (rc != SUCCESS)
+            {
+                return rc;
+            }
+        }
+        else
         {
-            assert(m_offsets.oldest() == updates[i]);
-            m_offsets.remove_oldest();
+            return rc;
         }
     }
 
-    m_log.advance_to(it);
-
-    if (flush_status != SUCCESS)
-    {
-        return flush_status;
-    }
-
-    if (flushed)
-    {
-        return SUCCESS;
-    }
-    else
-    {
-        return DIDNOTHING;
-    }
     return SUCCESS;
 }
 
 hyperdisk::returncode
 hyperdisk :: disk :: do_mandatory_io()
 {
-    po6::threads::mutex::hold hold(&m_shards_mutate);
+    profiled_mutex::hold hold(&m_shards_mutate);
 
     if (m_needs_io != static_cast<size_t>(-1))
     {
@@ -662,7 +880,7 @@ hyperdisk :: disk :: do_optimistic_io()
     e::intrusive_ptr<shard_vector> shards;
 
     {
-        po6::threads::mutex::hold b(&m_shards_lock);
+        profiled_mutex::hold b(&m_shards_lock);
         shards = m_shards;
     }
 
@@ -689,7 +907,7 @@ hyperdisk :: disk :: do_optimistic_io()
     {
         double flip = static_cast<double>(rand_r(&m_seed)) / static_cast<double>(RAND_MAX);
         double thresh = 1 / pow(1.01, 100 - used);
-        po6::threads::mutex::hold holdm(&m_shards_mutate);
+        profiled_mutex::hold holdm(&m_shards_mutate);
 
         if (shards == m_shards && flip < thresh && most_loaded_amt >= 75)
         {
@@ -704,7 +922,7 @@ hyperdisk::returncode
 hyperdisk :: disk :: preallocate()
 {
     {
-        po6::threads::mutex::hold hold(&m_spare_shards_lock);
+        profiled_mutex::hold hold(&m_spare_shards_lock);
 
         if (m_spare_shards.size() >= 16)
         {
@@ -715,7 +933,7 @@ hyperdisk :: disk :: preallocate()
     e::intrusive_ptr<shard_vector> shards;
 
     {
-        po6::threads::mutex::hold hold(&m_shards_lock);
+        profiled_mutex::hold hold(&m_shards_lock);
         shards = m_shards;
     }
 
@@ -755,7 +973,7 @@ hyperdisk :: disk :: preallocate()
     bool need_shard = false;
 
     {
-        po6::threads::mutex::hold hold(&m_spare_shards_lock);
+        profiled_mutex::hold hold(&m_spare_shards_lock);
         need_shard = needed_shards - static_cast<ssize_t>(m_spare_shards.size()) > 0;
     }
 
@@ -764,7 +982,7 @@ hyperdisk :: disk :: preallocate()
         std::ostringstream ostr;
 
         {
-            po6::threads::mutex::hold hold(&m_spare_shards_lock);
+            profiled_mutex::hold hold(&m_spare_shards_lock);
             ostr << "spare-" << m_spare_shard_counter;
             ++m_spare_shard_counter;
         }
@@ -773,7 +991,7 @@ hyperdisk :: disk :: preallocate()
         e::intrusive_ptr<hyperdisk::shard> spareshard = hyperdisk::shard::create(m_base, sparepath);
 
         {
-            po6::threads::mutex::hold hold(&m_spare_shards_lock);
+            profiled_mutex::hold hold(&m_spare_shards_lock);
             m_spare_shards.push(std::make_pair(sparepath, spareshard));
         }
     }
@@ -788,7 +1006,7 @@ hyperdisk :: disk :: async()
     returncode ret = SUCCESS;
 
     {
-        po6::threads::mutex::hold b(&m_shards_lock);
+        profiled_mutex::hold b(&m_shards_lock);
         shards = m_shards;
     }
 
@@ -810,7 +1028,7 @@ hyperdisk :: disk :: sync()
     returncode ret = SUCCESS;
 
     {
-        po6::threads::mutex::hold b(&m_shards_lock);
+        profiled_mutex::hold b(&m_shards_lock);
         shards = m_shards;
     }
 
@@ -825,6 +1043,22 @@ hyperdisk :: disk :: sync()
     return ret;
 }
 
+void
+hyperdisk :: disk :: prefault()
+{
+    e::intrusive_ptr<shard_vector> shards;
+
+    {
+        profiled_mutex::hold b(&m_shards_lock);
+        shards = m_shards;
+    }
+
+    for (size_t i = 0; i < shards->size(); ++i)
+    {
+        shards->get_shard(i)->prefault();
+    }
+}
+
 hyperdisk :: disk :: disk(const po6::pathname& directory,
                           const hyperspacehashing::mask::hasher& hasher,
                           const uint16_t arity,
@@ -845,6 +1079,15 @@ hyperdisk :: disk :: disk(const po6::pathname& directory,
     , m_spare_shard_counter(0)
     , m_needs_io(-1)
     , m_seed(0)
+    , m_summary()
+    , m_summary_stale(false)
+    , m_ops(0)
+    , m_bytes(0)
+    , m_logged(0)
+    , m_flushed(0)
+    , m_drained_at(e::time())
+    , m_manifest()
+    , m_manifest_state_id()
 {
     if (mkdir(directory.get(), S_IRWXU) < 0 && errno != EEXIST)
     {
@@ -862,17 +1105,26 @@ hyperdisk :: disk :: disk(const po6::pathname& directory,
     if (!load_quiesced_state)
     {
         // Create a starting disk which holds everything.
-        po6::threads::mutex::hold a(&m_shards_mutate);
-        po6::threads::mutex::hold b(&m_shards_lock);
+        profiled_mutex::hold a(&m_shards_mutate);
+        profiled_mutex::hold b(&m_shards_lock);
         coordinate start;
         e::intrusive_ptr<shard> s = create_shard(start);
         m_shards = new shard_vector(start, s);
     }
     else
     {
-        // Reopen quiesced disk.
-        // XXX handle errors
-        load_state(quiesce_state_id);
+        // Reopen a disk from its manifest, or from the state file of a disk
+        // quiesced before manifests existed.
+        if (!load_manifest(quiesce_state_id) &&
+            (errno != ENOENT || quiesce_state_id.empty() ||
+             !load_state(quiesce_state_id)))
+        {
+            throw po6::error(errno == 0 ? EINVAL : errno);
+        }
+
+        // Summarizing reads every object, so it waits until a transfer
+        // first asks for the summary.
+        m_summary_stale = true;
     }
 }
 
@@ -914,7 +1166,7 @@ hyperdisk :: disk :: create_shard(const coordinate& c)
     e::intrusive_ptr<hyperdisk::shard> spareshard;
 
     {
-        po6::threads::mutex::hold hold(&m_spare_shards_lock);
+        profiled_mutex::hold hold(&m_spare_shards_lock);
 
         if (!m_spare_shards.empty())
         {
@@ -952,7 +1204,7 @@ hyperdisk :: disk :: create_tmp_shard(const coordinate& c)
     e::intrusive_ptr<hyperdisk::shard> spareshard;
 
     {
-        po6::threads::mutex::hold hold(&m_spare_shards_lock);
+        profiled_mutex::hold hold(&m_spare_shards_lock);
 
         if (!m_spare_shards.empty())
         {
@@ -1053,8 +1305,15 @@ hyperdisk :: disk :: clean_shard(size_t shard_num)
     }
 
     disk_guard.dismiss();
-    po6::threads::mutex::hold hold(&m_shards_lock);
-    m_shards = newshard_vector;
+
+    {
+        profiled_mutex::hold hold(&m_shards_lock);
+        m_shards = newshard_vector;
+    }
+
+    // The cleaned shard replaced the old one under the same name, so the
+    // manifest's offsets for it are stale.
+    write_manifest("");
     return SUCCESS;
 }
 
@@ -1215,7 +1474,7 @@ hyperdisk :: disk :: split_shard(size_t shard_num)
                                             one_zero_coord, one_zero);
 
         {
-            po6::threads::mutex::hold hold(&m_shards_lock);
+            profiled_mutex::hold hold(&m_shards_lock);
             m_shards = newshard_vector;
         }
 
@@ -1223,6 +1482,8 @@ hyperdisk :: disk :: split_shard(size_t shard_num)
         zog.dismiss();
         ozg.dismiss();
         oog.dismiss();
+        // Record the new shards before the old one goes away.
+        write_manifest("");
         return drop_shard(c);
     }
     catch (std::exception& e)
@@ -1230,3 +1491,205 @@ hyperdisk :: disk :: split_shard(size_t shard_num)
         return SPLITFAILED;
     }
 }
+
+bool
+hyperdisk :: disk :: flush_all()
+{
+    while (true)
+    {
+        returncode rc = flush(-1, false);
+
+        switch (rc)
+        {
+            case DIDNOTHING:
+                // All data is flushed, move on.
+                return true;
+            case SUCCESS:
+                // Some data flushed, try again.
+                continue;
+            case DATAFULL:
+            case SEARCHFULL:
+                // Split the shards and try agian.
+                do_mandatory_io();
+                continue;
+            case NOTFOUND:
+            case WRONGARITY:
+            case SYNCFAILED:
+            case DROPFAILED:
+            case MISSINGDISK:
+            case SPLITFAILED:
+            default:
+                return false;
+        }
+    }
+}
+
+void
+hyperdisk :: disk :: rebuild_summary()
+{
+    if (!m_summary_stale)
+    {
+        return;
+    }
+
+    hyperspacehashing::search terms(m_arity);
+    merkle summary;
+
+    for (e::intrusive_ptr<snapshot> snap = make_snapshot(terms);
+            snap->valid(); snap->next())
+    {
+        summary.insert(snap->key(), snap->version());
+    }
+
+    m_summary = summary;
+    m_summary_stale = false;
+}
+
+hyperdisk::returncode
+hyperdisk :: disk :: write(const coordinate& coord,
+                           const e::slice& key,
+                           const std::vector<e::slice>* value,
+                           uint64_t version,
+                           bool probe)
+{
+    bool del_needed = false;
+    size_t del_num = 0;
+    uint32_t del_offset = 0;
+    uint64_t del_version = 0;
+
+    for (size_t i = 0; probe && !del_needed && i < m_shards->size(); ++i)
+    {
+        if (!m_shards->get_coordinate(i).primary_intersects(coord))
+        {
+            continue;
+        }
+
+        returncode ret;
+        ret = m_shards->get_shard(i)->get(coord.primary_hash, key, &del_version);
+
+        if (ret == SUCCESS)
+        {
+            del_needed = true;
+            del_num = i;
+        }
+        else if (ret == NOTFOUND)
+        {
+        }
+        else
+        {
+            abort();
+        }
+    }
+
+    bool put_performed = false;
+    size_t put_num = 0;
+    uint32_t put_offset = 0;
+
+    if (value)
+    {
+        // This must start at the last position and work downward so that
+        // the last arg to "shard_vector->replace" will be considered first.
+        for (ssize_t i = m_shards->size() - 1; !put_performed && i >= 0; --i)
+        {
+            if (!m_shards->get_coordinate(i).intersects(coord))
+            {
+                continue;
+            }
+
+            returncode ret;
+            ret = m_shards->get_shard(i)->put(coord, key, *value,
+                                              version, &put_offset);
+
+            if (ret == SUCCESS)
+            {
+                put_performed = true;
+                put_num = i;
+            }
+            else if (ret == DATAFULL || ret == SEARCHFULL)
+            {
+                m_needs_io = i;
+                return ret;
+            }
+            else
+            {
+                abort();
+            }
+        }
+
+        if (!put_performed)
+        {
+            return DIDNOTHING;
+        }
+    }
+
+    if (del_needed && (!put_performed || del_num != put_num))
+    {
+        switch (m_shards->get_shard(del_num)->del(coord.primary_hash, key, &del_offset))
+        {
+            case SUCCESS:
+                break;
+            case NOTFOUND:
+            case DATAFULL:
+            case WRONGARITY:
+            case SEARCHFULL:
+            case SYNCFAILED:
+            case DROPFAILED:
+            case MISSINGDISK:
+            case SPLITFAILED:
+            case DIDNOTHING:
+            default:
+                abort();
+        }
+    }
+
+    if (del_needed)
+    {
+        m_summary.remove(key, del_version);
+    }
+
+    if (put_performed)
+    {
+        m_summary.insert(key, version);
+    }
+
+    // Here we prepare two offset_updates that we can push onto the offsets
+    // log.  We then make the offset changes to the shard_vector, and then
+    // finish by removing the items we put on the log.
+    std::vector<offset_update> updates;
+
+    if (del_needed && (!put_performed || del_num != put_num))
+    {
+        updates.push_back(offset_update());
+        updates.back().shard_generation = m_shards->generation();
+        updates.back().shard_num = del_num;
+        updates.back().new_offset = del_offset;
+    }
+
+    if (put_performed)
+    {
+        updates.push_back(offset_update());
+        updates.back().shard_generation = m_shards->generation();
+        updates.back().shard_num = put_num;
+        updates.back().new_offset = put_offset;
+    }
+
+    // Log our intentions.
+    m_offsets.batch_append(updates);
+
+    // Do our updates.
+    for (size_t i = 0; i < updates.size(); ++i)
+    {
+        assert(updates[i].shard_generation == m_shards->generation());
+        assert(updates[i].new_offset > m_shards->get_offset(updates[i].shard_num));
+        m_shards->set_offset(updates[i].shard_num, updates[i].new_offset);
+    }
+
+    // Remove our updates from the log.
+    for (size_t i = 0; i < updates.size(); ++i)
+    {
+        assert(m_offsets.oldest() == updates[i]);
+        m_offsets.remove_oldest();
+    }
+
+    return SUCCESS;
+}
@@ -0,0 +1,145 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef hyperdisk_archive_h_
+#define hyperdisk_archive_h_
+
+// C
+#include <stdint.h>
+
+// STL
+#include <string>
+#include <vector>
+
+// po6
+#include <po6/io/fd.h>
+#include <po6/pathname.h>
+
+// e
+#include <e/slice.h>
+
+namespace hyperdisk
+{
+
+// A backup archive holds the objects of one disk as a sequence of compressed,
+// checksummed blocks, so that a restore can stream it without trusting it.
+//
+//     header:  [u64 MAGIC][u32 FORMAT][u32 label size][label]
+//     block:   [u32 raw size][u32 stored size][u64 checksum][stored bytes]
+//     trailer: a block header with a raw size of zero, then
+//              [u64 objects][u64 watermark][u64 checksum]
+//
+// Blocks are zlib-compressed and checksummed with CityHash64.  Within a block
+// each object is [u64 version][u32 key size][key][u32 n] and n values, each
+// [u32 size][bytes].  The watermark is the highest version in the archive.
+// The label is opaque here; the daemon uses it to name the region.  All
+// integers are little-endian.
+
+class archive_writer
+{
+    public:
+        static const uint64_t MAGIC;
+        static const uint32_t FORMAT;
+
+    public:
+        archive_writer();
+        ~archive_writer() throw ();
+
+    public:
+        // Start writing an archive.  It only appears under "path" once
+        // close() succeeds.
+        bool open(const po6::pathname& path, const e::slice& label);
+        bool append(const e::slice& key, const std::vector<e::slice>& value,
+                    uint64_t version);
+        bool close();
+        uint64_t objects() const { return m_objects; }
+        uint64_t watermark() const { return m_watermark; }
+
+    private:
+        archive_writer(const archive_writer&);
+
+    private:
+        bool flush_block();
+
+    private:
+        archive_writer& operator = (const archive_writer&);
+
+    private:
+        po6::io::fd m_fd;
+        po6::pathname m_path;
+        po6::pathname m_tmp;
+        std::vector<uint8_t> m_block;
+        std::vector<uint8_t> m_stored;
+        uint64_t m_objects;
+        uint64_t m_watermark;
+};
+
+class archive_reader
+{
+    public:
+        archive_reader();
+        ~archive_reader() throw ();
+
+    public:
+        bool open(const po6::pathname& path);
+        const std::string& label() const { return m_label; }
+        // Return the next object.  Slices remain valid until the next call.
+        // Returns false at the end of the archive, or if it is corrupt or
+        // truncated, in which case error() is true.
+        bool next(e::slice* key, std::vector<e::slice>* value, uint64_t* version);
+        bool error() const { return m_error; }
+        // These come from the trailer, and are set once next() returns false
+        // without error.
+        uint64_t objects() const { return m_objects; }
+        uint64_t watermark() const { return m_watermark; }
+
+    private:
+        archive_reader(const archive_reader&);
+
+    private:
+        bool read_block();
+
+    private:
+        archive_reader& operator = (const archive_reader&);
+
+    private:
+        po6::io::fd m_fd;
+        std::string m_label;
+        std::vector<uint8_t> m_block;
+        std::vector<uint8_t> m_stored;
+        size_t m_off;
+        bool m_done;
+        bool m_error;
+        uint64_t m_seen;
+        uint64_t m_objects;
+        uint64_t m_watermark;
+};
+
+} // namespace hyperdisk
+
+#endif // hyperdisk_archive_h_
@@ -36,7 +36,6 @@
 
 // po6
 #include <po6/pathname.h>
-#include <po6/threads/mutex.h>
 
 // e
 #include <e/intrusive_ptr.h>
@@ -47,6 +46,8 @@
 #include <hyperspacehashing/mask.h>
 
 // HyperDisk
+#include <hyperdisk/merkle.h>
+#include <hyperdisk/profiled_mutex.h>
 #include <hyperdisk/reference.h>
 #include <hyperdisk/returncode.h>
 #include <hyperdisk/snapshot.h>
@@ -63,6 +64,44 @@ class shard_vector;
 namespace hyperdisk
 {
 
+// An object written by disk::bulk_load.  The backing is only needed if the
+// object ends up in the write-ahead log.
+class bulk_object
+{
+    public:
+        bulk_object(std::tr1::shared_ptr<e::buffer> b,
+                    const e::slice& k,
+                    const std::vector<e::slice>& v,
+                    uint64_t ver)
+            : backing(b), key(k), value(v), version(ver) {}
+
+    public:
+        std::tr1::shared_ptr<e::buffer> backing;
+        e::slice key;
+        std::vector<e::slice> value;
+        uint64_t version;
+};
+
+// A point-in-time view of a disk's write-ahead log and shards.
+class disk_stats
+{
+    public:
+        disk_stats()
+            : logged(0), flushed(0), log_depth(0), lag_nanos(0), shards(0) {}
+
+    public:
+        // Objects appended to and flushed from the log since the disk opened.
+        uint64_t logged;
+        uint64_t flushed;
+        // Objects in the log, and how long ago the log was last empty.
+        uint64_t log_depth;
+        uint64_t lag_nanos;
+        uint64_t shards;
+        lockstats shards_mutate;
+        lockstats shards_lock;
+        lockstats spare_shards_lock;
+};
+
 // A simple embeddable disk layer which offers linearizable GET/PUT/DEL
 // operations, and snapshots which exhibit monotonic reads.
 //
@@ -76,7 +115,10 @@ class disk
         static e::intrusive_ptr<disk> create(const po6::pathname& directory,
                                              const hyperspacehashing::mask::hasher& hasher,
                                              uint16_t arity);
-        // Re-open quiesced disk.                                             
+        // Re-open a disk from its manifest.  If "quiesce_state_id" is not
+        // empty, the manifest must be the one written when the disk quiesced
+        // under that id.  Otherwise the disk holds whatever had been flushed
+        // when the manifest was last written.
         static e::intrusive_ptr<disk> open(const po6::pathname& directory,
                                            const hyperspacehashing::mask::hasher& hasher,
                                            uint16_t arity,
@@ -91,17 +133,35 @@ class disk
                        const std::vector<e::slice>& value, uint64_t version);
         // May return SUCCESS.
         returncode del(std::tr1::shared_ptr<e::buffer> backing, const e::slice& key);
+        // Write a batch of objects straight to the shards, without passing
+        // through the write-ahead log.  If "unique" is set, the caller
+        // promises that none of the keys are already on disk.  If the log is
+        // not empty the objects are appended to it instead, to preserve order.
+        // May return SUCCESS, WRONGARITY, or SPLITFAILED.
+        returncode bulk_load(const std::vector<bulk_object>& objects, bool unique);
         // Create a snapshot of the disk.  The snapshot will contain the result
         // after applying a prefix of the execution history of the disk.
         e::intrusive_ptr<snapshot> make_snapshot(const hyperspacehashing::search& terms);
         // Create a snapshot of the disk.  This will return every result that
         // will be returned by make_snapshot(), but will then continue to return
         // any execution history past the point at which the snapshot was taken.
-        e::intrusive_ptr<rolling_snapshot> make_rolling_snapshot();
+        // If "summary" is given, it is set to summarize exactly the objects in
+        // the snapshot portion.
+        e::intrusive_ptr<rolling_snapshot> make_rolling_snapshot(merkle* summary = NULL);
+        // Flush everything and summarize the objects on disk.  Returns false
+        // if the log could not be flushed.
+        bool summarize(merkle* summary);
+        // Flush the entire log to the shards, splitting them as necessary.
+        bool flush_all();
         // Drop the disk.  This removes it from the filesystem.  All existing
         // snapshots will continue to exist, but no calls should be made to the
         // disk (except the destructor).
         returncode drop();
+        // Return the number of GET/PUT/DEL operations and the bytes they
+        // carried since the last call, and reset both counts to zero.
+        void load(uint64_t* ops, uint64_t* bytes);
+        // Fill in "s" without blocking writers or the flush threads.
+        void stats(disk_stats* s);
 
     public:
         // Move data from in-memory data structures to the shards.  This
@@ -127,10 +187,18 @@ class disk
         // SYNCFAILED.  errno will be set to the reason the sync failed.
         returncode async();
         returncode sync();
+        // Fault in the index and used data of every shard so that reads on
+        // the latency-critical path do not block on the page cache.  Shards
+        // created by later splits are not prefaulted.
+        void prefault();
 
     public:
         // Quiesce.
         bool quiesce(const std::string& quiesce_state_id);
+        // Record the shards and their offsets in the manifest, if they
+        // changed since it was last written.  Returns true without writing
+        // if the shards are busy being mutated.
+        bool checkpoint();
 
     private:
         friend class e::intrusive_ptr<disk>;
@@ -168,30 +236,68 @@ class disk
         returncode deal_with_full_shard(size_t shard_num);
         returncode clean_shard(size_t shard_num);
         returncode split_shard(size_t shard_num);
+        // Recompute m_summary from the shards if it is stale.  The
+        // m_shards_mutate lock must be held.
+        void rebuild_summary();
+        // Serialize the shard vector into a manifest.  The m_shards_mutate
+        // lock must be held for both, so that the offsets are stable and
+        // manifests are written in order.
+        void encode_manifest(const std::string& quiesce_state_id,
+                             std::vector<uint8_t>* manifest);
+        bool write_manifest(const std::string& quiesce_state_id);
+        // Move one object into the shards, replacing any older copy that
+        // "probe" finds.  A NULL value deletes the key.  The m_shards_mutate
+        // lock must be held.  May return SUCCESS, DATAFULL or SEARCHFULL (and
+        // set m_needs_io), or DIDNOTHING if no shard would take the object.
+        returncode write(const hyperspacehashing::mask::coordinate& coord,
+                         const e::slice& key,
+                         const std::vector<e::slice>* value,
+                         uint64_t version,
+                         bool probe);
 
     private:
         size_t m_ref;
         size_t m_arity;
         hyperspacehashing::mask::hasher m_hasher;
         // Read about locking in the source.
-        po6::threads::mutex m_shards_mutate;
-        po6::threads::mutex m_shards_lock;
+        profiled_mutex m_shards_mutate;
+        profiled_mutex m_shards_lock;
         e::intrusive_ptr<shard_vector> m_shards;
         e::locking_iterable_fifo<log_entry> m_log;
         e::locking_iterable_fifo<offset_update> m_offsets;
         po6::io::fd m_base;
         po6::pathname m_base_filename;
-        po6::threads::mutex m_spare_shards_lock;
+        profiled_mutex m_spare_shards_lock;
         std::queue<std::pair<po6::pathname, e::intrusive_ptr<shard> > > m_spare_shards;
         size_t m_spare_shard_counter;
         size_t m_needs_io;
         unsigned int m_seed;
+        // Covers the objects in the shards.  Protected by m_shards_mutate.
+        // A reopened disk computes it on first use.
+        merkle m_summary;
+        bool m_summary_stale;
+        // Traffic since the last call to load().  Updated atomically.
+        uint64_t m_ops;
+        uint64_t m_bytes;
+        // Objects appended to and flushed from m_log, and when the flush
+        // threads last found it empty.  Updated atomically.
+        uint64_t m_logged;
+        uint64_t m_flushed;
+        uint64_t m_drained_at;
+        // The manifest last written, and the quiesce state id it carries.
+        // Protected by m_shards_mutate.
+        std::vector<uint8_t> m_manifest;
+        std::string m_manifest_state_id;
 
     private:
-        // State dump and load.
+        // State dump and load.  Disks quiesced before manifests existed left
+        // a text state file instead, which load_state still reads.
+        static const uint64_t MANIFEST_MAGIC;
+        static const uint32_t MANIFEST_FORMAT;
+        static const char* MANIFEST_FILE_NAME;
         static const int STATE_FILE_VER;
         static const char* STATE_FILE_NAME;
-        bool dump_state(const std::string& quiesce_state_id);
+        bool load_manifest(const std::string& quiesce_state_id);
         bool load_state(const std::string& quiesce_state_id);
 };
 
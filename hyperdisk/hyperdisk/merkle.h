@@ -0,0 +1,82 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef hyperdisk_merkle_h_
+#define hyperdisk_merkle_h_
+
+// STL
+#include <vector>
+
+// e
+#include <e/slice.h>
+
+namespace hyperdisk
+{
+
+// A summary of the objects on a disk that two copies of a region can compare
+// to find where they disagree.  Keys are spread over LEAVES buckets by the
+// low-order bits of their hash, and each leaf is the XOR of a hash of every
+// (key, version) pair in its bucket.  Adding and removing an object are the
+// same operation, so the leaves are maintained as the disk is written, and two
+// copies whose leaves match almost certainly hold the same objects in that
+// range of the key space.  The root covers all leaves.
+
+class merkle
+{
+    public:
+        static const size_t LEAVES = 4096;
+        static size_t leaf(const e::slice& key);
+
+    public:
+        merkle();
+        ~merkle() throw ();
+
+    public:
+        void insert(const e::slice& key, uint64_t version);
+        void remove(const e::slice& key, uint64_t version);
+        // True if the summary covers no objects.
+        bool empty() const { return m_objects == 0; }
+        uint64_t root() const;
+        const std::vector<uint64_t>& leaves() const { return m_leaves; }
+        // Set bit i of "differ" for every leaf i that is not the same in
+        // "other".  Returns false if "other" is not a summary of LEAVES leaves.
+        bool compare(const std::vector<uint64_t>& other,
+                     std::vector<uint64_t>* differ) const;
+        // Test the bit for "key" in a bitmap built by "compare".
+        static bool differs(const std::vector<uint64_t>& differ, const e::slice& key);
+
+    private:
+        void toggle(const e::slice& key, uint64_t version);
+
+    private:
+        std::vector<uint64_t> m_leaves;
+        uint64_t m_objects;
+};
+
+} // namespace hyperdisk
+
+#endif // hyperdisk_merkle_h_
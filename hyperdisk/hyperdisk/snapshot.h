@@ -69,6 +69,7 @@ class snapshot
     private:
         friend class e::intrusive_ptr<snapshot>;
         friend class disk;
+        friend class rolling_snapshot;
 
     private:
         snapshot(const hyperspacehashing::mask::coordinate& coord,
@@ -98,6 +99,16 @@ class rolling_snapshot
         bool valid();
         void next();
 
+    public:
+        // True while iterating the frozen snapshot of the shards, and false
+        // once the rolling snapshot has moved on to replaying the log.  Keys
+        // and values returned in the former phase point into the shards and
+        // remain valid for the lifetime of the rolling snapshot.
+        bool in_snapshot();
+        // A new rolling snapshot at the same position as this one.  The two
+        // advance independently.
+        e::intrusive_ptr<rolling_snapshot> clone();
+
     public:
         bool has_value();
         uint64_t version();
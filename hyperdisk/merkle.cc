@@ -0,0 +1,110 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Google CityHash
+#include <city.h>
+
+// HyperDisk
+#include "hyperdisk/hyperdisk/merkle.h"
+
+const size_t hyperdisk :: merkle :: LEAVES;
+
+size_t
+hyperdisk :: merkle :: leaf(const e::slice& key)
+{
+    // The high-order bits of the key's hash determine its region, so every key
+    // on a disk agrees on them.  Use the low-order bits instead.
+    return CityHash64(reinterpret_cast<const char*>(key.data()), key.size()) & (LEAVES - 1);
+}
+
+hyperdisk :: merkle :: merkle()
+    : m_leaves(LEAVES, 0)
+    , m_objects(0)
+{
+}
+
+hyperdisk :: merkle :: ~merkle() throw ()
+{
+}
+
+void
+hyperdisk :: merkle :: insert(const e::slice& key, uint64_t version)
+{
+    toggle(key, version);
+    ++m_objects;
+}
+
+void
+hyperdisk :: merkle :: remove(const e::slice& key, uint64_t version)
+{
+    toggle(key, version);
+    --m_objects;
+}
+
+uint64_t
+hyperdisk :: merkle :: root() const
+{
+    return CityHash64(reinterpret_cast<const char*>(&m_leaves.front()),
+                      m_leaves.size() * sizeof(uint64_t));
+}
+
+bool
+hyperdisk :: merkle :: compare(const std::vector<uint64_t>& other,
+                               std::vector<uint64_t>* differ) const
+{
+    if (other.size() != LEAVES)
+    {
+        return false;
+    }
+
+    differ->assign(LEAVES / 64, 0);
+
+    for (size_t i = 0; i < LEAVES; ++i)
+    {
+        if (m_leaves[i] != other[i])
+        {
+            (*differ)[i / 64] |= 1ULL << (i % 64);
+        }
+    }
+
+    return true;
+}
+
+bool
+hyperdisk :: merkle :: differs(const std::vector<uint64_t>& differ,
+                               const e::slice& key)
+{
+    size_t i = leaf(key);
+    return differ.size() == LEAVES / 64 && (differ[i / 64] & (1ULL << (i % 64)));
+}
+
+void
+hyperdisk :: merkle :: toggle(const e::slice& key, uint64_t version)
+{
+    m_leaves[leaf(key)] ^= CityHash64WithSeed(reinterpret_cast<const char*>(key.data()),
+                                              key.size(), version);
+}
@@ -110,29 +110,44 @@ hyperdisk :: shard :: open(const po6::io::fd& base,
 
     // Create the shard object.
     e::intrusive_ptr<shard> ret = new shard(&fd);
-
     // XXX We don't correctly restore the offsets.
-    while (ret->m_search_offset < SEARCH_INDEX_ENTRIES &&
-           ret->m_search_log[ret->m_search_offset].offset != 0)
+    ret->replay_search_log();
+    return ret;
+}
+
+e::intrusive_ptr<hyperdisk::shard>
+hyperdisk :: shard :: open(const po6::io::fd& base,
+                           const po6::pathname& filename,
+                           uint32_t data_offset,
+                           uint32_t search_offset)
+{
+    if (data_offset < INDEX_SEGMENT_SIZE ||
+        search_offset > SEARCH_INDEX_ENTRIES)
     {
-        ret->m_data_offset = ret->m_search_log[ret->m_search_offset].offset;
-        ++ ret->m_search_offset;
+        return open(base, filename);
     }
 
-    // XXX If you're looking for bugs that stem from opening shards, it's
-    // probably in this code block.
-    if (ret->m_search_offset > 0)
+    po6::io::fd fd(openat(base.get(), filename.get(), O_RDWR));
+
+    if (fd.get() < 0)
     {
-        e::slice key;
-        std::vector<e::slice> value;
-        size_t key_size = ret->data_key_size(ret->m_data_offset);
-        ret->data_key(ret->m_data_offset, key_size, &key);
-        ret->data_value(ret->m_data_offset, key_size, &value);
-        size_t entry_size = ret->data_size(key, value);
-        ret->m_data_offset = (ret->m_data_offset + entry_size + 7) & ~7; // Keep everything 8-byte aligned.
-        assert(ret->m_data_offset <= FILE_SIZE);
+        throw po6::error(errno);
     }
 
+    e::intrusive_ptr<shard> ret = new shard(&fd, false);
+
+    // The shard was cleaned or replaced after the manifest was written.
+    if (search_offset > 0 &&
+        ret->m_search_log[search_offset - 1].offset == 0)
+    {
+        return open(base, filename);
+    }
+
+    // The manifest's data offset also covers deletions, which the search
+    // log cannot show.
+    ret->m_data_offset = data_offset;
+    ret->m_search_offset = search_offset;
+    ret->replay_search_log();
     return ret;
 }
 
@@ -164,7 +179,8 @@ hyperdisk :: shard :: get(uint32_t primary_hash,
 
 hyperdisk::returncode
 hyperdisk :: shard :: get(uint32_t primary_hash,
-                          const e::slice& key)
+                          const e::slice& key,
+                          uint64_t* version)
 {
     // Find the bucket.
     size_t table_entry;
@@ -177,6 +193,11 @@ hyperdisk :: shard :: get(uint32_t primary_hash,
         return NOTFOUND;
     }
 
+    if (version)
+    {
+        *version = data_version(table_offset);
+    }
+
     return SUCCESS;
 }
 
@@ -366,6 +387,41 @@ hyperdisk :: shard :: sync()
     return SUCCESS;
 }
 
+hyperdisk::returncode
+hyperdisk :: shard :: sync_written()
+{
+    // Writers may be appending as we go; whatever they add past "end" is
+    // left for the next call.
+    uint32_t end = std::min(m_data_offset, static_cast<uint32_t>(FILE_SIZE));
+    __sync_synchronize();
+    const size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = m_synced_offset / page * page;
+
+    // Updates to the hash table land anywhere in the index segment, but
+    // msync only writes back the pages that are dirty.
+    if (msync(m_data, INDEX_SEGMENT_SIZE, MS_SYNC) < 0 ||
+        (end > start && msync(m_data + start, end - start, MS_SYNC) < 0))
+    {
+        return SYNCFAILED;
+    }
+
+    m_synced_offset = std::max(m_synced_offset, end);
+    return SUCCESS;
+}
+
+void
+hyperdisk :: shard :: prefault()
+{
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t end = m_data_offset;
+    volatile char sink = 0;
+
+    for (size_t off = 0; off < end; off += page)
+    {
+        sink += m_data[off];
+    }
+}
+
 void
 hyperdisk :: shard :: copy_to(const coordinate& c, e::intrusive_ptr<shard> s)
 {
@@ -540,13 +596,14 @@ hyperdisk :: shard :: make_snapshot()
     return shard_snapshot(m_data_offset, this);
 }
 
-hyperdisk :: shard :: shard(po6::io::fd* fd)
+hyperdisk :: shard :: shard(po6::io::fd* fd, bool willneed)
     : m_ref(0)
     , m_hash_table(NULL)
     , m_search_log(NULL)
     , m_data(NULL)
     , m_data_offset(INDEX_SEGMENT_SIZE)
     , m_search_offset(0)
+    , m_synced_offset(INDEX_SEGMENT_SIZE)
 {
     assert(SEARCH_INDEX_ENTRY_SIZE == sizeof(hyperdisk::shard::log_entry));
     m_data = static_cast<char*>(mmap(NULL, FILE_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd->get(), 0));
@@ -556,12 +613,12 @@ hyperdisk :: shard :: shard(po6::io::fd* fd)
         throw po6::error(errno);
     }
 
-    if (madvise(m_data, HASH_TABLE_SIZE, MADV_WILLNEED) < 0)
+    if (willneed && madvise(m_data, HASH_TABLE_SIZE, MADV_WILLNEED) < 0)
     {
         throw po6::error(errno);
     }
 
-    if (madvise(m_data + HASH_TABLE_SIZE, SEARCH_INDEX_SIZE, MADV_WILLNEED) < 0)
+    if (willneed && madvise(m_data + HASH_TABLE_SIZE, SEARCH_INDEX_SIZE, MADV_WILLNEED) < 0)
     {
         throw po6::error(errno);
     }
@@ -728,3 +785,31 @@ hyperdisk :: shard :: invalidate_search_log(uint32_t to_invalidate, uint32_t inv
         }
     }
 }
+
+void
+hyperdisk :: shard :: replay_search_log()
+{
+    uint32_t last = 0;
+
+    while (m_search_offset < SEARCH_INDEX_ENTRIES &&
+           m_search_log[m_search_offset].offset != 0)
+    {
+        last = m_search_log[m_search_offset].offset;
+        ++m_search_offset;
+    }
+
+    // XXX If you're looking for bugs that stem from opening shards, it's
+    // probably in this code block.
+    if (last > 0)
+    {
+        e::slice key;
+        std::vector<e::slice> value;
+        size_t key_size = data_key_size(last);
+        data_key(last, key_size, &key);
+        data_value(last, key_size, &value);
+        size_t entry_size = data_size(key, value);
+        uint32_t end = (last + entry_size + 7) & ~7; // Keep everything 8-byte aligned.
+        assert(end <= FILE_SIZE);
+        m_data_offset = std::max(m_data_offset, end);
+    }
+}
@@ -98,12 +98,21 @@ class shard
         // XXX This method is broken.  It does not restore the offsets.
         static e::intrusive_ptr<shard> open(const po6::io::fd& dir,
                                             const po6::pathname& filename);
+        // Re-open a shard at the offsets a disk manifest recorded for it.
+        // Only entries appended to the search log since then are read, and
+        // the index is left to fault in on first access.  A manifest that
+        // claims more entries than the shard holds falls back to open().
+        static e::intrusive_ptr<shard> open(const po6::io::fd& dir,
+                                            const po6::pathname& filename,
+                                            uint32_t data_offset,
+                                            uint32_t search_offset);
 
     public:
         // May return SUCCESS or NOTFOUND.
         returncode get(uint32_t primary_hash, const e::slice& key,
                        std::vector<e::slice>* value, uint64_t* version);
-        returncode get(uint32_t primary_hash, const e::slice& key);
+        returncode get(uint32_t primary_hash, const e::slice& key,
+                       uint64_t* version = NULL);
         // May return SUCCESS, DATAFULL, HASHFULL, or SEARCHFULL.
         returncode put(const hyperspacehashing::mask::coordinate& coord,
                        const e::slice& key,
@@ -121,12 +130,24 @@ class shard
         // How much space (as a percentage) is used by either current or stale
         // data.
         int used_space() const;
+        // Where the next object goes, as recorded in disk manifests.  Only
+        // stable while the shard is not being written.
+        uint32_t data_offset() const { return m_data_offset; }
+        uint32_t search_offset() const { return m_search_offset; }
         // May return SUCCESS or SYNCFAILED.  errno will be set to the reason
         // the sync failed.
         returncode async();
         // May return SUCCESS or SYNCFAILED.  errno will be set to the reason
         // the sync failed.
         returncode sync();
+        // Write the index and the data appended since the last call back to
+        // disk with msync(MS_SYNC), so that a manifest recording the current
+        // offsets survives a power loss.  May return SUCCESS or SYNCFAILED.
+        returncode sync_written();
+        // Fault in every page of the index segment and of the used portion of
+        // the data segment so that later reads do not take a page fault.  This
+        // does not pin the pages; memory pressure may still evict them.
+        void prefault();
         // Copy all non-stale data from this shard to the other shard,
         // completely erasing all the data in the other shard.  Only
         // entries which match the coordinate will be kept.
@@ -154,7 +175,7 @@ class shard
         } __attribute__ ((packed));
 
     private:
-        shard(po6::io::fd* fd);
+        shard(po6::io::fd* fd, bool willneed = true);
         shard(const shard&);
         ~shard() throw ();
 
@@ -184,6 +205,9 @@ class shard
         // This will invalidate any entry in the search log which references
         // the specified offset.
         void invalidate_search_log(uint32_t to_invalidate, uint32_t invalidate_with);
+        // Advance the offsets past any search log entries written after
+        // m_search_offset.
+        void replay_search_log();
 
     private:
         shard& operator = (const shard&);
@@ -195,6 +219,8 @@ class shard
         char* m_data;
         uint32_t m_data_offset;
         uint32_t m_search_offset;
+        // Data before this offset is known to be on disk.
+        uint32_t m_synced_offset;
 };
 
 } // namespace hyperdisk
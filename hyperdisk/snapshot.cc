@@ -143,6 +143,20 @@ hyperdisk :: rolling_snapshot :: next()
     }
 }
 
+bool
+hyperdisk :: rolling_snapshot :: in_snapshot()
+{
+    return m_snap->valid();
+}
+
+e::intrusive_ptr<hyperdisk::rolling_snapshot>
+hyperdisk :: rolling_snapshot :: clone()
+{
+    std::vector<hyperdisk::shard_snapshot> snaps(m_snap->m_snaps);
+    e::intrusive_ptr<snapshot> snap = new snapshot(m_snap->m_coord, m_snap->m_shards, &snaps);
+    return new rolling_snapshot(m_iter, snap);
+}
+
 bool
 hyperdisk :: rolling_snapshot :: has_value()
 {
@@ -0,0 +1,142 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// C
+#include <cstdlib>
+
+// POSIX
+#include <unistd.h>
+
+// STL
+#include <string>
+
+// Google Test
+#include <gtest/gtest.h>
+
+// HyperDisk
+#include "hyperdisk/hyperdisk/archive.h"
+
+#pragma GCC diagnostic ignored "-Wswitch-default"
+
+namespace
+{
+
+class ArchiveTest : public ::testing::Test
+{
+    protected:
+        ArchiveTest() : m_path() {}
+
+        virtual void SetUp()
+        {
+            char tmpl[] = "archive-test-XXXXXX";
+            ASSERT_TRUE(mkdtemp(tmpl));
+            m_dir = tmpl;
+            m_path = m_dir + "/region.hdb";
+        }
+
+        virtual void TearDown()
+        {
+            unlink(m_path.c_str());
+            rmdir(m_dir.c_str());
+        }
+
+        std::string m_dir;
+        std::string m_path;
+};
+
+TEST_F(ArchiveTest, RoundTrip)
+{
+    hyperdisk::archive_writer w;
+    std::vector<e::slice> value;
+    value.push_back(e::slice("value", 5));
+    value.push_back(e::slice("", 0));
+    ASSERT_TRUE(w.open(po6::pathname(m_path), e::slice("label", 5)));
+    // Enough objects to span several blocks.
+    std::string big(4096, 'x');
+    value[1] = e::slice(big.data(), big.size());
+
+    for (uint64_t i = 0; i < 1000; ++i)
+    {
+        ASSERT_TRUE(w.append(e::slice(&i, sizeof(i)), value, i + 1));
+    }
+
+    // Nothing is visible until the archive is closed.
+    ASSERT_NE(0, access(m_path.c_str(), F_OK));
+    ASSERT_TRUE(w.close());
+    ASSERT_EQ(1000U, w.objects());
+    ASSERT_EQ(1000U, w.watermark());
+
+    hyperdisk::archive_reader r;
+    e::slice key;
+    uint64_t version;
+    ASSERT_TRUE(r.open(po6::pathname(m_path)));
+    ASSERT_EQ("label", r.label());
+
+    for (uint64_t i = 0; i < 1000; ++i)
+    {
+        ASSERT_TRUE(r.next(&key, &value, &version));
+        ASSERT_EQ(sizeof(i), key.size());
+        ASSERT_EQ(0, memcmp(key.data(), &i, sizeof(i)));
+        ASSERT_EQ(i + 1, version);
+        ASSERT_EQ(2U, value.size());
+        ASSERT_TRUE(value[0] == e::slice("value", 5));
+        ASSERT_EQ(big.size(), value[1].size());
+    }
+
+    ASSERT_FALSE(r.next(&key, &value, &version));
+    ASSERT_FALSE(r.error());
+    ASSERT_EQ(1000U, r.objects());
+    ASSERT_EQ(1000U, r.watermark());
+}
+
+TEST_F(ArchiveTest, Corrupt)
+{
+    hyperdisk::archive_writer w;
+    std::vector<e::slice> value(1, e::slice("value", 5));
+    ASSERT_TRUE(w.open(po6::pathname(m_path), e::slice()));
+    ASSERT_TRUE(w.append(e::slice("key", 3), value, 1));
+    ASSERT_TRUE(w.close());
+
+    // Flip a byte in the compressed block.
+    FILE* f = fopen(m_path.c_str(), "r+");
+    ASSERT_TRUE(f);
+    ASSERT_EQ(0, fseek(f, 40, SEEK_SET));
+    int c = fgetc(f);
+    ASSERT_EQ(0, fseek(f, 40, SEEK_SET));
+    fputc(c ^ 0xff, f);
+    fclose(f);
+
+    hyperdisk::archive_reader r;
+    e::slice key;
+    uint64_t version;
+    ASSERT_TRUE(r.open(po6::pathname(m_path)));
+    ASSERT_FALSE(r.next(&key, &value, &version));
+    ASSERT_TRUE(r.error());
+}
+
+} // namespace
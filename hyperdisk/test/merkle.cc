@@ -0,0 +1,91 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Google Test
+#include <gtest/gtest.h>
+
+// HyperDisk
+#include "hyperdisk/hyperdisk/merkle.h"
+
+#pragma GCC diagnostic ignored "-Wswitch-default"
+
+namespace
+{
+
+TEST(MerkleTest, CtorAndDtor)
+{
+    hyperdisk::merkle m;
+    ASSERT_TRUE(m.empty());
+    ASSERT_EQ(hyperdisk::merkle::LEAVES, m.leaves().size());
+}
+
+TEST(MerkleTest, InsertRemove)
+{
+    hyperdisk::merkle a;
+    hyperdisk::merkle b;
+    uint64_t root = a.root();
+    a.insert(e::slice("key", 3), 1);
+    ASSERT_FALSE(a.empty());
+    ASSERT_NE(root, a.root());
+    a.remove(e::slice("key", 3), 1);
+    ASSERT_TRUE(a.empty());
+    ASSERT_EQ(root, a.root());
+
+    // Order does not matter.
+    a.insert(e::slice("one", 3), 1);
+    a.insert(e::slice("two", 3), 2);
+    b.insert(e::slice("two", 3), 2);
+    b.insert(e::slice("one", 3), 1);
+    ASSERT_EQ(a.root(), b.root());
+}
+
+TEST(MerkleTest, Compare)
+{
+    hyperdisk::merkle a;
+    hyperdisk::merkle b;
+    std::vector<uint64_t> differ;
+    a.insert(e::slice("same", 4), 1);
+    b.insert(e::slice("same", 4), 1);
+    a.insert(e::slice("old", 3), 1);
+    b.insert(e::slice("old", 3), 2);
+    a.insert(e::slice("gone", 4), 1);
+
+    ASSERT_TRUE(a.compare(b.leaves(), &differ));
+    ASSERT_EQ(hyperdisk::merkle::LEAVES / 64, differ.size());
+    ASSERT_TRUE(hyperdisk::merkle::differs(differ, e::slice("old", 3)));
+    ASSERT_TRUE(hyperdisk::merkle::differs(differ, e::slice("gone", 4)));
+
+    if (hyperdisk::merkle::leaf(e::slice("same", 4)) != hyperdisk::merkle::leaf(e::slice("old", 3)) &&
+        hyperdisk::merkle::leaf(e::slice("same", 4)) != hyperdisk::merkle::leaf(e::slice("gone", 4)))
+    {
+        ASSERT_FALSE(hyperdisk::merkle::differs(differ, e::slice("same", 4)));
+    }
+
+    ASSERT_FALSE(a.compare(std::vector<uint64_t>(3), &differ));
+}
+
+} // namespace
@@ -515,4 +515,40 @@ TEST(ShardTest, Snapshot)
     EXPECT_FALSE(s5b.valid());
 }
 
+TEST(ShardTest, ReopenFromManifest)
+{
+    po6::io::fd cwd(AT_FDCWD);
+    e::intrusive_ptr<hyperdisk::shard> d = hyperdisk::shard::create(cwd, "tmp-disk");
+    e::guard g = e::makeguard(::unlink, "tmp-disk");
+    std::vector<e::slice> value(1, e::slice("value", 5));
+    uint64_t version = 1;
+
+    ASSERT_EQ(hyperdisk::SUCCESS, d->put(coord(0xb5e57068UL, 0), e::slice("one", 3), value, version));
+    ASSERT_EQ(hyperdisk::SUCCESS, d->put(coord(0xa3a81e5fUL, 0), e::slice("two", 3), value, version));
+    ASSERT_EQ(hyperdisk::SUCCESS, d->del(0xb5e57068UL, e::slice("one", 3)));
+    uint32_t data_offset = d->data_offset();
+    uint32_t search_offset = d->search_offset();
+
+    // Only the manifest knows about the trailing delete.
+    e::intrusive_ptr<hyperdisk::shard> exact;
+    exact = hyperdisk::shard::open(cwd, "tmp-disk", data_offset, search_offset);
+    EXPECT_EQ(data_offset, exact->data_offset());
+    EXPECT_EQ(search_offset, exact->search_offset());
+
+    // Entries written after the manifest are picked up from the search log.
+    ASSERT_EQ(hyperdisk::SUCCESS, d->put(coord(0x6e9accf9UL, 0), e::slice("three", 5), value, version));
+    e::intrusive_ptr<hyperdisk::shard> tail;
+    tail = hyperdisk::shard::open(cwd, "tmp-disk", data_offset, search_offset);
+    EXPECT_EQ(d->data_offset(), tail->data_offset());
+    EXPECT_EQ(d->search_offset(), tail->search_offset());
+    ASSERT_EQ(hyperdisk::SUCCESS, tail->get(0x6e9accf9UL, e::slice("three", 5), &value, &version));
+    ASSERT_EQ(hyperdisk::NOTFOUND, tail->get(0xb5e57068UL, e::slice("one", 3), &value, &version));
+
+    // A manifest ahead of the shard is not trusted.
+    e::intrusive_ptr<hyperdisk::shard> ahead;
+    ahead = hyperdisk::shard::open(cwd, "tmp-disk", d->data_offset() + 4096, d->search_offset() + 8);
+    EXPECT_EQ(d->search_offset(), ahead->search_offset());
+    ASSERT_TRUE(tail->fsck());
+}
+
 } // namespace
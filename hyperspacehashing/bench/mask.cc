@@ -0,0 +1,208 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// STL
+#include <vector>
+
+// e
+#include <e/endian.h>
+
+// HyperspaceHashing
+#include "hyperspacehashing/hyperspacehashing/hashes.h"
+#include "hyperspacehashing/hyperspacehashing/mask.h"
+#include "hyperspacehashing/bithacks.h"
+
+// HyperDex
+#include "benchrunner.h"
+
+using namespace hyperspacehashing;
+using namespace hyperspacehashing::mask;
+
+#define INPUTS 1024
+
+// INPUTS objects with a key and "dims" values, each eight bytes, so that
+// EQUALITY and RANGE hashing see the same input.
+namespace
+{
+
+class objects
+{
+    public:
+        objects(size_t dims);
+
+    public:
+        const e::slice& key(size_t i) const { return m_keys[i % INPUTS]; }
+        const std::vector<e::slice>& value(size_t i) const { return m_values[i % INPUTS]; }
+
+    private:
+        std::vector<uint8_t> m_bytes;
+        std::vector<e::slice> m_keys;
+        std::vector<std::vector<e::slice> > m_values;
+};
+
+objects :: objects(size_t dims)
+    : m_bytes(INPUTS * (dims + 1) * sizeof(uint64_t))
+    , m_keys(INPUTS)
+    , m_values(INPUTS, std::vector<e::slice>(dims))
+{
+    bench::generator gen(dims + 1);
+    uint8_t* ptr = &m_bytes.front();
+
+    for (size_t i = 0; i < INPUTS; ++i)
+    {
+        m_keys[i] = e::slice(ptr, sizeof(uint64_t));
+        ptr = e::pack64le(gen.next(), ptr);
+
+        for (size_t d = 0; d < dims; ++d)
+        {
+            m_values[i][d] = e::slice(ptr, sizeof(uint64_t));
+            ptr = e::pack64le(gen.next(), ptr);
+        }
+    }
+}
+
+} // namespace
+
+static std::vector<hash_t>
+funcs(size_t dims, hash_t func)
+{
+    std::vector<hash_t> hf(dims + 1, func);
+    hf[0] = EQUALITY;
+    return hf;
+}
+
+BENCHMARK(MaskHasher, HashKey, 1000000)
+{
+    objects objs(1);
+    hasher h(funcs(1, EQUALITY));
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        bench::consume(h.hash(objs.key(i)));
+    }
+}
+
+BENCHMARK(MaskHasher, HashEquality3, 1000000)
+{
+    objects objs(3);
+    hasher h(funcs(3, EQUALITY));
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        bench::consume(h.hash(objs.key(i), objs.value(i)));
+    }
+}
+
+BENCHMARK(MaskHasher, HashEquality8, 1000000)
+{
+    objects objs(8);
+    hasher h(funcs(8, EQUALITY));
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        bench::consume(h.hash(objs.key(i), objs.value(i)));
+    }
+}
+
+BENCHMARK(MaskHasher, HashRange3, 1000000)
+{
+    objects objs(3);
+    hasher h(funcs(3, RANGE));
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        bench::consume(h.hash(objs.key(i), objs.value(i)));
+    }
+}
+
+BENCHMARK(MaskHasher, HashSearch3, 1000000)
+{
+    objects objs(3);
+    hasher h(funcs(3, EQUALITY));
+    std::vector<search> terms(INPUTS, search(4));
+
+    for (size_t i = 0; i < INPUTS; ++i)
+    {
+        terms[i].equality_set(1, objs.value(i)[0]);
+        terms[i].equality_set(3, objs.value(i)[2]);
+    }
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        bench::consume(h.hash(terms[i % INPUTS]));
+    }
+}
+
+static void
+interlace_inputs(size_t num, std::vector<uint64_t>* nums)
+{
+    bench::generator gen(num);
+    nums->resize(INPUTS * num);
+
+    for (size_t i = 0; i < nums->size(); ++i)
+    {
+        (*nums)[i] = gen.next();
+    }
+}
+
+BENCHMARK(Bithacks, LowerInterlace4, 1000000)
+{
+    std::vector<uint64_t> nums;
+    interlace_inputs(4, &nums);
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        bench::consume(lower_interlace(&nums[(i % INPUTS) * 4], 4));
+    }
+}
+
+BENCHMARK(Bithacks, UpperInterlace4, 1000000)
+{
+    std::vector<uint64_t> nums;
+    interlace_inputs(4, &nums);
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        bench::consume(upper_interlace(&nums[(i % INPUTS) * 4], 4));
+    }
+}
+
+BENCHMARK(Bithacks, DoubleLowerInterlace4, 1000000)
+{
+    std::vector<uint64_t> nums;
+    interlace_inputs(4, &nums);
+    uint64_t lower;
+    uint64_t upper;
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        double_lower_interlace(&nums[(i % INPUTS) * 4], 4, &lower, &upper);
+        bench::consume(lower);
+        bench::consume(upper);
+    }
+}
@@ -0,0 +1,184 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+// STL
+#include <memory>
+#include <vector>
+
+// e
+#include <e/buffer.h>
+#include <e/endian.h>
+
+// HyperspaceHashing
+#include "hyperspacehashing/hyperspacehashing/search.h"
+
+// HyperDex
+#include "benchrunner.h"
+
+using hyperspacehashing::search;
+
+#define INPUTS 1024
+#define DIMS 4
+
+// INPUTS objects with a key and DIMS values of eight bytes each.  One object
+// in four has NEEDLE as its first value, and the second value is uniformly
+// distributed, so the searches below match a predictable fraction of them.
+static const uint64_t NEEDLE = 0xdeadbeefcafebabeULL;
+
+namespace
+{
+
+class objects
+{
+    public:
+        objects();
+
+    public:
+        const e::slice& key(size_t i) const { return m_keys[i % INPUTS]; }
+        const std::vector<e::slice>& value(size_t i) const { return m_values[i % INPUTS]; }
+
+    private:
+        std::vector<uint8_t> m_bytes;
+        std::vector<e::slice> m_keys;
+        std::vector<std::vector<e::slice> > m_values;
+};
+
+objects :: objects()
+    : m_bytes(INPUTS * (DIMS + 1) * sizeof(uint64_t))
+    , m_keys(INPUTS)
+    , m_values(INPUTS, std::vector<e::slice>(DIMS))
+{
+    bench::generator gen(DIMS);
+    uint8_t* ptr = &m_bytes.front();
+
+    for (size_t i = 0; i < INPUTS; ++i)
+    {
+        m_keys[i] = e::slice(ptr, sizeof(uint64_t));
+        ptr = e::pack64le(gen.next(), ptr);
+
+        for (size_t d = 0; d < DIMS; ++d)
+        {
+            uint64_t num = gen.next();
+
+            if (d == 0 && i % 4 == 0)
+            {
+                num = NEEDLE;
+            }
+
+            m_values[i][d] = e::slice(ptr, sizeof(uint64_t));
+            ptr = e::pack64le(num, ptr);
+        }
+    }
+}
+
+} // namespace
+
+static void
+run_matches(bench::state& st, const search& s)
+{
+    objects objs;
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        bench::consume(s.matches(objs.key(i), objs.value(i)));
+    }
+}
+
+BENCHMARK(Search, MatchesEmpty, 1000000)
+{
+    search s(DIMS + 1);
+    run_matches(st, s);
+}
+
+BENCHMARK(Search, MatchesEquality, 1000000)
+{
+    uint8_t needle[sizeof(uint64_t)];
+    e::pack64le(NEEDLE, needle);
+    search s(DIMS + 1);
+    s.equality_set(1, e::slice(needle, sizeof(needle)));
+    run_matches(st, s);
+}
+
+BENCHMARK(Search, MatchesRange, 1000000)
+{
+    search s(DIMS + 1);
+    s.range_set(2, 0, 1ULL << 63);
+    run_matches(st, s);
+}
+
+BENCHMARK(Search, MatchesEqualityAndRange, 1000000)
+{
+    uint8_t needle[sizeof(uint64_t)];
+    e::pack64le(NEEDLE, needle);
+    search s(DIMS + 1);
+    s.equality_set(1, e::slice(needle, sizeof(needle)));
+    s.range_set(2, 0, 1ULL << 63);
+    run_matches(st, s);
+}
+
+static void
+mixed_search(const uint8_t* needle, search* s)
+{
+    s->equality_set(1, e::slice(needle, sizeof(uint64_t)));
+    s->range_set(2, 0, 1ULL << 63);
+    s->range_set(3, 1ULL << 62, UINT64_MAX);
+}
+
+BENCHMARK(Search, Pack, 1000000)
+{
+    uint8_t needle[sizeof(uint64_t)];
+    e::pack64le(NEEDLE, needle);
+    search s(DIMS + 1);
+    mixed_search(needle, &s);
+    std::auto_ptr<e::buffer> buf(e::buffer::create(s.packed_size()));
+    st.set_bytes(s.packed_size());
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        buf->pack_at(0) << s;
+        bench::consume(buf->data());
+    }
+}
+
+BENCHMARK(Search, Unpack, 1000000)
+{
+    uint8_t needle[sizeof(uint64_t)];
+    e::pack64le(NEEDLE, needle);
+    search s(DIMS + 1);
+    mixed_search(needle, &s);
+    std::auto_ptr<e::buffer> buf(e::buffer::create(s.packed_size()));
+    buf->pack_at(0) << s;
+    st.set_bytes(s.packed_size());
+
+    for (uint64_t i = 0; i < st.iterations(); ++i)
+    {
+        search out;
+        buf->unpack_from(0) >> out;
+        bench::consume(out);
+    }
+}
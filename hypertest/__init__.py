@@ -31,7 +31,9 @@ from __future__ import unicode_literals
 from __future__ import with_statement
 
 import random
+import shutil
 import subprocess
+import tempfile
 import time
 
 
@@ -72,9 +74,11 @@ class HyperDexCoordinator(object):
 
 class HyperDexDaemon(object):
 
-    def __init__(self, datadir='.', host='127.0.0.1', port=1234, threads=1):
+    def __init__(self, datadir='.', host='127.0.0.1', port=1234, threads=1, bindto=None):
         args = ['hyperdex-daemon', '-f', '-D', datadir, '-t', str(threads),
                 '-h', host, '-p', str(port)]
+        if bindto is not None:
+            args += ['-b', bindto]
         self._daemon = subprocess.Popen(args)
         #                                stdout=open('/dev/null', 'w'),
         #                                stderr=open('/dev/null', 'w'))
@@ -83,7 +87,58 @@ class HyperDexDaemon(object):
         return self
 
     def __exit__(self, exc_type, exc_value, traceback):
+        if self._daemon.poll() is not None:
+            return
         self._daemon.terminate()
         time.sleep(0.1)
         self._daemon.kill()
         self._daemon.wait()
+
+    def kill(self):
+        self._daemon.kill()
+        self._daemon.wait()
+
+
+class HyperDexCluster(object):
+    '''A coordinator and several daemons on the loopback interface.
+
+    Each daemon gets its own data directory, and the daemons pick their own
+    ports.  Daemons may be killed individually to exercise failure handling.
+    '''
+
+    def __init__(self, daemons=3, threads=1, bindto='127.0.0.1'):
+        self._coord = HyperDexCoordinator(bindto=bindto)
+        time.sleep(0.1)
+        self._datadirs = []
+        self._daemons = []
+        try:
+            for i in range(daemons):
+                datadir = tempfile.mkdtemp(prefix='hyperdex-daemon-')
+                self._datadirs.append(datadir)
+                self._daemons.append(HyperDexDaemon(datadir=datadir,
+                                                    host=bindto,
+                                                    port=self._coord.host_port(),
+                                                    threads=threads,
+                                                    bindto=bindto))
+        except:
+            self.__exit__(None, None, None)
+            raise
+
+    def coordinator(self):
+        return self._coord
+
+    def daemons(self):
+        return len(self._daemons)
+
+    def kill(self, idx):
+        self._daemons[idx].kill()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        for daemon in self._daemons:
+            daemon.__exit__(exc_type, exc_value, traceback)
+        self._coord.__exit__(exc_type, exc_value, traceback)
+        for datadir in self._datadirs:
+            shutil.rmtree(datadir, ignore_errors=True)
@@ -41,7 +41,7 @@ import hypercoordinator.parser
 import hypertest
 
 
-def runtest(lang, filename):
+def runtest(lang, filename, daemons=1):
     f = open(filename)
     spacedesc = f.readline()
     space = None
@@ -57,29 +57,29 @@ def runtest(lang, filename):
     if space is None:
         print('could not find valid space description; aborting test')
         return -1
-    with hypertest.HyperDexCoordinator() as coord:
-        time.sleep(0.1)
-        with hypertest.HyperDexDaemon(host=coord.bindto(), port=coord.host_port()) as daemon:
+    with hypertest.HyperDexCluster(daemons=daemons) as cluster:
+        coord = cluster.coordinator()
+        c = hypercoordinator.client.Client(coord.bindto(), coord.control_port())
+        while c.count_servers() < cluster.daemons():
             time.sleep(0.1)
-            c = hypercoordinator.client.Client(coord.bindto(), coord.control_port())
-            while c.count_servers() < 1:
-                time.sleep(0.1)
-            print('JSON TEST:  server up')
-            c.add_space(spacedesc)
-            print('JSON TEST:  space created')
-            while not c.is_stable():
-                time.sleep(0.1)
-            print('JSON TEST:  stabilized')
-            args = ['hyperdex-json-bridge-' + lang,
-                    '--host', coord.bindto(), '--port', str(coord.host_port())]
-            f.seek(0)
-            pipe = subprocess.Popen(args, stdin=f)
-            f.close()
-            print('JSON TEST:  bridge created')
-            pipe.wait()
-            print('JSON TEST:  bridge exited', pipe.returncode)
-            return pipe.returncode
+        print('JSON TEST:  servers up')
+        c.add_space(spacedesc)
+        print('JSON TEST:  space created')
+        while not c.is_stable():
+            time.sleep(0.1)
+        print('JSON TEST:  stabilized')
+        args = ['hyperdex-json-bridge-' + lang,
+                '--host', coord.bindto(), '--port', str(coord.host_port())]
+        f.seek(0)
+        pipe = subprocess.Popen(args, stdin=f)
+        f.close()
+        print('JSON TEST:  bridge created')
+        pipe.wait()
+        print('JSON TEST:  bridge exited', pipe.returncode)
+        return pipe.returncode
 
 
 if __name__ == '__main__':
-    sys.exit(runtest(sys.argv[1], sys.argv[2]))
+    # An optional third argument runs the test against that many daemons.
+    daemons = int(sys.argv[3]) if len(sys.argv) > 3 else 1
+    sys.exit(runtest(sys.argv[1], sys.argv[2], daemons))
@@ -0,0 +1,462 @@
+// Copyright (c) 2012, Cornell University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright notice,
+//       this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of HyperDex nor the names of its contributors may be
+//       used to endorse or promote products derived from this software without
+//       specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// This benchmark measures how much configuration changes disturb clients.  It
+// runs a closed loop of puts and gets against a space while periodically asking
+// the coordinator for a change, and reports latency in fixed windows so that
+// the windows following each change can be compared with the rest.
+
+// C
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+// POSIX
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Popt
+#include <popt.h>
+
+// C++
+#include <iomanip>
+#include <iostream>
+
+// STL
+#include <algorithm>
+#include <map>
+#include <string>
+#include <tr1/memory>
+#include <utility>
+#include <vector>
+
+// po6
+#include <po6/threads/mutex.h>
+#include <po6/threads/thread.h>
+
+// e
+#include <e/guard.h>
+#include <e/timer.h>
+
+// HyperClient
+#include <hyperclient.h>
+
+static long threads = 8;
+static long keys = 100000;
+static long duration = 60;
+static long interval = 10;
+static long window_ms = 100;
+static long write_percent = 50;
+static const char* space = "reconfiguration";
+static const char* host = "127.0.0.1";
+static long port = 1234;
+static long control_port = 6970;
+static const char* change = "{\"rebalance\": \"\"}";
+static volatile bool done = false;
+static uint64_t start;
+static po6::threads::mutex results_lock;
+// (time since start, latency) of every successful operation, in nanoseconds.
+static std::vector<std::pair<uint64_t, uint64_t> > latencies;
+static std::map<hyperclient_returncode, uint64_t> failures;
+// (time since start, coordinator's response) of every requested change.
+static std::vector<std::pair<uint64_t, std::string> > changes;
+
+extern "C"
+{
+
+static struct poptOption popts[] = {
+    POPT_AUTOHELP
+    {"threads", 't', POPT_ARG_LONG, &threads, 't',
+        "the number of client threads issuing operations",
+        "number"},
+    {"keys", 'k', POPT_ARG_LONG, &keys, 'k',
+        "the number of distinct keys to operate on",
+        "number"},
+    {"duration", 'd', POPT_ARG_LONG, &duration, 'd',
+        "the number of seconds to run for",
+        "seconds"},
+    {"interval", 'i', POPT_ARG_LONG, &interval, 'i',
+        "the number of seconds between configuration changes (0 for none)",
+        "seconds"},
+    {"window", 'w', POPT_ARG_LONG, &window_ms, 'w',
+        "the width of each reporting window",
+        "milliseconds"},
+    {"write-percent", 'W', POPT_ARG_LONG, &write_percent, 'W',
+        "the percentage of operations which are puts",
+        "percent"},
+    {"change", 'r', POPT_ARG_STRING, &change, 'r',
+        "the JSON request sent to the coordinator for each change",
+        "request"},
+    {"space", 's', POPT_ARG_STRING, &space, 's',
+        "the HyperDex space to use",
+        "space"},
+    {"host", 'h', POPT_ARG_STRING, &host, 'h',
+        "the IP address of the coordinator",
+        "IP"},
+    {"port", 'p', POPT_ARG_LONG, &port, 'p',
+        "the port number of the coordinator",
+        "port"},
+    {"control-port", 'c', POPT_ARG_LONG, &control_port, 'c',
+        "the control port number of the coordinator",
+        "port"},
+    POPT_TABLEEND
+};
+
+} // extern "C"
+
+static void
+client_thread();
+static void
+change_thread();
+static uint64_t
+percentile(const std::vector<uint64_t>& sorted, double p);
+static void
+report(const char* name, std::vector<uint64_t>* lats, uint64_t windows);
+
+int
+main(int argc, const char* argv[])
+{
+    poptContext poptcon;
+    poptcon = poptGetContext(NULL, argc, argv, popts, POPT_CONTEXT_POSIXMEHARDER);
+    e::guard g = e::makeguard(poptFreeContext, poptcon);
+    g.use_variable();
+    int rc;
+
+    while ((rc = poptGetNextOpt(poptcon)) != -1)
+    {
+        switch (rc)
+        {
+            case 't':
+            case 'k':
+            case 'd':
+            case 'w':
+                if (threads <= 0 || keys <= 0 || duration <= 0 || window_ms <= 0)
+                {
+                    std::cerr << "threads, keys, duration and window must be > 0" << std::endl;
+                    return EXIT_FAILURE;
+                }
+
+                break;
+            case 'i':
+                if (interval < 0)
+                {
+                    std::cerr << "interval must be >= 0" << std::endl;
+                    return EXIT_FAILURE;
+                }
+
+                break;
+            case 'W':
+                if (write_percent < 0 || write_percent > 100)
+                {
+                    std::cerr << "write-percent must be in [0, 100]" << std::endl;
+                    return EXIT_FAILURE;
+                }
+
+                break;
+            case 'r':
+            case 's':
+            case 'h':
+                break;
+            case 'p':
+            case 'c':
+                if (port >= (1 << 16) || control_port >= (1 << 16))
+                {
+                    std::cerr << "port number out of range for TCP" << std::endl;
+                    return EXIT_FAILURE;
+                }
+
+                break;
+            case POPT_ERROR_NOARG:
+            case POPT_ERROR_BADOPT:
+            case POPT_ERROR_BADNUMBER:
+            case POPT_ERROR_OVERFLOW:
+                std::cerr << poptStrerror(rc) << " " << poptBadOption(poptcon, 0) << std::endl;
+                return EXIT_FAILURE;
+            case POPT_ERROR_OPTSTOODEEP:
+            case POPT_ERROR_BADQUOTE:
+            case POPT_ERROR_ERRNO:
+            default:
+                std::cerr << "logic error in argument parsing" << std::endl;
+                return EXIT_FAILURE;
+        }
+    }
+
+    start = e::time();
+    std::vector<std::tr1::shared_ptr<po6::threads::thread> > clients;
+
+    for (long i = 0; i < threads; ++i)
+    {
+        std::tr1::shared_ptr<po6::threads::thread> tptr(new po6::threads::thread(client_thread));
+        clients.push_back(tptr);
+        tptr->start();
+    }
+
+    po6::threads::thread changer(change_thread);
+    changer.start();
+    e::sleep_ns(duration, 0);
+    done = true;
+    changer.join();
+
+    for (size_t i = 0; i < clients.size(); ++i)
+    {
+        clients[i]->join();
+    }
+
+    // Bucket the latencies into windows, and mark every window that overlaps
+    // the second after a change as disturbed.
+    const uint64_t window = window_ms * 1000000ULL;
+    const uint64_t windows = (duration * 1000000000ULL + window - 1) / window;
+    std::vector<std::vector<uint64_t> > by_window(windows);
+    std::vector<bool> disturbed(windows, false);
+
+    for (size_t i = 0; i < latencies.size(); ++i)
+    {
+        uint64_t w = latencies[i].first / window;
+
+        if (w < windows)
+        {
+            by_window[w].push_back(latencies[i].second);
+        }
+    }
+
+    for (size_t i = 0; i < changes.size(); ++i)
+    {
+        for (uint64_t w = changes[i].first / window;
+                w < windows && w * window < changes[i].first + 1000000000ULL; ++w)
+        {
+            disturbed[w] = true;
+        }
+    }
+
+    std::vector<uint64_t> steady;
+    std::vector<uint64_t> after_change;
+    uint64_t steady_windows = 0;
+    uint64_t after_change_windows = 0;
+    size_t next_change = 0;
+    std::cout << "# window_ms ops p50_us p99_us max_us" << std::endl;
+
+    for (uint64_t w = 0; w < windows; ++w)
+    {
+        while (next_change < changes.size() && changes[next_change].first < (w + 1) * window)
+        {
+            std::cout << "# change at " << changes[next_change].first / 1000000
+                      << "ms: " << changes[next_change].second << std::endl;
+            ++next_change;
+        }
+
+        std::vector<uint64_t>& lats(by_window[w]);
+        std::sort(lats.begin(), lats.end());
+        std::cout << w * window_ms << " " << lats.size()
+                  << " " << percentile(lats, 0.5) / 1000
+                  << " " << percentile(lats, 0.99) / 1000
+                  << " " << (lats.empty() ? 0 : lats.back() / 1000) << std::endl;
+        std::vector<uint64_t>& into(disturbed[w] ? after_change : steady);
+        into.insert(into.end(), lats.begin(), lats.end());
+        ++(disturbed[w] ? after_change_windows : steady_windows);
+    }
+
+    report("steady", &steady, steady_windows);
+    report("after-change", &after_change, after_change_windows);
+    typedef std::map<hyperclient_returncode, uint64_t>::iterator result_iter_t;
+
+    for (result_iter_t f = failures.begin(); f != failures.end(); ++f)
+    {
+        std::cout << "# failed " << f->first << " " << f->second << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void
+client_thread()
+{
+    std::vector<std::pair<uint64_t, uint64_t> > llatencies;
+    std::map<hyperclient_returncode, uint64_t> lfailures;
+    unsigned int seed = reinterpret_cast<uintptr_t>(&llatencies);
+    hyperclient cl(host, port);
+
+    while (!done)
+    {
+        int64_t key = rand_r(&seed) % keys;
+        const char* keystr = reinterpret_cast<const char*>(&key);
+        hyperclient_returncode status;
+        hyperclient_attribute* attrs = NULL;
+        size_t attrs_sz = 0;
+        uint64_t began = e::time();
+        int64_t id;
+
+        if (rand_r(&seed) % 100 < write_percent)
+        {
+            hyperclient_attribute attr;
+            attr.attr = "v";
+            attr.value = reinterpret_cast<const char*>(&began);
+            attr.value_sz = sizeof(began);
+            attr.datatype = HYPERDATATYPE_STRING;
+            id = cl.put(space, keystr, sizeof(key), &attr, 1, &status);
+        }
+        else
+        {
+            id = cl.get(space, keystr, sizeof(key), &status, &attrs, &attrs_sz);
+        }
+
+        if (id < 0)
+        {
+            ++lfailures[status];
+            continue;
+        }
+
+        hyperclient_returncode lstatus;
+        int64_t lid = cl.loop(-1, &lstatus);
+        uint64_t ended = e::time();
+
+        if (attrs)
+        {
+            hyperclient_destroy_attrs(attrs, attrs_sz);
+        }
+
+        if (lid < 0)
+        {
+            ++lfailures[lstatus];
+        }
+        else if (status != HYPERCLIENT_SUCCESS && status != HYPERCLIENT_NOTFOUND)
+        {
+            ++lfailures[status];
+        }
+        else
+        {
+            llatencies.push_back(std::make_pair(began - start, ended - began));
+        }
+    }
+
+    po6::threads::mutex::hold hold(&results_lock);
+    latencies.insert(latencies.end(), llatencies.begin(), llatencies.end());
+
+    for (std::map<hyperclient_returncode, uint64_t>::iterator f = lfailures.begin();
+            f != lfailures.end(); ++f)
+    {
+        failures[f->first] += f->second;
+    }
+}
+
+// Send one request to the coordinator's control port and return its response.
+static std::string
+control(const std::string& request)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    if (fd < 0)
+    {
+        return "could not create socket";
+    }
+
+    e::guard g = e::makeguard(close, fd);
+    g.use_variable();
+    sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(control_port);
+
+    if (inet_pton(AF_INET, host, &sa.sin_addr) != 1 ||
+        connect(fd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)) < 0)
+    {
+        return "could not connect to the coordinator";
+    }
+
+    std::string msg(request + "\n");
+
+    if (write(fd, msg.data(), msg.size()) != static_cast<ssize_t>(msg.size()))
+    {
+        return "could not send the request";
+    }
+
+    std::string response;
+    char buf[4096];
+    ssize_t ret;
+
+    while (response.find('\n') == std::string::npos &&
+           (ret = read(fd, buf, sizeof(buf))) > 0)
+    {
+        response.append(buf, ret);
+    }
+
+    return response.substr(0, response.find('\n'));
+}
+
+static void
+change_thread()
+{
+    if (interval == 0)
+    {
+        return;
+    }
+
+    uint64_t next = interval * 1000000000ULL;
+
+    while (!done)
+    {
+        uint64_t now = e::time() - start;
+
+        if (now < next)
+        {
+            e::sleep_ns(0, std::min(next - now, static_cast<uint64_t>(100000000)));
+            continue;
+        }
+
+        std::string response = control(change);
+        po6::threads::mutex::hold hold(&results_lock);
+        changes.push_back(std::make_pair(now, response));
+        next += interval * 1000000000ULL;
+    }
+}
+
+static uint64_t
+percentile(const std::vector<uint64_t>& sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+
+    return sorted[static_cast<size_t>(p * (sorted.size() - 1))];
+}
+
+static void
+report(const char* name, std::vector<uint64_t>* lats, uint64_t windows)
+{
+    std::sort(lats->begin(), lats->end());
+    double seconds = windows * window_ms / 1000.;
+    std::cout << "# " << name << ": " << lats->size() << " ops"
+              << " " << std::fixed << std::setprecision(0)
+              << (seconds > 0 ? lats->size() / seconds : 0) << " ops/s"
+              << " p50 " << percentile(*lats, 0.5) / 1000 << "us"
+              << " p99 " << percentile(*lats, 0.99) / 1000 << "us"
+              << " p999 " << percentile(*lats, 0.999) / 1000 << "us"
+              << " max " << (lats->empty() ? 0 : lats->back() / 1000) << "us"
+              << std::endl;
+}
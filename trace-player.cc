@@ -30,7 +30,9 @@
 #include <iostream>
 
 // STL
+#include <algorithm>
 #include <string>
+#include <vector>
 
 // BSD
 #include <vis.h>
@@ -50,10 +52,13 @@ class incompleteop
 {
     public:
         incompleteop(uint64_t ln)
-            : lineno(ln), status(), attrs(), attrs_sz(), m_ref(0) {}
+            : lineno(ln), start(e::time()), is_get(false)
+            , status(), attrs(), attrs_sz(), m_ref(0) {}
 
     public:
         uint64_t lineno;
+        uint64_t start;
+        bool is_get;
         hyperclient_returncode status;
         hyperclient_attribute* attrs;
         size_t attrs_sz;
@@ -79,6 +84,9 @@ class incompleteop
 static int
 usage();
 
+static void
+report_latency(const char* name, std::vector<uint64_t>* latencies);
+
 static void
 flush(hyperclient* cl,
       size_t outstanding,
@@ -94,6 +102,11 @@ handle_line(hyperclient* cl,
             char* ln,
             char* nl);
 
+// Per-op latency in nanoseconds, measured from issue to completion in loop().
+// Only meaningful at loads low enough that ops do not queue in the client.
+static std::vector<uint64_t> get_latencies;
+static std::vector<uint64_t> other_latencies;
+
 int
 main(int argc, char* argv[])
 {
@@ -164,6 +177,8 @@ main(int argc, char* argv[])
         }
 
         flush(&cl, 0, &incomplete_keyops, &incomplete_searches);
+        report_latency("GET", &get_latencies);
+        report_latency("other", &other_latencies);
     }
     catch (po6::error& e)
     {
@@ -199,6 +214,23 @@ usage()
 static uint64_t ops = 0;
 static uint64_t oldtime = 0;
 
+void
+report_latency(const char* name, std::vector<uint64_t>* latencies)
+{
+    if (latencies->empty())
+    {
+        return;
+    }
+
+    std::sort(latencies->begin(), latencies->end());
+    size_t p50 = latencies->size() * 50 / 100;
+    size_t p99 = std::min(latencies->size() * 99 / 100, latencies->size() - 1);
+    std::cerr << name << " latency (us):  n " << latencies->size()
+              << " p50 " << (*latencies)[p50] / 1000.
+              << " p99 " << (*latencies)[p99] / 1000.
+              << " max " << latencies->back() / 1000. << std::endl;
+}
+
 void
 flush(hyperclient* cl,
       size_t outstanding,
@@ -258,6 +290,9 @@ flush(hyperclient* cl,
         }
         else if ((op = incomplete_keyops->find(id)) != incomplete_keyops->end())
         {
+            uint64_t latency = e::time() - op->second->start;
+            (op->second->is_get ? get_latencies : other_latencies).push_back(latency);
+
             if (op->second->status == HYPERCLIENT_SUCCESS)
             {
                 hyperclient_destroy_attrs(op->second->attrs, op->second->attrs_sz);
@@ -351,6 +386,7 @@ handle_line(hyperclient* cl,
         }
 
         e::intrusive_ptr<incompleteop> op = new incompleteop(lineno);
+        op->is_get = true;
         int64_t id;
 
         if ((id = cl->get(space, words[1].first, words[1].second - words[1].first,